@@ -0,0 +1,423 @@
+//
+//  asset_baker - packs model and skybox directories into the bundles loaded by Model3D and SkyBox
+//
+//  usage: asset_baker [--formats <file>] [--optimize-overdraw] [--optimize-clusters] [--no-mesh-optimization] [--no-lod] [--tiles <size>] <directory>...
+//  Every .obj file of a directory becomes a model of <directory>.bundle, together with the textures it uses.
+//  A directory holding all of SkyBox::FACE_FILES also gets a cube map.
+//  With --tiles the models are cut into a grid of size x size tiles on the xz plane instead, streamed by WorldStreamer:
+//  one <directory>.tile_<x>_<z>.bundle per tile, listed in <directory>.tiles, while <directory>.bundle keeps the textures.
+//
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "AssetBundle.hpp"
+#include "Model3D.hpp"
+#include "SkyBox.hpp"
+#include "TextureCompressor.hpp"
+#include "TextureLoader.hpp"
+#include "ThreadPool.hpp"
+#include "WorldStreamer.hpp"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+    // The parts of the models of a directory falling into one grid cell
+    struct Tile {
+        gps::WorldStreamer::TileInfo info;
+        std::vector<gps::AssetBundle::ModelData> models;
+    };
+
+    struct Bundle {
+        std::string directory;
+        std::vector<gps::AssetBundle::ModelData> models;
+        std::vector<gps::AssetBundle::TextureData> textures;
+        std::vector<gps::AssetBundle::CubeMapData> cubeMaps;
+        std::vector<Tile> tiles;
+        bool failed;
+    };
+
+    struct ModelJob {
+        size_t bundle;
+        size_t model;
+    };
+
+    struct TileJob {
+        size_t bundle;
+        size_t tile;
+    };
+
+    // A texture, or a face of a cube map
+    struct ImageJob {
+        size_t bundle;
+        size_t index;
+        int face;
+    };
+
+    bool EndsWith(const std::string& text, const std::string& suffix) {
+        return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    // Names of the regular files in a directory, sorted so bundles come out the same every time
+    std::vector<std::string> ListFiles(const std::string& directory) {
+        std::vector<std::string> files;
+#ifdef _WIN32
+        WIN32_FIND_DATAA found;
+        HANDLE search = FindFirstFileA((directory + "/*").c_str(), &found);
+        if (search == INVALID_HANDLE_VALUE) {
+            return files;
+        }
+        do {
+            if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+                files.push_back(found.cFileName);
+            }
+        } while (FindNextFileA(search, &found));
+        FindClose(search);
+#else
+        DIR* dir = opendir(directory.c_str());
+        if (!dir) {
+            return files;
+        }
+        while (dirent* entry = readdir(dir)) {
+            struct stat fileStat;
+            std::string path = directory + "/" + entry->d_name;
+            if (stat(path.c_str(), &fileStat) == 0 && S_ISREG(fileStat.st_mode)) {
+                files.push_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+#endif
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    // Cuts every shape of the bundle along the grid - the tiles come out sorted by cell
+    void CutIntoTiles(Bundle& bundle, float tileSize) {
+        std::map<std::pair<int, int>, Tile> tiles;
+
+        for (size_t m = 0; m < bundle.models.size(); m++) {
+            const gps::AssetBundle::ModelData& model = bundle.models[m];
+            for (size_t s = 0; s < model.shapes.size(); s++) {
+                const gps::MeshData& shape = model.shapes[s];
+                std::map<std::pair<int, int>, gps::MeshData> cells;
+                gps::MeshOptimizer::SplitGrid(shape.vertices.data(), shape.vertices.size(), shape.indices.data(), shape.indices.size(), tileSize, cells);
+
+                for (std::map<std::pair<int, int>, gps::MeshData>::iterator cell = cells.begin(); cell != cells.end(); ++cell) {
+                    Tile& tile = tiles[cell->first];
+                    if (tile.models.empty()) {
+                        tile.info.x = cell->first.first;
+                        tile.info.z = cell->first.second;
+                        tile.info.bounds = cell->second.bounds;
+                    }
+                    tile.info.bounds.min = glm::min(tile.info.bounds.min, cell->second.bounds.min);
+                    tile.info.bounds.max = glm::max(tile.info.bounds.max, cell->second.bounds.max);
+
+                    // one model per source model, holding the parts of its shapes
+                    if (tile.models.empty() || tile.models.back().name != model.name) {
+                        gps::AssetBundle::ModelData part;
+                        part.name = model.name;
+                        tile.models.push_back(part);
+                    }
+                    cell->second.textures = shape.textures;
+                    cell->second.material = shape.material;
+                    tile.models.back().shapes.push_back(gps::MeshData());
+                    std::swap(tile.models.back().shapes.back(), cell->second);
+                }
+            }
+        }
+
+        bundle.tiles.clear();
+        for (std::map<std::pair<int, int>, Tile>::iterator tile = tiles.begin(); tile != tiles.end(); ++tile) {
+            bundle.tiles.push_back(tile->second);
+        }
+    }
+
+    // Decodes and compresses an image - textures are flipped and sRGB like at runtime, cube map faces are neither
+    bool BakeImage(const std::string& fileName, bool cubeMapFace, gps::CompressedImage& image) {
+        int width, height, n;
+        unsigned char* pixels = stbi_load(fileName.c_str(), &width, &height, &n, 4);
+        if (!pixels) {
+            fprintf(stderr, "ERROR: could not load %s\n", fileName.c_str());
+            return false;
+        }
+
+        gps::TextureCompressor::Format format = gps::TextureCompressor::FORMAT_AUTO;
+        if (!cubeMapFace) {
+            gps::TextureCompressor::FlipRows(pixels, width, height);
+            format = gps::TextureLoader::getInstance().getFormat(fileName);
+            // bundles only hold block-compressed images, and there is no BC7 encoder
+            if (format == gps::TextureCompressor::FORMAT_RGBA8) {
+                fprintf(stderr, "WARNING: %s is always compressed in bundles\n", fileName.c_str());
+                format = gps::TextureCompressor::FORMAT_AUTO;
+            } else if (format == gps::TextureCompressor::FORMAT_BC7) {
+                format = gps::TextureCompressor::FORMAT_BC3;
+            }
+        }
+
+        gps::TextureCompressor::Compress(pixels, width, height, format, image, !cubeMapFace);
+        stbi_image_free(pixels);
+        return true;
+    }
+}
+
+int main(int argc, const char * argv[]) {
+
+    float tileSize = 0.0f;
+    std::vector<Bundle> bundles;
+    for (int i = 1; i < argc; i++) {
+        // per-texture formats, like texture_formats.txt at runtime
+        if (std::string(argv[i]) == "--formats" && i + 1 < argc) {
+            if (!gps::TextureLoader::getInstance().LoadFormatOverrides(argv[++i])) {
+                fprintf(stderr, "ERROR: could not read %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        if (std::string(argv[i]) == "--optimize-overdraw") {
+            gps::Model3D::optimizeOverdraw = true;
+            continue;
+        }
+        if (std::string(argv[i]) == "--optimize-clusters") {
+            gps::Model3D::optimizeClusters = true;
+            continue;
+        }
+        if (std::string(argv[i]) == "--no-mesh-optimization") {
+            gps::Model3D::optimizeMeshes = false;
+            continue;
+        }
+        if (std::string(argv[i]) == "--no-lod") {
+            gps::Model3D::generateLods = false;
+            continue;
+        }
+        if (std::string(argv[i]) == "--tiles" && i + 1 < argc) {
+            tileSize = static_cast<float>(atof(argv[++i]));
+            if (tileSize <= 0.0f) {
+                fprintf(stderr, "ERROR: invalid tile size %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        Bundle bundle;
+        bundle.directory = argv[i];
+        while (bundle.directory.size() > 1 && (EndsWith(bundle.directory, "/") || EndsWith(bundle.directory, "\\"))) {
+            bundle.directory.erase(bundle.directory.size() - 1);
+        }
+        bundle.failed = false;
+        bundles.push_back(bundle);
+    }
+
+    if (bundles.empty()) {
+        std::cerr << "usage: asset_baker [--formats <file>] [--optimize-overdraw] [--optimize-clusters] [--no-mesh-optimization] [--no-lod] [--tiles <size>] <directory>..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<ModelJob> modelJobs;
+    std::vector<ImageJob> imageJobs;
+    for (size_t b = 0; b < bundles.size(); b++) {
+        Bundle& bundle = bundles[b];
+        std::vector<std::string> files = ListFiles(bundle.directory);
+        if (files.empty()) {
+            fprintf(stderr, "ERROR: %s is not a directory or is empty\n", bundle.directory.c_str());
+            return EXIT_FAILURE;
+        }
+
+        for (size_t f = 0; f < files.size(); f++) {
+            if (EndsWith(files[f], ".obj")) {
+                gps::AssetBundle::ModelData model;
+                model.name = files[f];
+                bundle.models.push_back(model);
+                ModelJob job = { b, bundle.models.size() - 1 };
+                modelJobs.push_back(job);
+            }
+        }
+
+        bool hasCubeMap = true;
+        for (int face = 0; face < 6; face++) {
+            hasCubeMap = hasCubeMap && std::binary_search(files.begin(), files.end(), std::string(gps::SkyBox::FACE_FILES[face]));
+        }
+        if (hasCubeMap) {
+            gps::AssetBundle::CubeMapData cubeMap;
+            cubeMap.name = bundle.directory.substr(bundle.directory.find_last_of("/\\") + 1);
+            bundle.cubeMaps.push_back(cubeMap);
+            for (int face = 0; face < 6; face++) {
+                ImageJob job = { b, 0, face };
+                imageJobs.push_back(job);
+            }
+        }
+    }
+
+    gps::ThreadPool& pool = gps::ThreadPool::getShared();
+
+    // tiles are simplified after cutting, so their levels of detail keep the tile borders closed
+    bool generateLods = gps::Model3D::generateLods;
+    if (tileSize > 0.0f) {
+        gps::Model3D::generateLods = false;
+    }
+
+    // the models first - their materials name the textures to bake
+    pool.ParallelFor(modelJobs.size(), [&](size_t i) {
+        Bundle& bundle = bundles[modelJobs[i].bundle];
+        gps::AssetBundle::ModelData& model = bundle.models[modelJobs[i].model];
+        std::string basePath = bundle.directory + "/";
+        gps::Model3D::ReadOBJ(basePath + model.name, basePath, model.shapes);
+
+        // texture paths become names relative to the directory
+        for (size_t s = 0; s < model.shapes.size(); s++) {
+            std::vector<gps::Texture>& textures = model.shapes[s].textures;
+            for (size_t t = 0; t < textures.size(); t++) {
+                if (textures[t].path.compare(0, basePath.size(), basePath) == 0) {
+                    textures[t].path.erase(0, basePath.size());
+                }
+            }
+        }
+    });
+
+    // every texture once per bundle
+    for (size_t b = 0; b < bundles.size(); b++) {
+        Bundle& bundle = bundles[b];
+        std::vector<std::string> names;
+        for (size_t m = 0; m < bundle.models.size(); m++) {
+            for (size_t s = 0; s < bundle.models[m].shapes.size(); s++) {
+                const std::vector<gps::Texture>& textures = bundle.models[m].shapes[s].textures;
+                for (size_t t = 0; t < textures.size(); t++) {
+                    names.push_back(textures[t].path);
+                }
+            }
+        }
+        std::sort(names.begin(), names.end());
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+
+        bundle.textures.resize(names.size());
+        for (size_t t = 0; t < names.size(); t++) {
+            bundle.textures[t].name = names[t];
+            ImageJob job = { b, t, -1 };
+            imageJobs.push_back(job);
+        }
+    }
+
+    std::vector<TileJob> tileJobs;
+    if (tileSize > 0.0f) {
+        for (size_t b = 0; b < bundles.size(); b++) {
+            CutIntoTiles(bundles[b], tileSize);
+            for (size_t t = 0; t < bundles[b].tiles.size(); t++) {
+                TileJob job = { b, t };
+                tileJobs.push_back(job);
+            }
+        }
+
+        if (generateLods) {
+            std::vector<gps::MeshData*> parts;
+            for (size_t j = 0; j < tileJobs.size(); j++) {
+                Tile& tile = bundles[tileJobs[j].bundle].tiles[tileJobs[j].tile];
+                for (size_t m = 0; m < tile.models.size(); m++) {
+                    for (size_t s = 0; s < tile.models[m].shapes.size(); s++) {
+                        parts.push_back(&tile.models[m].shapes[s]);
+                    }
+                }
+            }
+            pool.ParallelFor(parts.size(), [&](size_t i) {
+                gps::MeshSimplifier::GenerateLods(*parts[i]);
+            });
+        }
+    }
+
+    std::vector<char> imageFailed(imageJobs.size(), 0);
+    pool.ParallelFor(imageJobs.size(), [&](size_t i) {
+        const ImageJob& job = imageJobs[i];
+        Bundle& bundle = bundles[job.bundle];
+        bool baked;
+        if (job.face >= 0) {
+            std::string fileName = bundle.directory + "/" + gps::SkyBox::FACE_FILES[job.face];
+            baked = BakeImage(fileName, true, bundle.cubeMaps[job.index].faces[job.face]);
+        } else {
+            gps::AssetBundle::TextureData& texture = bundle.textures[job.index];
+            baked = BakeImage(bundle.directory + "/" + texture.name, false, texture.image);
+        }
+        imageFailed[i] = !baked;
+    });
+    for (size_t i = 0; i < imageJobs.size(); i++) {
+        if (imageFailed[i]) {
+            bundles[imageJobs[i].bundle].failed = true;
+        }
+    }
+
+    std::vector<char> written(bundles.size(), 0);
+    pool.ParallelFor(bundles.size(), [&](size_t b) {
+        const Bundle& bundle = bundles[b];
+        // the models of a tiled directory only live in its tiles
+        std::vector<gps::AssetBundle::ModelData> noModels;
+        written[b] = !bundle.failed &&
+            gps::AssetBundle::Write(gps::AssetBundle::getBundlePath(bundle.directory), tileSize > 0.0f ? noModels : bundle.models,
+                bundle.textures, bundle.cubeMaps);
+    });
+
+    std::vector<char> tileWritten(tileJobs.size(), 0);
+    pool.ParallelFor(tileJobs.size(), [&](size_t j) {
+        const Bundle& bundle = bundles[tileJobs[j].bundle];
+        const Tile& tile = bundle.tiles[tileJobs[j].tile];
+        std::vector<std::string> textureNames;
+        for (size_t t = 0; t < bundle.textures.size(); t++) {
+            textureNames.push_back(bundle.textures[t].name);
+        }
+        tileWritten[j] = written[tileJobs[j].bundle] &&
+            gps::AssetBundle::WriteTile(gps::WorldStreamer::getTilePath(bundle.directory, tile.info.x, tile.info.z), tile.models, textureNames);
+    });
+    for (size_t j = 0; j < tileJobs.size(); j++) {
+        written[tileJobs[j].bundle] = written[tileJobs[j].bundle] && tileWritten[j];
+    }
+
+    // the manifest last, so it never lists a tile that was not written
+    for (size_t b = 0; b < bundles.size(); b++) {
+        if (tileSize > 0.0f && written[b]) {
+            std::vector<gps::WorldStreamer::TileInfo> tiles;
+            for (size_t t = 0; t < bundles[b].tiles.size(); t++) {
+                tiles.push_back(bundles[b].tiles[t].info);
+            }
+            written[b] = gps::WorldStreamer::WriteManifest(bundles[b].directory, tileSize, tiles);
+        }
+    }
+
+    bool succeeded = true;
+    for (size_t b = 0; b < bundles.size(); b++) {
+        const Bundle& bundle = bundles[b];
+        std::string bundleFileName = gps::AssetBundle::getBundlePath(bundle.directory);
+        if (!written[b]) {
+            std::cerr << "Could not bake " << bundleFileName << std::endl;
+            succeeded = false;
+            continue;
+        }
+
+        size_t shapeCount = 0;
+        for (size_t m = 0; m < bundle.models.size(); m++) {
+            shapeCount += bundle.models[m].shapes.size();
+        }
+        std::cout << "Baked " << bundleFileName << " : " << bundle.models.size() << " models, " << shapeCount << " shapes, "
+            << bundle.textures.size() << " textures, " << bundle.cubeMaps.size() << " cube maps" << std::endl;
+        if (tileSize > 0.0f) {
+            std::cout << "Baked " << gps::WorldStreamer::getManifestPath(bundle.directory) << " : " << bundle.tiles.size()
+                << " tiles of " << tileSize << " units" << std::endl;
+        }
+    }
+
+    gps::TextureLoader::getInstance().Shutdown();
+    return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,510 @@
+#include "AssetBundle.hpp"
+
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+namespace gps {
+
+    namespace {
+
+        const char MAGIC[4] = { 'G', 'P', 'A', 'B' };
+
+        struct FileHeader {
+            char magic[4];
+            uint32_t version;
+            uint32_t textureCount;
+            uint32_t modelCount;
+            uint32_t cubeMapCount;
+            uint32_t flags;
+        };
+
+        // shape texture ids index the texture table of the directory bundle instead of this one
+        const uint32_t FLAG_SHARED_TEXTURES = 1;
+
+        // followed by the levels, each tightly after the previous one
+        struct ImageRecord {
+            uint32_t format;
+            uint32_t width;
+            uint32_t height;
+            uint32_t levelCount;
+        };
+
+        struct ShapeRecord {
+            uint32_t vertexCount;
+            uint32_t indexCount;
+            uint32_t textureCount;
+            uint32_t lodCount;
+            float ambient[3];
+            float diffuse[3];
+            float specular[3];
+            float boundsMin[3];
+            float boundsMax[3];
+            float sphere[4];
+        };
+
+        struct TextureRecord {
+            uint32_t textureIndex;
+            uint32_t typeLength;
+        };
+
+        struct LodRecord {
+            uint32_t indexCount;
+            float error;
+        };
+
+        // every array in the file starts on a 4 byte boundary
+        size_t Align4(size_t offset) {
+            return (offset + 3) & ~static_cast<size_t>(3);
+        }
+
+        void WritePadding(std::ofstream& out, size_t length) {
+            static const char zeros[4] = { 0, 0, 0, 0 };
+            out.write(zeros, Align4(length) - length);
+        }
+
+        bool ModificationTime(const std::string& fileName, int64_t& time) {
+#ifdef _WIN32
+            struct _stat64 fileStat;
+            if (_stat64(fileName.c_str(), &fileStat) != 0) {
+                return false;
+            }
+#else
+            struct stat fileStat;
+            if (stat(fileName.c_str(), &fileStat) != 0) {
+                return false;
+            }
+#endif
+            time = static_cast<int64_t>(fileStat.st_mtime);
+            return true;
+        }
+
+        // Bounds-checked walk over the mapped file
+        class Reader {
+        public:
+            Reader(const unsigned char* data, size_t size)
+                : data(data), size(size), offset(0) {}
+
+            const unsigned char* Take(size_t length) {
+                if (length > size - offset) {
+                    return NULL;
+                }
+                const unsigned char* start = data + offset;
+                offset = Align4(offset + length);
+                // the last array may end unaligned
+                if (offset > size) {
+                    offset = size;
+                }
+                return start;
+            }
+
+            template <typename T>
+            bool Read(T& value) {
+                const unsigned char* start = Take(sizeof(T));
+                if (!start) {
+                    return false;
+                }
+                memcpy(&value, start, sizeof(T));
+                return true;
+            }
+
+            bool ReadString(std::string& text) {
+                uint32_t length;
+                if (!Read(length)) {
+                    return false;
+                }
+                const unsigned char* start = Take(length);
+                if (!start) {
+                    return false;
+                }
+                text.assign(reinterpret_cast<const char*>(start), length);
+                return true;
+            }
+
+            bool ReadImage(AssetBundle::Image& image) {
+                ImageRecord record;
+                if (!Read(record) || CompressedImage::getBlockBytes(record.format) == 0) {
+                    return false;
+                }
+                image.format = record.format;
+                image.width = static_cast<int>(record.width);
+                image.height = static_cast<int>(record.height);
+                image.levels.clear();
+
+                size_t dataSize = 0;
+                int levelWidth = image.width;
+                int levelHeight = image.height;
+                for (uint32_t i = 0; i < record.levelCount; i++) {
+                    CompressedImage::Level level;
+                    level.width = levelWidth;
+                    level.height = levelHeight;
+                    level.offset = dataSize;
+                    level.size = CompressedImage::getLevelSize(image.format, levelWidth, levelHeight);
+                    image.levels.push_back(level);
+                    dataSize += level.size;
+                    levelWidth = levelWidth > 1 ? levelWidth / 2 : 1;
+                    levelHeight = levelHeight > 1 ? levelHeight / 2 : 1;
+                }
+                image.data = Take(dataSize);
+                return image.data != NULL;
+            }
+
+        private:
+            const unsigned char* data;
+            size_t size;
+            size_t offset;
+        };
+
+        void WriteString(std::ofstream& out, const std::string& text) {
+            uint32_t length = static_cast<uint32_t>(text.size());
+            out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            out.write(text.data(), length);
+            WritePadding(out, length);
+        }
+
+        void WriteImage(std::ofstream& out, const CompressedImage& image) {
+            ImageRecord record;
+            record.format = image.format;
+            record.width = static_cast<uint32_t>(image.width);
+            record.height = static_cast<uint32_t>(image.height);
+            record.levelCount = static_cast<uint32_t>(image.levels.size());
+            out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+            out.write(reinterpret_cast<const char*>(image.data.data()), image.data.size());
+            WritePadding(out, image.data.size());
+        }
+    }
+
+    CompressedImage* AssetBundle::Image::Copy() const
+    {
+        CompressedImage* image = new CompressedImage();
+        image->format = format;
+        image->width = width;
+        image->height = height;
+        image->levels = levels;
+        size_t dataSize = levels.empty() ? 0 : levels.back().offset + levels.back().size;
+        image->data.assign(data, data + dataSize);
+        return image;
+    }
+
+    std::string AssetBundle::getBundlePath(const std::string& directory)
+    {
+        std::string path = directory;
+        while (!path.empty() && (path[path.size() - 1] == '/' || path[path.size() - 1] == '\\')) {
+            path.erase(path.size() - 1);
+        }
+        return path + ".bundle";
+    }
+
+    bool AssetBundle::IsUpToDate(const std::string& bundleFileName, const std::string& sourceFileName)
+    {
+        int64_t bundleTime;
+        int64_t sourceTime;
+        if (!ModificationTime(bundleFileName, bundleTime)) {
+            return false;
+        }
+        if (ModificationTime(sourceFileName, sourceTime) && sourceTime > bundleTime) {
+            std::cout << "Bundle " << bundleFileName << " is older than " << sourceFileName << ", ignoring it" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool AssetBundle::Open(const std::string& bundleFileName)
+    {
+        Close();
+
+        if (!file.Open(bundleFileName)) {
+            return false;
+        }
+        fileName = bundleFileName;
+
+        if (!ReadContents()) {
+            std::cerr << "ERROR: bundle " << bundleFileName << " is corrupt or from another version, re-run asset_baker" << std::endl;
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    bool AssetBundle::ReadContents()
+    {
+        Reader reader(file.getData(), file.getSize());
+
+        FileHeader header;
+        if (!reader.Read(header) || memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION) {
+            return false;
+        }
+        sharedTextures = (header.flags & FLAG_SHARED_TEXTURES) != 0;
+
+        textureNames.resize(header.textureCount);
+        textures.resize(header.textureCount);
+        for (uint32_t t = 0; t < header.textureCount; t++) {
+            if (!reader.ReadString(textureNames[t]) || !reader.ReadImage(textures[t])) {
+                return false;
+            }
+        }
+
+        models.resize(header.modelCount);
+        for (uint32_t m = 0; m < header.modelCount; m++) {
+            uint32_t shapeCount;
+            if (!reader.ReadString(models[m].name) || !reader.Read(shapeCount)) {
+                return false;
+            }
+
+            std::vector<Shape>& shapes = models[m].shapes;
+            shapes.resize(shapeCount);
+            for (uint32_t s = 0; s < shapeCount; s++) {
+                ShapeRecord record;
+                if (!reader.Read(record)) {
+                    return false;
+                }
+
+                Shape& shape = shapes[s];
+                shape.material.ambient = glm::vec3(record.ambient[0], record.ambient[1], record.ambient[2]);
+                shape.material.diffuse = glm::vec3(record.diffuse[0], record.diffuse[1], record.diffuse[2]);
+                shape.material.specular = glm::vec3(record.specular[0], record.specular[1], record.specular[2]);
+                shape.bounds.min = glm::vec3(record.boundsMin[0], record.boundsMin[1], record.boundsMin[2]);
+                shape.bounds.max = glm::vec3(record.boundsMax[0], record.boundsMax[1], record.boundsMax[2]);
+                shape.sphere.center = glm::vec3(record.sphere[0], record.sphere[1], record.sphere[2]);
+                shape.sphere.radius = record.sphere[3];
+
+                for (uint32_t t = 0; t < record.textureCount; t++) {
+                    TextureRecord textureRecord;
+                    if (!reader.Read(textureRecord) || (!sharedTextures && textureRecord.textureIndex >= textureNames.size())) {
+                        return false;
+                    }
+                    const unsigned char* type = reader.Take(textureRecord.typeLength);
+                    if (!type) {
+                        return false;
+                    }
+                    Texture texture;
+                    texture.id = textureRecord.textureIndex;
+                    texture.type.assign(reinterpret_cast<const char*>(type), textureRecord.typeLength);
+                    if (!sharedTextures) {
+                        texture.path = textureNames[textureRecord.textureIndex];
+                    }
+                    shape.textures.push_back(texture);
+                }
+
+                shape.vertices = reinterpret_cast<const Vertex*>(reader.Take(static_cast<size_t>(record.vertexCount) * sizeof(Vertex)));
+                shape.vertexCount = record.vertexCount;
+                shape.indices = reinterpret_cast<const GLuint*>(reader.Take(static_cast<size_t>(record.indexCount) * sizeof(GLuint)));
+                shape.indexCount = record.indexCount;
+                if (!shape.vertices || !shape.indices) {
+                    return false;
+                }
+
+                for (uint32_t l = 0; l < record.lodCount; l++) {
+                    LodRecord lodRecord;
+                    if (!reader.Read(lodRecord)) {
+                        return false;
+                    }
+                    LodView lod;
+                    lod.indices = reinterpret_cast<const GLuint*>(reader.Take(static_cast<size_t>(lodRecord.indexCount) * sizeof(GLuint)));
+                    lod.indexCount = lodRecord.indexCount;
+                    lod.error = lodRecord.error;
+                    if (!lod.indices) {
+                        return false;
+                    }
+                    shape.lods.push_back(lod);
+                }
+            }
+        }
+
+        cubeMaps.resize(header.cubeMapCount);
+        for (uint32_t c = 0; c < header.cubeMapCount; c++) {
+            if (!reader.ReadString(cubeMaps[c].name)) {
+                return false;
+            }
+            for (int f = 0; f < 6; f++) {
+                if (!reader.ReadImage(cubeMaps[c].faces[f])) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    void AssetBundle::Close()
+    {
+        models.clear();
+        textureNames.clear();
+        textures.clear();
+        cubeMaps.clear();
+        sharedTextures = false;
+        fileName.clear();
+        file.Close();
+    }
+
+    const std::string& AssetBundle::getFileName() const
+    {
+        return fileName;
+    }
+
+    const AssetBundle::Model* AssetBundle::FindModel(const std::string& name) const
+    {
+        for (size_t m = 0; m < models.size(); m++) {
+            if (models[m].name == name) {
+                return &models[m];
+            }
+        }
+        return NULL;
+    }
+
+    const std::vector<AssetBundle::Model>& AssetBundle::getModels() const
+    {
+        return models;
+    }
+
+    bool AssetBundle::hasSharedTextures() const
+    {
+        return sharedTextures;
+    }
+
+    const std::vector<std::string>& AssetBundle::getTextureNames() const
+    {
+        return textureNames;
+    }
+
+    const std::vector<AssetBundle::Image>& AssetBundle::getTextures() const
+    {
+        return textures;
+    }
+
+    const std::vector<AssetBundle::CubeMap>& AssetBundle::getCubeMaps() const
+    {
+        return cubeMaps;
+    }
+
+    bool AssetBundle::Write(const std::string& bundleFileName, const std::vector<ModelData>& models,
+        const std::vector<TextureData>& textures, const std::vector<CubeMapData>& cubeMaps)
+    {
+        std::vector<std::string> names;
+        for (size_t t = 0; t < textures.size(); t++) {
+            names.push_back(textures[t].name);
+        }
+        return WriteFile(bundleFileName, models, textures, cubeMaps, names, 0);
+    }
+
+    bool AssetBundle::WriteTile(const std::string& bundleFileName, const std::vector<ModelData>& models,
+        const std::vector<std::string>& textureNames)
+    {
+        return WriteFile(bundleFileName, models, std::vector<TextureData>(), std::vector<CubeMapData>(),
+            textureNames, FLAG_SHARED_TEXTURES);
+    }
+
+    bool AssetBundle::WriteFile(const std::string& bundleFileName, const std::vector<ModelData>& models,
+        const std::vector<TextureData>& textures, const std::vector<CubeMapData>& cubeMaps,
+        const std::vector<std::string>& textureNames, uint32_t flags)
+    {
+        std::unordered_map<std::string, uint32_t> textureIndices;
+        for (size_t t = 0; t < textureNames.size(); t++) {
+            textureIndices[textureNames[t]] = static_cast<uint32_t>(t);
+        }
+
+        // write to a temporary file first so an interrupted write never leaves a broken bundle behind
+        std::string tempFileName = bundleFileName + ".tmp";
+        std::ofstream out(tempFileName.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "ERROR: could not write bundle " << bundleFileName << std::endl;
+            return false;
+        }
+
+        FileHeader header;
+        memset(&header, 0, sizeof(FileHeader));
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.textureCount = static_cast<uint32_t>(textures.size());
+        header.modelCount = static_cast<uint32_t>(models.size());
+        header.cubeMapCount = static_cast<uint32_t>(cubeMaps.size());
+        header.flags = flags;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+
+        for (size_t t = 0; t < textures.size(); t++) {
+            WriteString(out, textures[t].name);
+            WriteImage(out, textures[t].image);
+        }
+
+        for (size_t m = 0; m < models.size(); m++) {
+            WriteString(out, models[m].name);
+            uint32_t shapeCount = static_cast<uint32_t>(models[m].shapes.size());
+            out.write(reinterpret_cast<const char*>(&shapeCount), sizeof(shapeCount));
+
+            for (size_t s = 0; s < models[m].shapes.size(); s++) {
+                const MeshData& shape = models[m].shapes[s];
+
+                ShapeRecord record;
+                memset(&record, 0, sizeof(ShapeRecord));
+                record.vertexCount = static_cast<uint32_t>(shape.vertices.size());
+                record.indexCount = static_cast<uint32_t>(shape.indices.size());
+                record.textureCount = static_cast<uint32_t>(shape.textures.size());
+                record.lodCount = static_cast<uint32_t>(shape.lods.size());
+                for (int i = 0; i < 3; i++) {
+                    record.ambient[i] = shape.material.ambient[i];
+                    record.diffuse[i] = shape.material.diffuse[i];
+                    record.specular[i] = shape.material.specular[i];
+                    record.boundsMin[i] = shape.bounds.min[i];
+                    record.boundsMax[i] = shape.bounds.max[i];
+                    record.sphere[i] = shape.sphere.center[i];
+                }
+                record.sphere[3] = shape.sphere.radius;
+                out.write(reinterpret_cast<const char*>(&record), sizeof(ShapeRecord));
+
+                for (size_t t = 0; t < shape.textures.size(); t++) {
+                    std::unordered_map<std::string, uint32_t>::const_iterator index = textureIndices.find(shape.textures[t].path);
+                    if (index == textureIndices.end()) {
+                        std::cerr << "ERROR: texture " << shape.textures[t].path << " is missing from bundle " << bundleFileName << std::endl;
+                        out.close();
+                        std::remove(tempFileName.c_str());
+                        return false;
+                    }
+                    TextureRecord textureRecord;
+                    textureRecord.textureIndex = index->second;
+                    textureRecord.typeLength = static_cast<uint32_t>(shape.textures[t].type.size());
+                    out.write(reinterpret_cast<const char*>(&textureRecord), sizeof(TextureRecord));
+                    out.write(shape.textures[t].type.data(), textureRecord.typeLength);
+                    WritePadding(out, textureRecord.typeLength);
+                }
+
+                out.write(reinterpret_cast<const char*>(shape.vertices.data()), shape.vertices.size() * sizeof(Vertex));
+                out.write(reinterpret_cast<const char*>(shape.indices.data()), shape.indices.size() * sizeof(GLuint));
+
+                for (size_t l = 0; l < shape.lods.size(); l++) {
+                    LodRecord lodRecord;
+                    lodRecord.indexCount = static_cast<uint32_t>(shape.lods[l].indices.size());
+                    lodRecord.error = shape.lods[l].error;
+                    out.write(reinterpret_cast<const char*>(&lodRecord), sizeof(LodRecord));
+                    out.write(reinterpret_cast<const char*>(shape.lods[l].indices.data()), shape.lods[l].indices.size() * sizeof(GLuint));
+                }
+            }
+        }
+
+        for (size_t c = 0; c < cubeMaps.size(); c++) {
+            WriteString(out, cubeMaps[c].name);
+            for (int f = 0; f < 6; f++) {
+                WriteImage(out, cubeMaps[c].faces[f]);
+            }
+        }
+
+        out.close();
+        if (!out) {
+            std::cerr << "ERROR: could not write bundle " << bundleFileName << std::endl;
+            std::remove(tempFileName.c_str());
+            return false;
+        }
+
+        std::remove(bundleFileName.c_str());
+        if (std::rename(tempFileName.c_str(), bundleFileName.c_str()) != 0) {
+            std::cerr << "ERROR: could not write bundle " << bundleFileName << std::endl;
+            std::remove(tempFileName.c_str());
+            return false;
+        }
+
+        return true;
+    }
+}
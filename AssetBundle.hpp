@@ -0,0 +1,120 @@
+#ifndef AssetBundle_hpp
+#define AssetBundle_hpp
+
+#include "Mesh.hpp"
+#include "MappedFile.hpp"
+#include "CompressedImage.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+// Packed assets of one directory, written offline by asset_baker: the shapes of its models,
+// their textures with baked mip chains and its cube maps.
+// The vertex, index and image data is read straight out of the memory-mapped bundle file.
+class AssetBundle
+{
+public:
+    // Bump whenever the file layout, gps::Vertex or the triangle order left by the parser changes
+    static const uint32_t VERSION = 4;
+
+    // View of a baked image - the levels point into the mapped file
+    struct Image {
+        GLenum format;
+        int width;
+        int height;
+        std::vector<CompressedImage::Level> levels;
+        const unsigned char* data;
+
+        // Copies the image out of the bundle
+        CompressedImage* Copy() const;
+    };
+
+    // View of a baked shape - texture ids index getTextureNames(), paths hold the texture names
+    // In a tile bundle the ids index the texture names of the directory bundle and the paths are empty
+    struct Shape {
+        const Vertex* vertices;
+        GLuint vertexCount;
+        const GLuint* indices;
+        GLuint indexCount;
+        std::vector<Texture> textures;
+        Material material;
+        BoundingBox bounds;
+        BoundingSphere sphere;
+        std::vector<LodView> lods;
+    };
+
+    struct Model {
+        std::string name;
+        std::vector<Shape> shapes;
+    };
+
+    struct CubeMap {
+        std::string name;
+        Image faces[6];
+    };
+
+    // Source data for Write - shape texture paths hold texture names
+    struct ModelData {
+        std::string name;
+        std::vector<MeshData> shapes;
+    };
+
+    struct TextureData {
+        std::string name;
+        CompressedImage image;
+    };
+
+    struct CubeMapData {
+        std::string name;
+        CompressedImage faces[6];
+    };
+
+    // Path of the bundle packing a directory
+    static std::string getBundlePath(const std::string& directory);
+
+    // False if the bundle is missing or older than the source file - a missing source file is fine
+    static bool IsUpToDate(const std::string& bundleFileName, const std::string& sourceFileName);
+
+    // Maps the bundle - returns false if it is missing or corrupt
+    bool Open(const std::string& bundleFileName);
+    void Close();
+
+    const std::string& getFileName() const;
+    // NULL if the bundle has no model of that name
+    const Model* FindModel(const std::string& name) const;
+    const std::vector<Model>& getModels() const;
+    // True for tile bundles, whose shapes use the textures of the directory bundle
+    bool hasSharedTextures() const;
+    const std::vector<std::string>& getTextureNames() const;
+    const std::vector<Image>& getTextures() const;
+    const std::vector<CubeMap>& getCubeMaps() const;
+
+    static bool Write(const std::string& bundleFileName, const std::vector<ModelData>& models,
+        const std::vector<TextureData>& textures, const std::vector<CubeMapData>& cubeMaps);
+    // Writes a bundle without textures of its own - shape texture paths are looked up in textureNames,
+    // the texture names of the directory bundle
+    static bool WriteTile(const std::string& bundleFileName, const std::vector<ModelData>& models,
+        const std::vector<std::string>& textureNames);
+
+private:
+    MappedFile file;
+    std::string fileName;
+    std::vector<Model> models;
+    std::vector<std::string> textureNames;
+    std::vector<Image> textures;
+    std::vector<CubeMap> cubeMaps;
+    bool sharedTextures;
+
+    bool ReadContents();
+
+    static bool WriteFile(const std::string& bundleFileName, const std::vector<ModelData>& models,
+        const std::vector<TextureData>& textures, const std::vector<CubeMapData>& cubeMaps,
+        const std::vector<std::string>& textureNames, uint32_t flags);
+};
+
+}
+
+#endif /* AssetBundle_hpp */
@@ -0,0 +1,73 @@
+#ifndef Bounds_hpp
+#define Bounds_hpp
+
+#include "glm/glm.hpp"
+
+#include <cmath>
+#include <cstddef>
+
+namespace gps {
+
+struct BoundingBox
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+struct BoundingSphere
+{
+    glm::vec3 center;
+    float radius;
+};
+
+// Ritter's sphere around the positions of the vertices - a few percent larger than the smallest one
+// Any vertex type with a glm::vec3 Position works
+template <typename VertexType>
+BoundingSphere ComputeBoundingSphere(const VertexType* vertices, size_t vertexCount)
+{
+    BoundingSphere sphere = { glm::vec3(0.0f), 0.0f };
+    if (vertexCount == 0) {
+        return sphere;
+    }
+
+    // the vertex furthest from the first one, then the one furthest from that span the initial sphere
+    size_t a = 0;
+    float maxDistance = -1.0f;
+    for (size_t v = 0; v < vertexCount; v++) {
+        glm::vec3 offset = vertices[v].Position - vertices[0].Position;
+        float distance = glm::dot(offset, offset);
+        if (distance > maxDistance) {
+            maxDistance = distance;
+            a = v;
+        }
+    }
+    size_t b = a;
+    maxDistance = -1.0f;
+    for (size_t v = 0; v < vertexCount; v++) {
+        glm::vec3 offset = vertices[v].Position - vertices[a].Position;
+        float distance = glm::dot(offset, offset);
+        if (distance > maxDistance) {
+            maxDistance = distance;
+            b = v;
+        }
+    }
+    sphere.center = (vertices[a].Position + vertices[b].Position) * 0.5f;
+    sphere.radius = 0.5f * glm::length(vertices[b].Position - vertices[a].Position);
+
+    // grow it just enough to take in every vertex outside
+    for (size_t v = 0; v < vertexCount; v++) {
+        glm::vec3 offset = vertices[v].Position - sphere.center;
+        float squaredDistance = glm::dot(offset, offset);
+        if (squaredDistance > sphere.radius * sphere.radius) {
+            float distance = std::sqrt(squaredDistance);
+            float radius = (sphere.radius + distance) * 0.5f;
+            sphere.center += offset * ((radius - sphere.radius) / distance);
+            sphere.radius = radius;
+        }
+    }
+    return sphere;
+}
+
+}
+
+#endif /* Bounds_hpp */
@@ -0,0 +1,433 @@
+#include "Bvh.hpp"
+
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace gps {
+
+    namespace {
+
+        const int SAH_BINS = 16;
+        // cost of visiting a node relative to testing an item
+        const float TRAVERSAL_COST = 1.0f;
+        // count of a node standing in for a subtree while the top of the hierarchy is built
+        const uint32_t SUBTREE_PLACEHOLDER = 0xFFFFFFFFu;
+
+        BoundingBox EmptyBox() {
+            BoundingBox box;
+            box.min = glm::vec3(std::numeric_limits<float>::max());
+            box.max = glm::vec3(-std::numeric_limits<float>::max());
+            return box;
+        }
+
+        void Grow(BoundingBox& box, const BoundingBox& other) {
+            box.min = glm::min(box.min, other.min);
+            box.max = glm::max(box.max, other.max);
+        }
+
+        // half the surface area - only ever compared
+        float Area(const BoundingBox& box) {
+            glm::vec3 size = glm::max(box.max - box.min, glm::vec3(0.0f));
+            return size.x * size.y + size.y * size.z + size.z * size.x;
+        }
+
+        bool Overlaps(const glm::vec3& min, const glm::vec3& max, const BoundingBox& box) {
+            return min.x <= box.max.x && max.x >= box.min.x
+                && min.y <= box.max.y && max.y >= box.min.y
+                && min.z <= box.max.z && max.z >= box.min.z;
+        }
+
+        // slab test - distance at which the ray enters the box, if it does before maxDistance
+        bool IntersectRay(const glm::vec3& min, const glm::vec3& max, const glm::vec3& origin, const glm::vec3& inverseDirection,
+            float maxDistance, float& distance) {
+            glm::vec3 t1 = (min - origin) * inverseDirection;
+            glm::vec3 t2 = (max - origin) * inverseDirection;
+            glm::vec3 slabEnter = glm::min(t1, t2);
+            glm::vec3 slabExit = glm::max(t1, t2);
+            float enter = std::max(std::max(slabEnter.x, slabEnter.y), std::max(slabEnter.z, 0.0f));
+            float exit = std::min(std::min(slabExit.x, slabExit.y), std::min(slabExit.z, maxDistance));
+            distance = enter;
+            return enter <= exit;
+        }
+    }
+
+    size_t Bvh::parallelBuildItems = 1024;
+
+    Bvh::Bvh() : depth(0) {
+    }
+
+    void Bvh::Clear()
+    {
+        nodes.clear();
+        itemIndices.clear();
+        itemBounds.clear();
+        centroids.clear();
+        depth = 0;
+    }
+
+    bool Bvh::empty() const
+    {
+        return nodes.empty();
+    }
+
+    size_t Bvh::getNodeCount() const
+    {
+        return nodes.size();
+    }
+
+    size_t Bvh::getDepth() const
+    {
+        return depth;
+    }
+
+    void Bvh::Build(const std::vector<BoundingBox>& bounds)
+    {
+        Clear();
+        if (bounds.empty()) {
+            return;
+        }
+
+        itemBounds = bounds;
+        centroids.resize(bounds.size());
+        itemIndices.resize(bounds.size());
+        for (size_t i = 0; i < bounds.size(); i++) {
+            centroids[i] = (bounds[i].min + bounds[i].max) * 0.5f;
+            itemIndices[i] = static_cast<uint32_t>(i);
+        }
+
+        // the top is split on this thread until the subtrees are small enough, then those are built in parallel
+        std::vector<Node> top;
+        std::vector<Subtree> subtrees;
+        BuildNode(0, bounds.size(), top, &subtrees, parallelBuildItems);
+        ThreadPool::getShared().ParallelFor(subtrees.size(), [&](size_t s) {
+            BuildNode(subtrees[s].first, subtrees[s].count, subtrees[s].nodes, NULL, 0);
+        });
+
+        size_t nodeCount = top.size();
+        for (size_t s = 0; s < subtrees.size(); s++) {
+            nodeCount += subtrees[s].nodes.size();
+        }
+        nodes.reserve(nodeCount);
+        AppendTop(top, 0, subtrees);
+        depth = ComputeDepth(0);
+    }
+
+    void Bvh::BuildNode(size_t first, size_t count, std::vector<Node>& out, std::vector<Subtree>* subtrees, size_t maxItems)
+    {
+        if (subtrees && count <= maxItems) {
+            Node placeholder;
+            placeholder.offset = static_cast<uint32_t>(subtrees->size());
+            placeholder.count = SUBTREE_PLACEHOLDER;
+            out.push_back(placeholder);
+
+            Subtree subtree;
+            subtree.first = first;
+            subtree.count = count;
+            subtrees->push_back(subtree);
+            return;
+        }
+
+        BoundingBox bounds = EmptyBox();
+        for (size_t i = first; i < first + count; i++) {
+            Grow(bounds, itemBounds[itemIndices[i]]);
+        }
+
+        // out may grow under the children, so the node is only referred to by index
+        size_t index = out.size();
+        out.push_back(Node());
+        out[index].min = bounds.min;
+        out[index].max = bounds.max;
+
+        size_t leftCount = Split(first, count, bounds);
+        if (leftCount == 0) {
+            out[index].offset = static_cast<uint32_t>(first);
+            out[index].count = static_cast<uint32_t>(count);
+            return;
+        }
+
+        out[index].count = 0;
+        BuildNode(first, leftCount, out, subtrees, maxItems);
+        out[index].offset = static_cast<uint32_t>(out.size());
+        BuildNode(first + leftCount, count - leftCount, out, subtrees, maxItems);
+    }
+
+    size_t Bvh::Split(size_t first, size_t count, const BoundingBox& bounds)
+    {
+        if (count <= 1) {
+            return 0;
+        }
+
+        BoundingBox centroidBounds;
+        centroidBounds.min = centroidBounds.max = centroids[itemIndices[first]];
+        for (size_t i = first + 1; i < first + count; i++) {
+            centroidBounds.min = glm::min(centroidBounds.min, centroids[itemIndices[i]]);
+            centroidBounds.max = glm::max(centroidBounds.max, centroids[itemIndices[i]]);
+        }
+
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1;
+        int bestBin = 0;
+
+        for (int axis = 0; axis < 3; axis++) {
+            float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+            if (extent <= 0.0f) {
+                continue;
+            }
+            float scale = SAH_BINS / extent;
+
+            BoundingBox binBounds[SAH_BINS];
+            size_t binCounts[SAH_BINS];
+            for (int b = 0; b < SAH_BINS; b++) {
+                binBounds[b] = EmptyBox();
+                binCounts[b] = 0;
+            }
+            for (size_t i = first; i < first + count; i++) {
+                uint32_t item = itemIndices[i];
+                int b = std::min(static_cast<int>((centroids[item][axis] - centroidBounds.min[axis]) * scale), SAH_BINS - 1);
+                Grow(binBounds[b], itemBounds[item]);
+                binCounts[b]++;
+            }
+
+            // cost of the right side of every split position, then sweep the left side over them
+            float rightCosts[SAH_BINS];
+            BoundingBox right = EmptyBox();
+            size_t rightCount = 0;
+            for (int b = SAH_BINS - 1; b > 0; b--) {
+                Grow(right, binBounds[b]);
+                rightCount += binCounts[b];
+                rightCosts[b] = rightCount > 0 ? rightCount * Area(right) : 0.0f;
+            }
+
+            BoundingBox left = EmptyBox();
+            size_t leftCount = 0;
+            for (int b = 1; b < SAH_BINS; b++) {
+                Grow(left, binBounds[b - 1]);
+                leftCount += binCounts[b - 1];
+                if (leftCount == 0 || leftCount == count) {
+                    continue;
+                }
+                float cost = leftCount * Area(left) + rightCosts[b];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        if (bestAxis < 0) {
+            // every centroid in one spot - any split is as good as another
+            return count <= MAX_LEAF_ITEMS ? 0 : count / 2;
+        }
+
+        float area = Area(bounds);
+        if (count <= MAX_LEAF_ITEMS && TRAVERSAL_COST * area + bestCost >= count * area) {
+            return 0;
+        }
+
+        float scale = SAH_BINS / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+        float axisMin = centroidBounds.min[bestAxis];
+        const std::vector<glm::vec3>& itemCentroids = centroids;
+        std::vector<uint32_t>::iterator begin = itemIndices.begin() + first;
+        std::vector<uint32_t>::iterator middle = std::partition(begin, begin + count, [&](uint32_t item) {
+            return std::min(static_cast<int>((itemCentroids[item][bestAxis] - axisMin) * scale), SAH_BINS - 1) < bestBin;
+        });
+        return static_cast<size_t>(middle - begin);
+    }
+
+    void Bvh::AppendTop(const std::vector<Node>& top, uint32_t node, std::vector<Subtree>& subtrees)
+    {
+        const Node& topNode = top[node];
+
+        if (topNode.count == SUBTREE_PLACEHOLDER) {
+            // the right child offsets of a subtree are relative to its own array
+            const std::vector<Node>& subtreeNodes = subtrees[topNode.offset].nodes;
+            uint32_t base = static_cast<uint32_t>(nodes.size());
+            for (size_t n = 0; n < subtreeNodes.size(); n++) {
+                nodes.push_back(subtreeNodes[n]);
+                if (subtreeNodes[n].count == 0) {
+                    nodes.back().offset += base;
+                }
+            }
+            std::vector<Node>().swap(subtrees[topNode.offset].nodes);
+            return;
+        }
+
+        size_t index = nodes.size();
+        nodes.push_back(topNode);
+        if (topNode.count > 0) {
+            return;
+        }
+        AppendTop(top, node + 1, subtrees);
+        nodes[index].offset = static_cast<uint32_t>(nodes.size());
+        AppendTop(top, topNode.offset, subtrees);
+    }
+
+    size_t Bvh::ComputeDepth(uint32_t node) const
+    {
+        if (nodes[node].count > 0) {
+            return 1;
+        }
+        return 1 + std::max(ComputeDepth(node + 1), ComputeDepth(nodes[node].offset));
+    }
+
+    size_t Bvh::Cull(const Frustum& frustum, std::vector<uint32_t>& items) const
+    {
+        if (nodes.empty()) {
+            return 0;
+        }
+
+        struct Entry {
+            uint32_t node;
+            // planes the parent straddles - 0 once it is inside all of them
+            unsigned planes;
+        };
+        std::vector<Entry> stack;
+        stack.reserve(2 * depth);
+        Entry root = { 0, Frustum::ALL_PLANES };
+        stack.push_back(root);
+        size_t tested = 0;
+
+        while (!stack.empty()) {
+            Entry entry = stack.back();
+            stack.pop_back();
+            const Node& node = nodes[entry.node];
+
+            // below a node inside every plane, everything is accepted without another test
+            if (entry.planes != 0) {
+                tested++;
+                BoundingBox box = { node.min, node.max };
+                if (frustum.Classify(box, entry.planes) == Frustum::OUTSIDE) {
+                    continue;
+                }
+            }
+
+            if (node.count > 0) {
+                if (entry.planes == 0) {
+                    items.insert(items.end(), itemIndices.begin() + node.offset, itemIndices.begin() + node.offset + node.count);
+                    continue;
+                }
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                    unsigned planes = entry.planes;
+                    if (frustum.Classify(itemBounds[itemIndices[i]], planes) != Frustum::OUTSIDE) {
+                        items.push_back(itemIndices[i]);
+                    }
+                }
+                continue;
+            }
+            Entry right = { node.offset, entry.planes };
+            Entry left = { entry.node + 1, entry.planes };
+            stack.push_back(right);
+            stack.push_back(left);
+        }
+        return tested;
+    }
+
+    bool Bvh::Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, uint32_t& item, float& distance) const
+    {
+        if (nodes.empty()) {
+            return false;
+        }
+
+        glm::vec3 inverseDirection;
+        for (int a = 0; a < 3; a++) {
+            // keeps the slabs of axis-parallel rays finite
+            float component = std::fabs(direction[a]) > 1e-12f ? direction[a] : (direction[a] < 0.0f ? -1e-12f : 1e-12f);
+            inverseDirection[a] = 1.0f / component;
+        }
+
+        struct Entry {
+            uint32_t node;
+            float distance;
+        };
+        std::vector<Entry> stack;
+        stack.reserve(2 * depth);
+
+        float rootDistance;
+        if (!IntersectRay(nodes[0].min, nodes[0].max, origin, inverseDirection, maxDistance, rootDistance)) {
+            return false;
+        }
+        Entry root = { 0, rootDistance };
+        stack.push_back(root);
+        float nearest = maxDistance;
+        bool hit = false;
+
+        while (!stack.empty()) {
+            Entry entry = stack.back();
+            stack.pop_back();
+            if (entry.distance > nearest) {
+                continue;
+            }
+            const Node& node = nodes[entry.node];
+
+            if (node.count > 0) {
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                    const BoundingBox& box = itemBounds[itemIndices[i]];
+                    float itemDistance;
+                    if (IntersectRay(box.min, box.max, origin, inverseDirection, nearest, itemDistance)) {
+                        nearest = itemDistance;
+                        item = itemIndices[i];
+                        hit = true;
+                    }
+                }
+                continue;
+            }
+
+            // the nearer child goes on top of the stack
+            uint32_t children[2] = { entry.node + 1, node.offset };
+            float childDistances[2];
+            bool childHits[2];
+            for (int c = 0; c < 2; c++) {
+                childHits[c] = IntersectRay(nodes[children[c]].min, nodes[children[c]].max, origin, inverseDirection, nearest, childDistances[c]);
+            }
+            int nearer = childDistances[0] <= childDistances[1] ? 0 : 1;
+            for (int k = 0; k < 2; k++) {
+                int c = k == 0 ? 1 - nearer : nearer;
+                if (childHits[c]) {
+                    Entry child = { children[c], childDistances[c] };
+                    stack.push_back(child);
+                }
+            }
+        }
+
+        if (hit) {
+            distance = nearest;
+        }
+        return hit;
+    }
+
+    void Bvh::Query(const BoundingBox& box, std::vector<uint32_t>& items) const
+    {
+        if (nodes.empty()) {
+            return;
+        }
+
+        std::vector<uint32_t> stack;
+        stack.reserve(2 * depth);
+        stack.push_back(0);
+
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            uint32_t index = stack.back();
+            stack.pop_back();
+            if (!Overlaps(node.min, node.max, box)) {
+                continue;
+            }
+
+            if (node.count > 0) {
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                    const BoundingBox& itemBox = itemBounds[itemIndices[i]];
+                    if (Overlaps(itemBox.min, itemBox.max, box)) {
+                        items.push_back(itemIndices[i]);
+                    }
+                }
+                continue;
+            }
+            stack.push_back(node.offset);
+            stack.push_back(index + 1);
+        }
+    }
+}
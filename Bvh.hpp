@@ -0,0 +1,83 @@
+#ifndef Bvh_hpp
+#define Bvh_hpp
+
+#include "glm/glm.hpp"
+
+#include "Bounds.hpp"
+#include "Frustum.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+// Bounding volume hierarchy over a set of boxes, built with the binned surface area heuristic and flattened
+// depth first into one array - a node's left child follows it, so a traversal mostly walks forward in memory.
+// Items are the indices of the boxes passed to Build.
+class Bvh
+{
+public:
+    // Leaves hold at most this many items
+    static const size_t MAX_LEAF_ITEMS = 4;
+    // Subtrees with at most this many items are built as separate tasks on the shared thread pool
+    static size_t parallelBuildItems;
+
+    Bvh();
+
+    // Replaces the hierarchy with one over the boxes
+    void Build(const std::vector<BoundingBox>& bounds);
+    void Clear();
+
+    bool empty() const;
+    size_t getNodeCount() const;
+    size_t getDepth() const;
+
+    // Appends the items whose boxes intersect the frustum - whole subtrees are rejected or accepted at once
+    // Returns the count of nodes tested against a plane
+    size_t Cull(const Frustum& frustum, std::vector<uint32_t>& items) const;
+
+    // Item whose box the ray enters first, within maxDistance along the normalized direction - false if none
+    bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, uint32_t& item, float& distance) const;
+
+    // Appends the items whose boxes overlap the box
+    void Query(const BoundingBox& box, std::vector<uint32_t>& items) const;
+
+private:
+    // 32 bytes
+    struct Node {
+        glm::vec3 min;
+        // leaf: first of its items in itemIndices - interior: index of its right child
+        uint32_t offset;
+        glm::vec3 max;
+        // items of a leaf, 0 for an interior node
+        uint32_t count;
+    };
+
+    // A subtree of the top of the hierarchy, built on its own
+    struct Subtree {
+        size_t first;
+        size_t count;
+        std::vector<Node> nodes;
+    };
+
+    std::vector<Node> nodes;
+    // item indices, leaves own contiguous runs of them
+    std::vector<uint32_t> itemIndices;
+    std::vector<BoundingBox> itemBounds;
+    std::vector<glm::vec3> centroids;
+    size_t depth;
+
+    // Builds a subtree over itemIndices[first, first + count) into out, right child offsets relative to out
+    // Placeholders stand in for the subtrees of at most maxItems items if subtrees is given
+    void BuildNode(size_t first, size_t count, std::vector<Node>& out, std::vector<Subtree>* subtrees, size_t maxItems);
+    // Partitions itemIndices[first, first + count) by the cheapest split - returns the size of the left part, 0 for a leaf
+    size_t Split(size_t first, size_t count, const BoundingBox& bounds);
+    // Copies a node of the top of the hierarchy, and the subtrees under it, into nodes
+    void AppendTop(const std::vector<Node>& top, uint32_t node, std::vector<Subtree>& subtrees);
+    size_t ComputeDepth(uint32_t node) const;
+};
+
+}
+
+#endif /* Bvh_hpp */
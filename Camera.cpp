@@ -23,6 +23,10 @@ namespace gps {
         return glm::lookAt(this->cameraPosition, this->cameraTarget, this->cameraUpDirection);
     }
 
+    Frustum Camera::getFrustum(const glm::mat4& projection) {
+        return Frustum(projection * getViewMatrix());
+    }
+
     void Camera::setCamera(glm::vec3 pos, glm::vec3 trg) {
         this->cameraPosition = pos;
         this->cameraTarget = trg;
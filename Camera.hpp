@@ -4,6 +4,8 @@
 #include "glm/glm.hpp"
 #include "glm/gtx/transform.hpp"
 
+#include "Frustum.hpp"
+
 #include <string>
 
 namespace gps {
@@ -17,6 +19,8 @@ namespace gps {
         Camera(glm::vec3 cameraPosition, glm::vec3 cameraTarget, glm::vec3 cameraUp);
         //return the view matrix, using the glm::lookAt() function
         glm::mat4 getViewMatrix();
+        //return the world space planes of the view volume seen through the projection
+        Frustum getFrustum(const glm::mat4& projection);
         glm::vec3 getPosition();
         glm::vec3 getFront();
         glm::vec3 getTarget();
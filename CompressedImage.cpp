@@ -0,0 +1,352 @@
+#include "CompressedImage.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace gps {
+
+    namespace {
+        const uint32_t DDS_MAGIC = 0x20534444; // "DDS "
+        const uint32_t DDSD_CAPS = 0x1;
+        const uint32_t DDSD_HEIGHT = 0x2;
+        const uint32_t DDSD_WIDTH = 0x4;
+        const uint32_t DDSD_PIXELFORMAT = 0x1000;
+        const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+        const uint32_t DDSD_LINEARSIZE = 0x80000;
+        const uint32_t DDPF_FOURCC = 0x4;
+        const uint32_t DDSCAPS_COMPLEX = 0x8;
+        const uint32_t DDSCAPS_TEXTURE = 0x1000;
+        const uint32_t DDSCAPS_MIPMAP = 0x400000;
+        const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+
+        const uint32_t DXGI_FORMAT_BC1_UNORM = 71;
+        const uint32_t DXGI_FORMAT_BC1_UNORM_SRGB = 72;
+        const uint32_t DXGI_FORMAT_BC3_UNORM = 77;
+        const uint32_t DXGI_FORMAT_BC3_UNORM_SRGB = 78;
+        const uint32_t DXGI_FORMAT_BC7_UNORM = 98;
+        const uint32_t DXGI_FORMAT_BC7_UNORM_SRGB = 99;
+
+        const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+        const uint32_t KTX_ENDIANNESS = 0x04030201;
+
+        struct DDSPixelFormat {
+            uint32_t size;
+            uint32_t flags;
+            uint32_t fourCC;
+            uint32_t rgbBitCount;
+            uint32_t rBitMask;
+            uint32_t gBitMask;
+            uint32_t bBitMask;
+            uint32_t aBitMask;
+        };
+
+        struct DDSHeader {
+            uint32_t size;
+            uint32_t flags;
+            uint32_t height;
+            uint32_t width;
+            uint32_t pitchOrLinearSize;
+            uint32_t depth;
+            uint32_t mipMapCount;
+            uint32_t reserved1[11];
+            DDSPixelFormat pixelFormat;
+            uint32_t caps;
+            uint32_t caps2;
+            uint32_t caps3;
+            uint32_t caps4;
+            uint32_t reserved2;
+        };
+
+        struct DDSHeaderDX10 {
+            uint32_t dxgiFormat;
+            uint32_t resourceDimension;
+            uint32_t miscFlag;
+            uint32_t arraySize;
+            uint32_t miscFlags2;
+        };
+
+        struct KTXHeader {
+            unsigned char identifier[12];
+            uint32_t endianness;
+            uint32_t glType;
+            uint32_t glTypeSize;
+            uint32_t glFormat;
+            uint32_t glInternalFormat;
+            uint32_t glBaseInternalFormat;
+            uint32_t pixelWidth;
+            uint32_t pixelHeight;
+            uint32_t pixelDepth;
+            uint32_t numberOfArrayElements;
+            uint32_t numberOfFaces;
+            uint32_t numberOfMipmapLevels;
+            uint32_t bytesOfKeyValueData;
+        };
+
+        uint32_t FourCC(char a, char b, char c, char d) {
+            return static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 8) |
+                (static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24);
+        }
+
+        // Legacy files carry no colour space - they are treated as sRGB, like the uncompressed textures
+        GLenum FormatFromDXGI(uint32_t dxgiFormat) {
+            switch (dxgiFormat) {
+            case DXGI_FORMAT_BC1_UNORM: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+            case DXGI_FORMAT_BC1_UNORM_SRGB: return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+            case DXGI_FORMAT_BC3_UNORM: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            case DXGI_FORMAT_BC3_UNORM_SRGB: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+            case DXGI_FORMAT_BC7_UNORM: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+            case DXGI_FORMAT_BC7_UNORM_SRGB: return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+            default: return 0;
+            }
+        }
+
+        uint32_t DXGIFromFormat(GLenum format) {
+            switch (format) {
+            case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return DXGI_FORMAT_BC1_UNORM;
+            case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT: return DXGI_FORMAT_BC1_UNORM_SRGB;
+            case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return DXGI_FORMAT_BC3_UNORM;
+            case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT: return DXGI_FORMAT_BC3_UNORM_SRGB;
+            case GL_COMPRESSED_RGBA_BPTC_UNORM: return DXGI_FORMAT_BC7_UNORM;
+            case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM: return DXGI_FORMAT_BC7_UNORM_SRGB;
+            default: return 0;
+            }
+        }
+    }
+
+    CompressedImage::CompressedImage()
+        : format(0), width(0), height(0)
+    {
+    }
+
+    size_t CompressedImage::getBlockBytes(GLenum format)
+    {
+        switch (format) {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+            return 8;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+            return 16;
+        default:
+            return 0;
+        }
+    }
+
+    size_t CompressedImage::getLevelSize(GLenum format, int levelWidth, int levelHeight)
+    {
+        size_t blocksWide = (static_cast<size_t>(levelWidth) + 3) / 4;
+        size_t blocksHigh = (static_cast<size_t>(levelHeight) + 3) / 4;
+        return blocksWide * blocksHigh * getBlockBytes(format);
+    }
+
+    unsigned char* CompressedImage::AddLevel(int levelWidth, int levelHeight)
+    {
+        Level level;
+        level.width = levelWidth;
+        level.height = levelHeight;
+        level.offset = data.size();
+        level.size = getLevelSize(format, levelWidth, levelHeight);
+        levels.push_back(level);
+        data.resize(data.size() + level.size);
+        return &data[level.offset];
+    }
+
+    bool CompressedImage::Read(const std::string& fileName)
+    {
+        MappedFile file;
+        if (!file.Open(fileName)) {
+            return false;
+        }
+
+        const unsigned char* bytes = file.getData();
+        size_t size = file.getSize();
+        uint32_t magic = 0;
+        if (size >= sizeof(magic)) {
+            memcpy(&magic, bytes, sizeof(magic));
+        }
+
+        if (magic == DDS_MAGIC) {
+            return ReadDDS(bytes, size, fileName);
+        }
+        if (size >= sizeof(KTX_IDENTIFIER) && memcmp(bytes, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) == 0) {
+            return ReadKTX(bytes, size, fileName);
+        }
+        fprintf(stderr, "ERROR: %s is neither a DDS nor a KTX file\n", fileName.c_str());
+        return false;
+    }
+
+    bool CompressedImage::ReadDDS(const unsigned char* file, size_t fileSize, const std::string& fileName)
+    {
+        DDSHeader header;
+        size_t offset = sizeof(DDS_MAGIC);
+        if (fileSize < offset + sizeof(header)) {
+            fprintf(stderr, "ERROR: %s is truncated\n", fileName.c_str());
+            return false;
+        }
+        memcpy(&header, file + offset, sizeof(header));
+        offset += sizeof(header);
+
+        if (header.size != sizeof(DDSHeader) || !(header.pixelFormat.flags & DDPF_FOURCC)) {
+            fprintf(stderr, "ERROR: %s is not a block-compressed DDS file\n", fileName.c_str());
+            return false;
+        }
+
+        uint32_t fourCC = header.pixelFormat.fourCC;
+        if (fourCC == FourCC('D', 'X', '1', '0')) {
+            DDSHeaderDX10 header10;
+            if (fileSize < offset + sizeof(header10)) {
+                fprintf(stderr, "ERROR: %s is truncated\n", fileName.c_str());
+                return false;
+            }
+            memcpy(&header10, file + offset, sizeof(header10));
+            offset += sizeof(header10);
+            if (header10.resourceDimension != DDS_DIMENSION_TEXTURE2D || header10.arraySize > 1) {
+                fprintf(stderr, "ERROR: %s is not a single 2D texture\n", fileName.c_str());
+                return false;
+            }
+            format = FormatFromDXGI(header10.dxgiFormat);
+        } else if (fourCC == FourCC('D', 'X', 'T', '1')) {
+            format = GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+        } else if (fourCC == FourCC('D', 'X', 'T', '5')) {
+            format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+        } else {
+            format = 0;
+        }
+        if (getBlockBytes(format) == 0) {
+            fprintf(stderr, "ERROR: %s uses an unsupported compression format\n", fileName.c_str());
+            return false;
+        }
+
+        width = static_cast<int>(header.width);
+        height = static_cast<int>(header.height);
+        int levelCount = (header.flags & DDSD_MIPMAPCOUNT) ? std::max(1, static_cast<int>(header.mipMapCount)) : 1;
+        return ReadLevels(file, fileSize, offset, levelCount, fileName);
+    }
+
+    bool CompressedImage::ReadLevels(const unsigned char* file, size_t fileSize, size_t offset, int levelCount, const std::string& fileName)
+    {
+        levels.clear();
+        data.clear();
+        int levelWidth = width;
+        int levelHeight = height;
+        for (int i = 0; i < levelCount; i++) {
+            size_t size = getLevelSize(format, levelWidth, levelHeight);
+            if (fileSize - offset < size) {
+                fprintf(stderr, "ERROR: %s is truncated\n", fileName.c_str());
+                return false;
+            }
+            memcpy(AddLevel(levelWidth, levelHeight), file + offset, size);
+            offset += size;
+            if (levelWidth == 1 && levelHeight == 1) {
+                break;
+            }
+            levelWidth = std::max(1, levelWidth / 2);
+            levelHeight = std::max(1, levelHeight / 2);
+        }
+        return true;
+    }
+
+    bool CompressedImage::ReadKTX(const unsigned char* file, size_t fileSize, const std::string& fileName)
+    {
+        KTXHeader header;
+        if (fileSize < sizeof(header)) {
+            fprintf(stderr, "ERROR: %s is truncated\n", fileName.c_str());
+            return false;
+        }
+        memcpy(&header, file, sizeof(header));
+
+        if (header.endianness != KTX_ENDIANNESS) {
+            fprintf(stderr, "ERROR: %s has a foreign byte order\n", fileName.c_str());
+            return false;
+        }
+        if (header.glType != 0 || header.pixelDepth > 1 || header.numberOfArrayElements > 0 || header.numberOfFaces != 1) {
+            fprintf(stderr, "ERROR: %s is not a single compressed 2D texture\n", fileName.c_str());
+            return false;
+        }
+        format = header.glInternalFormat;
+        if (getBlockBytes(format) == 0) {
+            fprintf(stderr, "ERROR: %s uses an unsupported compression format\n", fileName.c_str());
+            return false;
+        }
+
+        width = static_cast<int>(header.pixelWidth);
+        height = static_cast<int>(header.pixelHeight);
+        int levelCount = std::max(1, static_cast<int>(header.numberOfMipmapLevels));
+
+        // every level is preceded by its size - block data is always a multiple of 4 bytes, so no padding
+        levels.clear();
+        data.clear();
+        size_t offset = sizeof(header) + header.bytesOfKeyValueData;
+        int levelWidth = width;
+        int levelHeight = height;
+        for (int i = 0; i < levelCount; i++) {
+            uint32_t imageSize;
+            if (offset > fileSize || fileSize - offset < sizeof(imageSize)) {
+                fprintf(stderr, "ERROR: %s is truncated\n", fileName.c_str());
+                return false;
+            }
+            memcpy(&imageSize, file + offset, sizeof(imageSize));
+            offset += sizeof(imageSize);
+
+            size_t size = getLevelSize(format, levelWidth, levelHeight);
+            if (imageSize != size || fileSize - offset < size) {
+                fprintf(stderr, "ERROR: level %d of %s has the wrong size\n", i, fileName.c_str());
+                return false;
+            }
+            memcpy(AddLevel(levelWidth, levelHeight), file + offset, size);
+            offset += size;
+            levelWidth = std::max(1, levelWidth / 2);
+            levelHeight = std::max(1, levelHeight / 2);
+        }
+        return true;
+    }
+
+    bool CompressedImage::WriteDDS(const std::string& fileName) const
+    {
+        std::ofstream out(fileName.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out) {
+            fprintf(stderr, "ERROR: could not write %s\n", fileName.c_str());
+            return false;
+        }
+
+        DDSHeader header;
+        memset(&header, 0, sizeof(header));
+        header.size = sizeof(DDSHeader);
+        header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+        header.height = static_cast<uint32_t>(height);
+        header.width = static_cast<uint32_t>(width);
+        header.pitchOrLinearSize = levels.empty() ? 0 : static_cast<uint32_t>(levels[0].size);
+        header.mipMapCount = static_cast<uint32_t>(levels.size());
+        header.pixelFormat.size = sizeof(DDSPixelFormat);
+        header.pixelFormat.flags = DDPF_FOURCC;
+        header.pixelFormat.fourCC = FourCC('D', 'X', '1', '0');
+        header.caps = DDSCAPS_TEXTURE | (levels.size() > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+
+        // the DX10 header keeps the colour space
+        DDSHeaderDX10 header10;
+        memset(&header10, 0, sizeof(header10));
+        header10.dxgiFormat = DXGIFromFormat(format);
+        header10.resourceDimension = DDS_DIMENSION_TEXTURE2D;
+        header10.arraySize = 1;
+
+        out.write(reinterpret_cast<const char*>(&DDS_MAGIC), sizeof(DDS_MAGIC));
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(&header10), sizeof(header10));
+        if (!data.empty()) {
+            out.write(reinterpret_cast<const char*>(&data[0]), data.size());
+        }
+
+        if (!out) {
+            fprintf(stderr, "ERROR: could not write %s\n", fileName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+}
@@ -0,0 +1,54 @@
+#ifndef CompressedImage_hpp
+#define CompressedImage_hpp
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+// Block-compressed image with its mip chain, read from .dds or .ktx (version 1) files.
+// Supports BC1 (DXT1), BC3 (DXT5) and BC7. The data is uploaded as stored, so the rows must
+// already be bottom-up like the images flipped by the texture loader (e.g. texconv -vflip).
+class CompressedImage
+{
+public:
+    struct Level {
+        int width;
+        int height;
+        size_t offset;
+        size_t size;
+    };
+
+    GLenum format;
+    int width;
+    int height;
+    std::vector<Level> levels;
+    std::vector<unsigned char> data;
+
+    CompressedImage();
+
+    // Reads a .dds or .ktx file, recognised by its signature
+    bool Read(const std::string& fileName);
+
+    bool WriteDDS(const std::string& fileName) const;
+
+    // Appends a level of the given size, returning where its blocks go in data
+    unsigned char* AddLevel(int levelWidth, int levelHeight);
+
+    // Bytes per 4x4 block - 0 for formats that are not supported
+    static size_t getBlockBytes(GLenum format);
+    static size_t getLevelSize(GLenum format, int levelWidth, int levelHeight);
+
+private:
+    bool ReadDDS(const unsigned char* file, size_t fileSize, const std::string& fileName);
+    bool ReadKTX(const unsigned char* file, size_t fileSize, const std::string& fileName);
+    // Splits the data into levels, each tightly following the previous one
+    bool ReadLevels(const unsigned char* file, size_t fileSize, size_t offset, int levelCount, const std::string& fileName);
+};
+
+}
+
+#endif /* CompressedImage_hpp */
@@ -0,0 +1,329 @@
+#include "DepthRasterizer.hpp"
+
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define DEPTH_RASTERIZER_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace gps {
+
+    namespace {
+
+        // triangles smaller than this, in square pixels, cover no pixel center worth having
+        const float MIN_TRIANGLE_AREA = 1e-6f;
+
+        // a vertex in front of the near plane - w is then at least the near distance
+        bool InFrontOfNear(const glm::vec4& clip) {
+            return clip.z >= -clip.w;
+        }
+    }
+
+    DepthRasterizer& DepthRasterizer::getInstance()
+    {
+        static DepthRasterizer* instance = new DepthRasterizer();
+        return *instance;
+    }
+
+    DepthRasterizer::DepthRasterizer()
+        : width(0), height(0), tilesX(0), tilesY(0), clipFromWorld(1.0f), clipFromObject(1.0f), frameCount(0)
+    {
+        FrameStats zero = { 0, 0, 0, 0.0 };
+        frame = lastFrame = total = zero;
+    }
+
+    void DepthRasterizer::BeginFrame(const glm::mat4& clipFromWorld, int width, int height)
+    {
+        if (frameCount > 0) {
+            lastFrame = frame;
+            total.triangles += frame.triangles;
+            total.tested += frame.tested;
+            total.occluded += frame.occluded;
+            total.milliseconds += frame.milliseconds;
+        }
+        FrameStats zero = { 0, 0, 0, 0.0 };
+        frame = zero;
+        frameCount++;
+
+        tilesX = (std::max(width, 1) + TILE_WIDTH - 1) / TILE_WIDTH;
+        tilesY = (std::max(height, 1) + TILE_HEIGHT - 1) / TILE_HEIGHT;
+        this->width = tilesX * TILE_WIDTH;
+        this->height = tilesY * TILE_HEIGHT;
+        this->clipFromWorld = clipFromWorld;
+        this->clipFromObject = clipFromWorld;
+
+        // nothing drawn is infinitely far
+        depth.assign(static_cast<size_t>(this->width) * this->height, 0.0f);
+        tileFarDepth.assign(static_cast<size_t>(tilesX) * tilesY, 0.0f);
+        bins.resize(static_cast<size_t>(tilesX) * tilesY);
+        for (size_t t = 0; t < bins.size(); t++) {
+            bins[t].clear();
+        }
+        triangles.clear();
+    }
+
+    void DepthRasterizer::AddOccluder(const glm::vec3* positions, size_t positionCount, const uint32_t* indices, size_t indexCount,
+        const glm::mat4& model)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        glm::mat4 clipFromModel = clipFromWorld * model;
+        clipPositions.resize(positionCount);
+        for (size_t i = 0; i < positionCount; i++) {
+            clipPositions[i] = clipFromModel * glm::vec4(positions[i], 1.0f);
+        }
+
+        glm::vec2 viewport(static_cast<float>(width), static_cast<float>(height));
+        for (size_t i = 0; i + 2 < indexCount; i += 3) {
+            const glm::vec4& c0 = clipPositions[indices[i]];
+            const glm::vec4& c1 = clipPositions[indices[i + 1]];
+            const glm::vec4& c2 = clipPositions[indices[i + 2]];
+            // dropping an occluder triangle only hides less
+            if (!InFrontOfNear(c0) || !InFrontOfNear(c1) || !InFrontOfNear(c2)) {
+                continue;
+            }
+
+            ScreenTriangle triangle;
+            const glm::vec4* clip[3] = { &c0, &c1, &c2 };
+            for (int v = 0; v < 3; v++) {
+                float inverseW = 1.0f / clip[v]->w;
+                glm::vec2 ndc = glm::vec2(clip[v]->x, clip[v]->y) * inverseW;
+                triangle.v[v] = glm::vec3((ndc * 0.5f + 0.5f) * viewport, inverseW);
+            }
+
+            float area = (triangle.v[1].x - triangle.v[0].x) * (triangle.v[2].y - triangle.v[0].y)
+                - (triangle.v[2].x - triangle.v[0].x) * (triangle.v[1].y - triangle.v[0].y);
+            if (std::fabs(area) < MIN_TRIANGLE_AREA) {
+                continue;
+            }
+            // occluders are closed hulls seen from either side
+            if (area < 0.0f) {
+                std::swap(triangle.v[1], triangle.v[2]);
+            }
+
+            float minX = std::min(triangle.v[0].x, std::min(triangle.v[1].x, triangle.v[2].x));
+            float maxX = std::max(triangle.v[0].x, std::max(triangle.v[1].x, triangle.v[2].x));
+            float minY = std::min(triangle.v[0].y, std::min(triangle.v[1].y, triangle.v[2].y));
+            float maxY = std::max(triangle.v[0].y, std::max(triangle.v[1].y, triangle.v[2].y));
+            if (maxX < 0.0f || maxY < 0.0f || minX >= viewport.x || minY >= viewport.y) {
+                continue;
+            }
+
+            // into the bins of the tiles under its bounds
+            uint32_t index = static_cast<uint32_t>(triangles.size());
+            triangles.push_back(triangle);
+            int tileMinX = std::max(static_cast<int>(minX) / TILE_WIDTH, 0);
+            int tileMaxX = std::min(static_cast<int>(maxX) / TILE_WIDTH, tilesX - 1);
+            int tileMinY = std::max(static_cast<int>(minY) / TILE_HEIGHT, 0);
+            int tileMaxY = std::min(static_cast<int>(maxY) / TILE_HEIGHT, tilesY - 1);
+            for (int ty = tileMinY; ty <= tileMaxY; ty++) {
+                for (int tx = tileMinX; tx <= tileMaxX; tx++) {
+                    bins[static_cast<size_t>(ty) * tilesX + tx].push_back(index);
+                }
+            }
+        }
+
+        frame.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void DepthRasterizer::Rasterize()
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        // the tiles share no pixels, so they need no locking
+        ThreadPool::getShared().ParallelFor(bins.size(), [this](size_t tile) {
+            RasterizeTile(tile);
+        });
+
+        frame.triangles += triangles.size();
+        frame.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void DepthRasterizer::RasterizeTile(size_t tile)
+    {
+        int minX = static_cast<int>(tile % tilesX) * TILE_WIDTH;
+        int minY = static_cast<int>(tile / tilesX) * TILE_HEIGHT;
+        const std::vector<uint32_t>& bin = bins[tile];
+        for (size_t i = 0; i < bin.size(); i++) {
+            RasterizeTriangle(triangles[bin[i]], minX, minY, minX + TILE_WIDTH, minY + TILE_HEIGHT);
+        }
+
+        float farDepth = depth[static_cast<size_t>(minY) * width + minX];
+        for (int y = minY; y < minY + TILE_HEIGHT; y++) {
+            const float* row = &depth[static_cast<size_t>(y) * width];
+            for (int x = minX; x < minX + TILE_WIDTH; x++) {
+                farDepth = std::min(farDepth, row[x]);
+            }
+        }
+        tileFarDepth[tile] = farDepth;
+    }
+
+    // Edge functions and the depth plane evaluated at the pixel centers - pixels in all three half planes keep the nearer depth
+    void DepthRasterizer::RasterizeTriangle(const ScreenTriangle& triangle, int minX, int minY, int maxX, int maxY)
+    {
+        const glm::vec3& v0 = triangle.v[0];
+        const glm::vec3& v1 = triangle.v[1];
+        const glm::vec3& v2 = triangle.v[2];
+
+        // edge (a, b) is a.y - b.y, b.x - a.x, positive inside a counter-clockwise triangle
+        float edgeA[3] = { v1.y - v2.y, v2.y - v0.y, v0.y - v1.y };
+        float edgeB[3] = { v2.x - v1.x, v0.x - v2.x, v1.x - v0.x };
+        float edgeC[3] = {
+            -(edgeA[0] * v1.x + edgeB[0] * v1.y),
+            -(edgeA[1] * v2.x + edgeB[1] * v2.y),
+            -(edgeA[2] * v0.x + edgeB[2] * v0.y)
+        };
+        // edge i is zero on the side opposite vertex i, and the area at vertex i - the barycentrics are the edges over the area
+        float area = edgeA[0] * v0.x + edgeB[0] * v0.y + edgeC[0];
+        float depthA = (edgeA[0] * v0.z + edgeA[1] * v1.z + edgeA[2] * v2.z) / area;
+        float depthB = (edgeB[0] * v0.z + edgeB[1] * v1.z + edgeB[2] * v2.z) / area;
+        float depthC = (edgeC[0] * v0.z + edgeC[1] * v1.z + edgeC[2] * v2.z) / area;
+
+        // pixels whose centers the bounds can hold, the first column aligned for four pixels at a time
+        int startX = std::max(static_cast<int>(std::floor(std::min(v0.x, std::min(v1.x, v2.x)) - 0.5f)), minX) & ~3;
+        int endX = std::min(static_cast<int>(std::ceil(std::max(v0.x, std::max(v1.x, v2.x)) - 0.5f)) + 1, maxX);
+        int startY = std::max(static_cast<int>(std::floor(std::min(v0.y, std::min(v1.y, v2.y)) - 0.5f)), minY);
+        int endY = std::min(static_cast<int>(std::ceil(std::max(v0.y, std::max(v1.y, v2.y)) - 0.5f)) + 1, maxY);
+        startX = std::max(startX, minX);
+
+        for (int y = startY; y < endY; y++) {
+            float centerY = y + 0.5f;
+            float* row = &depth[static_cast<size_t>(y) * width];
+            int x = startX;
+
+#ifdef DEPTH_RASTERIZER_SSE
+            __m128 rowEdge0 = _mm_set1_ps(edgeB[0] * centerY + edgeC[0]);
+            __m128 rowEdge1 = _mm_set1_ps(edgeB[1] * centerY + edgeC[1]);
+            __m128 rowEdge2 = _mm_set1_ps(edgeB[2] * centerY + edgeC[2]);
+            __m128 rowDepth = _mm_set1_ps(depthB * centerY + depthC);
+            __m128 stepA0 = _mm_set1_ps(edgeA[0]);
+            __m128 stepA1 = _mm_set1_ps(edgeA[1]);
+            __m128 stepA2 = _mm_set1_ps(edgeA[2]);
+            __m128 stepDepth = _mm_set1_ps(depthA);
+            __m128 zero = _mm_setzero_ps();
+            // endX - startX is not a multiple of four, but the tiles are - the last group stays in the tile
+            for (; x < endX; x += 4) {
+                __m128 centerX = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+                __m128 e0 = _mm_add_ps(_mm_mul_ps(stepA0, centerX), rowEdge0);
+                __m128 e1 = _mm_add_ps(_mm_mul_ps(stepA1, centerX), rowEdge1);
+                __m128 e2 = _mm_add_ps(_mm_mul_ps(stepA2, centerX), rowEdge2);
+                __m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+                if (_mm_movemask_ps(inside) == 0) {
+                    continue;
+                }
+                __m128 pixelDepth = _mm_add_ps(_mm_mul_ps(stepDepth, centerX), rowDepth);
+                __m128 stored = _mm_loadu_ps(row + x);
+                __m128 nearer = _mm_max_ps(stored, pixelDepth);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, stored)));
+            }
+#endif
+
+            for (; x < endX; x++) {
+                float centerX = x + 0.5f;
+                if (edgeA[0] * centerX + edgeB[0] * centerY + edgeC[0] >= 0.0f
+                    && edgeA[1] * centerX + edgeB[1] * centerY + edgeC[1] >= 0.0f
+                    && edgeA[2] * centerX + edgeB[2] * centerY + edgeC[2] >= 0.0f) {
+                    row[x] = std::max(row[x], depthA * centerX + depthB * centerY + depthC);
+                }
+            }
+        }
+    }
+
+    void DepthRasterizer::setObjectTransform(const glm::mat4& model)
+    {
+        clipFromObject = clipFromWorld * model;
+    }
+
+    bool DepthRasterizer::IsVisible(const BoundingBox& box)
+    {
+        frame.tested++;
+
+        float minX = static_cast<float>(width);
+        float maxX = 0.0f;
+        float minY = static_cast<float>(height);
+        float maxY = 0.0f;
+        // of the nearest corner - w is linear, so no point of the box is nearer
+        float nearestDepth = 0.0f;
+        for (int c = 0; c < 8; c++) {
+            glm::vec3 corner(c & 1 ? box.max.x : box.min.x, c & 2 ? box.max.y : box.min.y, c & 4 ? box.max.z : box.min.z);
+            glm::vec4 clip = clipFromObject * glm::vec4(corner, 1.0f);
+            // the camera may be inside or right next to it
+            if (!InFrontOfNear(clip)) {
+                return true;
+            }
+            float inverseW = 1.0f / clip.w;
+            float x = (clip.x * inverseW * 0.5f + 0.5f) * width;
+            float y = (clip.y * inverseW * 0.5f + 0.5f) * height;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            nearestDepth = std::max(nearestDepth, inverseW);
+        }
+
+        if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height) {
+            frame.occluded++;
+            return false;
+        }
+
+        // every pixel the box overlaps, and one more around them - the occluders only cover the pixels whose centers they do
+        int startX = std::max(static_cast<int>(std::floor(minX)) - 1, 0);
+        int endX = std::min(static_cast<int>(std::floor(maxX)) + 2, width);
+        int startY = std::max(static_cast<int>(std::floor(minY)) - 1, 0);
+        int endY = std::min(static_cast<int>(std::floor(maxY)) + 2, height);
+
+        for (int ty = startY / TILE_HEIGHT; ty <= (endY - 1) / TILE_HEIGHT; ty++) {
+            for (int tx = startX / TILE_WIDTH; tx <= (endX - 1) / TILE_WIDTH; tx++) {
+                // the whole tile is nearer
+                if (tileFarDepth[static_cast<size_t>(ty) * tilesX + tx] > nearestDepth) {
+                    continue;
+                }
+                int tileStartX = std::max(startX, tx * TILE_WIDTH);
+                int tileEndX = std::min(endX, (tx + 1) * TILE_WIDTH);
+                int tileStartY = std::max(startY, ty * TILE_HEIGHT);
+                int tileEndY = std::min(endY, (ty + 1) * TILE_HEIGHT);
+                for (int y = tileStartY; y < tileEndY; y++) {
+                    const float* row = &depth[static_cast<size_t>(y) * width];
+                    int x = tileStartX;
+
+#ifdef DEPTH_RASTERIZER_SSE
+                    __m128 boxDepth = _mm_set1_ps(nearestDepth);
+                    for (; x + 4 <= tileEndX; x += 4) {
+                        if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(row + x), boxDepth)) != 0) {
+                            return true;
+                        }
+                    }
+#endif
+
+                    for (; x < tileEndX; x++) {
+                        if (row[x] <= nearestDepth) {
+                            return true;
+                        }
+                    }
+                }
+            }
+        }
+
+        frame.occluded++;
+        return false;
+    }
+
+    void DepthRasterizer::PrintStats() const
+    {
+        size_t frames = frameCount > 1 ? frameCount - 1 : 0;
+        printf("Depth raster   : %dx%d, last frame %zu occluder triangles in %.2f ms, %zu of %zu boxes occluded",
+            width, height, lastFrame.triangles, lastFrame.milliseconds, lastFrame.occluded, lastFrame.tested);
+        if (frames > 0) {
+            printf(" - per frame %.1f triangles in %.2f ms, %.1f of %.1f boxes occluded",
+                static_cast<double>(total.triangles) / frames, total.milliseconds / frames,
+                static_cast<double>(total.occluded) / frames, static_cast<double>(total.tested) / frames);
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef DepthRasterizer_hpp
+#define DepthRasterizer_hpp
+
+#include "glm/glm.hpp"
+
+#include "Bounds.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+// Software occlusion culling: a few large occluder meshes are rasterized on the CPU into a low resolution depth buffer,
+// and the boxes of the shapes are tested against it before they are submitted - in the same frame, without the GPU.
+// The buffer is cut into tiles, the triangles are binned by the tiles they touch and each tile is rasterized as its own
+// task on the shared thread pool, four pixels at a time with SSE where the compiler targets it.
+// Depth is kept as 1 / w, larger is nearer - it is linear across the screen and keeps its precision in the distance.
+// Used from one thread at a time.
+class DepthRasterizer
+{
+public:
+    static const int TILE_WIDTH = 32;
+    static const int TILE_HEIGHT = 16;
+
+    // Never destroyed
+    static DepthRasterizer& getInstance();
+
+    // Clears the buffer and drops the occluders of the last frame - the size is rounded up to whole tiles
+    void BeginFrame(const glm::mat4& clipFromWorld, int width, int height);
+
+    // Projects the triangles of an occluder mesh given in model space - triangles crossing the near plane are dropped
+    void AddOccluder(const glm::vec3* positions, size_t positionCount, const uint32_t* indices, size_t indexCount,
+        const glm::mat4& model);
+
+    // Bins and rasterizes the occluders added since BeginFrame
+    void Rasterize();
+
+    // Transform of the boxes tested next
+    void setObjectTransform(const glm::mat4& model);
+
+    // False if every pixel the box covers holds an occluder nearer than the whole box
+    bool IsVisible(const BoundingBox& box);
+
+    void PrintStats() const;
+
+private:
+    // in pixels and 1 / w, counter-clockwise
+    struct ScreenTriangle {
+        glm::vec3 v[3];
+    };
+
+    // per-frame counts
+    struct FrameStats {
+        size_t triangles;
+        size_t tested;
+        size_t occluded;
+        double milliseconds;
+    };
+
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    std::vector<float> depth;
+    // farthest depth in each tile, so a box behind it needs no per-pixel test
+    std::vector<float> tileFarDepth;
+
+    glm::mat4 clipFromWorld;
+    glm::mat4 clipFromObject;
+
+    std::vector<ScreenTriangle> triangles;
+    // triangles overlapping each tile
+    std::vector<std::vector<uint32_t> > bins;
+    std::vector<glm::vec4> clipPositions;
+
+    FrameStats frame;
+    FrameStats lastFrame;
+    FrameStats total;
+    size_t frameCount;
+
+    DepthRasterizer();
+    DepthRasterizer(const DepthRasterizer&);
+    DepthRasterizer& operator=(const DepthRasterizer&);
+
+    void RasterizeTile(size_t tile);
+    void RasterizeTriangle(const ScreenTriangle& triangle, int minX, int minY, int maxX, int maxY);
+};
+
+}
+
+#endif /* DepthRasterizer_hpp */
@@ -0,0 +1,169 @@
+#include "Frustum.hpp"
+
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRUSTUM_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace gps {
+
+    Frustum::Frustum()
+    {
+        for (int p = 0; p < PLANE_COUNT; p++) {
+            planes[p] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        }
+    }
+
+    // Gribb and Hartmann - each plane is the w row plus or minus one of the others, -w <= x, y, z <= w inside
+    Frustum::Frustum(const glm::mat4& clipFromSpace)
+    {
+        glm::vec4 rows[4];
+        for (int r = 0; r < 4; r++) {
+            rows[r] = glm::vec4(clipFromSpace[0][r], clipFromSpace[1][r], clipFromSpace[2][r], clipFromSpace[3][r]);
+        }
+        planes[PLANE_LEFT] = rows[3] + rows[0];
+        planes[PLANE_RIGHT] = rows[3] - rows[0];
+        planes[PLANE_BOTTOM] = rows[3] + rows[1];
+        planes[PLANE_TOP] = rows[3] - rows[1];
+        planes[PLANE_NEAR] = rows[3] + rows[2];
+        planes[PLANE_FAR] = rows[3] - rows[2];
+        Normalize();
+    }
+
+    const glm::vec4& Frustum::getPlane(Plane plane) const
+    {
+        return planes[plane];
+    }
+
+    // a point p of model space is inside where plane . (model * p) >= 0, i.e. (transpose(model) * plane) . p >= 0
+    Frustum Frustum::InModelSpace(const glm::mat4& model) const
+    {
+        Frustum transformed;
+        glm::mat4 transposed = glm::transpose(model);
+        for (int p = 0; p < PLANE_COUNT; p++) {
+            transformed.planes[p] = transposed * planes[p];
+        }
+        transformed.Normalize();
+        return transformed;
+    }
+
+    // Cramer's rule on the left, right and bottom planes
+    bool Frustum::getApex(glm::vec3& apex) const
+    {
+        glm::vec3 left(planes[PLANE_LEFT]);
+        glm::vec3 right(planes[PLANE_RIGHT]);
+        glm::vec3 bottom(planes[PLANE_BOTTOM]);
+        glm::vec3 rightBottom = glm::cross(right, bottom);
+        float determinant = glm::dot(left, rightBottom);
+        if (std::fabs(determinant) < 1e-6f) {
+            return false;
+        }
+        apex = -(planes[PLANE_LEFT].w * rightBottom + planes[PLANE_RIGHT].w * glm::cross(bottom, left)
+            + planes[PLANE_BOTTOM].w * glm::cross(left, right)) / determinant;
+        return true;
+    }
+
+    void Frustum::Normalize()
+    {
+        for (int p = 0; p < PLANE_COUNT; p++) {
+            float length = glm::length(glm::vec3(planes[p]));
+            if (length > 0.0f) {
+                planes[p] /= length;
+            }
+        }
+    }
+
+    bool Frustum::Intersects(const BoundingSphere& sphere) const
+    {
+        for (int p = 0; p < PLANE_COUNT; p++) {
+            if (glm::dot(glm::vec3(planes[p]), sphere.center) + planes[p].w < -sphere.radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Frustum::Intersects(const BoundingBox& box) const
+    {
+        for (int p = 0; p < PLANE_COUNT; p++) {
+            // the corner furthest along the normal
+            glm::vec3 corner(planes[p].x >= 0.0f ? box.max.x : box.min.x,
+                planes[p].y >= 0.0f ? box.max.y : box.min.y,
+                planes[p].z >= 0.0f ? box.max.z : box.min.z);
+            if (glm::dot(glm::vec3(planes[p]), corner) + planes[p].w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Frustum::Containment Frustum::Classify(const BoundingBox& box, unsigned& planeMask) const
+    {
+        glm::vec3 center = (box.min + box.max) * 0.5f;
+        glm::vec3 extent = (box.max - box.min) * 0.5f;
+        for (int p = 0; p < PLANE_COUNT; p++) {
+            if (!(planeMask & (1u << p))) {
+                continue;
+            }
+            glm::vec3 normal(planes[p]);
+            float distance = glm::dot(normal, center) + planes[p].w;
+            // half the extent of the box along the normal
+            float radius = glm::dot(glm::abs(normal), extent);
+            if (distance + radius < 0.0f) {
+                return OUTSIDE;
+            }
+            if (distance - radius >= 0.0f) {
+                planeMask &= ~(1u << p);
+            }
+        }
+        return planeMask == 0 ? INSIDE : INTERSECTING;
+    }
+
+    size_t Frustum::CullSpheres(const glm::vec4* spheres, size_t count, unsigned char* visible) const
+    {
+        size_t visibleCount = 0;
+        size_t i = 0;
+
+#ifdef FRUSTUM_SSE
+        __m128 planeX[PLANE_COUNT], planeY[PLANE_COUNT], planeZ[PLANE_COUNT], planeW[PLANE_COUNT];
+        for (int p = 0; p < PLANE_COUNT; p++) {
+            planeX[p] = _mm_set1_ps(planes[p].x);
+            planeY[p] = _mm_set1_ps(planes[p].y);
+            planeZ[p] = _mm_set1_ps(planes[p].z);
+            planeW[p] = _mm_set1_ps(planes[p].w);
+        }
+
+        for (; i + 4 <= count; i += 4) {
+            // four (x, y, z, radius) rows into x, y, z and radius lanes
+            __m128 x = _mm_loadu_ps(&spheres[i].x);
+            __m128 y = _mm_loadu_ps(&spheres[i + 1].x);
+            __m128 z = _mm_loadu_ps(&spheres[i + 2].x);
+            __m128 radius = _mm_loadu_ps(&spheres[i + 3].x);
+            _MM_TRANSPOSE4_PS(x, y, z, radius);
+            __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), radius);
+
+            __m128 outside = _mm_setzero_ps();
+            for (int p = 0; p < PLANE_COUNT; p++) {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+                    _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negativeRadius));
+            }
+
+            int outsideMask = _mm_movemask_ps(outside);
+            for (int k = 0; k < 4; k++) {
+                visible[i + k] = (outsideMask >> k) & 1 ? 0 : 1;
+                visibleCount += visible[i + k];
+            }
+        }
+#endif
+
+        for (; i < count; i++) {
+            BoundingSphere sphere = { glm::vec3(spheres[i]), spheres[i].w };
+            visible[i] = Intersects(sphere) ? 1 : 0;
+            visibleCount += visible[i];
+        }
+        return visibleCount;
+    }
+}
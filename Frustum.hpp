@@ -0,0 +1,69 @@
+#ifndef Frustum_hpp
+#define Frustum_hpp
+
+#include "glm/glm.hpp"
+
+#include "Bounds.hpp"
+
+#include <cstddef>
+
+namespace gps {
+
+// The six planes of a clip volume, normals pointing inwards and normalized, so plane . (p, 1) is the signed
+// distance of p to it
+class Frustum
+{
+public:
+    enum Plane {
+        PLANE_LEFT,
+        PLANE_RIGHT,
+        PLANE_BOTTOM,
+        PLANE_TOP,
+        PLANE_NEAR,
+        PLANE_FAR,
+        PLANE_COUNT
+    };
+
+    static const unsigned ALL_PLANES = (1u << PLANE_COUNT) - 1;
+
+    enum Containment {
+        OUTSIDE,
+        INTERSECTING,
+        INSIDE
+    };
+
+    // Holds everything
+    Frustum();
+    // Planes in the space clipFromSpace takes to clip space - e.g. world space for projection * view
+    explicit Frustum(const glm::mat4& clipFromSpace);
+
+    const glm::vec4& getPlane(Plane plane) const;
+
+    // Where the side planes of a perspective frustum meet - the camera position in the space of the planes
+    // False for an orthographic one, whose side planes are parallel
+    bool getApex(glm::vec3& apex) const;
+
+    // The same planes in the space of the model - bounds in model space can be tested as they are
+    Frustum InModelSpace(const glm::mat4& model) const;
+
+    // Conservative - bounds straddling a corner outside may pass
+    bool Intersects(const BoundingSphere& sphere) const;
+    bool Intersects(const BoundingBox& box) const;
+
+    // Tests the box against the planes in planeMask only, and clears the planes it lies wholly inside of -
+    // passing the mask down a hierarchy skips the planes a parent is already inside of, and everything below a parent inside all of them
+    Containment Classify(const BoundingBox& box, unsigned& planeMask) const;
+
+    // Tests spheres packed as (center, radius), four at a time with SSE where available
+    // visible[i] becomes 1 for the spheres intersecting the frustum and 0 for the others - returns the count of the former
+    size_t CullSpheres(const glm::vec4* spheres, size_t count, unsigned char* visible) const;
+
+private:
+    glm::vec4 planes[PLANE_COUNT];
+
+    void Normalize();
+};
+
+}
+
+#endif /* Frustum_hpp */
@@ -0,0 +1,104 @@
+#ifndef GLHandle_hpp
+#define GLHandle_hpp
+
+#include <GL/glew.h>
+
+namespace gps {
+
+// Move-only owner of one GL object name - the object is deleted with the handle, or when another one is assigned.
+// Traits::Delete frees a name, Traits::Create (where the object needs no parameters) makes a new one.
+template <typename Traits>
+class GLHandle
+{
+public:
+    GLHandle() : name(0) {}
+    explicit GLHandle(GLuint name) : name(name) {}
+    ~GLHandle() { reset(); }
+
+    GLHandle(GLHandle&& other) noexcept : name(other.release()) {}
+    GLHandle& operator=(GLHandle&& other) noexcept {
+        if (this != &other) {
+            reset(other.release());
+        }
+        return *this;
+    }
+
+    GLHandle(const GLHandle&) = delete;
+    GLHandle& operator=(const GLHandle&) = delete;
+
+    static GLHandle Create() {
+        return GLHandle(Traits::Create());
+    }
+
+    GLuint get() const {
+        return name;
+    }
+
+    explicit operator bool() const {
+        return name != 0;
+    }
+
+    // Gives up ownership without deleting the object
+    GLuint release() {
+        GLuint released = name;
+        name = 0;
+        return released;
+    }
+
+    void reset(GLuint newName = 0) {
+        if (name != 0) {
+            Traits::Delete(name);
+        }
+        name = newName;
+    }
+
+private:
+    GLuint name;
+};
+
+struct GLBufferTraits {
+    static GLuint Create() { GLuint name; glGenBuffers(1, &name); return name; }
+    static void Delete(GLuint name) { glDeleteBuffers(1, &name); }
+};
+
+struct GLVertexArrayTraits {
+    static GLuint Create() { GLuint name; glGenVertexArrays(1, &name); return name; }
+    static void Delete(GLuint name) { glDeleteVertexArrays(1, &name); }
+};
+
+struct GLTextureTraits {
+    static GLuint Create() { GLuint name; glGenTextures(1, &name); return name; }
+    static void Delete(GLuint name) { glDeleteTextures(1, &name); }
+};
+
+struct GLFramebufferTraits {
+    static GLuint Create() { GLuint name; glGenFramebuffers(1, &name); return name; }
+    static void Delete(GLuint name) { glDeleteFramebuffers(1, &name); }
+};
+
+struct GLProgramTraits {
+    static GLuint Create() { return glCreateProgram(); }
+    static void Delete(GLuint name) { glDeleteProgram(name); }
+};
+
+struct GLQueryTraits {
+    static GLuint Create() { GLuint name; glGenQueries(1, &name); return name; }
+    static void Delete(GLuint name) { glDeleteQueries(1, &name); }
+};
+
+// Created with glCreateShader(type), so there is no Create
+struct GLShaderTraits {
+    static void Delete(GLuint name) { glDeleteShader(name); }
+};
+
+typedef GLHandle<GLBufferTraits> GLBuffer;
+typedef GLHandle<GLVertexArrayTraits> GLVertexArray;
+typedef GLHandle<GLTextureTraits> GLTexture;
+typedef GLHandle<GLFramebufferTraits> GLFramebuffer;
+typedef GLHandle<GLProgramTraits> GLProgram;
+typedef GLHandle<GLQueryTraits> GLQuery;
+typedef GLHandle<GLShaderTraits> GLShaderObject;
+
+}
+
+#endif /* GLHandle_hpp */
@@ -1,70 +1,263 @@
 #include "Mesh.hpp"
+
+#include "RenderQueue.hpp"
+
+#include <algorithm>
+#include <utility>
+
 namespace gps {
 
 	/* Mesh Constructor */
-	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures)
+	Mesh::Mesh(std::vector<Vertex>&& vertices, std::vector<GLuint>&& indices, std::vector<Texture> textures,
+		VertexFormat format, bool retainData)
+		: vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures))
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
+		this->uploadMesh(this->vertices.data(), static_cast<GLuint>(this->vertices.size()),
+			this->indices.data(), static_cast<GLuint>(this->indices.size()), format);
+
+		if (!retainData) {
+			std::vector<Vertex>().swap(this->vertices);
+			std::vector<GLuint>().swap(this->indices);
+		}
+	}
+
+	Mesh::Mesh(const Vertex* vertices, GLuint vertexCount, const GLuint* indices, GLuint indexCount, std::vector<Texture> textures,
+		VertexFormat format, bool retainData)
+		: textures(std::move(textures))
+	{
+		this->uploadMesh(vertices, vertexCount, indices, indexCount, format);
+
+		if (retainData) {
+			this->vertices.assign(vertices, vertices + vertexCount);
+			this->indices.assign(indices, indices + indexCount);
+		}
+	}
+
+	Buffers Mesh::getBuffers() const {
+		Buffers buffers = { this->vertexArray.get(), this->vertexBuffer.get(), this->indexBuffer.get() };
+		return buffers;
+	}
+
+	VertexFormat Mesh::getVertexFormat() const {
+		return this->format;
+	}
+
+	size_t Mesh::getVertexBytes() const {
+		return this->vertexBytes;
+	}
+
+	GLuint Mesh::getVertexCount() const {
+		return this->vertexCount;
+	}
+
+	GLenum Mesh::getIndexType() const {
+		return this->indexType;
+	}
+
+	size_t Mesh::getIndexBytes() const {
+		return this->indexBytes;
+	}
+
+	GLsizei Mesh::getIndexCount() const {
+		return this->indexCount;
+	}
+
+	const std::vector<MeshRange>& Mesh::getRanges() const {
+		return this->ranges;
+	}
+
+	void Mesh::setRanges(const std::vector<MeshRange>& ranges) {
+		this->ranges = ranges;
+
+		this->fullDetailIndexCount = 0;
+		for (size_t r = 0; r < ranges.size(); r++) {
+			this->fullDetailIndexCount = std::max(this->fullDetailIndexCount,
+				static_cast<GLsizei>(ranges[r].firstIndex) + ranges[r].indexCount);
+		}
+
+		if (!ranges.empty()) {
+			this->bounds = ranges[0].bounds;
+		}
+		for (size_t r = 1; r < ranges.size(); r++) {
+			this->bounds.min = glm::min(this->bounds.min, ranges[r].bounds.min);
+			this->bounds.max = glm::max(this->bounds.max, ranges[r].bounds.max);
+		}
+
+		this->rangeSpheres.resize(ranges.size());
+		this->clusterCount = 0;
+		for (size_t r = 0; r < ranges.size(); r++) {
+			this->rangeSpheres[r] = glm::vec4(ranges[r].sphere.center, ranges[r].sphere.radius);
+			this->clusterCount += ranges[r].clusters.size();
+		}
+	}
 
-		this->setupMesh();
+	const BoundingBox& Mesh::getBounds() const {
+		return this->bounds;
 	}
 
-	Buffers Mesh::getBuffers() {
-	    return this->buffers;
+	const BoundingSphere& Mesh::getBoundingSphere() const {
+		return this->sphere;
+	}
+
+	const std::vector<glm::vec4>& Mesh::getRangeSpheres() const {
+		return this->rangeSpheres;
+	}
+
+	size_t Mesh::getClusterCount() const {
+		return this->clusterCount;
 	}
 
 	/* Mesh drawing function - also applies associated textures */
-	void Mesh::Draw(gps::Shader shader)
+	void Mesh::Draw(gps::Shader& shader)
+	{
+		const GLvoid* offset = 0;
+		submit(shader, &this->fullDetailIndexCount, &offset, 1, 1.0f);
+	}
+
+	// Draws only the given ranges, in ascending order - adjacent ranges are merged into one draw
+	void Mesh::DrawRanges(gps::Shader& shader, const std::vector<size_t>& rangeIndices, int lod, float fade)
 	{
-		shader.useShaderProgram();
-
-		//set textures
-		for (GLuint i = 0; i < textures.size(); i++)
-		{
-			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+		std::vector<IndexSpan> spans(rangeIndices.size());
+		for (size_t i = 0; i < rangeIndices.size(); i++) {
+			const MeshRange& range = this->ranges[rangeIndices[i]];
+			spans[i].firstIndex = range.firstIndex;
+			spans[i].indexCount = range.indexCount;
+			if (lod > 0 && !range.lods.empty()) {
+				const MeshLod& level = range.lods[std::min(static_cast<size_t>(lod), range.lods.size()) - 1];
+				spans[i].firstIndex = level.firstIndex;
+				spans[i].indexCount = level.indexCount;
+			}
 		}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		DrawSpans(shader, spans, fade);
+	}
+
+	// Draws the given spans of the index buffer, in ascending order - adjacent spans are merged
+	void Mesh::DrawSpans(gps::Shader& shader, const std::vector<IndexSpan>& spans, float fade)
+	{
+		if (spans.empty()) {
+			return;
+		}
+
+		size_t indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		std::vector<GLsizei> counts;
+		std::vector<const GLvoid*> offsets;
+		GLuint end = 0;
+
+		for (size_t i = 0; i < spans.size(); i++) {
+			if (!counts.empty() && spans[i].firstIndex == end) {
+				counts.back() += spans[i].indexCount;
+			}
+			else {
+				counts.push_back(spans[i].indexCount);
+				offsets.push_back((const GLvoid*)(spans[i].firstIndex * indexSize));
+			}
+			end = spans[i].firstIndex + static_cast<GLuint>(spans[i].indexCount);
+		}
 
-        for(GLuint i = 0; i < this->textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i);
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
+		submit(shader, counts.data(), offsets.data(), counts.size(), fade);
+	}
+
+	// Queues the draw with the textures of the mesh on their units and the dequantization of its vertices
+	void Mesh::submit(gps::Shader& shader, const GLsizei* counts, const GLvoid* const* offsets, size_t rangeCount, float fade)
+	{
+		RenderQueue::DrawCommand command;
+		command.textures[RenderQueue::DIFFUSE_TEXTURE_UNIT] = 0;
+		command.textures[RenderQueue::SPECULAR_TEXTURE_UNIT] = 0;
+		for (size_t i = 0; i < textures.size(); i++) {
+			if (textures[i].type == "diffuseTexture")
+				command.textures[RenderQueue::DIFFUSE_TEXTURE_UNIT] = textures[i].id;
+			else if (textures[i].type == "specularTexture")
+				command.textures[RenderQueue::SPECULAR_TEXTURE_UNIT] = textures[i].id;
+		}
+
+		// meshes without a specular map skip its sample, ranges drawn whole skip the dither discard
+		bool specularMap = command.textures[RenderQueue::SPECULAR_TEXTURE_UNIT] != 0;
+		bool fading = fade > -1.0f && fade < 1.0f && fade != 0.0f;
+		command.program = shader.getProgram((specularMap ? 0 : SHADER_TEXTURED_SPECULAR) | (fading ? 0 : SHADER_LOD_FADE));
+		command.vertexArray = this->vertexArray.get();
+		command.indexType = this->indexType;
+		// the vertex shader dequantizes packed positions and decodes packed normals
+		command.positionOffset = this->positionOffset;
+		command.positionScale = this->positionScale;
+		command.packedNormals = this->format == VERTEX_FORMAT_PACKED;
+		command.lodFade = fade;
+		command.center = (this->bounds.min + this->bounds.max) * 0.5f;
+
+		RenderQueue::getInstance().Submit(command, counts, offsets, rangeCount);
+	}
+
+	// Converts the vertices to the requested format and uploads them
+	void Mesh::uploadMesh(const Vertex* vertices, GLuint vertexCount, const GLuint* indices, GLuint indexCount, VertexFormat requestedFormat) {
+		MeshRange whole;
+		whole.firstIndex = 0;
+		whole.indexCount = static_cast<GLsizei>(indexCount);
+		whole.bounds.min = vertexCount > 0 ? vertices[0].Position : glm::vec3(0.0f);
+		whole.bounds.max = whole.bounds.min;
+		for (GLuint v = 1; v < vertexCount; v++) {
+			whole.bounds.min = glm::min(whole.bounds.min, vertices[v].Position);
+			whole.bounds.max = glm::max(whole.bounds.max, vertices[v].Position);
+		}
+		whole.sphere = ComputeBoundingSphere(vertices, vertexCount);
+		this->ranges.assign(1, whole);
+		this->fullDetailIndexCount = whole.indexCount;
+		this->bounds = whole.bounds;
+		this->sphere = whole.sphere;
+		this->rangeSpheres.assign(1, glm::vec4(whole.sphere.center, whole.sphere.radius));
+		this->clusterCount = 0;
 
-    }
+		if (requestedFormat == VERTEX_FORMAT_PACKED && VertexPacker::CanPack(vertices, vertexCount)) {
+			std::vector<PackedVertex> packed;
+			VertexPacker::Pack(vertices, vertexCount, packed, this->positionOffset, this->positionScale);
+
+			this->format = VERTEX_FORMAT_PACKED;
+			this->setupMesh(packed.data(), vertexCount, indices, indexCount);
+			return;
+		}
+
+		this->format = VERTEX_FORMAT_FLOAT;
+		this->positionOffset = glm::vec3(0.0f);
+		this->positionScale = glm::vec3(1.0f);
+		this->setupMesh(vertices, vertexCount, indices, indexCount);
+	}
 
 	// Initializes all the buffer objects/arrays
-	void Mesh::setupMesh(){
+	template <typename VertexType>
+	void Mesh::setupMesh(const VertexType* vertices, GLuint vertexCount, const GLuint* indices, GLuint indexCount){
+		this->indexCount = static_cast<GLsizei>(indexCount);
+		this->vertexCount = vertexCount;
+		this->vertexBytes = vertexCount * sizeof(VertexType);
+
 		// Create buffers/arrays
-		glGenVertexArrays(1, &this->buffers.VAO);
-		glGenBuffers(1, &this->buffers.VBO);
-		glGenBuffers(1, &this->buffers.EBO);
+		this->vertexArray = GLVertexArray::Create();
+		this->vertexBuffer = GLBuffer::Create();
+		this->indexBuffer = GLBuffer::Create();
 
-		glBindVertexArray(this->buffers.VAO);
+		glBindVertexArray(this->vertexArray.get());
 		// Load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, this->vertexBuffer.get());
+		glBufferData(GL_ARRAY_BUFFER, this->vertexBytes, vertices, GL_STATIC_DRAW);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indexBuffer.get());
+		if (vertexCount <= MAX_SHORT_INDEX_VERTICES) {
+			std::vector<GLushort> shortIndices(indices, indices + indexCount);
+			this->indexType = GL_UNSIGNED_SHORT;
+			this->indexBytes = indexCount * sizeof(GLushort);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indexBytes, shortIndices.data(), GL_STATIC_DRAW);
+		}
+		else {
+			this->indexType = GL_UNSIGNED_INT;
+			this->indexBytes = indexCount * sizeof(GLuint);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indexBytes, indices, GL_STATIC_DRAW);
+		}
 
 		// Set the vertex attribute pointers
-		// Vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-		// Vertex Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-		// Vertex Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+		for (size_t a = 0; a < VertexLayout<VertexType>::ATTRIBUTE_COUNT; a++) {
+			const VertexAttribute& attribute = VertexLayout<VertexType>::attributes[a];
+			glEnableVertexAttribArray(attribute.location);
+			glVertexAttribPointer(attribute.location, attribute.size, attribute.type, attribute.normalized,
+				sizeof(VertexType), (GLvoid*)attribute.offset);
+		}
 
 		glBindVertexArray(0);
 	}
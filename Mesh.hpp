@@ -4,7 +4,10 @@
 #include <GL/glew.h>
 #include "glm/glm.hpp"
 
+#include "Bounds.hpp"
+#include "GLHandle.hpp"
 #include "Shader.hpp"
+#include "VertexFormat.hpp"
 
 #include <string>
 #include <vector>
@@ -12,13 +15,6 @@
 
 namespace gps {
 
-struct Vertex
-{
-    glm::vec3 Position;
-    glm::vec3 Normal;
-    glm::vec2 TexCoords;
-};
-
 struct Texture
 {
     GLuint id;
@@ -34,31 +30,177 @@ struct Material
         glm::vec3 specular;
     };
 
+// Coarser level of detail of a shape - simplified triangles over the same vertices
+struct LodData
+{
+    std::vector<GLuint> indices;
+    // distance between the simplified and the full surface, in model units
+    float error;
+};
+
+// Level of detail in a memory-mapped cache or bundle
+struct LodView
+{
+    const GLuint* indices;
+    GLuint indexCount;
+    float error;
+};
+
+// CPU-side data of one shape, before it is uploaded to the GPU
+struct MeshData
+{
+    std::vector<Vertex> vertices;
+    std::vector<GLuint> indices;
+    // only the type and path of the textures are filled in
+    std::vector<Texture> textures;
+    Material material;
+    BoundingBox bounds;
+    BoundingSphere sphere;
+    // coarser levels of detail, finest first
+    std::vector<LodData> lods;
+};
+
+// Level of detail of a range, stored behind the full detail triangles of all ranges
+struct MeshLod
+{
+    GLuint firstIndex;
+    GLsizei indexCount;
+    float error;
+};
+
+// About MeshOptimizer::CLUSTER_TRIANGLES neighbouring triangles of a range, culled on their own when it is drawn in full detail
+struct MeshCluster
+{
+    GLuint firstIndex;
+    GLsizei indexCount;
+    BoundingSphere sphere;
+    // the face normals of the triangles lie within the cone around the axis whose half angle has this sine -
+    // above 1 if they spread too wide for the cluster to ever face away as a whole
+    glm::vec3 coneAxis;
+    float coneCutoff;
+};
+
+// Contiguous triangles of a mesh - one source shape of a static batch, and the unit of culling
+struct MeshRange
+{
+    GLuint firstIndex;
+    GLsizei indexCount;
+    BoundingBox bounds;
+    BoundingSphere sphere;
+    // coarser levels of detail, finest first
+    std::vector<MeshLod> lods;
+    // splits the full detail triangles, in order - empty for ranges too small to be worth it
+    std::vector<MeshCluster> clusters;
+};
+
+// Indices drawn together - e.g. the clusters of a range left after culling
+struct IndexSpan
+{
+    GLuint firstIndex;
+    GLsizei indexCount;
+};
+
+// Names of the GL objects of a mesh - owned by the mesh
 struct Buffers {
     GLuint VAO;
     GLuint VBO;
     GLuint EBO;
 };
 
+// Owns its vertex array and buffers - move-only
 class Mesh
 {
 public:
+    // Meshes with at most this many vertices are drawn with 16-bit indices
+    static const GLuint MAX_SHORT_INDEX_VERTICES = 65536;
+
+    // CPU-side copy of the uploaded data - empty unless the mesh was created with retainData
     std::vector<Vertex> vertices;
     std::vector<GLuint> indices;
     std::vector<Texture> textures;
 
-	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
-
-	Buffers getBuffers();
-
-	void Draw(gps::Shader shader);
+	// Takes over the arrays - freed once uploaded unless retainData keeps them in vertices and indices
+	// VERTEX_FORMAT_PACKED quantizes the vertices on upload - unless the mesh is too large or its texture coordinates out of range
+	Mesh(std::vector<Vertex>&& vertices, std::vector<GLuint>&& indices, std::vector<Texture> textures,
+		VertexFormat format = VERTEX_FORMAT_FLOAT, bool retainData = false);
+
+	// Uploads the arrays directly (e.g. from a memory-mapped cache) - retainData copies them into vertices and indices
+	Mesh(const Vertex* vertices, GLuint vertexCount, const GLuint* indices, GLuint indexCount, std::vector<Texture> textures,
+		VertexFormat format = VERTEX_FORMAT_FLOAT, bool retainData = false);
+
+	Mesh(Mesh&& other) noexcept = default;
+	Mesh& operator=(Mesh&& other) noexcept = default;
+	Mesh(const Mesh&) = delete;
+	Mesh& operator=(const Mesh&) = delete;
+
+	Buffers getBuffers() const;
+
+	// Format the vertex buffer was actually uploaded in
+	VertexFormat getVertexFormat() const;
+	size_t getVertexBytes() const;
+	GLuint getVertexCount() const;
+
+	// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT - the narrowest type that fits the vertex count
+	GLenum getIndexType() const;
+	size_t getIndexBytes() const;
+	GLsizei getIndexCount() const;
+
+	// The draws are queued on the RenderQueue, with the transform set on it - they happen at its next Flush
+	void Draw(gps::Shader& shader);
+
+	// Draws only the given ranges, in ascending order - adjacent ranges are merged into one draw
+	// lod picks the level of detail of every range (clamped to the levels it has)
+	// fade dithers the ranges out while cross-fading: in (0, 1) keeps that share of the pixels, in (-1, 0) the others
+	void DrawRanges(gps::Shader& shader, const std::vector<size_t>& rangeIndices, int lod = 0, float fade = 1.0f);
+
+	// Draws the given spans of the index buffer, in ascending order, with one glMultiDrawElements - adjacent spans are merged
+	void DrawSpans(gps::Shader& shader, const std::vector<IndexSpan>& spans, float fade = 1.0f);
+
+	// A single range covering the whole mesh unless set otherwise
+	// The full detail triangles of the ranges must come first in the index buffer, their levels of detail after them
+	const std::vector<MeshRange>& getRanges() const;
+	void setRanges(const std::vector<MeshRange>& ranges);
+
+	// Union of the bounds of the ranges, in model space
+	const BoundingBox& getBounds() const;
+	// Around all the vertices, in model space
+	const BoundingSphere& getBoundingSphere() const;
+	// Spheres of the ranges packed as (center, radius) for Frustum::CullSpheres
+	const std::vector<glm::vec4>& getRangeSpheres() const;
+	// Clusters of all the ranges
+	size_t getClusterCount() const;
 
 private:
     /*  Render data  */
-    Buffers buffers;
-
-	// Initializes all the buffer objects/arrays
-	void setupMesh();
+    GLVertexArray vertexArray;
+    GLBuffer vertexBuffer;
+    GLBuffer indexBuffer;
+    GLsizei indexCount;
+    // indices drawn by Draw - the full detail triangles in front of the levels of detail
+    GLsizei fullDetailIndexCount;
+    GLenum indexType;
+    size_t indexBytes;
+    VertexFormat format;
+    GLuint vertexCount;
+    size_t vertexBytes;
+    // dequantization of packed positions - identity for float vertices
+    glm::vec3 positionOffset;
+    glm::vec3 positionScale;
+    std::vector<MeshRange> ranges;
+    BoundingBox bounds;
+    BoundingSphere sphere;
+    std::vector<glm::vec4> rangeSpheres;
+    size_t clusterCount;
+
+	// Queues a draw of the index ranges with the textures and the permutation of the mesh
+	void submit(gps::Shader& shader, const GLsizei* counts, const GLvoid* const* offsets, size_t rangeCount, float fade);
+
+	// Converts the vertices to the requested format and uploads them
+	void uploadMesh(const Vertex* vertices, GLuint vertexCount, const GLuint* indices, GLuint indexCount, VertexFormat requestedFormat);
+
+	// Initializes all the buffer objects/arrays - the attribute pointers come from VertexLayout<VertexType>
+	template <typename VertexType>
+	void setupMesh(const VertexType* vertices, GLuint vertexCount, const GLuint* indices, GLuint indexCount);
 
 };
 
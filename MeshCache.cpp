@@ -0,0 +1,332 @@
+#include "MeshCache.hpp"
+
+#include <sys/stat.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+    namespace {
+
+        const char MAGIC[4] = { 'G', 'P', 'M', 'C' };
+
+        struct FileHeader {
+            char magic[4];
+            uint32_t version;
+            uint64_t sourceSize;
+            int64_t sourceModificationTime;
+            uint64_t sourceHash;
+            uint32_t shapeCount;
+            uint32_t reserved;
+        };
+
+        struct ShapeRecord {
+            uint32_t vertexCount;
+            uint32_t indexCount;
+            uint32_t textureCount;
+            uint32_t lodCount;
+            float ambient[3];
+            float diffuse[3];
+            float specular[3];
+            float boundsMin[3];
+            float boundsMax[3];
+            float sphere[4];
+        };
+
+        struct TextureRecord {
+            uint32_t typeLength;
+            uint32_t pathLength;
+        };
+
+        struct LodRecord {
+            uint32_t indexCount;
+            float error;
+        };
+
+        // every array in the file starts on a 4 byte boundary
+        size_t Align4(size_t offset) {
+            return (offset + 3) & ~static_cast<size_t>(3);
+        }
+
+        void WritePadding(std::ofstream& out, size_t length) {
+            static const char zeros[4] = { 0, 0, 0, 0 };
+            out.write(zeros, Align4(length) - length);
+        }
+
+        // Stores the timestamp of a source that was touched but not changed - the file must not be mapped
+        void WriteModificationTime(const std::string& cacheFileName, int64_t modificationTime) {
+            std::fstream out(cacheFileName.c_str(), std::ios::binary | std::ios::in | std::ios::out);
+            out.seekp(offsetof(FileHeader, sourceModificationTime));
+            out.write(reinterpret_cast<const char*>(&modificationTime), sizeof(modificationTime));
+        }
+
+        // FNV-1a
+        uint64_t HashBytes(const unsigned char* data, size_t size) {
+            uint64_t hash = 14695981039346656037ull;
+            for (size_t i = 0; i < size; i++) {
+                hash ^= data[i];
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+    }
+
+    std::string MeshCache::getCachePath(const std::string& sourceFileName)
+    {
+        return sourceFileName + ".meshcache";
+    }
+
+    bool MeshCache::StatSource(const std::string& sourceFileName, SourceInfo& info)
+    {
+#ifdef _WIN32
+        struct _stat64 fileStat;
+        if (_stat64(sourceFileName.c_str(), &fileStat) != 0) {
+            return false;
+        }
+#else
+        struct stat fileStat;
+        if (stat(sourceFileName.c_str(), &fileStat) != 0) {
+            return false;
+        }
+#endif
+        info.size = static_cast<uint64_t>(fileStat.st_size);
+        info.modificationTime = static_cast<int64_t>(fileStat.st_mtime);
+        return true;
+    }
+
+    uint64_t MeshCache::HashSource(const std::string& sourceFileName)
+    {
+        MappedFile source;
+        if (!source.Open(sourceFileName)) {
+            return 0;
+        }
+        return HashBytes(source.getData(), source.getSize());
+    }
+
+    bool MeshCache::Open(const std::string& cacheFileName, const std::string& sourceFileName)
+    {
+        Close();
+
+        SourceInfo source;
+        if (!StatSource(sourceFileName, source)) {
+            return false;
+        }
+
+        // the header is read before mapping the file, so its timestamp can still be rewritten below
+        FileHeader header;
+        {
+            std::ifstream in(cacheFileName.c_str(), std::ios::binary);
+            if (!in || !in.read(reinterpret_cast<char*>(&header), sizeof(FileHeader))) {
+                return false;
+            }
+        }
+        if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION) {
+            std::cout << "Mesh cache " << cacheFileName << " has an old format, rebuilding" << std::endl;
+            return false;
+        }
+
+        if (header.sourceSize != source.size) {
+            return false;
+        }
+
+        // A different timestamp alone (e.g. after a checkout) does not invalidate the cache
+        if (header.sourceModificationTime != source.modificationTime) {
+            if (header.sourceHash != HashSource(sourceFileName)) {
+                return false;
+            }
+            // the next launch trusts the timestamp again instead of hashing the whole source
+            WriteModificationTime(cacheFileName, source.modificationTime);
+        }
+
+        if (!file.Open(cacheFileName) || file.getSize() < sizeof(FileHeader)) {
+            Close();
+            return false;
+        }
+
+        if (!ReadShapes(header.shapeCount, sizeof(FileHeader))) {
+            std::cerr << "Mesh cache " << cacheFileName << " is corrupt, rebuilding" << std::endl;
+            Close();
+            return false;
+        }
+
+        return true;
+    }
+
+    bool MeshCache::ReadShapes(uint32_t shapeCount, size_t offset)
+    {
+        const unsigned char* data = file.getData();
+        size_t size = file.getSize();
+
+        shapes.resize(shapeCount);
+        for (uint32_t s = 0; s < shapeCount; s++) {
+            if (offset + sizeof(ShapeRecord) > size) {
+                return false;
+            }
+            ShapeRecord record;
+            memcpy(&record, data + offset, sizeof(ShapeRecord));
+            offset += sizeof(ShapeRecord);
+
+            Shape& shape = shapes[s];
+            shape.material.ambient = glm::vec3(record.ambient[0], record.ambient[1], record.ambient[2]);
+            shape.material.diffuse = glm::vec3(record.diffuse[0], record.diffuse[1], record.diffuse[2]);
+            shape.material.specular = glm::vec3(record.specular[0], record.specular[1], record.specular[2]);
+            shape.bounds.min = glm::vec3(record.boundsMin[0], record.boundsMin[1], record.boundsMin[2]);
+            shape.bounds.max = glm::vec3(record.boundsMax[0], record.boundsMax[1], record.boundsMax[2]);
+            shape.sphere.center = glm::vec3(record.sphere[0], record.sphere[1], record.sphere[2]);
+            shape.sphere.radius = record.sphere[3];
+
+            for (uint32_t t = 0; t < record.textureCount; t++) {
+                if (offset + sizeof(TextureRecord) > size) {
+                    return false;
+                }
+                TextureRecord textureRecord;
+                memcpy(&textureRecord, data + offset, sizeof(TextureRecord));
+                offset += sizeof(TextureRecord);
+
+                size_t length = static_cast<size_t>(textureRecord.typeLength) + textureRecord.pathLength;
+                if (offset + length > size) {
+                    return false;
+                }
+                Texture texture;
+                texture.id = 0;
+                texture.type.assign(reinterpret_cast<const char*>(data + offset), textureRecord.typeLength);
+                texture.path.assign(reinterpret_cast<const char*>(data + offset) + textureRecord.typeLength, textureRecord.pathLength);
+                shape.textures.push_back(texture);
+                offset = Align4(offset + length);
+            }
+
+            size_t vertexBytes = static_cast<size_t>(record.vertexCount) * sizeof(Vertex);
+            size_t indexBytes = static_cast<size_t>(record.indexCount) * sizeof(GLuint);
+            if (offset + vertexBytes + indexBytes > size) {
+                return false;
+            }
+            shape.vertices = reinterpret_cast<const Vertex*>(data + offset);
+            shape.vertexCount = record.vertexCount;
+            offset += vertexBytes;
+            shape.indices = reinterpret_cast<const GLuint*>(data + offset);
+            shape.indexCount = record.indexCount;
+            offset += indexBytes;
+
+            for (uint32_t l = 0; l < record.lodCount; l++) {
+                if (offset + sizeof(LodRecord) > size) {
+                    return false;
+                }
+                LodRecord lodRecord;
+                memcpy(&lodRecord, data + offset, sizeof(LodRecord));
+                offset += sizeof(LodRecord);
+
+                size_t lodBytes = static_cast<size_t>(lodRecord.indexCount) * sizeof(GLuint);
+                if (offset + lodBytes > size) {
+                    return false;
+                }
+                LodView lod;
+                lod.indices = reinterpret_cast<const GLuint*>(data + offset);
+                lod.indexCount = lodRecord.indexCount;
+                lod.error = lodRecord.error;
+                shape.lods.push_back(lod);
+                offset += lodBytes;
+            }
+        }
+
+        return true;
+    }
+
+    void MeshCache::Close()
+    {
+        shapes.clear();
+        file.Close();
+    }
+
+    const std::vector<MeshCache::Shape>& MeshCache::getShapes() const
+    {
+        return shapes;
+    }
+
+    bool MeshCache::Write(const std::string& cacheFileName, const std::string& sourceFileName, const std::vector<MeshData>& shapes)
+    {
+        SourceInfo source;
+        if (!StatSource(sourceFileName, source)) {
+            return false;
+        }
+
+        // write to a temporary file first so an interrupted write never leaves a broken cache behind
+        std::string tempFileName = cacheFileName + ".tmp";
+        std::ofstream out(tempFileName.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "WARNING: could not write mesh cache " << cacheFileName << std::endl;
+            return false;
+        }
+
+        FileHeader header;
+        memset(&header, 0, sizeof(FileHeader));
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.sourceSize = source.size;
+        header.sourceModificationTime = source.modificationTime;
+        header.sourceHash = HashSource(sourceFileName);
+        header.shapeCount = static_cast<uint32_t>(shapes.size());
+        out.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+
+        for (size_t s = 0; s < shapes.size(); s++) {
+            const MeshData& shape = shapes[s];
+
+            ShapeRecord record;
+            memset(&record, 0, sizeof(ShapeRecord));
+            record.vertexCount = static_cast<uint32_t>(shape.vertices.size());
+            record.indexCount = static_cast<uint32_t>(shape.indices.size());
+            record.textureCount = static_cast<uint32_t>(shape.textures.size());
+            record.lodCount = static_cast<uint32_t>(shape.lods.size());
+            for (int i = 0; i < 3; i++) {
+                record.ambient[i] = shape.material.ambient[i];
+                record.diffuse[i] = shape.material.diffuse[i];
+                record.specular[i] = shape.material.specular[i];
+                record.boundsMin[i] = shape.bounds.min[i];
+                record.boundsMax[i] = shape.bounds.max[i];
+                record.sphere[i] = shape.sphere.center[i];
+            }
+            record.sphere[3] = shape.sphere.radius;
+            out.write(reinterpret_cast<const char*>(&record), sizeof(ShapeRecord));
+
+            for (size_t t = 0; t < shape.textures.size(); t++) {
+                TextureRecord textureRecord;
+                textureRecord.typeLength = static_cast<uint32_t>(shape.textures[t].type.size());
+                textureRecord.pathLength = static_cast<uint32_t>(shape.textures[t].path.size());
+                out.write(reinterpret_cast<const char*>(&textureRecord), sizeof(TextureRecord));
+                out.write(shape.textures[t].type.data(), textureRecord.typeLength);
+                out.write(shape.textures[t].path.data(), textureRecord.pathLength);
+                WritePadding(out, static_cast<size_t>(textureRecord.typeLength) + textureRecord.pathLength);
+            }
+
+            out.write(reinterpret_cast<const char*>(shape.vertices.data()), shape.vertices.size() * sizeof(Vertex));
+            out.write(reinterpret_cast<const char*>(shape.indices.data()), shape.indices.size() * sizeof(GLuint));
+
+            for (size_t l = 0; l < shape.lods.size(); l++) {
+                LodRecord lodRecord;
+                lodRecord.indexCount = static_cast<uint32_t>(shape.lods[l].indices.size());
+                lodRecord.error = shape.lods[l].error;
+                out.write(reinterpret_cast<const char*>(&lodRecord), sizeof(LodRecord));
+                out.write(reinterpret_cast<const char*>(shape.lods[l].indices.data()), shape.lods[l].indices.size() * sizeof(GLuint));
+            }
+        }
+
+        out.close();
+        if (!out) {
+            std::cerr << "WARNING: could not write mesh cache " << cacheFileName << std::endl;
+            std::remove(tempFileName.c_str());
+            return false;
+        }
+
+        std::remove(cacheFileName.c_str());
+        if (std::rename(tempFileName.c_str(), cacheFileName.c_str()) != 0) {
+            std::cerr << "WARNING: could not write mesh cache " << cacheFileName << std::endl;
+            std::remove(tempFileName.c_str());
+            return false;
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef MeshCache_hpp
+#define MeshCache_hpp
+
+#include "Mesh.hpp"
+#include "MappedFile.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+// Versioned binary cache of the parsed shapes of an .obj file, stored next to it.
+// The vertex and index arrays are read straight out of the memory-mapped cache file.
+class MeshCache
+{
+public:
+    // Bump whenever the file layout, gps::Vertex or the triangle order left by the parser changes
+    static const uint32_t VERSION = 4;
+
+    // View of one cached shape - the arrays point into the mapped file
+    struct Shape {
+        const Vertex* vertices;
+        GLuint vertexCount;
+        const GLuint* indices;
+        GLuint indexCount;
+        std::vector<Texture> textures;
+        Material material;
+        BoundingBox bounds;
+        BoundingSphere sphere;
+        std::vector<LodView> lods;
+    };
+
+    // Path of the cache file belonging to a source file
+    static std::string getCachePath(const std::string& sourceFileName);
+
+    // Maps the cache and checks it against the source file (size, modification time, content hash)
+    // Returns false if the cache is missing, stale or corrupt
+    bool Open(const std::string& cacheFileName, const std::string& sourceFileName);
+    void Close();
+
+    const std::vector<Shape>& getShapes() const;
+
+    // Writes the shapes of a freshly parsed source file
+    static bool Write(const std::string& cacheFileName, const std::string& sourceFileName, const std::vector<MeshData>& shapes);
+
+private:
+    MappedFile file;
+    std::vector<Shape> shapes;
+
+    struct SourceInfo {
+        uint64_t size;
+        int64_t modificationTime;
+    };
+
+    static bool StatSource(const std::string& sourceFileName, SourceInfo& info);
+    static uint64_t HashSource(const std::string& sourceFileName);
+    bool ReadShapes(uint32_t shapeCount, size_t offset);
+};
+
+}
+
+#endif /* MeshCache_hpp */
@@ -0,0 +1,544 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+
+namespace gps {
+
+    namespace {
+
+        // FIFO post-transform cache - a vertex hits while fewer than cacheSize misses happened since its own
+        class CacheSimulator {
+        public:
+            CacheSimulator(size_t vertexCount, unsigned int cacheSize)
+                : timestamps(vertexCount, 0), time(cacheSize + 1), cacheSize(cacheSize) {}
+
+            // Returns true on a miss
+            bool Access(GLuint vertex) {
+                if (time - timestamps[vertex] > cacheSize) {
+                    timestamps[vertex] = time++;
+                    return true;
+                }
+                return false;
+            }
+
+            void Reset() {
+                time += cacheSize + 1;
+            }
+
+        private:
+            std::vector<unsigned int> timestamps;
+            unsigned int time;
+            unsigned int cacheSize;
+        };
+
+        struct Cluster {
+            size_t start;
+            size_t end;
+            float sortKey;
+        };
+
+        bool OutwardFirst(const Cluster& a, const Cluster& b) {
+            return a.sortKey > b.sortKey;
+        }
+    }
+
+    MeshOptimizer::CacheStats MeshOptimizer::AnalyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount, unsigned int cacheSize)
+    {
+        CacheStats stats = { 0.0f, 0.0f };
+        if (indices.empty() || vertexCount == 0) {
+            return stats;
+        }
+
+        CacheSimulator cache(vertexCount, cacheSize);
+        size_t misses = 0;
+        for (size_t i = 0; i < indices.size(); i++) {
+            misses += cache.Access(indices[i]) ? 1 : 0;
+        }
+        stats.acmr = static_cast<float>(misses) / (indices.size() / 3);
+        stats.atvr = static_cast<float>(misses) / vertexCount;
+        return stats;
+    }
+
+    void MeshOptimizer::OptimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount, unsigned int cacheSize)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0) {
+            return;
+        }
+
+        // triangles around each vertex
+        std::vector<unsigned int> liveTriangles(vertexCount, 0);
+        for (size_t i = 0; i < indices.size(); i++) {
+            liveTriangles[indices[i]]++;
+        }
+        std::vector<size_t> adjacencyOffsets(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++) {
+            adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+        }
+        std::vector<unsigned int> adjacency(indices.size());
+        std::vector<size_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++) {
+            for (int c = 0; c < 3; c++) {
+                adjacency[fill[indices[t * 3 + c]]++] = static_cast<unsigned int>(t);
+            }
+        }
+
+        std::vector<unsigned int> cacheTime(vertexCount, 0);
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<GLuint> deadEnd;
+        std::vector<GLuint> candidates;
+        std::vector<GLuint> output;
+        output.reserve(indices.size());
+        unsigned int time = cacheSize + 1;
+        size_t cursor = 0;
+
+        long long fanning = 0;
+        while (fanning >= 0) {
+            GLuint vertex = static_cast<GLuint>(fanning);
+            candidates.clear();
+
+            for (size_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++) {
+                unsigned int triangle = adjacency[a];
+                if (emitted[triangle]) {
+                    continue;
+                }
+                for (int c = 0; c < 3; c++) {
+                    GLuint corner = indices[triangle * 3 + c];
+                    output.push_back(corner);
+                    deadEnd.push_back(corner);
+                    candidates.push_back(corner);
+                    liveTriangles[corner]--;
+                    if (time - cacheTime[corner] > cacheSize) {
+                        cacheTime[corner] = time++;
+                    }
+                }
+                emitted[triangle] = true;
+            }
+
+            // the candidate still in the cache after its remaining triangles were emitted, used longest ago
+            fanning = -1;
+            long long bestPriority = -1;
+            for (size_t i = 0; i < candidates.size(); i++) {
+                GLuint candidate = candidates[i];
+                if (liveTriangles[candidate] == 0) {
+                    continue;
+                }
+                long long priority = 0;
+                if (time - cacheTime[candidate] + 2 * liveTriangles[candidate] <= cacheSize) {
+                    priority = time - cacheTime[candidate];
+                }
+                if (priority > bestPriority) {
+                    bestPriority = priority;
+                    fanning = candidate;
+                }
+            }
+
+            // stuck - go back to a recent vertex, or on to the next one in input order
+            while (fanning < 0 && !deadEnd.empty()) {
+                GLuint recent = deadEnd.back();
+                deadEnd.pop_back();
+                if (liveTriangles[recent] > 0) {
+                    fanning = recent;
+                }
+            }
+            while (fanning < 0 && cursor < vertexCount) {
+                if (liveTriangles[cursor] > 0) {
+                    fanning = static_cast<long long>(cursor);
+                }
+                cursor++;
+            }
+        }
+
+        indices.swap(output);
+    }
+
+    void MeshOptimizer::OptimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices, float threshold, unsigned int cacheSize)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount < 2) {
+            return;
+        }
+
+        float meshAcmr = AnalyzeVertexCache(indices, vertices.size(), cacheSize).acmr;
+
+        // a cluster ends where the cache restarts anyway (all three vertices miss), or as soon as its
+        // ACMR, counted from a cold cache, is close enough to the mesh's - it can then go anywhere in the order
+        std::vector<Cluster> clusters;
+        CacheSimulator cache(vertices.size(), cacheSize);
+        size_t clusterStart = 0;
+        size_t clusterMisses = 0;
+        for (size_t t = 0; t < triangleCount; t++) {
+            int misses = 0;
+            for (int c = 0; c < 3; c++) {
+                misses += cache.Access(indices[t * 3 + c]) ? 1 : 0;
+            }
+            if (misses == 3 && t > clusterStart) {
+                Cluster cluster = { clusterStart, t, 0.0f };
+                clusters.push_back(cluster);
+                clusterStart = t;
+                clusterMisses = 0;
+            }
+            clusterMisses += misses;
+
+            float clusterAcmr = static_cast<float>(clusterMisses) / (t + 1 - clusterStart);
+            if (clusterAcmr <= meshAcmr * threshold && t + 1 < triangleCount) {
+                Cluster cluster = { clusterStart, t + 1, 0.0f };
+                clusters.push_back(cluster);
+                clusterStart = t + 1;
+                clusterMisses = 0;
+                cache.Reset();
+            }
+        }
+        if (clusterStart < triangleCount) {
+            Cluster cluster = { clusterStart, triangleCount, 0.0f };
+            clusters.push_back(cluster);
+        }
+        if (clusters.size() < 2) {
+            return;
+        }
+
+        // area-weighted centroids and normals
+        glm::vec3 meshCentroid(0.0f);
+        float meshArea = 0.0f;
+        std::vector<glm::vec3> clusterCentroids(clusters.size());
+        std::vector<glm::vec3> clusterNormals(clusters.size());
+        for (size_t c = 0; c < clusters.size(); c++) {
+            glm::vec3 centroid(0.0f);
+            glm::vec3 normal(0.0f);
+            float area = 0.0f;
+            for (size_t t = clusters[c].start; t < clusters[c].end; t++) {
+                const glm::vec3& p0 = vertices[indices[t * 3]].Position;
+                const glm::vec3& p1 = vertices[indices[t * 3 + 1]].Position;
+                const glm::vec3& p2 = vertices[indices[t * 3 + 2]].Position;
+                glm::vec3 crossProduct = glm::cross(p1 - p0, p2 - p0);
+                float triangleArea = glm::length(crossProduct);
+                centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+                normal += crossProduct;
+                area += triangleArea;
+            }
+            meshCentroid += centroid;
+            meshArea += area;
+            clusterCentroids[c] = area > 0.0f ? centroid / area : vertices[indices[clusters[c].start * 3]].Position;
+            float normalLength = glm::length(normal);
+            clusterNormals[c] = normalLength > 0.0f ? normal / normalLength : glm::vec3(0.0f);
+        }
+        if (meshArea > 0.0f) {
+            meshCentroid /= meshArea;
+        }
+
+        for (size_t c = 0; c < clusters.size(); c++) {
+            clusters[c].sortKey = glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c]);
+        }
+        std::stable_sort(clusters.begin(), clusters.end(), OutwardFirst);
+
+        std::vector<GLuint> output;
+        output.reserve(indices.size());
+        for (size_t c = 0; c < clusters.size(); c++) {
+            output.insert(output.end(), indices.begin() + clusters[c].start * 3, indices.begin() + clusters[c].end * 3);
+        }
+        indices.swap(output);
+    }
+
+    void MeshOptimizer::OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices)
+    {
+        std::vector<GLuint> remap(vertices.size(), UINT_MAX);
+        std::vector<Vertex> output;
+        output.reserve(vertices.size());
+
+        for (size_t i = 0; i < indices.size(); i++) {
+            GLuint& index = indices[i];
+            if (remap[index] == UINT_MAX) {
+                remap[index] = static_cast<GLuint>(output.size());
+                output.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+        vertices.swap(output);
+    }
+
+    void MeshOptimizer::Split(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount,
+        size_t maxVertices, std::vector<MeshData>& parts)
+    {
+        // remap[v] is the index of vertex v in the part numbered remapPart[v]
+        std::vector<GLuint> remap(vertexCount);
+        std::vector<size_t> remapPart(vertexCount, SIZE_MAX);
+
+        parts.clear();
+        parts.push_back(MeshData());
+
+        for (size_t i = 0; i + 2 < indexCount; i += 3) {
+            size_t partIndex = parts.size() - 1;
+
+            size_t newVertices = 0;
+            for (int k = 0; k < 3; k++) {
+                if (remapPart[indices[i + k]] != partIndex) {
+                    newVertices++;
+                }
+            }
+            if (parts[partIndex].vertices.size() + newVertices > maxVertices) {
+                parts.push_back(MeshData());
+                partIndex++;
+            }
+
+            MeshData& part = parts[partIndex];
+            for (int k = 0; k < 3; k++) {
+                GLuint index = indices[i + k];
+                if (remapPart[index] != partIndex) {
+                    remapPart[index] = partIndex;
+                    remap[index] = static_cast<GLuint>(part.vertices.size());
+                    part.vertices.push_back(vertices[index]);
+                }
+                part.indices.push_back(remap[index]);
+            }
+        }
+    }
+
+    void MeshOptimizer::SplitGrid(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount,
+        float cellSize, std::map<std::pair<int, int>, MeshData>& cells)
+    {
+        cells.clear();
+
+        std::map<std::pair<int, int>, std::vector<size_t> > cellTriangles;
+        for (size_t i = 0; i + 2 < indexCount; i += 3) {
+            glm::vec3 centroid = (vertices[indices[i]].Position + vertices[indices[i + 1]].Position + vertices[indices[i + 2]].Position) / 3.0f;
+            std::pair<int, int> cell(static_cast<int>(std::floor(centroid.x / cellSize)), static_cast<int>(std::floor(centroid.z / cellSize)));
+            cellTriangles[cell].push_back(i);
+        }
+
+        // remap[v] is the index of vertex v in the cell numbered remapCell[v]
+        std::vector<GLuint> remap(vertexCount);
+        std::vector<size_t> remapCell(vertexCount, SIZE_MAX);
+        size_t cellIndex = 0;
+
+        for (std::map<std::pair<int, int>, std::vector<size_t> >::const_iterator it = cellTriangles.begin(); it != cellTriangles.end(); ++it, cellIndex++) {
+            MeshData& part = cells[it->first];
+            for (size_t t = 0; t < it->second.size(); t++) {
+                for (int k = 0; k < 3; k++) {
+                    GLuint index = indices[it->second[t] + k];
+                    if (remapCell[index] != cellIndex) {
+                        remapCell[index] = cellIndex;
+                        remap[index] = static_cast<GLuint>(part.vertices.size());
+                        part.vertices.push_back(vertices[index]);
+                    }
+                    part.indices.push_back(remap[index]);
+                }
+            }
+
+            part.bounds.min = part.vertices[0].Position;
+            part.bounds.max = part.vertices[0].Position;
+            for (size_t v = 1; v < part.vertices.size(); v++) {
+                part.bounds.min = glm::min(part.bounds.min, part.vertices[v].Position);
+                part.bounds.max = glm::max(part.bounds.max, part.vertices[v].Position);
+            }
+            part.sphere = ComputeBoundingSphere(part.vertices.data(), part.vertices.size());
+        }
+    }
+
+    void MeshOptimizer::OptimizeClusters(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount <= CLUSTER_TRIANGLES) {
+            return;
+        }
+
+        // triangles around each vertex
+        size_t vertexCount = vertices.size();
+        std::vector<size_t> adjacencyOffsets(vertexCount + 1, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++) {
+            adjacencyOffsets[indices[i] + 1]++;
+        }
+        for (size_t v = 0; v < vertexCount; v++) {
+            adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+        }
+        std::vector<unsigned int> adjacency(triangleCount * 3);
+        std::vector<size_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++) {
+            for (int c = 0; c < 3; c++) {
+                adjacency[fill[indices[t * 3 + c]]++] = static_cast<unsigned int>(t);
+            }
+        }
+
+        // distances are measured in average edges, so the score does not depend on the scale of the mesh
+        std::vector<glm::vec3> centroids(triangleCount);
+        std::vector<glm::vec3> normals(triangleCount);
+        float edgeSum = 0.0f;
+        for (size_t t = 0; t < triangleCount; t++) {
+            const glm::vec3& a = vertices[indices[t * 3]].Position;
+            const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3& c = vertices[indices[t * 3 + 2]].Position;
+            centroids[t] = (a + b + c) / 3.0f;
+            glm::vec3 normal = glm::cross(b - a, c - a);
+            float length = glm::length(normal);
+            normals[t] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+            edgeSum += glm::length(b - a) + glm::length(c - b) + glm::length(a - c);
+        }
+        float edgeLength = std::max(edgeSum / (triangleCount * 3), 1e-6f);
+
+        std::vector<bool> assigned(triangleCount, false);
+        // cluster each triangle was last put on the frontier of
+        std::vector<size_t> frontierOf(triangleCount, SIZE_MAX);
+        std::vector<unsigned int> cluster;
+        std::vector<unsigned int> frontier;
+        std::vector<GLuint> localIndex(vertexCount, UINT_MAX);
+        std::vector<GLuint> clusterVertices;
+        std::vector<GLuint> clusterIndices;
+        std::vector<GLuint> output;
+        output.reserve(triangleCount * 3);
+        size_t cursor = 0;
+        size_t clusterIndex = 0;
+
+        while (output.size() < triangleCount * 3) {
+            cluster.clear();
+            frontier.clear();
+            glm::vec3 centroidSum(0.0f);
+            glm::vec3 normalSum(0.0f);
+
+            while (cluster.size() < CLUSTER_TRIANGLES && output.size() + cluster.size() * 3 < triangleCount * 3) {
+                // the neighbour nearest the cluster that widens its normal cone the least - or the next triangle left
+                // in input order once the cluster has no neighbours left
+                long long best = -1;
+                if (!cluster.empty()) {
+                    glm::vec3 center = centroidSum / static_cast<float>(cluster.size());
+                    float normalLength = glm::length(normalSum);
+                    glm::vec3 axis = normalLength > 0.0f ? normalSum / normalLength : glm::vec3(0.0f);
+                    float radius = edgeLength * std::sqrt(static_cast<float>(cluster.size()));
+                    float bestScore = 0.0f;
+                    for (size_t i = 0; i < frontier.size(); ) {
+                        unsigned int triangle = frontier[i];
+                        if (assigned[triangle]) {
+                            frontier[i] = frontier.back();
+                            frontier.pop_back();
+                            continue;
+                        }
+                        float score = glm::length(centroids[triangle] - center) / radius
+                            + (1.0f - glm::dot(normals[triangle], axis));
+                        if (best < 0 || score < bestScore) {
+                            best = triangle;
+                            bestScore = score;
+                        }
+                        i++;
+                    }
+                }
+                if (best < 0) {
+                    while (assigned[cursor]) {
+                        cursor++;
+                    }
+                    best = static_cast<long long>(cursor);
+                }
+
+                unsigned int triangle = static_cast<unsigned int>(best);
+                assigned[triangle] = true;
+                cluster.push_back(triangle);
+                centroidSum += centroids[triangle];
+                normalSum += normals[triangle];
+                for (int c = 0; c < 3; c++) {
+                    GLuint vertex = indices[triangle * 3 + c];
+                    for (size_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++) {
+                        unsigned int neighbour = adjacency[a];
+                        if (!assigned[neighbour] && frontierOf[neighbour] != clusterIndex) {
+                            frontierOf[neighbour] = clusterIndex;
+                            frontier.push_back(neighbour);
+                        }
+                    }
+                }
+            }
+
+            // the triangles of a cluster are drawn together, so the cache order is made again inside each one -
+            // over its own vertices, numbered locally
+            std::sort(cluster.begin(), cluster.end());
+            clusterVertices.clear();
+            clusterIndices.clear();
+            for (size_t i = 0; i < cluster.size(); i++) {
+                for (int c = 0; c < 3; c++) {
+                    GLuint vertex = indices[cluster[i] * 3 + c];
+                    if (localIndex[vertex] == UINT_MAX) {
+                        localIndex[vertex] = static_cast<GLuint>(clusterVertices.size());
+                        clusterVertices.push_back(vertex);
+                    }
+                    clusterIndices.push_back(localIndex[vertex]);
+                }
+            }
+            OptimizeVertexCache(clusterIndices, clusterVertices.size());
+            for (size_t i = 0; i < clusterIndices.size(); i++) {
+                output.push_back(clusterVertices[clusterIndices[i]]);
+            }
+            for (size_t v = 0; v < clusterVertices.size(); v++) {
+                localIndex[clusterVertices[v]] = UINT_MAX;
+            }
+            clusterIndex++;
+        }
+
+        indices.swap(output);
+    }
+
+    void MeshOptimizer::ComputeClusters(const Vertex* vertices, const GLuint* indices, size_t indexCount, GLuint firstIndex,
+        std::vector<MeshCluster>& clusters)
+    {
+        clusters.clear();
+        size_t triangleCount = indexCount / 3;
+        if (triangleCount <= CLUSTER_TRIANGLES) {
+            return;
+        }
+
+        std::vector<Vertex> corners;
+        std::vector<glm::vec3> normals;
+        for (size_t first = 0; first < triangleCount; first += CLUSTER_TRIANGLES) {
+            size_t last = std::min(first + CLUSTER_TRIANGLES, triangleCount);
+            corners.clear();
+            normals.clear();
+
+            // the cone bounds the face normals - the winding, not the vertex normals, decides what the GPU culls
+            glm::vec3 axis(0.0f);
+            for (size_t t = first; t < last; t++) {
+                const Vertex& a = vertices[indices[t * 3]];
+                const Vertex& b = vertices[indices[t * 3 + 1]];
+                const Vertex& c = vertices[indices[t * 3 + 2]];
+                corners.push_back(a);
+                corners.push_back(b);
+                corners.push_back(c);
+
+                // degenerate triangles cover no pixels
+                glm::vec3 normal = glm::cross(b.Position - a.Position, c.Position - a.Position);
+                float length = glm::length(normal);
+                if (length > 0.0f) {
+                    normals.push_back(normal / length);
+                    axis += normals.back();
+                }
+            }
+
+            MeshCluster cluster;
+            cluster.firstIndex = firstIndex + static_cast<GLuint>(first * 3);
+            cluster.indexCount = static_cast<GLsizei>((last - first) * 3);
+            cluster.sphere = ComputeBoundingSphere(corners.data(), corners.size());
+
+            float axisLength = glm::length(axis);
+            cluster.coneAxis = axisLength > 0.0f ? axis / axisLength : glm::vec3(0.0f, 1.0f, 0.0f);
+            float minDot = axisLength > 0.0f ? 1.0f : -1.0f;
+            for (size_t n = 0; n < normals.size(); n++) {
+                minDot = std::min(minDot, glm::dot(normals[n], cluster.coneAxis));
+            }
+            // a cone of 90 degrees or more always has some triangle facing the camera
+            cluster.coneCutoff = minDot > 0.0f ? std::sqrt(1.0f - minDot * minDot) : 2.0f;
+
+            clusters.push_back(cluster);
+        }
+    }
+
+    void MeshOptimizer::Optimize(MeshData& mesh, bool overdraw, bool clusters, CacheStats& before, CacheStats& after)
+    {
+        before = AnalyzeVertexCache(mesh.indices, mesh.vertices.size());
+        OptimizeVertexCache(mesh.indices, mesh.vertices.size());
+        if (overdraw) {
+            OptimizeOverdraw(mesh.indices, mesh.vertices);
+        }
+        if (clusters) {
+            OptimizeClusters(mesh.indices, mesh.vertices);
+        }
+        OptimizeVertexFetch(mesh.vertices, mesh.indices);
+        after = AnalyzeVertexCache(mesh.indices, mesh.vertices.size());
+    }
+
+}
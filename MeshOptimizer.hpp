@@ -0,0 +1,70 @@
+#ifndef MeshOptimizer_hpp
+#define MeshOptimizer_hpp
+
+#include "Mesh.hpp"
+
+#include <cstddef>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace gps {
+
+// Reorders the triangles and vertices of indexed triangle lists for the GPU:
+// post-transform vertex cache locality (Tipsify), view-independent overdraw, culling clusters and vertex fetch locality.
+class MeshOptimizer
+{
+public:
+    // Size of the simulated FIFO post-transform cache
+    static const unsigned int CACHE_SIZE = 16;
+
+    // Triangles in a cluster culled on its own - every run of this many triangles of a range is one
+    static const size_t CLUSTER_TRIANGLES = 128;
+
+    struct CacheStats {
+        // vertex shader invocations per triangle - 0.5 at best, 3 at worst
+        float acmr;
+        // vertex shader invocations per vertex - 1 at best
+        float atvr;
+    };
+
+    static CacheStats AnalyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount, unsigned int cacheSize = CACHE_SIZE);
+
+    // Tipsify - fans around the vertices in the cache, jumping to a recently used vertex when stuck
+    static void OptimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount, unsigned int cacheSize = CACHE_SIZE);
+
+    // Splits cache-optimized indices into clusters and draws the outward-facing clusters first
+    // threshold is how much worse than the whole mesh the ACMR of a cluster may get (1.05 = 5%)
+    static void OptimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices, float threshold = 1.05f, unsigned int cacheSize = CACHE_SIZE);
+
+    // Regroups the triangles so every CLUSTER_TRIANGLES consecutive ones are close together and face the same way - each
+    // grows from the first triangle left over the neighbours that keep it compact and its normal cone narrow.
+    // The clusters follow the order of their first triangles, so most of the overdraw order survives, and the vertex
+    // cache order is made again inside each of them
+    static void OptimizeClusters(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices);
+
+    // Bounding sphere and normal cone of every CLUSTER_TRIANGLES triangles of a range, their first indices offset by firstIndex
+    // Leaves clusters empty for ranges of a single cluster
+    static void ComputeClusters(const Vertex* vertices, const GLuint* indices, size_t indexCount, GLuint firstIndex,
+        std::vector<MeshCluster>& clusters);
+
+    // Renumbers the vertices in the order they are first used, dropping unused ones
+    static void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+
+    // Splits a mesh into parts referencing at most maxVertices vertices each - vertices shared by two parts are duplicated
+    // Only the vertices and indices of the parts are filled in, the triangles keep their order
+    static void Split(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount,
+        size_t maxVertices, std::vector<MeshData>& parts);
+
+    // Splits a mesh along a square grid on the xz plane, each triangle going to the cell of its centroid
+    // Fills in the vertices, indices and bounds of the part in each (x, z) cell, the triangles keep their order
+    static void SplitGrid(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount,
+        float cellSize, std::map<std::pair<int, int>, MeshData>& cells);
+
+    // Runs the passes above in order, the overdraw and cluster passes only if asked for - returns the cache statistics before and after
+    static void Optimize(MeshData& mesh, bool overdraw, bool clusters, CacheStats& before, CacheStats& after);
+};
+
+}
+
+#endif /* MeshOptimizer_hpp */
@@ -0,0 +1,464 @@
+#include "MeshSimplifier.hpp"
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace gps {
+
+    namespace {
+
+        const double BORDER_WEIGHT = 10.0;
+
+        uint64_t EdgeKey(GLuint from, GLuint to) {
+            return (static_cast<uint64_t>(from) << 32) | to;
+        }
+
+        struct PositionKey {
+            uint32_t bits[3];
+
+            bool operator==(const PositionKey& other) const {
+                return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+            }
+        };
+
+        struct PositionKeyHash {
+            size_t operator()(const PositionKey& key) const {
+                return (key.bits[0] * 73856093u) ^ (key.bits[1] * 19349663u) ^ (key.bits[2] * 83492791u);
+            }
+        };
+    }
+
+    const float MeshSimplifier::MAX_RELATIVE_ERROR = 0.05f;
+
+    MeshSimplifier::MeshSimplifier(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount)
+        : vertices(vertices), vertexCount(vertexCount), indices(indices, indices + indexCount), error(0.0f)
+    {
+        BuildGroups();
+        BuildQuadrics();
+    }
+
+    const std::vector<GLuint>& MeshSimplifier::getIndices() const
+    {
+        return indices;
+    }
+
+    void MeshSimplifier::BuildGroups()
+    {
+        positionGroup.resize(vertexCount);
+        nextWedge.resize(vertexCount);
+
+        std::unordered_map<PositionKey, GLuint, PositionKeyHash> groups;
+        groups.reserve(vertexCount);
+
+        for (size_t v = 0; v < vertexCount; v++) {
+            PositionKey key;
+            memcpy(key.bits, &vertices[v].Position[0], sizeof(key.bits));
+
+            std::unordered_map<PositionKey, GLuint, PositionKeyHash>::iterator group = groups.find(key);
+            if (group == groups.end()) {
+                groups[key] = static_cast<GLuint>(v);
+                positionGroup[v] = static_cast<GLuint>(v);
+                nextWedge[v] = static_cast<GLuint>(v);
+            }
+            else {
+                // insert after the first vertex of the group
+                positionGroup[v] = group->second;
+                nextWedge[v] = nextWedge[group->second];
+                nextWedge[group->second] = static_cast<GLuint>(v);
+            }
+        }
+    }
+
+    void MeshSimplifier::BuildQuadrics()
+    {
+        Quadric zero;
+        memset(&zero, 0, sizeof(Quadric));
+        quadrics.assign(vertexCount, zero);
+
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            GLuint a = positionGroup[indices[i]];
+            GLuint b = positionGroup[indices[i + 1]];
+            GLuint c = positionGroup[indices[i + 2]];
+
+            glm::vec3 p0 = vertices[a].Position;
+            glm::vec3 p1 = vertices[b].Position;
+            glm::vec3 p2 = vertices[c].Position;
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float length = glm::length(normal);
+            if (length == 0.0f) {
+                continue;
+            }
+            normal /= length;
+
+            // area weighted, so large triangles dominate the error of their corners
+            double area = 0.5 * length;
+            float distance = -glm::dot(normal, p0);
+            AddPlane(quadrics[a], normal, distance, area);
+            AddPlane(quadrics[b], normal, distance, area);
+            AddPlane(quadrics[c], normal, distance, area);
+        }
+
+        // planes perpendicular to the border edges keep the outline in place
+        BuildAdjacency();
+        ClassifyVertices();
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            for (int e = 0; e < 3; e++) {
+                GLuint from = positionGroup[indices[i + e]];
+                GLuint to = positionGroup[indices[i + (e + 1) % 3]];
+                if (!std::binary_search(borderEdges.begin(), borderEdges.end(), EdgeKey(from, to))) {
+                    continue;
+                }
+
+                GLuint opposite = positionGroup[indices[i + (e + 2) % 3]];
+                glm::vec3 edge = vertices[to].Position - vertices[from].Position;
+                glm::vec3 triangleNormal = glm::cross(edge, vertices[opposite].Position - vertices[from].Position);
+                glm::vec3 normal = glm::cross(edge, triangleNormal);
+                float length = glm::length(normal);
+                if (length == 0.0f) {
+                    continue;
+                }
+                normal /= length;
+
+                double weight = BORDER_WEIGHT * glm::dot(edge, edge);
+                float distance = -glm::dot(normal, vertices[from].Position);
+                AddPlane(quadrics[from], normal, distance, weight);
+                AddPlane(quadrics[to], normal, distance, weight);
+            }
+        }
+    }
+
+    void MeshSimplifier::BuildAdjacency()
+    {
+        triangleOffsets.assign(vertexCount + 1, 0);
+        for (size_t i = 0; i < indices.size(); i++) {
+            triangleOffsets[indices[i] + 1]++;
+        }
+        for (size_t v = 0; v < vertexCount; v++) {
+            triangleOffsets[v + 1] += triangleOffsets[v];
+        }
+
+        vertexTriangles.resize(indices.size());
+        std::vector<GLuint> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) {
+            vertexTriangles[fill[indices[i]]++] = static_cast<GLuint>(i / 3);
+        }
+    }
+
+    void MeshSimplifier::ClassifyVertices()
+    {
+        // directed edges between position groups - an edge without its reverse is on the border
+        std::vector<uint64_t> edges;
+        edges.reserve(indices.size());
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            for (int e = 0; e < 3; e++) {
+                GLuint from = positionGroup[indices[i + e]];
+                GLuint to = positionGroup[indices[i + (e + 1) % 3]];
+                if (from != to) {
+                    edges.push_back(EdgeKey(from, to));
+                }
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+
+        std::vector<unsigned char> borderCount(vertexCount, 0);
+        kinds.assign(vertexCount, KIND_MANIFOLD);
+        borderEdges.clear();
+
+        for (size_t e = 0; e < edges.size(); e++) {
+            GLuint from = static_cast<GLuint>(edges[e] >> 32);
+            GLuint to = static_cast<GLuint>(edges[e] & 0xffffffffu);
+
+            // the same directed edge twice - non-manifold, leave it alone
+            if (e + 1 < edges.size() && edges[e + 1] == edges[e]) {
+                kinds[from] = KIND_LOCKED;
+                kinds[to] = KIND_LOCKED;
+                continue;
+            }
+            if (std::binary_search(edges.begin(), edges.end(), EdgeKey(to, from))) {
+                continue;
+            }
+
+            borderEdges.push_back(edges[e]);
+            if (borderCount[from] < 255) borderCount[from]++;
+            if (borderCount[to] < 255) borderCount[to]++;
+        }
+
+        for (size_t v = 0; v < vertexCount; v++) {
+            if (kinds[v] == KIND_LOCKED || borderCount[v] == 0) {
+                continue;
+            }
+            // one border edge in, one out - anything else is a corner where several borders meet
+            kinds[v] = borderCount[v] == 2 ? KIND_BORDER : KIND_LOCKED;
+        }
+    }
+
+    bool MeshSimplifier::IsBorderEdge(GLuint from, GLuint to) const
+    {
+        return std::binary_search(borderEdges.begin(), borderEdges.end(), EdgeKey(from, to))
+            || std::binary_search(borderEdges.begin(), borderEdges.end(), EdgeKey(to, from));
+    }
+
+    bool MeshSimplifier::CanCollapse(GLuint from, GLuint to) const
+    {
+        switch (kinds[from]) {
+        case KIND_MANIFOLD:
+            return true;
+        case KIND_BORDER:
+            // slide along the border only
+            return kinds[to] != KIND_MANIFOLD && IsBorderEdge(from, to);
+        default:
+            return false;
+        }
+    }
+
+    double MeshSimplifier::CollapseCost(GLuint from, GLuint to) const
+    {
+        Quadric quadric = quadrics[from];
+        AddQuadric(quadric, quadrics[to]);
+        if (quadric.weight <= 0.0) {
+            return 0.0;
+        }
+        return std::max(0.0, Evaluate(quadric, vertices[to].Position) / quadric.weight);
+    }
+
+    bool MeshSimplifier::MapWedges(GLuint from, GLuint to, std::vector<GLuint>& collapseTargets) const
+    {
+        std::vector<GLuint> targets;
+
+        GLuint wedge = from;
+        do {
+            GLuint target = UINT32_MAX;
+            for (GLuint t = triangleOffsets[wedge]; t < triangleOffsets[wedge + 1] && target == UINT32_MAX; t++) {
+                const GLuint* triangle = &indices[vertexTriangles[t] * 3];
+                for (int k = 0; k < 3; k++) {
+                    if (positionGroup[triangle[k]] == to) {
+                        target = triangle[k];
+                        break;
+                    }
+                }
+            }
+            // a wedge without triangles is not referenced any more and can stay as it is
+            if (target == UINT32_MAX && triangleOffsets[wedge] != triangleOffsets[wedge + 1]) {
+                return false;
+            }
+            targets.push_back(target);
+            wedge = nextWedge[wedge];
+        } while (wedge != from);
+
+        size_t w = 0;
+        wedge = from;
+        do {
+            if (targets[w] != UINT32_MAX) {
+                collapseTargets[wedge] = targets[w];
+            }
+            w++;
+            wedge = nextWedge[wedge];
+        } while (wedge != from);
+
+        return true;
+    }
+
+    bool MeshSimplifier::KeepsOrientation(GLuint from, GLuint to) const
+    {
+        glm::vec3 target = vertices[to].Position;
+
+        GLuint wedge = from;
+        do {
+            for (GLuint t = triangleOffsets[wedge]; t < triangleOffsets[wedge + 1]; t++) {
+                const GLuint* triangle = &indices[vertexTriangles[t] * 3];
+                GLuint g0 = positionGroup[triangle[0]];
+                GLuint g1 = positionGroup[triangle[1]];
+                GLuint g2 = positionGroup[triangle[2]];
+                // triangles on the collapsed edge disappear
+                if (g0 == to || g1 == to || g2 == to) {
+                    continue;
+                }
+
+                glm::vec3 p0 = vertices[g0].Position;
+                glm::vec3 p1 = vertices[g1].Position;
+                glm::vec3 p2 = vertices[g2].Position;
+                glm::vec3 before = glm::cross(p1 - p0, p2 - p0);
+
+                if (g0 == from) p0 = target;
+                if (g1 == from) p1 = target;
+                if (g2 == from) p2 = target;
+                glm::vec3 after = glm::cross(p1 - p0, p2 - p0);
+
+                if (glm::dot(before, after) <= 0.0f) {
+                    return false;
+                }
+            }
+            wedge = nextWedge[wedge];
+        } while (wedge != from);
+
+        return true;
+    }
+
+    float MeshSimplifier::Simplify(size_t targetIndexCount, float maxError)
+    {
+        double maxCost = static_cast<double>(maxError) * maxError;
+
+        while (indices.size() > targetIndexCount) {
+            BuildAdjacency();
+            ClassifyVertices();
+
+            std::vector<Collapse> collapses;
+            collapses.reserve(indices.size() * 2);
+            for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+                for (int e = 0; e < 3; e++) {
+                    GLuint a = positionGroup[indices[i + e]];
+                    GLuint b = positionGroup[indices[i + (e + 1) % 3]];
+                    if (a == b) {
+                        continue;
+                    }
+                    if (CanCollapse(a, b)) {
+                        Collapse collapse = { a, b, CollapseCost(a, b) };
+                        collapses.push_back(collapse);
+                    }
+                    if (CanCollapse(b, a)) {
+                        Collapse collapse = { b, a, CollapseCost(b, a) };
+                        collapses.push_back(collapse);
+                    }
+                }
+            }
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) {
+                return x.cost < y.cost;
+            });
+
+            std::vector<GLuint> collapseTargets(vertexCount);
+            for (size_t v = 0; v < vertexCount; v++) {
+                collapseTargets[v] = static_cast<GLuint>(v);
+            }
+            // a group whose triangles changed in this pass is not touched again until the next one
+            std::vector<bool> locked(vertexCount, false);
+
+            // every collapse removes about two triangles
+            size_t collapseBudget = std::max<size_t>(1, (indices.size() - targetIndexCount) / 6);
+            size_t collapseCount = 0;
+
+            for (size_t c = 0; c < collapses.size() && collapseCount < collapseBudget; c++) {
+                const Collapse& collapse = collapses[c];
+                if (collapse.cost > maxCost) {
+                    break;
+                }
+                if (locked[collapse.from] || locked[collapse.to]) {
+                    continue;
+                }
+                if (!KeepsOrientation(collapse.from, collapse.to) || !MapWedges(collapse.from, collapse.to, collapseTargets)) {
+                    continue;
+                }
+
+                AddQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+                error = std::max(error, static_cast<float>(std::sqrt(collapse.cost)));
+                collapseCount++;
+
+                // lock the one-ring of the collapsed group
+                GLuint wedge = collapse.from;
+                do {
+                    for (GLuint t = triangleOffsets[wedge]; t < triangleOffsets[wedge + 1]; t++) {
+                        const GLuint* triangle = &indices[vertexTriangles[t] * 3];
+                        locked[positionGroup[triangle[0]]] = true;
+                        locked[positionGroup[triangle[1]]] = true;
+                        locked[positionGroup[triangle[2]]] = true;
+                    }
+                    wedge = nextWedge[wedge];
+                } while (wedge != collapse.from);
+            }
+
+            if (collapseCount == 0) {
+                break;
+            }
+
+            // apply the collapses and drop the triangles that became degenerate
+            size_t write = 0;
+            for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+                GLuint a = collapseTargets[indices[i]];
+                GLuint b = collapseTargets[indices[i + 1]];
+                GLuint c = collapseTargets[indices[i + 2]];
+                if (positionGroup[a] == positionGroup[b] || positionGroup[b] == positionGroup[c] || positionGroup[a] == positionGroup[c]) {
+                    continue;
+                }
+                indices[write++] = a;
+                indices[write++] = b;
+                indices[write++] = c;
+            }
+            indices.resize(write);
+        }
+
+        return error;
+    }
+
+    void MeshSimplifier::GenerateLods(MeshData& mesh)
+    {
+        mesh.lods.clear();
+        if (mesh.indices.size() < MIN_TRIANGLES * 3) {
+            return;
+        }
+
+        float maxError = MAX_RELATIVE_ERROR * glm::length(mesh.bounds.max - mesh.bounds.min);
+        MeshSimplifier simplifier(mesh.vertices.data(), mesh.vertices.size(), mesh.indices.data(), mesh.indices.size());
+
+        size_t previousCount = mesh.indices.size();
+        for (int level = 0; level < LOD_LEVELS; level++) {
+            size_t target = previousCount / 2 / 3 * 3;
+            float levelError = simplifier.Simplify(target, maxError);
+
+            // stop once simplification stalls - a level barely smaller than the previous one only costs memory
+            const std::vector<GLuint>& simplified = simplifier.getIndices();
+            if (simplified.empty() || simplified.size() > previousCount * 3 / 4) {
+                break;
+            }
+
+            LodData lod;
+            lod.indices = simplified;
+            lod.error = levelError;
+            MeshOptimizer::OptimizeVertexCache(lod.indices, mesh.vertices.size());
+            mesh.lods.push_back(lod);
+
+            previousCount = simplified.size();
+        }
+    }
+
+    void MeshSimplifier::AddPlane(Quadric& quadric, glm::vec3 normal, float distance, double weight)
+    {
+        double a = normal.x, b = normal.y, c = normal.z, d = distance;
+        quadric.a00 += weight * a * a;
+        quadric.a01 += weight * a * b;
+        quadric.a02 += weight * a * c;
+        quadric.a03 += weight * a * d;
+        quadric.a11 += weight * b * b;
+        quadric.a12 += weight * b * c;
+        quadric.a13 += weight * b * d;
+        quadric.a22 += weight * c * c;
+        quadric.a23 += weight * c * d;
+        quadric.a33 += weight * d * d;
+        quadric.weight += weight;
+    }
+
+    void MeshSimplifier::AddQuadric(Quadric& quadric, const Quadric& other)
+    {
+        quadric.a00 += other.a00;
+        quadric.a01 += other.a01;
+        quadric.a02 += other.a02;
+        quadric.a03 += other.a03;
+        quadric.a11 += other.a11;
+        quadric.a12 += other.a12;
+        quadric.a13 += other.a13;
+        quadric.a22 += other.a22;
+        quadric.a23 += other.a23;
+        quadric.a33 += other.a33;
+        quadric.weight += other.weight;
+    }
+
+    double MeshSimplifier::Evaluate(const Quadric& quadric, glm::vec3 position)
+    {
+        double x = position.x, y = position.y, z = position.z;
+        return quadric.a00 * x * x + 2.0 * quadric.a01 * x * y + 2.0 * quadric.a02 * x * z + 2.0 * quadric.a03 * x
+            + quadric.a11 * y * y + 2.0 * quadric.a12 * y * z + 2.0 * quadric.a13 * y
+            + quadric.a22 * z * z + 2.0 * quadric.a23 * z
+            + quadric.a33;
+    }
+}
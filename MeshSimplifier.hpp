@@ -0,0 +1,97 @@
+#ifndef MeshSimplifier_hpp
+#define MeshSimplifier_hpp
+
+#include "Mesh.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+// Edge-collapse simplification driven by quadric error metrics.
+// Vertices are only collapsed onto other vertices, so every level of detail indexes the original vertex buffer.
+// Vertices sharing a position (normal or texture seams) move together, borders only collapse along themselves.
+class MeshSimplifier
+{
+public:
+    // Levels of detail generated below the full mesh, each with half the triangles of the previous one
+    static const int LOD_LEVELS = 3;
+    // Shapes with fewer triangles are not worth simplifying
+    static const size_t MIN_TRIANGLES = 64;
+    // Largest error a level may reach, relative to the diagonal of the shape's bounds
+    static const float MAX_RELATIVE_ERROR;
+
+    MeshSimplifier(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount);
+
+    // Collapses edges until at most targetIndexCount indices are left or the next collapse would exceed maxError
+    // Can be called again with a lower target to continue from the current result - returns its error in model units
+    float Simplify(size_t targetIndexCount, float maxError);
+
+    const std::vector<GLuint>& getIndices() const;
+
+    // Fills in mesh.lods - the vertices and indices must already be in their final order
+    static void GenerateLods(MeshData& mesh);
+
+private:
+    // Symmetric 4x4 matrix summing squared distances to planes, and the total weight of the planes
+    struct Quadric {
+        double a00, a01, a02, a03;
+        double a11, a12, a13;
+        double a22, a23;
+        double a33;
+        double weight;
+    };
+
+    enum VertexKind {
+        KIND_MANIFOLD,
+        KIND_BORDER,
+        KIND_LOCKED
+    };
+
+    struct Collapse {
+        GLuint from;
+        GLuint to;
+        double cost;
+    };
+
+    const Vertex* vertices;
+    size_t vertexCount;
+    std::vector<GLuint> indices;
+    float error;
+
+    // Lowest vertex with the same position - the vertex the quadrics and topology are kept for
+    std::vector<GLuint> positionGroup;
+    // Circular list through the vertices of a position group
+    std::vector<GLuint> nextWedge;
+    std::vector<Quadric> quadrics;
+
+    // Per pass: triangles around each vertex, classification and the border edges in position groups
+    std::vector<GLuint> triangleOffsets;
+    std::vector<GLuint> vertexTriangles;
+    std::vector<unsigned char> kinds;
+    std::vector<uint64_t> borderEdges;
+
+    void BuildGroups();
+    void BuildQuadrics();
+    void BuildAdjacency();
+    void ClassifyVertices();
+
+    bool IsBorderEdge(GLuint from, GLuint to) const;
+    bool CanCollapse(GLuint from, GLuint to) const;
+    double CollapseCost(GLuint from, GLuint to) const;
+
+    // Picks for each vertex of the from group the vertex of the to group it shares a triangle with
+    // Fails if a vertex has none, which would stretch an attribute seam
+    bool MapWedges(GLuint from, GLuint to, std::vector<GLuint>& collapseTargets) const;
+    // False if moving the from group onto the to group would flip a triangle
+    bool KeepsOrientation(GLuint from, GLuint to) const;
+
+    static void AddPlane(Quadric& quadric, glm::vec3 normal, float distance, double weight);
+    static void AddQuadric(Quadric& quadric, const Quadric& other);
+    static double Evaluate(const Quadric& quadric, glm::vec3 position);
+};
+
+}
+
+#endif /* MeshSimplifier_hpp */
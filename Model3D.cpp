@@ -1,27 +1,783 @@
 #include "Model3D.hpp"
 
+#include "RenderQueue.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <unordered_map>
+#include <utility>
+
 namespace gps {
 
+	// Hashes an OBJ (vertex, normal, texcoord) index triple so equal face corners can share a vertex
+	struct IndexTripleHash {
+		size_t operator()(const tinyobj::index_t& idx) const {
+			size_t h = static_cast<size_t>(idx.vertex_index) * 73856093u;
+			h ^= static_cast<size_t>(idx.normal_index) * 19349663u;
+			h ^= static_cast<size_t>(idx.texcoord_index) * 83492791u;
+			return h;
+		}
+	};
+
+	struct IndexTripleEqual {
+		bool operator()(const tinyobj::index_t& a, const tinyobj::index_t& b) const {
+			return a.vertex_index == b.vertex_index
+				&& a.normal_index == b.normal_index
+				&& a.texcoord_index == b.texcoord_index;
+		}
+	};
+
+	// Views of the levels of detail of a freshly parsed shape
+	static std::vector<gps::LodView> getLodViews(const gps::MeshData& shape) {
+		std::vector<gps::LodView> views(shape.lods.size());
+		for (size_t l = 0; l < shape.lods.size(); l++) {
+			views[l].indices = shape.lods[l].indices.data();
+			views[l].indexCount = static_cast<GLuint>(shape.lods[l].indices.size());
+			views[l].error = shape.lods[l].error;
+		}
+		return views;
+	}
+
+	// Ranges closer than this are treated as this far away
+	const float MIN_LOD_DISTANCE = 1.0f;
+
+	// Shapes with more triangles are not kept as occluders
+	const size_t MAX_OCCLUDER_SHAPE_TRIANGLES = 2048;
+
+	// Gives the single range of a freshly uploaded mesh its clusters
+	static void setClusters(gps::Mesh& mesh, std::vector<gps::MeshCluster>& clusters) {
+		if (clusters.empty()) {
+			return;
+		}
+		std::vector<gps::MeshRange> ranges = mesh.getRanges();
+		ranges[0].clusters.swap(clusters);
+		mesh.setRanges(ranges);
+	}
+
+	// Whether every triangle of a cluster faces away from a camera at eye - or looking along forward for an orthographic one
+	// In perspective the cone is tested from the whole bounding sphere, so it holds for every point of the cluster
+	static bool facesAway(const gps::MeshCluster& cluster, bool perspective, const glm::vec3& eye, const glm::vec3& forward) {
+		if (!perspective) {
+			return glm::dot(forward, cluster.coneAxis) > cluster.coneCutoff;
+		}
+		glm::vec3 view = cluster.sphere.center - eye;
+		return glm::dot(view, cluster.coneAxis) > cluster.coneCutoff * glm::length(view) + cluster.sphere.radius;
+	}
+
+	bool Model3D::rebuildMeshCache = false;
+	bool Model3D::optimizeMeshes = true;
+	bool Model3D::optimizeOverdraw = false;
+	bool Model3D::optimizeClusters = false;
+	gps::VertexFormat Model3D::vertexFormat = gps::VERTEX_FORMAT_PACKED;
+	bool Model3D::staticBatching = true;
+	bool Model3D::generateLods = true;
+	float Model3D::lodFadeTime = 0.25f;
+	bool Model3D::retainMeshData = false;
+	size_t Model3D::occluderTriangleBudget = 16384;
+
+	Model3D::Model3D() : isStatic(false), shapeCount(0), bvhDirty(false), candidateTriangles(0) {
+	}
+
+	void Model3D::setStatic(bool isStatic) {
+		this->isStatic = isStatic;
+	}
+
 	void Model3D::LoadModel(std::string fileName)
 	{
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
-		ReadOBJ(fileName, basePath);
+		LoadModel(fileName, basePath);
 	}
 
     void Model3D::LoadModel(std::string fileName, std::string basePath)
 	{
-		ReadOBJ(fileName, basePath);
+		std::string bundleFileName = gps::AssetBundle::getBundlePath(basePath);
+		std::string cacheFileName = gps::MeshCache::getCachePath(fileName);
+
+		if (!rebuildMeshCache && ReadBundle(bundleFileName, fileName)) {
+			FlushBatches();
+			return;
+		}
+
+		if (!rebuildMeshCache && ReadCache(cacheFileName, fileName)) {
+			FlushBatches();
+			return;
+		}
+
+		std::vector<gps::MeshData> shapes;
+		ReadOBJ(fileName, basePath, shapes);
+
+		if (gps::MeshCache::Write(cacheFileName, fileName, shapes)) {
+			std::cout << "Wrote mesh cache : " << cacheFileName << std::endl;
+		}
+
+		for (size_t s = 0; s < shapes.size(); s++) {
+			AddMesh(shapes[s].vertices.data(), static_cast<GLuint>(shapes[s].vertices.size()),
+				shapes[s].indices.data(), static_cast<GLuint>(shapes[s].indices.size()), getLodViews(shapes[s]),
+				LoadTextures(shapes[s].textures), shapes[s].bounds, shapes[s].sphere);
+		}
+		FlushBatches();
 	}
 
 	// Draw each mesh from the model
-	void Model3D::Draw(gps::Shader shaderProgram)
+	void Model3D::Draw(gps::Shader& shaderProgram, const gps::Frustum* frustum, gps::OcclusionCulling occlusion)
 	{
-		for (int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw(shaderProgram);
+		if (!frustum) {
+			for (int i = 0; i < meshes.size(); i++)
+				meshes[i].Draw(shaderProgram);
+			return;
+		}
+
+		CullMeshes(*frustum);
+		for (size_t m = 0; m < meshes.size(); m++) {
+			if (!meshVisibility[m]) {
+				continue;
+			}
+			size_t visible = CullRanges(m, *frustum, occlusion);
+			if (meshes[m].getClusterCount() > 0) {
+				CullClusters(m, visibleRanges, *frustum);
+				meshes[m].DrawSpans(shaderProgram, visibleSpans);
+			}
+			else if (visible == meshes[m].getRanges().size()) {
+				meshes[m].Draw(shaderProgram);
+			}
+			else if (!visibleRanges.empty()) {
+				meshes[m].DrawRanges(shaderProgram, visibleRanges);
+			}
+		}
+	}
+
+	void Model3D::UpdateBvh()
+	{
+		if (!bvhDirty) {
+			return;
+		}
+		bvhDirty = false;
+
+		std::vector<gps::BoundingBox> itemBounds;
+		meshFirstItem.resize(meshes.size());
+		itemShapes.clear();
+		for (size_t m = 0; m < meshes.size(); m++) {
+			const std::vector<gps::MeshRange>& ranges = meshes[m].getRanges();
+			meshFirstItem[m] = itemShapes.size();
+			for (size_t r = 0; r < ranges.size(); r++) {
+				ShapeRef shape = { m, r };
+				itemShapes.push_back(shape);
+				itemBounds.push_back(ranges[r].bounds);
+			}
+		}
+
+		for (size_t i = 0; i < occlusionStates.size(); i++) {
+			gps::OcclusionQueries::getInstance().Release(occlusionStates[i]);
+		}
+		gps::OcclusionState unseen = { 0, true, 0, 0 };
+		occlusionStates.assign(itemShapes.size(), unseen);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bvh.Build(itemBounds);
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		printf("# BVH          : %zu shapes, %zu nodes, depth %zu, built in %.1f ms\n",
+			itemShapes.size(), bvh.getNodeCount(), bvh.getDepth(), milliseconds);
+	}
+
+	bool Model3D::Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, ShapeRef& shape, float& distance)
+	{
+		if (!isStatic) {
+			return false;
+		}
+		UpdateBvh();
+		uint32_t item;
+		if (!bvh.Raycast(origin, direction, maxDistance, item, distance)) {
+			return false;
+		}
+		shape = itemShapes[item];
+		return true;
+	}
+
+	void Model3D::QueryBounds(const gps::BoundingBox& box, std::vector<ShapeRef>& shapes)
+	{
+		if (!isStatic) {
+			return;
+		}
+		UpdateBvh();
+		std::vector<uint32_t> items;
+		bvh.Query(box, items);
+		for (size_t i = 0; i < items.size(); i++) {
+			shapes.push_back(itemShapes[items[i]]);
+		}
+	}
+
+	void Model3D::CullMeshes(const gps::Frustum& frustum)
+	{
+		meshVisibility.resize(meshes.size());
+
+		if (isStatic) {
+			UpdateBvh();
+			bvhItems.clear();
+			bvh.Cull(frustum, bvhItems);
+
+			// a mesh is drawn if any of its ranges is
+			itemVisibility.assign(itemShapes.size(), 0);
+			std::fill(meshVisibility.begin(), meshVisibility.end(), 0);
+			for (size_t i = 0; i < bvhItems.size(); i++) {
+				itemVisibility[bvhItems[i]] = 1;
+				meshVisibility[itemShapes[bvhItems[i]].mesh] = 1;
+			}
+			gps::RenderQueue::getInstance().CountCulling(bvhItems.size(), itemShapes.size() - bvhItems.size());
+			return;
+		}
+
+		if (meshSpheres.size() != meshes.size()) {
+			meshSpheres.resize(meshes.size());
+			for (size_t m = 0; m < meshes.size(); m++) {
+				const gps::BoundingSphere& sphere = meshes[m].getBoundingSphere();
+				meshSpheres[m] = glm::vec4(sphere.center, sphere.radius);
+			}
+		}
+
+		frustum.CullSpheres(meshSpheres.data(), meshSpheres.size(), meshVisibility.data());
+
+		// the ranges of a culled mesh go with it
+		size_t culled = 0;
+		for (size_t m = 0; m < meshes.size(); m++) {
+			if (!meshVisibility[m]) {
+				culled += meshes[m].getRanges().size();
+			}
+		}
+		gps::RenderQueue::getInstance().CountCulling(0, culled);
+	}
+
+	size_t Model3D::CullRanges(size_t mesh, const gps::Frustum& frustum, gps::OcclusionCulling occlusion)
+	{
+		const std::vector<glm::vec4>& spheres = meshes[mesh].getRangeSpheres();
+		rangeVisibility.resize(spheres.size());
+
+		size_t visible;
+		if (isStatic) {
+			// already tested by the hierarchy and counted
+			std::copy(itemVisibility.begin() + meshFirstItem[mesh], itemVisibility.begin() + meshFirstItem[mesh] + spheres.size(),
+				rangeVisibility.begin());
+			visible = static_cast<size_t>(std::count(rangeVisibility.begin(), rangeVisibility.end(), 1));
+		}
+		else if (spheres.size() == 1) {
+			// the mesh passed the same test
+			rangeVisibility[0] = 1;
+			visible = 1;
+		}
+		else {
+			visible = frustum.CullSpheres(spheres.data(), spheres.size(), rangeVisibility.data());
+		}
+
+		if (isStatic && occlusion != gps::OCCLUSION_OFF) {
+			const std::vector<gps::MeshRange>& ranges = meshes[mesh].getRanges();
+			for (size_t r = 0; r < ranges.size(); r++) {
+				if (!rangeVisibility[r]) {
+					continue;
+				}
+				bool unoccluded = occlusion == gps::OCCLUSION_QUERIES
+					? gps::OcclusionQueries::getInstance().Test(occlusionStates[meshFirstItem[mesh] + r], ranges[r].bounds)
+					: gps::DepthRasterizer::getInstance().IsVisible(ranges[r].bounds);
+				if (!unoccluded) {
+					rangeVisibility[r] = 0;
+					visible--;
+				}
+			}
+		}
+
+		visibleRanges.clear();
+		for (size_t r = 0; r < spheres.size(); r++) {
+			if (rangeVisibility[r]) {
+				visibleRanges.push_back(r);
+			}
+		}
+		if (!isStatic) {
+			gps::RenderQueue::getInstance().CountCulling(visible, spheres.size() - visible);
+		}
+		return visible;
+	}
+
+	void Model3D::CullClusters(size_t mesh, const std::vector<size_t>& rangeIndices, const gps::Frustum& frustum)
+	{
+		const std::vector<gps::MeshRange>& ranges = meshes[mesh].getRanges();
+		glm::vec3 eye(0.0f);
+		bool perspective = frustum.getApex(eye);
+		glm::vec3 forward(frustum.getPlane(gps::Frustum::PLANE_NEAR));
+
+		visibleSpans.clear();
+		size_t visible = 0;
+		size_t culled = 0;
+		for (size_t i = 0; i < rangeIndices.size(); i++) {
+			const gps::MeshRange& range = ranges[rangeIndices[i]];
+			if (range.clusters.empty()) {
+				gps::IndexSpan span = { range.firstIndex, range.indexCount };
+				visibleSpans.push_back(span);
+				continue;
+			}
+			for (size_t c = 0; c < range.clusters.size(); c++) {
+				const gps::MeshCluster& cluster = range.clusters[c];
+				if (!frustum.Intersects(cluster.sphere) || facesAway(cluster, perspective, eye, forward)) {
+					culled++;
+					continue;
+				}
+				gps::IndexSpan span = { cluster.firstIndex, cluster.indexCount };
+				visibleSpans.push_back(span);
+				visible++;
+			}
+		}
+		gps::RenderQueue::getInstance().CountClusters(visible, culled);
+	}
+
+	// Draws every shape range at the coarsest level of detail whose projected error stays below the limit
+	void Model3D::DrawLod(gps::Shader& shaderProgram, const LodParameters& parameters, const gps::Frustum* frustum,
+		gps::OcclusionCulling occlusion)
+	{
+		// the largest axis scale bounds how much the model matrix magnifies the error
+		float modelScale = std::max(glm::length(glm::vec3(parameters.model[0])),
+			std::max(glm::length(glm::vec3(parameters.model[1])), glm::length(glm::vec3(parameters.model[2]))));
+		bool fading = parameters.deltaTime > 0.0f && lodFadeTime > 0.0f;
+
+		if (lodStates.size() != meshes.size()) {
+			lodStates.resize(meshes.size());
+			for (size_t m = 0; m < meshes.size(); m++) {
+				LodState initial = { -1, 0, 1.0f };
+				lodStates[m].assign(meshes[m].getRanges().size(), initial);
+			}
+		}
+
+		std::vector<size_t> levelRanges[gps::MeshSimplifier::LOD_LEVELS + 1];
+		std::vector<size_t> fadingRange(1);
+
+		if (frustum) {
+			CullMeshes(*frustum);
+		}
+
+		for (size_t m = 0; m < meshes.size(); m++) {
+			const std::vector<gps::MeshRange>& ranges = meshes[m].getRanges();
+			for (int l = 0; l <= gps::MeshSimplifier::LOD_LEVELS; l++) {
+				levelRanges[l].clear();
+			}
+
+			// culled ranges keep their level and fade until they come back
+			if (frustum) {
+				if (!meshVisibility[m]) {
+					continue;
+				}
+				CullRanges(m, *frustum, occlusion);
+			}
+
+			for (size_t r = 0; r < ranges.size(); r++) {
+				if (frustum && !rangeVisibility[r]) {
+					continue;
+				}
+				int level = SelectLod(ranges[r], parameters, modelScale);
+
+				if (fading) {
+					LodState& state = lodStates[m][r];
+					if (state.level < 0) {
+						state.level = level;
+					}
+					else if (level != state.level) {
+						state.previousLevel = state.level;
+						state.level = level;
+						state.fade = 0.0f;
+					}
+					if (state.fade < 1.0f) {
+						// the two levels keep complementary halves of a dither pattern
+						state.fade = std::min(1.0f, state.fade + parameters.deltaTime / lodFadeTime);
+						fadingRange[0] = r;
+						meshes[m].DrawRanges(shaderProgram, fadingRange, state.level, state.fade);
+						if (state.fade < 1.0f) {
+							meshes[m].DrawRanges(shaderProgram, fadingRange, state.previousLevel, -state.fade);
+						}
+						continue;
+					}
+				}
+
+				levelRanges[level].push_back(r);
+			}
+
+			// only the full detail triangles are split into clusters
+			if (frustum && meshes[m].getClusterCount() > 0 && !levelRanges[0].empty()) {
+				CullClusters(m, levelRanges[0], *frustum);
+				meshes[m].DrawSpans(shaderProgram, visibleSpans);
+				levelRanges[0].clear();
+			}
+			for (int l = 0; l <= gps::MeshSimplifier::LOD_LEVELS; l++) {
+				if (!levelRanges[l].empty()) {
+					meshes[m].DrawRanges(shaderProgram, levelRanges[l], l);
+				}
+			}
+		}
+	}
+
+	int Model3D::SelectLod(const gps::MeshRange& range, const LodParameters& parameters, float modelScale) const
+	{
+		glm::vec3 center = glm::vec3(parameters.model * glm::vec4((range.bounds.min + range.bounds.max) * 0.5f, 1.0f));
+		float radius = 0.5f * glm::length(range.bounds.max - range.bounds.min) * modelScale;
+		float distance = std::max(glm::length(center - parameters.cameraPosition) - radius, MIN_LOD_DISTANCE);
+
+		// pixels per unit of error at the nearest point of the bounding sphere
+		float pixelsPerUnit = modelScale * parameters.projectionScale / distance;
+
+		int level = 0;
+		while (level < static_cast<int>(range.lods.size()) && range.lods[level].error * pixelsPerUnit <= parameters.pixelError) {
+			level++;
+		}
+		return std::min(level + parameters.lodBias, static_cast<int>(range.lods.size()));
+	}
+
+	size_t Model3D::getMeshBytes() const {
+
+		size_t bytes = 0;
+		for (size_t i = 0; i < meshes.size(); i++) {
+			bytes += meshes[i].getVertexBytes() + meshes[i].getIndexBytes();
+		}
+		return bytes;
+	}
+
+	// Prints the GPU memory taken by the vertex and index buffers and what the compact formats saved
+	void Model3D::PrintStats(const std::string& name) const {
+
+		size_t vertexBytes = 0;
+		size_t indexBytes = 0;
+		size_t savedVertexBytes = 0;
+		size_t savedIndexBytes = 0;
+		size_t shortIndexMeshes = 0;
+
+		for (size_t i = 0; i < meshes.size(); i++) {
+			const gps::Mesh& mesh = meshes[i];
+			vertexBytes += mesh.getVertexBytes();
+			indexBytes += mesh.getIndexBytes();
+			savedVertexBytes += mesh.getVertexCount() * sizeof(gps::Vertex) - mesh.getVertexBytes();
+			savedIndexBytes += mesh.getIndexCount() * sizeof(GLuint) - mesh.getIndexBytes();
+			if (mesh.getIndexType() == GL_UNSIGNED_SHORT) {
+				shortIndexMeshes++;
+			}
+		}
+
+		printf("Mesh data %-5s: %zu shapes in %zu meshes (%zu with 16-bit indices), %.1f MB vertices (%.1f MB saved by packing), %.1f MB indices (%.1f MB saved by 16-bit indices)\n",
+			name.c_str(), shapeCount, meshes.size(), shortIndexMeshes,
+			vertexBytes / (1024.0 * 1024.0), savedVertexBytes / (1024.0 * 1024.0),
+			indexBytes / (1024.0 * 1024.0), savedIndexBytes / (1024.0 * 1024.0));
+	}
+
+	// Uploads one shape - split into parts if that lets them use 16-bit indices for less memory overall
+	void Model3D::AddMesh(const gps::Vertex* vertices, GLuint vertexCount, const GLuint* indices, GLuint indexCount,
+		const std::vector<gps::LodView>& lods, const std::vector<gps::Texture>& textures, const gps::BoundingBox& bounds,
+		const gps::BoundingSphere& sphere) {
+
+		shapeCount++;
+		bvhDirty = true;
+
+		if (isStatic && occluderTriangleBudget > 0) {
+			AddOccluderCandidate(vertices, vertexCount, indices, indexCount, bounds);
+		}
+
+		if (isStatic && staticBatching && vertexCount <= gps::Mesh::MAX_SHORT_INDEX_VERTICES) {
+			AddToBatch(vertices, vertexCount, indices, indexCount, lods, textures, bounds, sphere);
+			return;
+		}
+
+		if (vertexCount > gps::Mesh::MAX_SHORT_INDEX_VERTICES) {
+			std::vector<gps::MeshData> parts;
+			gps::MeshOptimizer::Split(vertices, vertexCount, indices, indexCount, gps::Mesh::MAX_SHORT_INDEX_VERTICES, parts);
+
+			// the parts duplicate the vertices along their borders - worth it if the halved indices save more
+			size_t partVertexCount = 0;
+			for (size_t p = 0; p < parts.size(); p++) {
+				partVertexCount += parts[p].vertices.size();
+			}
+			size_t vertexSize = vertexFormat == gps::VERTEX_FORMAT_PACKED ? sizeof(gps::PackedVertex) : sizeof(gps::Vertex);
+			size_t duplicatedBytes = (partVertexCount - vertexCount) * vertexSize;
+			size_t savedBytes = indexCount * (sizeof(GLuint) - sizeof(GLushort));
+
+			if (duplicatedBytes < savedBytes) {
+				std::vector<gps::MeshCluster> clusters;
+				for (size_t p = 0; p < parts.size(); p++) {
+					gps::MeshOptimizer::ComputeClusters(parts[p].vertices.data(), parts[p].indices.data(), parts[p].indices.size(), 0, clusters);
+					meshes.emplace_back(std::move(parts[p].vertices), std::move(parts[p].indices), textures, vertexFormat, retainMeshData);
+					setClusters(meshes.back(), clusters);
+				}
+				return;
+			}
+		}
+
+		std::vector<gps::MeshCluster> clusters;
+		gps::MeshOptimizer::ComputeClusters(vertices, indices, indexCount, 0, clusters);
+
+		if (lods.empty()) {
+			meshes.emplace_back(vertices, vertexCount, indices, indexCount, textures, vertexFormat, retainMeshData);
+			setClusters(meshes.back(), clusters);
+			return;
+		}
+
+		// the levels of detail go behind the full detail triangles in the same index buffer
+		std::vector<gps::MeshRange> ranges(1);
+		ranges[0].firstIndex = 0;
+		ranges[0].indexCount = static_cast<GLsizei>(indexCount);
+		ranges[0].bounds = bounds;
+		ranges[0].sphere = sphere;
+		ranges[0].clusters.swap(clusters);
+
+		std::vector<GLuint> allIndices(indices, indices + indexCount);
+		for (size_t l = 0; l < lods.size(); l++) {
+			gps::MeshLod level;
+			level.firstIndex = static_cast<GLuint>(allIndices.size());
+			level.indexCount = static_cast<GLsizei>(lods[l].indexCount);
+			level.error = lods[l].error;
+			ranges[0].lods.push_back(level);
+			allIndices.insert(allIndices.end(), lods[l].indices, lods[l].indices + lods[l].indexCount);
+		}
+
+		meshes.emplace_back(vertices, vertexCount, allIndices.data(), static_cast<GLuint>(allIndices.size()), textures, vertexFormat, retainMeshData);
+		meshes.back().setRanges(ranges);
+	}
+
+	// Appends a shape to the batch of its textures - a batch is closed before it outgrows 16-bit indices
+	void Model3D::AddToBatch(const gps::Vertex* vertices, GLuint vertexCount, const GLuint* indices, GLuint indexCount,
+		const std::vector<gps::LodView>& lods, const std::vector<gps::Texture>& textures, const gps::BoundingBox& bounds,
+		const gps::BoundingSphere& sphere) {
+
+		// the shader only takes its textures from the material, so they identify the batch
+		std::string material;
+		for (size_t t = 0; t < textures.size(); t++) {
+			material += std::to_string(textures[t].id) + ":" + textures[t].type + ";";
+		}
+
+		std::map<std::string, size_t>::iterator open = openBatches.find(material);
+		size_t batchIndex;
+		if (open == openBatches.end()
+			|| pendingBatches[open->second].vertices.size() + vertexCount > gps::Mesh::MAX_SHORT_INDEX_VERTICES) {
+			batchIndex = pendingBatches.size();
+			openBatches[material] = batchIndex;
+			pendingBatches.push_back(gps::MeshData());
+			pendingBatches.back().textures = textures;
+			pendingRanges.push_back(std::vector<gps::MeshRange>());
+			pendingLodIndices.push_back(std::vector<GLuint>());
+		}
+		else {
+			batchIndex = open->second;
+		}
+
+		gps::MeshData& batch = pendingBatches[batchIndex];
+		GLuint baseVertex = static_cast<GLuint>(batch.vertices.size());
+
+		// the shapes of a model share its model matrix, so their vertices are merged as they are
+		gps::MeshRange range;
+		range.firstIndex = static_cast<GLuint>(batch.indices.size());
+		range.indexCount = static_cast<GLsizei>(indexCount);
+		range.bounds = bounds;
+		range.sphere = sphere;
+		gps::MeshOptimizer::ComputeClusters(vertices, indices, indexCount, range.firstIndex, range.clusters);
+
+		batch.vertices.insert(batch.vertices.end(), vertices, vertices + vertexCount);
+		for (GLuint i = 0; i < indexCount; i++) {
+			batch.indices.push_back(baseVertex + indices[i]);
+		}
+
+		// first indices of the levels are relative to the batch's level of detail indices until it is uploaded
+		std::vector<GLuint>& lodIndices = pendingLodIndices[batchIndex];
+		for (size_t l = 0; l < lods.size(); l++) {
+			gps::MeshLod level;
+			level.firstIndex = static_cast<GLuint>(lodIndices.size());
+			level.indexCount = static_cast<GLsizei>(lods[l].indexCount);
+			level.error = lods[l].error;
+			range.lods.push_back(level);
+			for (GLuint i = 0; i < lods[l].indexCount; i++) {
+				lodIndices.push_back(baseVertex + lods[l].indices[i]);
+			}
+		}
+
+		pendingRanges[batchIndex].push_back(range);
+	}
+
+	// Uploads the batches of a static model, each keeping the ranges of its shapes
+	void Model3D::FlushBatches() {
+
+		for (size_t b = 0; b < pendingBatches.size(); b++) {
+			gps::MeshData& batch = pendingBatches[b];
+			std::vector<gps::MeshRange>& ranges = pendingRanges[b];
+
+			GLuint lodOffset = static_cast<GLuint>(batch.indices.size());
+			for (size_t r = 0; r < ranges.size(); r++) {
+				for (size_t l = 0; l < ranges[r].lods.size(); l++) {
+					ranges[r].lods[l].firstIndex += lodOffset;
+				}
+			}
+			batch.indices.insert(batch.indices.end(), pendingLodIndices[b].begin(), pendingLodIndices[b].end());
+
+			meshes.emplace_back(std::move(batch.vertices), std::move(batch.indices), std::move(batch.textures), vertexFormat, retainMeshData);
+			meshes.back().setRanges(ranges);
+		}
+
+		if (!pendingBatches.empty()) {
+			std::cout << "# of batches   : " << shapeCount << " shapes -> " << meshes.size() << " meshes" << std::endl;
+		}
+
+		pendingBatches.clear();
+		pendingRanges.clear();
+		pendingLodIndices.clear();
+		openBatches.clear();
+
+		SelectOccluders();
+	}
+
+	void Model3D::AddOccluderCandidate(const gps::Vertex* vertices, GLuint vertexCount, const GLuint* indices, GLuint indexCount,
+		const gps::BoundingBox& bounds) {
+
+		// building hulls are large and simple - detailed shapes cost more to rasterize than they hide
+		size_t triangles = indexCount / 3;
+		glm::vec3 extent = bounds.max - bounds.min;
+		float size = extent.y * std::max(extent.x, extent.z);
+		if (triangles == 0 || triangles > MAX_OCCLUDER_SHAPE_TRIANGLES || size <= 0.0f) {
+			return;
+		}
+
+		occluderCandidates.push_back(OccluderCandidate());
+		OccluderCandidate& candidate = occluderCandidates.back();
+		candidate.size = size;
+		candidate.positions.resize(vertexCount);
+		for (GLuint v = 0; v < vertexCount; v++) {
+			candidate.positions[v] = vertices[v].Position;
+		}
+		candidate.indices.assign(indices, indices + triangles * 3);
+		candidateTriangles += triangles;
+
+		// bounds the copies kept while loading
+		if (candidateTriangles > 4 * occluderTriangleBudget) {
+			PruneOccluderCandidates();
+		}
+	}
+
+	void Model3D::PruneOccluderCandidates() {
+
+		std::sort(occluderCandidates.begin(), occluderCandidates.end(),
+			[](const OccluderCandidate& a, const OccluderCandidate& b) { return a.size > b.size; });
+
+		size_t kept = 0;
+		candidateTriangles = 0;
+		while (kept < occluderCandidates.size()
+			&& candidateTriangles + occluderCandidates[kept].indices.size() / 3 <= occluderTriangleBudget) {
+			candidateTriangles += occluderCandidates[kept].indices.size() / 3;
+			kept++;
+		}
+		occluderCandidates.resize(kept);
+	}
+
+	void Model3D::SelectOccluders() {
+
+		if (occluderCandidates.empty()) {
+			return;
+		}
+		PruneOccluderCandidates();
+
+		for (size_t c = 0; c < occluderCandidates.size(); c++) {
+			uint32_t base = static_cast<uint32_t>(occluderPositions.size());
+			const OccluderCandidate& candidate = occluderCandidates[c];
+			occluderPositions.insert(occluderPositions.end(), candidate.positions.begin(), candidate.positions.end());
+			for (size_t i = 0; i < candidate.indices.size(); i++) {
+				occluderIndices.push_back(base + candidate.indices[i]);
+			}
+		}
+
+		std::cout << "# of occluders : " << occluderCandidates.size() << " shapes, " << occluderIndices.size() / 3 << " triangles" << std::endl;
+		occluderCandidates.clear();
+		occluderCandidates.shrink_to_fit();
+		candidateTriangles = 0;
+	}
+
+	void Model3D::RasterizeOccluders(const glm::mat4& model) {
+
+		if (!occluderIndices.empty()) {
+			gps::DepthRasterizer::getInstance().AddOccluder(occluderPositions.data(), occluderPositions.size(),
+				occluderIndices.data(), occluderIndices.size(), model);
+		}
+	}
+
+	// Creates the meshes straight from a valid binary cache of the .obj file
+	bool Model3D::ReadCache(std::string cacheFileName, std::string fileName) {
+
+		gps::MeshCache cache;
+		if (!cache.Open(cacheFileName, fileName)) {
+			return false;
+		}
+
+		std::cout << "Loading : " << cacheFileName << std::endl;
+		const std::vector<gps::MeshCache::Shape>& shapes = cache.getShapes();
+		std::cout << "# of shapes    : " << shapes.size() << std::endl;
+
+		for (size_t s = 0; s < shapes.size(); s++) {
+			AddMesh(shapes[s].vertices, shapes[s].vertexCount,
+				shapes[s].indices, shapes[s].indexCount, shapes[s].lods, LoadTextures(shapes[s].textures), shapes[s].bounds, shapes[s].sphere);
+		}
+
+		return true;
+	}
+
+	// Creates the meshes and textures from the bundle baked for the model's directory
+	bool Model3D::ReadBundle(std::string bundleFileName, std::string fileName) {
+
+		if (!gps::AssetBundle::IsUpToDate(bundleFileName, fileName)) {
+			return false;
+		}
+
+		gps::AssetBundle bundle;
+		if (!bundle.Open(bundleFileName)) {
+			return false;
+		}
+
+		std::string modelName = fileName.substr(fileName.find_last_of("/\\") + 1);
+		const gps::AssetBundle::Model* model = bundle.FindModel(modelName);
+		if (!model) {
+			return false;
+		}
+
+		std::cout << "Loading : " << bundleFileName << " (" << modelName << ")" << std::endl;
+		std::cout << "# of shapes    : " << model->shapes.size() << std::endl;
+
+		return AddBundleShapes(*model, bundle);
+	}
+
+	// Creates the meshes of every model of a map tile - its textures come from the directory bundle
+	bool Model3D::LoadTile(const gps::AssetBundle& tile, const gps::AssetBundle& textureBundle) {
+
+		const std::vector<gps::AssetBundle::Model>& models = tile.getModels();
+		for (size_t m = 0; m < models.size(); m++) {
+			if (!AddBundleShapes(models[m], textureBundle)) {
+				std::cerr << "ERROR: tile " << tile.getFileName() << " does not match " << textureBundle.getFileName() << ", re-run asset_baker" << std::endl;
+				FlushBatches();
+				return false;
+			}
+		}
+		FlushBatches();
+		return true;
+	}
+
+	bool Model3D::AddBundleShapes(const gps::AssetBundle::Model& model, const gps::AssetBundle& textureBundle) {
+
+		for (size_t s = 0; s < model.shapes.size(); s++) {
+			const gps::AssetBundle::Shape& shape = model.shapes[s];
+
+			std::vector<gps::Texture> textures;
+			for (size_t t = 0; t < shape.textures.size(); t++) {
+				if (shape.textures[t].id >= textureBundle.getTextureNames().size()) {
+					return false;
+				}
+				gps::Texture texture = shape.textures[t];
+				texture.id = gps::TextureCache::getInstance().Acquire(textureBundle, shape.textures[t].id);
+				texture.path = textureBundle.getTextureNames()[shape.textures[t].id];
+				loadedTextures.push_back(texture);
+				textures.push_back(texture);
+			}
+
+			AddMesh(shape.vertices, shape.vertexCount, shape.indices, shape.indexCount, shape.lods, textures, shape.bounds, shape.sphere);
+		}
+
+		return true;
 	}
 
 	// Does the parsing of the .obj file and fills in the data structure
-	void Model3D::ReadOBJ(std::string fileName, std::string basePath){
+	void Model3D::ReadOBJ(std::string fileName, std::string basePath, std::vector<gps::MeshData>& shapeData){
 
         std::cout << "Loading : " << fileName << std::endl;
 		tinyobj::attrib_t attrib;
@@ -30,7 +786,7 @@ namespace gps {
 		int materialId;
 
 		std::string err;
-		bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
+		bool ret = gps::ObjParser::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
 
 		if (!err.empty()) { // `err` may contain warning message.
 			std::cerr << err << std::endl;
@@ -43,11 +799,24 @@ namespace gps {
 		std::cout << "# of shapes    : " << shapes.size() << std::endl;
 		std::cout << "# of materials : " << materials.size() << std::endl;
 
+		size_t cornerCount = 0;
+		size_t weldedCount = 0;
+
+		shapeData.resize(shapes.size());
+
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
-			std::vector<gps::Vertex> vertices;
-			std::vector<GLuint> indices;
-			std::vector<gps::Texture> textures;
+			std::vector<gps::Vertex>& vertices = shapeData[s].vertices;
+			std::vector<GLuint>& indices = shapeData[s].indices;
+			std::vector<gps::Texture>& textures = shapeData[s].textures;
+			gps::Material& currentMaterial = shapeData[s].material;
+			currentMaterial.ambient = glm::vec3(0.0f);
+			currentMaterial.diffuse = glm::vec3(0.0f);
+			currentMaterial.specular = glm::vec3(0.0f);
+
+			// Face corners referencing the same index triple are welded into a single vertex
+			std::unordered_map<tinyobj::index_t, GLuint, IndexTripleHash, IndexTripleEqual> weldedVertices;
+			weldedVertices.reserve(shapes[s].mesh.indices.size());
 
 			// Loop over faces(polygon)
 			size_t index_offset = 0;
@@ -62,6 +831,12 @@ namespace gps {
 					// access to vertex
 					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
 
+					std::unordered_map<tinyobj::index_t, GLuint, IndexTripleHash, IndexTripleEqual>::iterator welded = weldedVertices.find(idx);
+					if (welded != weldedVertices.end()) {
+						indices.push_back(welded->second);
+						continue;
+					}
+
 					float vx = attrib.vertices[3 * idx.vertex_index + 0];
 					float vy = attrib.vertices[3 * idx.vertex_index + 1];
 					float vz = attrib.vertices[3 * idx.vertex_index + 2];
@@ -84,21 +859,26 @@ namespace gps {
 					currentVertex.Normal = vertexNormal;
 					currentVertex.TexCoords = vertexTexCoords;
 
+					GLuint vertexIndex = static_cast<GLuint>(vertices.size());
+					weldedVertices[idx] = vertexIndex;
+
 					vertices.push_back(currentVertex);
 
-					indices.push_back(index_offset + v);
+					indices.push_back(vertexIndex);
 				}
 
 				index_offset += fv;
 			}
 
+			cornerCount += indices.size();
+			weldedCount += vertices.size();
+
 			// get material id
 			// Only try to read materials if the .mtl file is present
 			int a = shapes[s].mesh.material_ids.size();
 			if (a > 0 && materials.size()>0) {
 				materialId = shapes[s].mesh.material_ids[0];
 				if (materialId != -1) {
-					gps::Material currentMaterial;
 					currentMaterial.ambient = glm::vec3(materials[materialId].ambient[0], materials[materialId].ambient[1], materials[materialId].ambient[2]);
 					currentMaterial.diffuse = glm::vec3(materials[materialId].diffuse[0], materials[materialId].diffuse[1], materials[materialId].diffuse[2]);
 					currentMaterial.specular = glm::vec3(materials[materialId].specular[0], materials[materialId].specular[1], materials[materialId].specular[2]);
@@ -108,7 +888,9 @@ namespace gps {
 					if (!ambientTexturePath.empty())
 					{
 						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + ambientTexturePath, "ambientTexture");
+						currentTexture.id = 0;
+						currentTexture.type = "ambientTexture";
+						currentTexture.path = basePath + ambientTexturePath;
 						textures.push_back(currentTexture);
 					}
 
@@ -117,7 +899,9 @@ namespace gps {
 					if (!diffuseTexturePath.empty())
 					{
 						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + diffuseTexturePath, "diffuseTexture");
+						currentTexture.id = 0;
+						currentTexture.type = "diffuseTexture";
+						currentTexture.path = basePath + diffuseTexturePath;
 						textures.push_back(currentTexture);
 					}
 
@@ -126,29 +910,78 @@ namespace gps {
 					if (!specularTexturePath.empty())
 					{
 						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + specularTexturePath, "specularTexture");
+						currentTexture.id = 0;
+						currentTexture.type = "specularTexture";
+						currentTexture.path = basePath + specularTexturePath;
 						textures.push_back(currentTexture);
 					}
 				}
 			}
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
+			gps::BoundingBox& bounds = shapeData[s].bounds;
+			bounds.min = vertices.empty() ? glm::vec3(0.0f) : vertices[0].Position;
+			bounds.max = bounds.min;
+			for (size_t v = 1; v < vertices.size(); v++) {
+				bounds.min = glm::min(bounds.min, vertices[v].Position);
+				bounds.max = glm::max(bounds.max, vertices[v].Position);
+			}
+			shapeData[s].sphere = gps::ComputeBoundingSphere(vertices.data(), vertices.size());
 		}
-	}
 
-	// Retrieves a texture associated with the object - by its name and type
-	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
+		std::cout << "# of vertices  : " << cornerCount << " -> " << weldedCount << " after welding" << std::endl;
+
+		if (optimizeMeshes) {
+			std::vector<gps::MeshOptimizer::CacheStats> before(shapeData.size());
+			std::vector<gps::MeshOptimizer::CacheStats> after(shapeData.size());
+			gps::ThreadPool::getShared().ParallelFor(shapeData.size(), [&](size_t s) {
+				gps::MeshOptimizer::Optimize(shapeData[s], optimizeOverdraw, optimizeClusters, before[s], after[s]);
+			});
+
+			for (size_t s = 0; s < shapeData.size(); s++) {
+				printf("  %-20s : ACMR %.2f -> %.2f, ATVR %.2f -> %.2f\n", shapes[s].name.c_str(),
+					before[s].acmr, after[s].acmr, before[s].atvr, after[s].atvr);
+			}
+		}
 
-			for (int i = 0; i < loadedTextures.size(); i++) {
-				if (loadedTextures[i].path == path)
-				{
-					//already loaded texture
-					return loadedTextures[i];
+		// the levels of detail index the final vertex order, so they are made last
+		if (generateLods) {
+			gps::ThreadPool::getShared().ParallelFor(shapeData.size(), [&](size_t s) {
+				gps::MeshSimplifier::GenerateLods(shapeData[s]);
+			});
+
+			size_t triangleCounts[gps::MeshSimplifier::LOD_LEVELS + 1] = {};
+			for (size_t s = 0; s < shapeData.size(); s++) {
+				triangleCounts[0] += shapeData[s].indices.size() / 3;
+				for (int l = 0; l < gps::MeshSimplifier::LOD_LEVELS; l++) {
+					// shapes without a level draw the previous one instead
+					size_t levelIndices = l < static_cast<int>(shapeData[s].lods.size()) ? shapeData[s].lods[l].indices.size()
+						: shapeData[s].lods.empty() ? shapeData[s].indices.size() : shapeData[s].lods.back().indices.size();
+					triangleCounts[l + 1] += levelIndices / 3;
 				}
 			}
+			std::cout << "# of triangles : " << triangleCounts[0];
+			for (int l = 0; l < gps::MeshSimplifier::LOD_LEVELS; l++) {
+				std::cout << " -> " << triangleCounts[l + 1];
+			}
+			std::cout << " per level of detail" << std::endl;
+		}
+	}
+
+	// Loads the textures referenced by a shape - only their type and path need to be set
+	std::vector<gps::Texture> Model3D::LoadTextures(const std::vector<gps::Texture>& textureRefs) {
+
+		std::vector<gps::Texture> textures;
+		for (size_t i = 0; i < textureRefs.size(); i++) {
+			textures.push_back(LoadTexture(textureRefs[i].path, textureRefs[i].type));
+		}
+		return textures;
+	}
+
+	// Retrieves a texture associated with the object from the shared texture cache - by its name and type
+	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
 
 			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
+			currentTexture.id = gps::TextureCache::getInstance().Acquire(path);
 			currentTexture.type = std::string(type);
 			currentTexture.path = path;
 
@@ -157,77 +990,45 @@ namespace gps {
 			return currentTexture;
 		}
 
-	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
-		int x, y, n;
-		int force_channels = 4;
-		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
-		if (!image_data) {
-			fprintf(stderr, "ERROR: could not load %s\n", file_name);
-			return false;
-		}
-		// NPOT check
-		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
-			fprintf(
-				stderr, "WARNING: texture %s is not power-of-2 dimensions\n", file_name
-			);
-		}
-
-		int width_in_bytes = x * 4;
-		unsigned char *top = NULL;
-		unsigned char *bottom = NULL;
-		unsigned char temp = 0;
-		int half_height = y / 2;
-
-		for (int row = 0; row < half_height; row++) {
-			top = image_data + row * width_in_bytes;
-			bottom = image_data + (y - row - 1) * width_in_bytes;
-			for (int col = 0; col < width_in_bytes; col++) {
-				temp = *top;
-				*top = *bottom;
-				*bottom = temp;
-				top++;
-				bottom++;
-			}
-		}
-
-		GLuint textureID;
-		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_SRGB, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
-			0,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			image_data
-		);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glBindTexture(GL_TEXTURE_2D, 0);
-
-		return textureID;
+	// The meshes delete their own buffers
+	Model3D::~Model3D() {
+		Clear();
 	}
 
-	Model3D::~Model3D() {
+	void Model3D::Clear() {
+		for (size_t i = 0; i < occlusionStates.size(); i++) {
+			gps::OcclusionQueries::getInstance().Release(occlusionStates[i]);
+		}
         for (size_t i = 0; i < loadedTextures.size(); i++) {
-            glDeleteTextures(1, &loadedTextures.at(i).id);
+            gps::TextureCache::getInstance().Release(loadedTextures.at(i).id);
         }
+		meshes.clear();
+		loadedTextures.clear();
+		occlusionStates.clear();
+		shapeCount = 0;
 
-        for (size_t i = 0; i < meshes.size(); i++) {
-            GLuint VBO = meshes.at(i).getBuffers().VBO;
-            GLuint EBO = meshes.at(i).getBuffers().EBO;
-            GLuint VAO = meshes.at(i).getBuffers().VAO;
-            glDeleteBuffers(1, &VBO);
-            glDeleteBuffers(1, &EBO);
-            glDeleteVertexArrays(1, &VAO);
-        }
+		pendingBatches.clear();
+		pendingRanges.clear();
+		pendingLodIndices.clear();
+		openBatches.clear();
+		lodStates.clear();
+		meshSpheres.clear();
+		meshVisibility.clear();
+		rangeVisibility.clear();
+		visibleRanges.clear();
+		visibleSpans.clear();
+
+		// rebuilt over the meshes loaded next
+		bvh.Clear();
+		bvhDirty = true;
+		meshFirstItem.clear();
+		itemShapes.clear();
+		bvhItems.clear();
+		itemVisibility.clear();
+
+		occluderCandidates.clear();
+		candidateTriangles = 0;
+		occluderPositions.clear();
+		occluderIndices.clear();
 	}
 }
@@ -1,43 +1,246 @@
 #ifndef Model3D_hpp
 #define Model3D_hpp
 
+#include "Bvh.hpp"
+#include "DepthRasterizer.hpp"
+#include "Frustum.hpp"
 #include "Mesh.hpp"
+#include "MeshCache.hpp"
+#include "AssetBundle.hpp"
+#include "ObjParser.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+#include "OcclusionQueries.hpp"
+#include "TextureCache.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 
 #include <iostream>
+#include <map>
 #include <string>
 #include <vector>
 
 namespace gps {
 
+    // How the shapes of static models hidden behind others are skipped, among those in the frustum
+    enum OcclusionCulling {
+        OCCLUSION_OFF,
+        // results of the OcclusionQueries of the last frames
+        OCCLUSION_QUERIES,
+        // boxes tested against the occluders the DepthRasterizer drew this frame
+        OCCLUSION_DEPTH_RASTER
+    };
+
     class Model3D
     {
 
     public:
+        Model3D();
         ~Model3D();
 
+		// Frees the meshes and gives back the textures and queries - while the GL context is still current
+		void Clear();
+
+		// Static models merge their shapes by material into a few batches - set before LoadModel
+		void setStatic(bool isStatic);
+
 		void LoadModel(std::string fileName);
 
 		void LoadModel(std::string fileName, std::string basePath);
 
-		void Draw(gps::Shader shaderProgram);
+		// Creates the meshes of every model of a map tile bundle - its textures come from the directory bundle
+		bool LoadTile(const gps::AssetBundle& tile, const gps::AssetBundle& textureBundle);
+
+		// Meshes and ranges outside the frustum (in the model space of the model) are skipped - NULL draws everything
+		// The clusters of large ranges drawn in full detail are culled too, against the frustum and by facing away from it
+		// occlusion also skips the ranges of static models found hidden behind others - set the object transform of
+		// OcclusionQueries or DepthRasterizer first
+		void Draw(gps::Shader& shaderProgram, const gps::Frustum* frustum = NULL, gps::OcclusionCulling occlusion = gps::OCCLUSION_OFF);
+
+		// Everything needed to pick the levels of detail of a model for one pass
+		struct LodParameters {
+			glm::mat4 model;
+			glm::vec3 cameraPosition;
+			// viewport height / (2 * tan(fovy / 2)) - pixels covered by one unit at distance one
+			float projectionScale;
+			// largest projected simplification error allowed, in pixels
+			float pixelError;
+			// levels added to the chosen ones - e.g. for a shadow pass
+			int lodBias;
+			// seconds since the last frame of this pass - 0 switches levels instantly and leaves the cross-fades alone
+			float deltaTime;
+		};
+
+		// Draws every shape range at the coarsest level of detail whose projected error stays below the limit
+		void DrawLod(gps::Shader& shaderProgram, const LodParameters& parameters, const gps::Frustum* frustum = NULL,
+			gps::OcclusionCulling occlusion = gps::OCCLUSION_OFF);
+
+		// A shape range of the model
+		struct ShapeRef {
+			size_t mesh;
+			size_t range;
+		};
+
+		// Shape range whose box a ray in model space enters first, within maxDistance along the normalized direction
+		// Static models only - false if none is hit
+		bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, ShapeRef& shape, float& distance);
+
+		// Appends the shape ranges whose boxes overlap a box in model space - static models only
+		void QueryBounds(const gps::BoundingBox& box, std::vector<ShapeRef>& shapes);
+
+		// Adds the occluders picked from the shapes of a static model to the frame of the DepthRasterizer
+		void RasterizeOccluders(const glm::mat4& model);
+
+		// GPU memory taken by the vertex and index buffers
+		size_t getMeshBytes() const;
+
+		// Prints the GPU memory taken by the vertex and index buffers and what the compact formats saved
+		void PrintStats(const std::string& name) const;
+
+		// Ignore existing mesh caches and bundles and re-parse the .obj files
+		static bool rebuildMeshCache;
+
+		// Reorder the parsed meshes for the vertex cache and vertex fetch - and optionally for overdraw
+		// Only affects meshes parsed from .obj files, rebuild the caches after changing them
+		static bool optimizeMeshes;
+		static bool optimizeOverdraw;
+		// Regroup the triangles into tighter clusters, so more of them are culled - at some cost in vertex cache hits
+		static bool optimizeClusters;
+
+		// Layout of the vertex buffers of the meshes loaded from now on
+		static gps::VertexFormat vertexFormat;
+
+		// Batch the shapes of static models - off draws every shape on its own
+		static bool staticBatching;
+
+		// Simplify freshly parsed meshes into levels of detail
+		static bool generateLods;
+		// Seconds a range takes to dither over to a new level of detail - 0 pops
+		static float lodFadeTime;
+
+		// Keep a CPU-side copy of the vertices and indices of the meshes loaded from now on - dropped after upload otherwise
+		static bool retainMeshData;
+
+		// Triangles of the largest simple shapes of a static model kept on the CPU as occluders - 0 keeps none
+		static size_t occluderTriangleBudget;
+
+		// Does the parsing of the .obj file and fills in the data structure - also used by asset_baker
+		static void ReadOBJ(std::string fileName, std::string basePath, std::vector<gps::MeshData>& shapeData);
 
     private:
 		// Component meshes - group of objects
         std::vector<gps::Mesh> meshes;
-		// Associated textures
+		// Associated textures - one reference in the texture cache each
         std::vector<gps::Texture> loadedTextures;
 
-		// Does the parsing of the .obj file and fills in the data structure
-		void ReadOBJ(std::string fileName, std::string basePath);
+		bool isStatic;
+		// Shapes of the source file - one mesh each unless batched or split
+		size_t shapeCount;
+
+		// Batches being filled while loading a static model, uploaded by FlushBatches
+		std::vector<gps::MeshData> pendingBatches;
+		std::vector<std::vector<gps::MeshRange> > pendingRanges;
+		// Levels of detail of the pending batches - appended behind their full detail triangles when uploaded
+		std::vector<std::vector<GLuint> > pendingLodIndices;
+		// Batch currently filled for each material
+		std::map<std::string, size_t> openBatches;
+
+		// Level of detail each range is shown at, and the level it is fading from
+		struct LodState {
+			int level;
+			int previousLevel;
+			// 1 once the fade is done
+			float fade;
+		};
+		std::vector<std::vector<LodState> > lodStates;
+
+		// spheres of the meshes packed for Frustum::CullSpheres - and the results of the last test
+		std::vector<glm::vec4> meshSpheres;
+		std::vector<unsigned char> meshVisibility;
+		std::vector<unsigned char> rangeVisibility;
+		std::vector<size_t> visibleRanges;
+		// full detail clusters left by CullClusters
+		std::vector<gps::IndexSpan> visibleSpans;
+
+		// Hierarchy over the range boxes of a static model - item meshFirstItem[m] + r is range r of mesh m
+		gps::Bvh bvh;
+		// set whenever meshes are added, the hierarchy is rebuilt the next time it is used
+		bool bvhDirty;
+		std::vector<size_t> meshFirstItem;
+		std::vector<ShapeRef> itemShapes;
+		// items in the frustum at the last test, and the same as flags
+		std::vector<uint32_t> bvhItems;
+		std::vector<unsigned char> itemVisibility;
+		// by item, follows the hierarchy
+		std::vector<gps::OcclusionState> occlusionStates;
+
+		// A shape of a static model that could serve as an occluder
+		struct OccluderCandidate {
+			// area of its vertical silhouette
+			float size;
+			std::vector<glm::vec3> positions;
+			std::vector<uint32_t> indices;
+		};
+		std::vector<OccluderCandidate> occluderCandidates;
+		size_t candidateTriangles;
+		// the picked candidates, merged
+		std::vector<glm::vec3> occluderPositions;
+		std::vector<uint32_t> occluderIndices;
+
+		// Keeps a copy of a shape that is simple enough for an occluder
+		void AddOccluderCandidate(const gps::Vertex* vertices, GLuint vertexCount, const GLuint* indices, GLuint indexCount,
+			const gps::BoundingBox& bounds);
+		// Keeps the largest candidates that fit the budget
+		void PruneOccluderCandidates();
+		// Merges the candidates into the occluders once the model is loaded
+		void SelectOccluders();
+
+		// Rebuilds the hierarchy if the meshes changed since it was built
+		void UpdateBvh();
+
+		// Tests every mesh against the frustum into meshVisibility - static models go through the hierarchy
+		void CullMeshes(const gps::Frustum& frustum);
+		// Tests the ranges of a visible mesh into rangeVisibility and visibleRanges - returns how many are visible
+		// occlusion drops the ranges of static models found hidden
+		size_t CullRanges(size_t mesh, const gps::Frustum& frustum, gps::OcclusionCulling occlusion);
+		// Tests the clusters of the given visible ranges into visibleSpans - ranges without clusters are kept whole
+		void CullClusters(size_t mesh, const std::vector<size_t>& rangeIndices, const gps::Frustum& frustum);
+
+		int SelectLod(const gps::MeshRange& range, const LodParameters& parameters, float modelScale) const;
+
+		// Creates the meshes straight from a valid binary cache of the .obj file
+		bool ReadCache(std::string cacheFileName, std::string fileName);
+
+		// Creates the meshes and textures from the bundle baked for the model's directory
+		bool ReadBundle(std::string bundleFileName, std::string fileName);
+
+		// Adds the shapes of a bundled model - false if a texture id is not in textureBundle
+		bool AddBundleShapes(const gps::AssetBundle::Model& model, const gps::AssetBundle& textureBundle);
+
+		// Uploads one shape - split into parts if that lets them use 16-bit indices for less memory overall (dropping its levels of detail)
+		// Shapes of static models are appended to the batch of their material instead
+		void AddMesh(const gps::Vertex* vertices, GLuint vertexCount, const GLuint* indices, GLuint indexCount,
+			const std::vector<gps::LodView>& lods, const std::vector<gps::Texture>& textures, const gps::BoundingBox& bounds,
+			const gps::BoundingSphere& sphere);
+
+		// Appends a shape to the batch of its textures - a batch is closed before it outgrows 16-bit indices
+		void AddToBatch(const gps::Vertex* vertices, GLuint vertexCount, const GLuint* indices, GLuint indexCount,
+			const std::vector<gps::LodView>& lods, const std::vector<gps::Texture>& textures, const gps::BoundingBox& bounds,
+			const gps::BoundingSphere& sphere);
+
+		// Uploads the batches of a static model, each keeping the ranges of its shapes
+		void FlushBatches();
+
+		// Loads the textures referenced by a shape - only their type and path need to be set
+		std::vector<gps::Texture> LoadTextures(const std::vector<gps::Texture>& textureRefs);
 
-		// Retrieves a texture associated with the object - by its name and type
+		// Retrieves a texture associated with the object from the shared texture cache - by its name and type
 		gps::Texture LoadTexture(std::string path, std::string type);
 
-		// Reads the pixel data from an image file and loads it into the video memory
-		GLuint ReadTextureFromFile(const char* file_name);
+		// holds one texture cache reference per loaded texture
+		Model3D(const Model3D&);
+		Model3D& operator=(const Model3D&);
     };
 }
 
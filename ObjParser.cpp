@@ -0,0 +1,737 @@
+#include "ObjParser.hpp"
+#include "MappedFile.hpp"
+
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+namespace gps {
+
+    namespace {
+
+#define OBJ_IS_SPACE(x) (((x) == ' ') || ((x) == '\t'))
+#define OBJ_IS_DIGIT(x) (static_cast<unsigned int>((x) - '0') < static_cast<unsigned int>(10))
+#define OBJ_IS_NEW_LINE(x) (((x) == '\r') || ((x) == '\n') || ((x) == '\0'))
+
+        // Chunks smaller than this are not worth a task of their own
+        const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+        // Marks a texcoord/normal index missing from a face corner
+        const int ABSENT_INDEX = INT_MIN;
+
+        // Face corner as written in the file; resolved to zero-based indices during the merge
+        struct Corner {
+            int v;
+            int vt;
+            int vn;
+        };
+
+        enum CommandType { COMMAND_FACE, COMMAND_LINE };
+
+        // Order-dependent record of a chunk - a face, or a usemtl/mtllib/g/o/t line kept for the merge
+        struct Command {
+            CommandType type;
+            // face: first corner in Chunk::corners, line: index in Chunk::lines
+            size_t first;
+            size_t count;
+            // number of v/vn/vt read in this chunk before the face, for relative indices
+            int vCount;
+            int vnCount;
+            int vtCount;
+        };
+
+        struct Chunk {
+            const char* begin;
+            const char* end;
+            std::vector<float> v;
+            std::vector<float> vn;
+            std::vector<float> vt;
+            std::vector<Corner> corners;
+            std::vector<Command> commands;
+            std::vector<std::string> lines;
+            // offsets of this chunk's attributes in the merged arrays
+            int vBase;
+            int vnBase;
+            int vtBase;
+        };
+
+        // Face of the current face group - points into the resolved corners of a chunk
+        struct Face {
+            const Corner* corners;
+            size_t count;
+        };
+
+        // atoi() without the locale lookups
+        inline int FastAtoi(const char* s) {
+            while (*s == ' ' || (*s >= '\t' && *s <= '\r')) s++;
+            bool negative = false;
+            if (*s == '+' || *s == '-') {
+                negative = (*s == '-');
+                s++;
+            }
+            unsigned int value = 0;
+            while (OBJ_IS_DIGIT(*s)) {
+                value = value * 10 + static_cast<unsigned int>(*s - '0');
+                s++;
+            }
+            return negative ? -static_cast<int>(value) : static_cast<int>(value);
+        }
+
+        // strcspn(s, "/ \t\r")
+        inline size_t SkipIndex(const char* s) {
+            const char* p = s;
+            while (*p != '\0' && *p != '/' && *p != ' ' && *p != '\t' && *p != '\r') p++;
+            return static_cast<size_t>(p - s);
+        }
+
+        // strcspn(s, " \t\r")
+        inline size_t SkipField(const char* s) {
+            const char* p = s;
+            while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r') p++;
+            return static_cast<size_t>(p - s);
+        }
+
+        // strspn(s, " \t")
+        inline size_t SkipBlanks(const char* s) {
+            const char* p = s;
+            while (*p == ' ' || *p == '\t') p++;
+            return static_cast<size_t>(p - s);
+        }
+
+        // Same arithmetic as tinyobj's tryParseDouble, so the parsed floats are bit-identical
+        bool TryParseDouble(const char* s, const char* s_end, double* result) {
+            if (s >= s_end) {
+                return false;
+            }
+
+            static const double pow_lut[] = { 1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001 };
+            const int lut_entries = sizeof pow_lut / sizeof pow_lut[0];
+
+            double mantissa = 0.0;
+            int exponent = 0;
+            char sign = '+';
+            char exp_sign = '+';
+            const char* curr = s;
+            int read = 0;
+            bool end_not_reached = false;
+
+            if (*curr == '+' || *curr == '-') {
+                sign = *curr;
+                curr++;
+            } else if (!OBJ_IS_DIGIT(*curr)) {
+                return false;
+            }
+
+            // integer part
+            end_not_reached = (curr != s_end);
+            while (end_not_reached && OBJ_IS_DIGIT(*curr)) {
+                mantissa *= 10;
+                mantissa += static_cast<int>(*curr - 0x30);
+                curr++;
+                read++;
+                end_not_reached = (curr != s_end);
+            }
+            if (read == 0) return false;
+            if (!end_not_reached) goto assemble;
+
+            // decimal part
+            if (*curr == '.') {
+                curr++;
+                read = 1;
+                end_not_reached = (curr != s_end);
+                while (end_not_reached && OBJ_IS_DIGIT(*curr)) {
+                    mantissa += static_cast<int>(*curr - 0x30) *
+                        (read < lut_entries ? pow_lut[read] : pow(10.0, -read));
+                    read++;
+                    curr++;
+                    end_not_reached = (curr != s_end);
+                }
+            } else if (*curr == 'e' || *curr == 'E') {
+            } else {
+                goto assemble;
+            }
+
+            if (!end_not_reached) goto assemble;
+
+            // exponent part
+            if (*curr == 'e' || *curr == 'E') {
+                curr++;
+                end_not_reached = (curr != s_end);
+                if (end_not_reached && (*curr == '+' || *curr == '-')) {
+                    exp_sign = *curr;
+                    curr++;
+                } else if (!OBJ_IS_DIGIT(*curr)) {
+                    return false;
+                }
+
+                read = 0;
+                end_not_reached = (curr != s_end);
+                while (end_not_reached && OBJ_IS_DIGIT(*curr)) {
+                    exponent *= 10;
+                    exponent += static_cast<int>(*curr - 0x30);
+                    curr++;
+                    read++;
+                    end_not_reached = (curr != s_end);
+                }
+                exponent *= (exp_sign == '+' ? 1 : -1);
+                if (read == 0) return false;
+            }
+
+        assemble:
+            *result = (sign == '+' ? 1 : -1) *
+                (exponent ? ldexp(mantissa * pow(5.0, exponent), exponent) : mantissa);
+            return true;
+        }
+
+        inline float ParseFloat(const char** token, double default_value = 0.0) {
+            (*token) += SkipBlanks(*token);
+            const char* end = (*token) + SkipField(*token);
+            double val = default_value;
+            TryParseDouble((*token), end, &val);
+            (*token) = end;
+            return static_cast<float>(val);
+        }
+
+        // First whitespace-delimited word, like sscanf(token, "%s", buf)
+        std::string ParseWord(const char* token) {
+            while (*token == ' ' || (*token >= '\t' && *token <= '\r')) token++;
+            const char* end = token;
+            while (*end != '\0' && !(*end == ' ' || (*end >= '\t' && *end <= '\r'))) end++;
+            return std::string(token, end);
+        }
+
+        // Mirrors tinyobj's parseString
+        std::string ParseString(const char** token) {
+            (*token) += SkipBlanks(*token);
+            size_t e = SkipField(*token);
+            std::string s((*token), (*token) + e);
+            (*token) += e;
+            return s;
+        }
+
+        // Mirrors tinyobj's parseTriple, without resolving the indices yet
+        Corner ParseCorner(const char** token) {
+            Corner corner;
+            corner.vt = ABSENT_INDEX;
+            corner.vn = ABSENT_INDEX;
+
+            corner.v = FastAtoi(*token);
+            (*token) += SkipIndex(*token);
+            if ((*token)[0] != '/') {
+                return corner;
+            }
+            (*token)++;
+
+            // i//k
+            if ((*token)[0] == '/') {
+                (*token)++;
+                corner.vn = FastAtoi(*token);
+                (*token) += SkipIndex(*token);
+                return corner;
+            }
+
+            // i/j/k or i/j
+            corner.vt = FastAtoi(*token);
+            (*token) += SkipIndex(*token);
+            if ((*token)[0] != '/') {
+                return corner;
+            }
+
+            // i/j/k
+            (*token)++;
+            corner.vn = FastAtoi(*token);
+            (*token) += SkipIndex(*token);
+            return corner;
+        }
+
+        // Make index zero-base, and also support relative index (tinyobj's fixIndex)
+        inline int FixIndex(int idx, int n) {
+            if (idx > 0) return idx - 1;
+            if (idx == 0) return 0;
+            return n + idx;
+        }
+
+        // Parses the v/vn/vt/f records of one chunk; other relevant lines are kept for the merge
+        void ParseChunk(Chunk& chunk) {
+            size_t estimatedLines = static_cast<size_t>(chunk.end - chunk.begin) / 32;
+            chunk.v.reserve(estimatedLines);
+            chunk.corners.reserve(estimatedLines);
+
+            std::vector<char> lineBuffer(256);
+            const char* p = chunk.begin;
+
+            while (p < chunk.end) {
+                // same line endings as tinyobj's safeGetline: \n, \r\n and \r
+                const char* lineEnd = p;
+                while (lineEnd < chunk.end && *lineEnd != '\n' && *lineEnd != '\r') lineEnd++;
+
+                size_t length = static_cast<size_t>(lineEnd - p);
+                if (length + 1 > lineBuffer.size()) {
+                    lineBuffer.resize(length + 1);
+                }
+                memcpy(&lineBuffer[0], p, length);
+                lineBuffer[length] = '\0';
+
+                p = lineEnd;
+                if (p < chunk.end) {
+                    if (*p == '\r' && p + 1 < chunk.end && p[1] == '\n') p++;
+                    p++;
+                }
+
+                const char* token = &lineBuffer[0];
+                token += SkipBlanks(token);
+                if (token[0] == '\0' || token[0] == '#') continue;
+
+                // vertex
+                if (token[0] == 'v' && OBJ_IS_SPACE(token[1])) {
+                    token += 2;
+                    chunk.v.push_back(ParseFloat(&token));
+                    chunk.v.push_back(ParseFloat(&token));
+                    chunk.v.push_back(ParseFloat(&token));
+                    continue;
+                }
+
+                // normal
+                if (token[0] == 'v' && token[1] == 'n' && OBJ_IS_SPACE(token[2])) {
+                    token += 3;
+                    chunk.vn.push_back(ParseFloat(&token));
+                    chunk.vn.push_back(ParseFloat(&token));
+                    chunk.vn.push_back(ParseFloat(&token));
+                    continue;
+                }
+
+                // texcoord
+                if (token[0] == 'v' && token[1] == 't' && OBJ_IS_SPACE(token[2])) {
+                    token += 3;
+                    chunk.vt.push_back(ParseFloat(&token));
+                    chunk.vt.push_back(ParseFloat(&token));
+                    continue;
+                }
+
+                // face
+                if (token[0] == 'f' && OBJ_IS_SPACE(token[1])) {
+                    token += 2;
+                    token += SkipBlanks(token);
+
+                    Command command;
+                    command.type = COMMAND_FACE;
+                    command.first = chunk.corners.size();
+                    command.vCount = static_cast<int>(chunk.v.size() / 3);
+                    command.vnCount = static_cast<int>(chunk.vn.size() / 3);
+                    command.vtCount = static_cast<int>(chunk.vt.size() / 2);
+
+                    while (!OBJ_IS_NEW_LINE(token[0])) {
+                        chunk.corners.push_back(ParseCorner(&token));
+                        while (*token == ' ' || *token == '\t' || *token == '\r') token++;
+                    }
+
+                    command.count = chunk.corners.size() - command.first;
+                    chunk.commands.push_back(command);
+                    continue;
+                }
+
+                // usemtl, mtllib, group, object and tag lines change the shape state - handled in order by the merge
+                if (((0 == strncmp(token, "usemtl", 6) || 0 == strncmp(token, "mtllib", 6)) && OBJ_IS_SPACE(token[6])) ||
+                    ((token[0] == 'g' || token[0] == 'o' || token[0] == 't') && OBJ_IS_SPACE(token[1]))) {
+                    Command command;
+                    command.type = COMMAND_LINE;
+                    command.first = chunk.lines.size();
+                    command.count = 0;
+                    command.vCount = command.vnCount = command.vtCount = 0;
+                    chunk.lines.push_back(std::string(token));
+                    chunk.commands.push_back(command);
+                }
+
+                // Ignore unknown command.
+            }
+        }
+
+        // Resolves the corners of a chunk to zero-based indices into the merged attribute arrays
+        void ResolveChunk(Chunk& chunk) {
+            for (size_t c = 0; c < chunk.commands.size(); c++) {
+                const Command& command = chunk.commands[c];
+                if (command.type != COMMAND_FACE) {
+                    continue;
+                }
+                int vSize = chunk.vBase + command.vCount;
+                int vnSize = chunk.vnBase + command.vnCount;
+                int vtSize = chunk.vtBase + command.vtCount;
+
+                for (size_t i = command.first; i < command.first + command.count; i++) {
+                    Corner& corner = chunk.corners[i];
+                    corner.v = FixIndex(corner.v, vSize);
+                    corner.vt = corner.vt == ABSENT_INDEX ? -1 : FixIndex(corner.vt, vtSize);
+                    corner.vn = corner.vn == ABSENT_INDEX ? -1 : FixIndex(corner.vn, vnSize);
+                }
+            }
+        }
+
+        tinyobj::index_t ToIndex(const Corner& corner) {
+            tinyobj::index_t idx;
+            idx.vertex_index = corner.v;
+            idx.normal_index = corner.vn;
+            idx.texcoord_index = corner.vt;
+            return idx;
+        }
+
+        // Mirrors tinyobj's exportFaceGroupToShape
+        bool ExportFaceGroupToShape(tinyobj::shape_t* shape, const std::vector<Face>& faceGroup,
+            const std::vector<tinyobj::tag_t>& tags, const int material_id, const std::string& name, bool triangulate) {
+            if (faceGroup.empty()) {
+                return false;
+            }
+
+            for (size_t i = 0; i < faceGroup.size(); i++) {
+                const Face& face = faceGroup[i];
+
+                if (triangulate) {
+                    // Polygon -> triangle fan conversion
+                    for (size_t k = 2; k < face.count; k++) {
+                        shape->mesh.indices.push_back(ToIndex(face.corners[0]));
+                        shape->mesh.indices.push_back(ToIndex(face.corners[k - 1]));
+                        shape->mesh.indices.push_back(ToIndex(face.corners[k]));
+                        shape->mesh.num_face_vertices.push_back(3);
+                        shape->mesh.material_ids.push_back(material_id);
+                    }
+                } else {
+                    for (size_t k = 0; k < face.count; k++) {
+                        shape->mesh.indices.push_back(ToIndex(face.corners[k]));
+                    }
+                    shape->mesh.num_face_vertices.push_back(static_cast<unsigned char>(face.count));
+                    shape->mesh.material_ids.push_back(material_id);
+                }
+            }
+
+            shape->name = name;
+            shape->mesh.tags = tags;
+
+            return true;
+        }
+
+        // Mirrors tinyobj's tag ('t') parsing
+        tinyobj::tag_t ParseTag(const std::string& line) {
+            const char* token = line.c_str();
+            const char* lineEnd = token + line.size();
+
+            tinyobj::tag_t tag;
+            token += 2;
+            tag.name = ParseWord(token);
+            token += tag.name.size() + 1;
+            if (token > lineEnd) token = lineEnd;
+
+            int numInts = FastAtoi(token);
+            int numFloats = 0;
+            int numStrings = 0;
+            token += SkipIndex(token);
+            if (token[0] == '/') {
+                token++;
+                numFloats = FastAtoi(token);
+                token += SkipIndex(token);
+                if (token[0] == '/') {
+                    token++;
+                    numStrings = FastAtoi(token);
+                    token += SkipIndex(token) + 1;
+                }
+            }
+            if (token > lineEnd) token = lineEnd;
+
+            tag.intValues.resize(static_cast<size_t>(numInts > 0 ? numInts : 0));
+            for (size_t i = 0; i < tag.intValues.size(); ++i) {
+                tag.intValues[i] = FastAtoi(token);
+                token += SkipIndex(token) + 1;
+                if (token > lineEnd) token = lineEnd;
+            }
+
+            tag.floatValues.resize(static_cast<size_t>(numFloats > 0 ? numFloats : 0));
+            for (size_t i = 0; i < tag.floatValues.size(); ++i) {
+                tag.floatValues[i] = ParseFloat(&token);
+                token += SkipIndex(token) + 1;
+                if (token > lineEnd) token = lineEnd;
+            }
+
+            tag.stringValues.resize(static_cast<size_t>(numStrings > 0 ? numStrings : 0));
+            for (size_t i = 0; i < tag.stringValues.size(); ++i) {
+                tag.stringValues[i] = ParseWord(token);
+                token += tag.stringValues[i].size() + 1;
+                if (token > lineEnd) token = lineEnd;
+            }
+
+            return tag;
+        }
+
+        bool SameMaterials(const std::vector<tinyobj::material_t>& a, const std::vector<tinyobj::material_t>& b) {
+            if (a.size() != b.size()) return false;
+            for (size_t i = 0; i < a.size(); i++) {
+                if (a[i].name != b[i].name || a[i].ambient_texname != b[i].ambient_texname ||
+                    a[i].diffuse_texname != b[i].diffuse_texname || a[i].specular_texname != b[i].specular_texname ||
+                    memcmp(a[i].ambient, b[i].ambient, sizeof(a[i].ambient)) != 0 ||
+                    memcmp(a[i].diffuse, b[i].diffuse, sizeof(a[i].diffuse)) != 0 ||
+                    memcmp(a[i].specular, b[i].specular, sizeof(a[i].specular)) != 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool SameFloats(const std::vector<float>& a, const std::vector<float>& b) {
+            return a.size() == b.size() && (a.empty() || memcmp(&a[0], &b[0], a.size() * sizeof(float)) == 0);
+        }
+
+        bool SameShapes(const std::vector<tinyobj::shape_t>& a, const std::vector<tinyobj::shape_t>& b) {
+            if (a.size() != b.size()) return false;
+            for (size_t s = 0; s < a.size(); s++) {
+                const tinyobj::mesh_t& ma = a[s].mesh;
+                const tinyobj::mesh_t& mb = b[s].mesh;
+                if (a[s].name != b[s].name || ma.indices.size() != mb.indices.size() ||
+                    ma.num_face_vertices != mb.num_face_vertices || ma.material_ids != mb.material_ids ||
+                    ma.tags.size() != mb.tags.size()) {
+                    return false;
+                }
+                for (size_t i = 0; i < ma.indices.size(); i++) {
+                    if (ma.indices[i].vertex_index != mb.indices[i].vertex_index ||
+                        ma.indices[i].normal_index != mb.indices[i].normal_index ||
+                        ma.indices[i].texcoord_index != mb.indices[i].texcoord_index) {
+                        return false;
+                    }
+                }
+                for (size_t t = 0; t < ma.tags.size(); t++) {
+                    if (ma.tags[t].name != mb.tags[t].name || ma.tags[t].intValues != mb.tags[t].intValues ||
+                        !SameFloats(ma.tags[t].floatValues, mb.tags[t].floatValues) ||
+                        ma.tags[t].stringValues != mb.tags[t].stringValues) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+    }
+
+    bool ObjParser::LoadObj(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+        std::vector<tinyobj::material_t>* materials, std::string* err,
+        const char* filename, const char* mtl_basepath, bool triangulate, ThreadPool& pool)
+    {
+        attrib->vertices.clear();
+        attrib->normals.clear();
+        attrib->texcoords.clear();
+        shapes->clear();
+
+        MappedFile file;
+        if (!file.Open(filename)) {
+            std::stringstream errss;
+            errss << "Cannot open file [" << filename << "]" << std::endl;
+            if (err) {
+                (*err) = errss.str();
+            }
+            return false;
+        }
+
+        // Split the file into chunks that end right after a '\n'
+        const char* data = reinterpret_cast<const char*>(file.getData());
+        const char* dataEnd = data + file.getSize();
+        size_t chunkSize = file.getSize() / (pool.getThreadCount() * 4 + 1);
+        if (chunkSize < MIN_CHUNK_SIZE) {
+            chunkSize = MIN_CHUNK_SIZE;
+        }
+
+        std::vector<Chunk> chunks;
+        const char* chunkBegin = data;
+        while (chunkBegin < dataEnd) {
+            const char* chunkEnd = chunkBegin + chunkSize < dataEnd ? chunkBegin + chunkSize : dataEnd;
+            while (chunkEnd < dataEnd && chunkEnd[-1] != '\n') chunkEnd++;
+
+            Chunk chunk;
+            chunk.begin = chunkBegin;
+            chunk.end = chunkEnd;
+            chunks.push_back(chunk);
+            chunkBegin = chunkEnd;
+        }
+
+        pool.ParallelFor(chunks.size(), [&chunks](size_t i) {
+            ParseChunk(chunks[i]);
+        });
+
+        // Attribute offsets of every chunk in the merged arrays
+        size_t vTotal = 0, vnTotal = 0, vtTotal = 0;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            chunks[i].vBase = static_cast<int>(vTotal / 3);
+            chunks[i].vnBase = static_cast<int>(vnTotal / 3);
+            chunks[i].vtBase = static_cast<int>(vtTotal / 2);
+            vTotal += chunks[i].v.size();
+            vnTotal += chunks[i].vn.size();
+            vtTotal += chunks[i].vt.size();
+        }
+
+        std::vector<float> v(vTotal);
+        std::vector<float> vn(vnTotal);
+        std::vector<float> vt(vtTotal);
+
+        pool.ParallelFor(chunks.size(), [&chunks, &v, &vn, &vt](size_t i) {
+            Chunk& chunk = chunks[i];
+            ResolveChunk(chunk);
+            std::copy(chunk.v.begin(), chunk.v.end(), v.begin() + static_cast<size_t>(chunk.vBase) * 3);
+            std::copy(chunk.vn.begin(), chunk.vn.end(), vn.begin() + static_cast<size_t>(chunk.vnBase) * 3);
+            std::copy(chunk.vt.begin(), chunk.vt.end(), vt.begin() + static_cast<size_t>(chunk.vtBase) * 2);
+            std::vector<float>().swap(chunk.v);
+            std::vector<float>().swap(chunk.vn);
+            std::vector<float>().swap(chunk.vt);
+        });
+
+        // Replay the records in file order, with the same shape/material state machine as tinyobj
+        tinyobj::MaterialFileReader readMatFn(mtl_basepath ? std::string(mtl_basepath) : std::string());
+        std::map<std::string, int> material_map;
+        int material = -1;
+        std::vector<tinyobj::tag_t> tags;
+        std::vector<Face> faceGroup;
+        std::string name;
+        tinyobj::shape_t shape;
+
+        for (size_t i = 0; i < chunks.size(); i++) {
+            const Chunk& chunk = chunks[i];
+
+            for (size_t c = 0; c < chunk.commands.size(); c++) {
+                const Command& command = chunk.commands[c];
+
+                if (command.type == COMMAND_FACE) {
+                    Face face;
+                    face.corners = command.count > 0 ? &chunk.corners[command.first] : NULL;
+                    face.count = command.count;
+                    faceGroup.push_back(face);
+                    continue;
+                }
+
+                const std::string& line = chunk.lines[command.first];
+                const char* token = line.c_str();
+
+                // use mtl
+                if (0 == strncmp(token, "usemtl", 6)) {
+                    std::string materialName = ParseWord(token + 7);
+
+                    int newMaterialId = -1;
+                    std::map<std::string, int>::const_iterator found = material_map.find(materialName);
+                    if (found != material_map.end()) {
+                        newMaterialId = found->second;
+                    }
+
+                    if (newMaterialId != material) {
+                        ExportFaceGroupToShape(&shape, faceGroup, tags, material, name, triangulate);
+                        faceGroup.clear();
+                        material = newMaterialId;
+                    }
+                    continue;
+                }
+
+                // load mtl
+                if (0 == strncmp(token, "mtllib", 6)) {
+                    std::string err_mtl;
+                    bool ok = readMatFn(ParseWord(token + 7), materials, &material_map, &err_mtl);
+                    if (err) {
+                        (*err) += err_mtl;
+                    }
+                    if (!ok) {
+                        return false;
+                    }
+                    continue;
+                }
+
+                // group name
+                if (token[0] == 'g') {
+                    if (ExportFaceGroupToShape(&shape, faceGroup, tags, material, name, triangulate)) {
+                        shapes->push_back(shape);
+                    }
+                    shape = tinyobj::shape_t();
+                    faceGroup.clear();
+
+                    std::vector<std::string> names;
+                    while (!OBJ_IS_NEW_LINE(token[0])) {
+                        names.push_back(ParseString(&token));
+                        while (*token == ' ' || *token == '\t' || *token == '\r') token++;
+                    }
+
+                    // names[0] must be 'g', so skip the 0th element.
+                    name = names.size() > 1 ? names[1] : "";
+                    continue;
+                }
+
+                // object name
+                if (token[0] == 'o') {
+                    if (ExportFaceGroupToShape(&shape, faceGroup, tags, material, name, triangulate)) {
+                        shapes->push_back(shape);
+                    }
+                    faceGroup.clear();
+                    shape = tinyobj::shape_t();
+
+                    name = ParseWord(token + 2);
+                    continue;
+                }
+
+                // tag
+                if (token[0] == 't') {
+                    tags.push_back(ParseTag(line));
+                }
+            }
+        }
+
+        bool ret = ExportFaceGroupToShape(&shape, faceGroup, tags, material, name, triangulate);
+        if (ret || shape.mesh.indices.size()) {
+            shapes->push_back(shape);
+        }
+
+        attrib->vertices.swap(v);
+        attrib->normals.swap(vn);
+        attrib->texcoords.swap(vt);
+
+        return true;
+    }
+
+    bool ObjParser::Benchmark(const std::string& fileName, int runs)
+    {
+        std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+
+        tinyobj::attrib_t tinyAttrib, parallelAttrib;
+        std::vector<tinyobj::shape_t> tinyShapes, parallelShapes;
+        std::vector<tinyobj::material_t> tinyMaterials, parallelMaterials;
+        double tinyBest = 0.0, parallelBest = 0.0;
+
+        for (int run = 0; run < runs; run++) {
+            std::string err;
+            tinyMaterials.clear();
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if (!tinyobj::LoadObj(&tinyAttrib, &tinyShapes, &tinyMaterials, &err, fileName.c_str(), basePath.c_str(), true)) {
+                std::cerr << err << std::endl;
+                return false;
+            }
+            double tinyTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            parallelMaterials.clear();
+            start = std::chrono::steady_clock::now();
+            if (!LoadObj(&parallelAttrib, &parallelShapes, &parallelMaterials, &err, fileName.c_str(), basePath.c_str(), true)) {
+                std::cerr << err << std::endl;
+                return false;
+            }
+            double parallelTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            if (run == 0 || tinyTime < tinyBest) tinyBest = tinyTime;
+            if (run == 0 || parallelTime < parallelBest) parallelBest = parallelTime;
+        }
+
+        bool same = SameFloats(tinyAttrib.vertices, parallelAttrib.vertices) &&
+            SameFloats(tinyAttrib.normals, parallelAttrib.normals) &&
+            SameFloats(tinyAttrib.texcoords, parallelAttrib.texcoords) &&
+            SameShapes(tinyShapes, parallelShapes) &&
+            SameMaterials(tinyMaterials, parallelMaterials);
+
+        std::cout << "OBJ benchmark  : " << fileName << " (best of " << runs << ")" << std::endl;
+        std::cout << "tinyobj        : " << tinyBest << " ms" << std::endl;
+        std::cout << "ObjParser      : " << parallelBest << " ms on " << ThreadPool::getShared().getThreadCount() << " threads ("
+            << (parallelBest > 0.0 ? tinyBest / parallelBest : 0.0) << "x)" << std::endl;
+        std::cout << "results        : " << (same ? "identical" : "DIFFERENT") << std::endl;
+
+        return same;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef ObjParser_hpp
+#define ObjParser_hpp
+
+#include "ThreadPool.hpp"
+
+#include "tiny_obj_loader.h"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+// Multithreaded replacement for tinyobj::LoadObj
+// The .obj file is memory-mapped and split into line-aligned chunks, the v/vn/vt/f records of each
+// chunk are parsed in parallel and the results are merged into exactly what tinyobj::LoadObj returns.
+class ObjParser
+{
+public:
+    // Same arguments and results as tinyobj::LoadObj
+    static bool LoadObj(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+        std::vector<tinyobj::material_t>* materials, std::string* err,
+        const char* filename, const char* mtl_basepath = NULL, bool triangulate = true,
+        ThreadPool& pool = ThreadPool::getShared());
+
+    // Times tinyobj::LoadObj against LoadObj on the same file and checks that their results match
+    static bool Benchmark(const std::string& fileName, int runs = 3);
+};
+
+}
+
+#endif /* ObjParser_hpp */
@@ -0,0 +1,261 @@
+#include "OcclusionQueries.hpp"
+
+#include "UniformBuffers.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace gps {
+
+    namespace {
+
+        // the boxes grow by this share of their size, so the faces of the shapes on them never hide them
+        const float BOX_MARGIN = 0.01f;
+        // a camera this close to a box may have its front faces clipped by the near plane - the shape counts as visible
+        const float CAMERA_MARGIN = 1.0f;
+
+        const GLfloat CUBE_CORNERS[8 * 3] = {
+            0.0f, 0.0f, 0.0f,
+            1.0f, 0.0f, 0.0f,
+            1.0f, 1.0f, 0.0f,
+            0.0f, 1.0f, 0.0f,
+            0.0f, 0.0f, 1.0f,
+            1.0f, 0.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,
+            0.0f, 1.0f, 1.0f
+        };
+
+        // both sides are drawn, so the winding does not matter
+        const GLubyte CUBE_INDICES[36] = {
+            0, 1, 2, 0, 2, 3,
+            4, 5, 6, 4, 6, 7,
+            0, 1, 5, 0, 5, 4,
+            3, 2, 6, 3, 6, 7,
+            0, 3, 7, 0, 7, 4,
+            1, 2, 6, 1, 6, 5
+        };
+
+        BoundingBox Grow(const BoundingBox& box, float margin) {
+            glm::vec3 grow = (box.max - box.min) * BOX_MARGIN + glm::vec3(margin);
+            BoundingBox grown = { box.min - grow, box.max + grow };
+            return grown;
+        }
+
+        bool Contains(const BoundingBox& box, const glm::vec3& point) {
+            return point.x >= box.min.x && point.y >= box.min.y && point.z >= box.min.z
+                && point.x <= box.max.x && point.y <= box.max.y && point.z <= box.max.z;
+        }
+    }
+
+    unsigned OcclusionQueries::visibleRetestFrames = 8;
+
+    OcclusionQueries& OcclusionQueries::getInstance()
+    {
+        static OcclusionQueries* instance = new OcclusionQueries();
+        return *instance;
+    }
+
+    OcclusionQueries::OcclusionQueries()
+        : objectModel(1.0f), objectCameraPosition(0.0f), objectOffset(0), objectWritten(false), frameIndex(1), staggerCount(0)
+    {
+        FrameStats zero = { 0, 0, 0, 0 };
+        frame = lastFrame = total = zero;
+
+        // boxes queued so far are drawn against the depth there is, and the next box writes its ObjectData again
+        UniformBuffers::getInstance().AddReuseCallback([this]() {
+            Issue();
+            objectWritten = false;
+        });
+    }
+
+    void OcclusionQueries::Init()
+    {
+        boxShader.loadShader("shaders/occlusionBox.vert", "shaders/occlusionBox.frag");
+
+        boxVAO = GLVertexArray::Create();
+        boxVBO = GLBuffer::Create();
+        boxEBO = GLBuffer::Create();
+        glBindVertexArray(boxVAO.get());
+        glBindBuffer(GL_ARRAY_BUFFER, boxVBO.get());
+        glBufferData(GL_ARRAY_BUFFER, sizeof(CUBE_CORNERS), CUBE_CORNERS, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxEBO.get());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(CUBE_INDICES), CUBE_INDICES, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+        glBindVertexArray(0);
+    }
+
+    void OcclusionQueries::BeginFrame()
+    {
+        if (frameIndex > 1) {
+            lastFrame = frame;
+            total.visible += frame.visible;
+            total.occluded += frame.occluded;
+            total.queries += frame.queries;
+            total.pending += frame.pending;
+        }
+        FrameStats zero = { 0, 0, 0, 0 };
+        frame = zero;
+        frameIndex++;
+    }
+
+    void OcclusionQueries::setObjectTransform(const glm::mat4& model, const glm::vec3& cameraPosition)
+    {
+        objectModel = model;
+        objectCameraPosition = glm::vec3(glm::inverse(model) * glm::vec4(cameraPosition, 1.0f));
+        objectWritten = false;
+    }
+
+    bool OcclusionQueries::Test(OcclusionState& state, const BoundingBox& bounds)
+    {
+        if (!boxVAO) {
+            return true;
+        }
+
+        // never waits - a result still on its way leaves the shape as it was
+        if (state.query != 0) {
+            GLuint available = 0;
+            glGetQueryObjectuiv(state.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint samplesPassed = 0;
+                glGetQueryObjectuiv(state.query, GL_QUERY_RESULT, &samplesPassed);
+                state.visible = samplesPassed != 0;
+                freeQueries.push_back(state.query);
+                state.query = 0;
+            }
+            else {
+                frame.pending++;
+            }
+        }
+
+        // first seen - its retests are spread over the frames
+        if (state.lastSeen == 0) {
+            state.lastTested = frameIndex - std::min<unsigned long long>(frameIndex, staggerCount++ % visibleRetestFrames);
+        }
+
+        // the last result is stale for a shape that was out of view
+        if (state.lastSeen + 1 < frameIndex) {
+            state.visible = true;
+        }
+        state.lastSeen = frameIndex;
+
+        BoundingBox box = Grow(bounds, 0.0f);
+        BoundingBox cameraBox = Grow(bounds, CAMERA_MARGIN);
+        if (Contains(cameraBox, objectCameraPosition)) {
+            state.visible = true;
+            frame.visible++;
+            return true;
+        }
+
+        bool due = !state.visible || frameIndex - state.lastTested >= visibleRetestFrames;
+        if (due && state.query == 0) {
+            if (!objectWritten) {
+                ObjectData object;
+                object.model = objectModel;
+                object.normalMatrix[0] = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+                object.normalMatrix[1] = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+                object.normalMatrix[2] = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+                object.positionOffset = glm::vec3(0.0f);
+                object.lodFade = 1.0f;
+                object.positionScale = glm::vec3(1.0f);
+                object.packedNormals = 0;
+                objectOffset = UniformBuffers::getInstance().WriteObject(object);
+                objectWritten = true;
+            }
+            state.query = AcquireQuery();
+            state.lastTested = frameIndex;
+            Request request = { state.query, box, objectOffset };
+            requests.push_back(request);
+            frame.queries++;
+        }
+
+        if (state.visible) {
+            frame.visible++;
+        }
+        else {
+            frame.occluded++;
+        }
+        return state.visible;
+    }
+
+    void OcclusionQueries::Issue()
+    {
+        if (requests.empty()) {
+            return;
+        }
+
+        boxShader.useShaderProgram();
+        int boxMin = boxShader.getUniform("boxMin");
+        int boxMax = boxShader.getUniform("boxMax");
+
+        // tests depth only
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glDepthFunc(GL_LEQUAL);
+        glDisable(GL_CULL_FACE);
+        glBindVertexArray(boxVAO.get());
+
+        size_t boundObject = static_cast<size_t>(-1);
+        for (size_t i = 0; i < requests.size(); i++) {
+            const Request& request = requests[i];
+            if (request.objectOffset != boundObject) {
+                UniformBuffers::getInstance().BindObject(request.objectOffset);
+                boundObject = request.objectOffset;
+            }
+            boxShader.setUniform(boxMin, request.box.min);
+            boxShader.setUniform(boxMax, request.box.max);
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, request.query);
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+        }
+
+        glBindVertexArray(0);
+        glEnable(GL_CULL_FACE);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        requests.clear();
+    }
+
+    void OcclusionQueries::Release(OcclusionState& state)
+    {
+        if (state.query != 0) {
+            freeQueries.push_back(state.query);
+            state.query = 0;
+        }
+    }
+
+    GLuint OcclusionQueries::AcquireQuery()
+    {
+        if (freeQueries.empty()) {
+            queries.push_back(GLQuery::Create());
+            return queries.back().get();
+        }
+        GLuint query = freeQueries.back();
+        freeQueries.pop_back();
+        return query;
+    }
+
+    void OcclusionQueries::PrintStats() const
+    {
+        size_t frames = frameIndex > 2 ? static_cast<size_t>(frameIndex - 2) : 0;
+        printf("Occlusion      : last frame %zu shapes visible, %zu occluded, %zu queries issued, %zu results not back yet",
+            lastFrame.visible, lastFrame.occluded, lastFrame.queries, lastFrame.pending);
+        if (frames > 0) {
+            printf(" - per frame %.1f visible, %.1f occluded, %.1f queries",
+                static_cast<double>(total.visible) / frames, static_cast<double>(total.occluded) / frames,
+                static_cast<double>(total.queries) / frames);
+        }
+        printf(", %zu query objects\n", queries.size());
+    }
+
+    void OcclusionQueries::Destroy()
+    {
+        requests.clear();
+        freeQueries.clear();
+        queries.clear();
+        boxVAO.reset();
+        boxVBO.reset();
+        boxEBO.reset();
+    }
+}
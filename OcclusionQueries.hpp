@@ -0,0 +1,114 @@
+#ifndef OcclusionQueries_hpp
+#define OcclusionQueries_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Bounds.hpp"
+#include "GLHandle.hpp"
+#include "Shader.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+// Occlusion of one shape across frames - kept by whoever draws the shape
+struct OcclusionState {
+    // query in flight, 0 for none
+    GLuint query;
+    // result of the last query that came back - shapes start out visible
+    bool visible;
+    // frames the shape was last tested in and last in view - 0 for never
+    unsigned long long lastTested;
+    unsigned long long lastSeen;
+};
+
+// Hardware occlusion culling with GL_ANY_SAMPLES_PASSED queries on the bounding boxes of shapes.
+// The boxes are drawn once the depth of a pass is complete and their results are read back in a later frame, only once
+// they are available - so nothing ever waits for the GPU, and a shape shows up a frame after it comes out from behind
+// an occluder. Hidden shapes are tested again every frame, visible ones every visibleRetestFrames frames, staggered
+// so their queries spread over the frames.
+// Only used from the thread owning the GL context.
+class OcclusionQueries
+{
+public:
+    // Frames a visible shape is drawn without being tested again
+    static unsigned visibleRetestFrames;
+
+    // Never destroyed - Destroy frees the GL objects
+    static OcclusionQueries& getInstance();
+
+    // Builds the box program and geometry - with the other programs, before the first frame
+    void Init();
+
+    // Clears the statistics of the last frame
+    void BeginFrame();
+
+    // Transform and world space camera position of the shapes tested next
+    void setObjectTransform(const glm::mat4& model, const glm::vec3& cameraPosition);
+
+    // Whether to draw a shape with these model space bounds this frame - picks up the result of its last query and
+    // queues a new test when one is due
+    bool Test(OcclusionState& state, const BoundingBox& bounds);
+
+    // Draws the boxes queued by Test against the depth buffer bound now - after the pass that fills it
+    void Issue();
+
+    // Gives back the query of a shape that is no longer drawn
+    void Release(OcclusionState& state);
+
+    void PrintStats() const;
+
+    // Before the GL context goes away
+    void Destroy();
+
+private:
+    struct Request {
+        GLuint query;
+        BoundingBox box;
+        size_t objectOffset;
+    };
+
+    // per-frame counts
+    struct FrameStats {
+        size_t visible;
+        size_t occluded;
+        size_t queries;
+        // queries not back yet when their shape was drawn again
+        size_t pending;
+    };
+
+    Shader boxShader;
+    GLVertexArray boxVAO;
+    GLBuffer boxVBO;
+    GLBuffer boxEBO;
+
+    std::vector<GLQuery> queries;
+    std::vector<GLuint> freeQueries;
+    std::vector<Request> requests;
+
+    glm::mat4 objectModel;
+    // in the model space of objectModel
+    glm::vec3 objectCameraPosition;
+    // where the ObjectData of objectModel went, written once the first box needs it
+    size_t objectOffset;
+    bool objectWritten;
+
+    unsigned long long frameIndex;
+    // spreads the first tests of the shapes over visibleRetestFrames
+    size_t staggerCount;
+    FrameStats frame;
+    FrameStats lastFrame;
+    FrameStats total;
+
+    OcclusionQueries();
+    OcclusionQueries(const OcclusionQueries&);
+    OcclusionQueries& operator=(const OcclusionQueries&);
+
+    GLuint AcquireQuery();
+};
+
+}
+
+#endif /* OcclusionQueries_hpp */
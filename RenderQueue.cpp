@@ -0,0 +1,281 @@
+#include "RenderQueue.hpp"
+
+#include "UniformBuffers.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace gps {
+
+    namespace {
+
+        const int PASS_BITS = 4;
+        const int PROGRAM_BITS = 12;
+        const int TEXTURE_BITS = 20;
+        const int VERTEX_ARRAY_BITS = 12;
+        const int DEPTH_BITS = 16;
+
+        const int DEPTH_SHIFT = 0;
+        const int VERTEX_ARRAY_SHIFT = DEPTH_SHIFT + DEPTH_BITS;
+        const int TEXTURE_SHIFT = VERTEX_ARRAY_SHIFT + VERTEX_ARRAY_BITS;
+        const int PROGRAM_SHIFT = TEXTURE_SHIFT + TEXTURE_BITS;
+        const int PASS_SHIFT = PROGRAM_SHIFT + PROGRAM_BITS;
+
+        static_assert(PASS_SHIFT + PASS_BITS == 64, "the sort key fields must fill 64 bits");
+
+        // no GL name is this - forces the first bind of a Flush
+        const GLuint UNKNOWN_NAME = ~0u;
+    }
+
+    float RenderQueue::maxDepth = 5000.0f;
+
+    RenderQueue& RenderQueue::getInstance()
+    {
+        static RenderQueue* instance = new RenderQueue();
+        return *instance;
+    }
+
+    RenderQueue::RenderQueue()
+        : pass(0), cameraPosition(0.0f), objectModel(1.0f), objectNormalMatrix(1.0f), frameCount(0)
+    {
+        FrameStats zero = { 0, 0, 0, 0, 0, 0, 0, 0 };
+        frame = lastFrame = total = zero;
+
+        // the ObjectData of the queued draws is read when they are issued - before the ring is written over
+        UniformBuffers::getInstance().AddReuseCallback([this]() { Flush(); });
+    }
+
+    void RenderQueue::BeginFrame()
+    {
+        if (frameCount > 0) {
+            lastFrame = frame;
+            total.draws += frame.draws;
+            total.programSwitches += frame.programSwitches;
+            total.textureBinds += frame.textureBinds;
+            total.vertexArrayBinds += frame.vertexArrayBinds;
+            total.visible += frame.visible;
+            total.culled += frame.culled;
+            total.clustersVisible += frame.clustersVisible;
+            total.clustersCulled += frame.clustersCulled;
+        }
+        FrameStats zero = { 0, 0, 0, 0, 0, 0, 0, 0 };
+        frame = zero;
+        frameCount++;
+    }
+
+    void RenderQueue::setPass(unsigned pass)
+    {
+        this->pass = std::min(pass, (1u << PASS_BITS) - 1);
+    }
+
+    void RenderQueue::setCameraPosition(const glm::vec3& position)
+    {
+        cameraPosition = position;
+    }
+
+    void RenderQueue::setObjectTransform(const glm::mat4& model, const glm::mat3& normalMatrix)
+    {
+        objectModel = model;
+        objectNormalMatrix = normalMatrix;
+    }
+
+    // Names past the limit share the last id - they still draw correctly, only their order suffers
+    uint32_t RenderQueue::SmallId(std::unordered_map<GLuint, uint32_t>& ids, GLuint name, uint32_t limit)
+    {
+        std::unordered_map<GLuint, uint32_t>::const_iterator found = ids.find(name);
+        if (found != ids.end()) {
+            return found->second;
+        }
+        uint32_t id = std::min(static_cast<uint32_t>(ids.size()), limit);
+        ids[name] = id;
+        return id;
+    }
+
+    uint64_t RenderQueue::MakeKey(const DrawCommand& command)
+    {
+        uint64_t programId = SmallId(programIds, command.program, (1u << PROGRAM_BITS) - 1);
+        uint64_t vertexArrayId = SmallId(vertexArrayIds, command.vertexArray, (1u << VERTEX_ARRAY_BITS) - 1);
+
+        uint64_t textureSet = (static_cast<uint64_t>(command.textures[DIFFUSE_TEXTURE_UNIT]) << 32) | command.textures[SPECULAR_TEXTURE_UNIT];
+        uint64_t textureId;
+        std::unordered_map<uint64_t, uint32_t>::const_iterator found = textureSetIds.find(textureSet);
+        if (found != textureSetIds.end()) {
+            textureId = found->second;
+        }
+        else {
+            textureId = std::min(static_cast<uint32_t>(textureSetIds.size()), (1u << TEXTURE_BITS) - 1);
+            textureSetIds[textureSet] = static_cast<uint32_t>(textureId);
+        }
+
+        glm::vec3 center = glm::vec3(objectModel * glm::vec4(command.center, 1.0f));
+        float depth = std::min(glm::length(center - cameraPosition) / maxDepth, 1.0f);
+        uint64_t depthBucket = static_cast<uint64_t>(depth * ((1u << DEPTH_BITS) - 1));
+
+        return (static_cast<uint64_t>(pass) << PASS_SHIFT) | (programId << PROGRAM_SHIFT) | (textureId << TEXTURE_SHIFT)
+            | (vertexArrayId << VERTEX_ARRAY_SHIFT) | (depthBucket << DEPTH_SHIFT);
+    }
+
+    void RenderQueue::Submit(const DrawCommand& command, const GLsizei* counts, const GLvoid* const* offsets, size_t rangeCount)
+    {
+        if (rangeCount == 0) {
+            return;
+        }
+
+        ObjectData object;
+        object.model = objectModel;
+        for (int c = 0; c < 3; c++) {
+            object.normalMatrix[c] = glm::vec4(objectNormalMatrix[c], 0.0f);
+        }
+        object.positionOffset = command.positionOffset;
+        object.lodFade = command.lodFade;
+        object.positionScale = command.positionScale;
+        object.packedNormals = command.packedNormals ? 1 : 0;
+
+        DrawItem item;
+        item.program = command.program;
+        item.vertexArray = command.vertexArray;
+        item.indexType = command.indexType;
+        for (int u = 0; u < TEXTURE_UNITS; u++) {
+            item.textures[u] = command.textures[u];
+        }
+        item.objectOffset = UniformBuffers::getInstance().WriteObject(object);
+        item.firstRange = this->counts.size();
+        item.rangeCount = rangeCount;
+
+        this->counts.insert(this->counts.end(), counts, counts + rangeCount);
+        this->offsets.insert(this->offsets.end(), offsets, offsets + rangeCount);
+        items.push_back(item);
+        keys.push_back(MakeKey(command));
+    }
+
+    void RenderQueue::SortItems()
+    {
+        size_t count = items.size();
+        order.resize(count);
+        sortScratch.resize(count);
+        keyScratch.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            order[i] = static_cast<uint32_t>(i);
+        }
+
+        for (int shift = 0; shift < 64; shift += 8) {
+            size_t histogram[256] = { 0 };
+            for (size_t i = 0; i < count; i++) {
+                histogram[(keys[i] >> shift) & 0xFF]++;
+            }
+            // every key has the same byte here
+            if (histogram[(keys[0] >> shift) & 0xFF] == count) {
+                continue;
+            }
+
+            size_t position = 0;
+            for (int b = 0; b < 256; b++) {
+                size_t bucketSize = histogram[b];
+                histogram[b] = position;
+                position += bucketSize;
+            }
+            for (size_t i = 0; i < count; i++) {
+                size_t destination = histogram[(keys[i] >> shift) & 0xFF]++;
+                keyScratch[destination] = keys[i];
+                sortScratch[destination] = order[i];
+            }
+            keys.swap(keyScratch);
+            order.swap(sortScratch);
+        }
+    }
+
+    void RenderQueue::Flush()
+    {
+        if (items.empty()) {
+            return;
+        }
+        SortItems();
+
+        // anything may have been bound since the last Flush
+        GLuint program = UNKNOWN_NAME;
+        GLuint vertexArray = UNKNOWN_NAME;
+        GLuint textures[TEXTURE_UNITS];
+        for (int u = 0; u < TEXTURE_UNITS; u++) {
+            textures[u] = UNKNOWN_NAME;
+        }
+        UniformBuffers& uniformBuffers = UniformBuffers::getInstance();
+
+        for (size_t i = 0; i < order.size(); i++) {
+            const DrawItem& item = items[order[i]];
+
+            if (item.program != program) {
+                glUseProgram(item.program);
+                program = item.program;
+                frame.programSwitches++;
+            }
+            for (int u = 0; u < TEXTURE_UNITS; u++) {
+                if (item.textures[u] != textures[u]) {
+                    glActiveTexture(GL_TEXTURE0 + u);
+                    glBindTexture(GL_TEXTURE_2D, item.textures[u]);
+                    textures[u] = item.textures[u];
+                    frame.textureBinds++;
+                }
+            }
+            if (item.vertexArray != vertexArray) {
+                glBindVertexArray(item.vertexArray);
+                vertexArray = item.vertexArray;
+                frame.vertexArrayBinds++;
+            }
+            uniformBuffers.BindObject(item.objectOffset);
+
+            if (item.rangeCount == 1) {
+                glDrawElements(GL_TRIANGLES, counts[item.firstRange], item.indexType, offsets[item.firstRange]);
+            }
+            else {
+                glMultiDrawElements(GL_TRIANGLES, &counts[item.firstRange], item.indexType, &offsets[item.firstRange],
+                    static_cast<GLsizei>(item.rangeCount));
+            }
+            frame.draws++;
+        }
+        glBindVertexArray(0);
+
+        items.clear();
+        counts.clear();
+        offsets.clear();
+        keys.clear();
+        programIds.clear();
+        vertexArrayIds.clear();
+        textureSetIds.clear();
+    }
+
+    void RenderQueue::CountCulling(size_t visible, size_t culled)
+    {
+        frame.visible += visible;
+        frame.culled += culled;
+    }
+
+    void RenderQueue::CountClusters(size_t visible, size_t culled)
+    {
+        frame.clustersVisible += visible;
+        frame.clustersCulled += culled;
+    }
+
+    void RenderQueue::PrintStats() const
+    {
+        size_t frames = frameCount > 1 ? frameCount - 1 : 0;
+        printf("Render queue   : last frame %zu draws, %zu program switches, %zu texture binds, %zu vertex array binds\n",
+            lastFrame.draws, lastFrame.programSwitches, lastFrame.textureBinds, lastFrame.vertexArrayBinds);
+        if (frames > 0) {
+            printf("                 per frame %.1f draws, %.1f program switches, %.1f texture binds, %.1f vertex array binds\n",
+                static_cast<double>(total.draws) / frames, static_cast<double>(total.programSwitches) / frames,
+                static_cast<double>(total.textureBinds) / frames, static_cast<double>(total.vertexArrayBinds) / frames);
+        }
+        printf("Frustum culling: last frame %zu shapes visible, %zu culled", lastFrame.visible, lastFrame.culled);
+        if (frames > 0) {
+            printf(" - per frame %.1f visible, %.1f culled",
+                static_cast<double>(total.visible) / frames, static_cast<double>(total.culled) / frames);
+        }
+        printf("\n");
+        printf("Cluster culling: last frame %zu clusters visible, %zu culled", lastFrame.clustersVisible, lastFrame.clustersCulled);
+        if (frames > 0) {
+            printf(" - per frame %.1f visible, %.1f culled",
+                static_cast<double>(total.clustersVisible) / frames, static_cast<double>(total.clustersCulled) / frames);
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,137 @@
+#ifndef RenderQueue_hpp
+#define RenderQueue_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+// Collects the draws of the meshes instead of issuing them, sorts them by a 64-bit key and submits them in that order,
+// binding only the state that differs from the previous draw.
+// Key, most significant bits first: pass (4), program (12), textures (20), vertex array (12), depth (16) - so draws
+// are grouped by the state that is most expensive to change, and front to back within the same state.
+// Only used from the thread owning the GL context.
+class RenderQueue
+{
+public:
+    // Texture units the meshes bind their maps to - set the samplers once per program with Shader::setSampler
+    enum TextureUnit {
+        DIFFUSE_TEXTURE_UNIT = 0,
+        SPECULAR_TEXTURE_UNIT = 1,
+        TEXTURE_UNITS = 2
+    };
+
+    // One draw of a mesh
+    struct DrawCommand {
+        GLuint program;
+        GLuint vertexArray;
+        GLenum indexType;
+        // by texture unit, 0 for none
+        GLuint textures[TEXTURE_UNITS];
+        glm::vec3 positionOffset;
+        glm::vec3 positionScale;
+        bool packedNormals;
+        float lodFade;
+        // model space center of the geometry, orders the draws front to back
+        glm::vec3 center;
+    };
+
+    // Draws further from the camera than this share the last depth bucket
+    static float maxDepth;
+
+    // Never destroyed
+    static RenderQueue& getInstance();
+
+    // Clears the statistics of the last frame
+    void BeginFrame();
+
+    // Pass of the draws submitted next - earlier passes are drawn first when they share a Flush
+    void setPass(unsigned pass);
+    // Camera position the depth of the draws is measured from
+    void setCameraPosition(const glm::vec3& position);
+    // Transform of the draws submitted next
+    void setObjectTransform(const glm::mat4& model, const glm::mat3& normalMatrix);
+
+    // Queues a draw of rangeCount index ranges - one glDrawElements, or a glMultiDrawElements over several
+    // Its ObjectData is written into the uniform buffers right away
+    void Submit(const DrawCommand& command, const GLsizei* counts, const GLvoid* const* offsets, size_t rangeCount);
+
+    // Sorts and draws everything queued since the last Flush - also run early by UniformBuffers when a frame fills its ring
+    void Flush();
+
+    // Adds to the shapes found visible and culled this frame - for the statistics only
+    void CountCulling(size_t visible, size_t culled);
+    // The same for the clusters of the visible shapes
+    void CountClusters(size_t visible, size_t culled);
+
+    void PrintStats() const;
+
+private:
+    struct DrawItem {
+        GLuint program;
+        GLuint vertexArray;
+        GLenum indexType;
+        GLuint textures[TEXTURE_UNITS];
+        size_t objectOffset;
+        // into counts and offsets
+        size_t firstRange;
+        size_t rangeCount;
+    };
+
+    // per-frame counts
+    struct FrameStats {
+        size_t draws;
+        size_t programSwitches;
+        size_t textureBinds;
+        size_t vertexArrayBinds;
+        // shapes tested against a frustum before being submitted
+        size_t visible;
+        size_t culled;
+        // clusters of the visible shapes tested against the frustum and their normal cones
+        size_t clustersVisible;
+        size_t clustersCulled;
+    };
+
+    std::vector<DrawItem> items;
+    std::vector<GLsizei> counts;
+    std::vector<const GLvoid*> offsets;
+    std::vector<uint64_t> keys;
+    // indices into items, sorted by key - and the scratch buffer of the radix sort
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> sortScratch;
+    std::vector<uint64_t> keyScratch;
+
+    // small ids of the GL names and texture sets, in the order they were first seen since the last Flush -
+    // the keys are only compared within one sort, so streamed-out names never pile up here
+    std::unordered_map<GLuint, uint32_t> programIds;
+    std::unordered_map<GLuint, uint32_t> vertexArrayIds;
+    std::unordered_map<uint64_t, uint32_t> textureSetIds;
+
+    unsigned pass;
+    glm::vec3 cameraPosition;
+    glm::mat4 objectModel;
+    glm::mat3 objectNormalMatrix;
+
+    FrameStats frame;
+    FrameStats lastFrame;
+    FrameStats total;
+    size_t frameCount;
+
+    RenderQueue();
+    RenderQueue(const RenderQueue&);
+    RenderQueue& operator=(const RenderQueue&);
+
+    static uint32_t SmallId(std::unordered_map<GLuint, uint32_t>& ids, GLuint name, uint32_t limit);
+    uint64_t MakeKey(const DrawCommand& command);
+    // LSD radix sort of order by keys, a byte at a time - bytes equal in every key are skipped
+    void SortItems();
+};
+
+}
+
+#endif /* RenderQueue_hpp */
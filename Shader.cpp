@@ -1,90 +1,155 @@
 #include "Shader.hpp"
 
+#include "glm/gtc/type_ptr.hpp"
+
 namespace gps {
-    std::string Shader::readShaderFile(std::string fileName)
+
+    namespace {
+
+        // in the order of the ShaderFeature bits
+        const char* FEATURE_NAMES[SHADER_FEATURE_COUNT] = { "FOG", "POINT_LIGHT", "SHADOWS", "TEXTURED_SPECULAR", "LOD_FADE" };
+    }
+
+    std::string getShaderFeatureNames(unsigned features)
     {
-        std::ifstream shaderFile;
-        std::string shaderString;
+        std::string names;
+        for (unsigned f = 0; f < SHADER_FEATURE_COUNT; f++) {
+            if (features & (1u << f)) {
+                names += names.empty() ? FEATURE_NAMES[f] : std::string(" ") + FEATURE_NAMES[f];
+            }
+        }
+        return names.empty() ? "none" : names;
+    }
 
-        //open shader file
-        shaderFile.open(fileName.c_str());
+    Shader::Shader() : shaderProgram(0), uniforms(NULL), permutationFeatures(0), features(0) {
+    }
 
-        std::stringstream shaderStringStream;
+    Shader::Shader(Shader&& other) noexcept
+        : shaderProgram(other.shaderProgram), uniforms(other.uniforms), permutations(std::move(other.permutations)),
+        permutationFeatures(other.permutationFeatures), features(other.features) {
+        other.shaderProgram = 0;
+        other.uniforms = NULL;
+        other.permutationFeatures = 0;
+    }
 
-        //read shader content into stream
-        shaderStringStream << shaderFile.rdbuf();
+    Shader& Shader::operator=(Shader&& other) noexcept {
+        if (this != &other) {
+            shaderProgram = other.shaderProgram;
+            uniforms = other.uniforms;
+            permutations = std::move(other.permutations);
+            permutationFeatures = other.permutationFeatures;
+            features = other.features;
+            other.shaderProgram = 0;
+            other.uniforms = NULL;
+            other.permutationFeatures = 0;
+        }
+        return *this;
+    }
 
-        //close shader file
-        shaderFile.close();
+    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName,
+        const std::vector<std::string>& defines, unsigned permutationFeatures)
+    {
+        ShaderCache& cache = ShaderCache::getInstance();
+        this->permutationFeatures = permutationFeatures & SHADER_ALL_FEATURES;
+        this->permutations.assign(this->permutationFeatures != 0 ? SHADER_ALL_FEATURES + 1 : 1, Permutation());
 
-        //convert stream into GLchar array
-        shaderString = shaderStringStream.str();
-        return shaderString;
+        // every subset of the features, the empty one included
+        for (unsigned subset = 0; subset < permutations.size(); subset++) {
+            if ((subset & ~this->permutationFeatures) != 0) {
+                continue;
+            }
+            std::vector<std::string> permutationDefines = defines;
+            for (unsigned f = 0; f < SHADER_FEATURE_COUNT; f++) {
+                if (subset & (1u << f)) {
+                    permutationDefines.push_back(FEATURE_NAMES[f]);
+                }
+            }
+            permutations[subset].program = cache.getProgram(vertexShaderFileName, fragmentShaderFileName, permutationDefines);
+            permutations[subset].uniforms = cache.getUniforms(permutations[subset].program);
+        }
+
+        const Permutation& bound = permutations[features & this->permutationFeatures];
+        this->shaderProgram = bound.program;
+        this->uniforms = bound.uniforms;
+    }
+
+    void Shader::setFeatures(unsigned features)
+    {
+        this->features = features;
     }
 
-    void Shader::shaderCompileLog(GLuint shaderId)
+    unsigned Shader::getFeatures() const
     {
-        GLint success;
-        GLchar infoLog[512];
-
-        //check compilation info
-        glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success);
-        if(!success)
-        {
-            glGetShaderInfoLog(shaderId, 512, NULL, infoLog);
-            std::cout << "Shader compilation error\n" << infoLog << std::endl;
+        return features;
+    }
+
+    void Shader::useShaderProgram(unsigned disabledFeatures)
+    {
+        if (!permutations.empty()) {
+            const Permutation& permutation = permutations[features & ~disabledFeatures & permutationFeatures];
+            this->shaderProgram = permutation.program;
+            this->uniforms = permutation.uniforms;
         }
+        glUseProgram(this->shaderProgram);
     }
 
-    void Shader::shaderLinkLog(GLuint shaderProgramId)
+    GLuint Shader::getProgram(unsigned disabledFeatures) const
     {
-        GLint success;
-        GLchar infoLog[512];
-
-        //check linking info
-        glGetProgramiv(shaderProgramId, GL_LINK_STATUS, &success);
-        if(!success) {
-            glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-            std::cout << "Shader linking error\n" << infoLog << std::endl;
+        if (permutations.empty()) {
+            return this->shaderProgram;
         }
+        return permutations[features & ~disabledFeatures & permutationFeatures].program;
     }
 
-    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName)
+    int Shader::getUniform(UniformName name) const
     {
-        //read, parse and compile the vertex shader
-        std::string v = readShaderFile(vertexShaderFileName);
-        const GLchar* vertexShaderString = v.c_str();
-        GLuint vertexShader;
-        vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderString, NULL);
-        glCompileShader(vertexShader);
-        //check compilation status
-        shaderCompileLog(vertexShader);
-
-        //read, parse and compile the vertex shader
-        std::string f = readShaderFile(fragmentShaderFileName);
-        const GLchar* fragmentShaderString = f.c_str();
-        GLuint fragmentShader;
-        fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderString, NULL);
-        glCompileShader(fragmentShader);
-        //check compilation status
-        shaderCompileLog(fragmentShader);
-
-        //attach and link the shader programs
-        this->shaderProgram = glCreateProgram();
-        glAttachShader(this->shaderProgram, vertexShader);
-        glAttachShader(this->shaderProgram, fragmentShader);
-        glLinkProgram(this->shaderProgram);
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
-        //check linking info
-        shaderLinkLog(this->shaderProgram);
-    }
-
-    void Shader::useShaderProgram()
+        return uniforms ? uniforms->find(name) : -1;
+    }
+
+    void Shader::setUniform(int handle, GLint value)
     {
-        glUseProgram(this->shaderProgram);
+        if (uniforms && uniforms->Update(handle, &value, sizeof(value))) {
+            glProgramUniform1i(shaderProgram, uniforms->getLocation(handle), value);
+        }
+    }
+
+    void Shader::setUniform(int handle, GLfloat value)
+    {
+        if (uniforms && uniforms->Update(handle, &value, sizeof(value))) {
+            glProgramUniform1f(shaderProgram, uniforms->getLocation(handle), value);
+        }
+    }
+
+    void Shader::setUniform(int handle, const glm::vec3& value)
+    {
+        if (uniforms && uniforms->Update(handle, glm::value_ptr(value), sizeof(value))) {
+            glProgramUniform3fv(shaderProgram, uniforms->getLocation(handle), 1, glm::value_ptr(value));
+        }
+    }
+
+    void Shader::setUniform(int handle, const glm::mat3& value)
+    {
+        if (uniforms && uniforms->Update(handle, glm::value_ptr(value), sizeof(value))) {
+            glProgramUniformMatrix3fv(shaderProgram, uniforms->getLocation(handle), 1, GL_FALSE, glm::value_ptr(value));
+        }
+    }
+
+    void Shader::setUniform(int handle, const glm::mat4& value)
+    {
+        if (uniforms && uniforms->Update(handle, glm::value_ptr(value), sizeof(value))) {
+            glProgramUniformMatrix4fv(shaderProgram, uniforms->getLocation(handle), 1, GL_FALSE, glm::value_ptr(value));
+        }
+    }
+
+    void Shader::setSampler(UniformName name, GLint unit)
+    {
+        for (size_t p = 0; p < permutations.size(); p++) {
+            UniformTable* table = permutations[p].uniforms;
+            int handle = table ? table->find(name) : -1;
+            if (table && table->Update(handle, &unit, sizeof(unit))) {
+                glProgramUniform1i(permutations[p].program, table->getLocation(handle), unit);
+            }
+        }
     }
 
 }
@@ -3,25 +3,90 @@
 
 #include <GL/glew.h>
 
-#include <iostream>
-#include <fstream>
-#include <sstream>
-#include <iostream>
+#include "ShaderCache.hpp"
+
+#include "glm/glm.hpp"
+
 #include <string>
+#include <vector>
 
 namespace gps {
 
+// Features a program can be compiled with or without - each one is a #define of its name in the permutation
+enum ShaderFeature {
+    SHADER_FOG = 1 << 0,
+    SHADER_POINT_LIGHT = 1 << 1,
+    SHADER_SHADOWS = 1 << 2,
+    // the drawn mesh has a specular map
+    SHADER_TEXTURED_SPECULAR = 1 << 3,
+    // the drawn range is cross-fading between levels of detail - the dither discard
+    SHADER_LOD_FADE = 1 << 4
+};
+
+const unsigned SHADER_FEATURE_COUNT = 5;
+const unsigned SHADER_ALL_FEATURES = (1u << SHADER_FEATURE_COUNT) - 1;
+
+// Names of the features set in a mask, separated by spaces - "none" for 0
+std::string getShaderFeatureNames(unsigned features);
+
+// Handle to a program of the ShaderCache - move-only, pass it by reference
 class Shader
 {
 public:
+    // Name of the program bound last by useShaderProgram - 0 until loaded
     GLuint shaderProgram;
-    void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
-    void useShaderProgram();
+
+    Shader();
+    Shader(Shader&& other) noexcept;
+    Shader& operator=(Shader&& other) noexcept;
+    Shader(const Shader&) = delete;
+    Shader& operator=(const Shader&) = delete;
+
+    // Compiles the combination on first use only - later calls get the cached program
+    // permutationFeatures builds one program per subset of those features, all of them up front
+    void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName,
+        const std::vector<std::string>& defines = std::vector<std::string>(), unsigned permutationFeatures = 0);
+
+    // Features of the permutation useShaderProgram binds - the ones the program has no permutations for are ignored
+    void setFeatures(unsigned features);
+    unsigned getFeatures() const;
+
+    // Binds the permutation of the features, less the ones the drawn object cannot use
+    void useShaderProgram(unsigned disabledFeatures = 0);
+    // The program useShaderProgram would bind, without binding it
+    GLuint getProgram(unsigned disabledFeatures = 0) const;
+
+    // Handle of an active uniform, to keep for the setters - -1 if the program does not use it
+    int getUniform(UniformName name) const;
+
+    // The setters write straight to the program, bound or not, and skip values the uniform already holds.
+    // Handles of -1 are ignored.
+    void setUniform(int handle, GLint value);
+    void setUniform(int handle, GLfloat value);
+    void setUniform(int handle, const glm::vec3& value);
+    void setUniform(int handle, const glm::mat3& value);
+    void setUniform(int handle, const glm::mat4& value);
+
+    template <typename T>
+    void setUniform(UniformName name, const T& value) {
+        setUniform(getUniform(name), value);
+    }
+
+    // Points a sampler of every permutation at a texture unit
+    void setSampler(UniformName name, GLint unit);
 
 private:
-    std::string readShaderFile(std::string fileName);
-    void shaderCompileLog(GLuint shaderId);
-    void shaderLinkLog(GLuint shaderProgramId);
+    struct Permutation {
+        GLuint program;
+        UniformTable* uniforms;
+    };
+
+    // of the bound program - owned by the ShaderCache, NULL until loaded
+    UniformTable* uniforms;
+    // indexed by feature mask, only the subsets of permutationFeatures are filled
+    std::vector<Permutation> permutations;
+    unsigned permutationFeatures;
+    unsigned features;
 };
 
 }
@@ -0,0 +1,401 @@
+#include "ShaderCache.hpp"
+
+#include "UniformBuffers.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+namespace gps {
+
+    namespace {
+
+        const char MAGIC[4] = { 'G', 'P', 'S', 'B' };
+        // Bump whenever the layout of the binary files changes
+        const uint32_t VERSION = 1;
+
+        // followed by the program binary
+        struct BinaryHeader {
+            char magic[4];
+            uint32_t version;
+            uint64_t sourceHash;
+            uint32_t binaryFormat;
+            uint32_t binaryLength;
+        };
+
+        // FNV-1a
+        uint64_t HashString(const std::string& text, uint64_t hash = 14695981039346656037ull) {
+            for (size_t i = 0; i < text.size(); i++) {
+                hash ^= static_cast<unsigned char>(text[i]);
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        std::string GLString(GLenum name) {
+            const GLubyte* text = glGetString(name);
+            return text ? reinterpret_cast<const char*>(text) : "";
+        }
+    }
+
+    UniformTable::UniformTable() : uploadCount(0), skipCount(0)
+    {
+    }
+
+    void UniformTable::Reflect(GLuint program)
+    {
+        uniforms.clear();
+        handles.clear();
+
+        GLint count = 0;
+        GLint maxLength = 0;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> name(maxLength > 0 ? maxLength : 1);
+
+        for (GLint i = 0; i < count; i++) {
+            Uniform uniform;
+            GLsizei length = 0;
+            glGetActiveUniform(program, i, static_cast<GLsizei>(name.size()), &length, &uniform.size, &uniform.type, name.data());
+            uniform.name.assign(name.data(), length);
+            // arrays are reported as "name[0]" - they are set through their first element
+            size_t bracket = uniform.name.find('[');
+            if (bracket != std::string::npos) {
+                uniform.name.erase(bracket);
+            }
+            // members of uniform blocks have no location
+            uniform.location = glGetUniformLocation(program, uniform.name.c_str());
+            if (uniform.location < 0) {
+                continue;
+            }
+            uniform.hasValue = false;
+            handles[UniformHash(uniform.name.c_str())] = static_cast<int>(uniforms.size());
+            uniforms.push_back(uniform);
+        }
+    }
+
+    int UniformTable::find(UniformName name) const
+    {
+        std::unordered_map<uint64_t, int>::const_iterator found = handles.find(name.hash);
+        return found != handles.end() ? found->second : -1;
+    }
+
+    bool UniformTable::Update(int handle, const void* value, size_t bytes)
+    {
+        if (handle < 0 || handle >= static_cast<int>(uniforms.size()) || bytes > MAX_VALUE_BYTES) {
+            return false;
+        }
+        Uniform& uniform = uniforms[handle];
+        if (uniform.hasValue && memcmp(uniform.value, value, bytes) == 0) {
+            skipCount++;
+            return false;
+        }
+        memcpy(uniform.value, value, bytes);
+        uniform.hasValue = true;
+        uploadCount++;
+        return true;
+    }
+
+    GLint UniformTable::getLocation(int handle) const
+    {
+        return handle >= 0 && handle < static_cast<int>(uniforms.size()) ? uniforms[handle].location : -1;
+    }
+
+    size_t UniformTable::getUploadCount() const
+    {
+        return uploadCount;
+    }
+
+    size_t UniformTable::getSkipCount() const
+    {
+        return skipCount;
+    }
+
+    const char* ShaderCache::CACHE_DIRECTORY = "shader_cache";
+
+    ShaderCache& ShaderCache::getInstance()
+    {
+        static ShaderCache* instance = new ShaderCache();
+        return *instance;
+    }
+
+    ShaderCache::ShaderCache()
+        : programBinaries(true), binariesChecked(false), binariesSupported(false),
+        compileCount(0), binaryLoadCount(0), hitCount(0), frameBuildCount(0)
+    {
+    }
+
+    GLuint ShaderCache::getProgram(const std::string& vertexShaderFileName, const std::string& fragmentShaderFileName,
+        const std::vector<std::string>& defines)
+    {
+        std::string key = vertexShaderFileName + "|" + fragmentShaderFileName;
+        for (size_t d = 0; d < defines.size(); d++) {
+            key += "|" + defines[d];
+        }
+
+        std::unordered_map<std::string, GLProgram>::const_iterator found = programs.find(key);
+        if (found != programs.end()) {
+            hitCount++;
+            return found->second.get();
+        }
+
+        std::string vertexSource;
+        std::string fragmentSource;
+        if (!ReadSource(vertexShaderFileName, defines, vertexSource) || !ReadSource(fragmentShaderFileName, defines, fragmentSource)) {
+            // keeps failing loudly on every call instead of caching a broken program
+            return 0;
+        }
+        frameBuildCount++;
+
+        bool useBinaries = programBinaries && BinariesSupported();
+        // the binary is only valid for the same sources on the same driver
+        uint64_t sourceHash = HashString(fragmentSource, HashString(vertexSource, HashString(driver)));
+        char keyHash[17];
+        snprintf(keyHash, sizeof(keyHash), "%016llx", static_cast<unsigned long long>(HashString(key)));
+        std::string binaryFileName = std::string(CACHE_DIRECTORY) + "/" + keyHash + ".bin";
+
+        GLuint program = useBinaries ? LoadBinary(binaryFileName, sourceHash) : 0;
+        if (program != 0) {
+            binaryLoadCount++;
+        }
+        else {
+            program = Compile(vertexShaderFileName, vertexSource, fragmentShaderFileName, fragmentSource, useBinaries);
+            compileCount++;
+            if (!LinkLog(program, key)) {
+                // neither cached nor saved - the next call compiles again, after the source is fixed
+                glDeleteProgram(program);
+                return 0;
+            }
+            if (useBinaries) {
+                SaveBinary(binaryFileName, sourceHash, program);
+            }
+        }
+
+        programs[key] = GLProgram(program);
+        // block bindings are reset by every link and binary load
+        UniformBuffers::BindBlocks(program);
+        uniformTables[program].Reflect(program);
+        return program;
+    }
+
+    UniformTable* ShaderCache::getUniforms(GLuint program)
+    {
+        std::unordered_map<GLuint, UniformTable>::iterator found = uniformTables.find(program);
+        return found != uniformTables.end() ? &found->second : NULL;
+    }
+
+    void ShaderCache::setProgramBinaries(bool enabled)
+    {
+        programBinaries = enabled;
+    }
+
+    void ShaderCache::BeginFrame()
+    {
+        frameBuildCount = 0;
+    }
+
+    size_t ShaderCache::getFrameBuildCount() const
+    {
+        return frameBuildCount;
+    }
+
+    void ShaderCache::PrintStats() const
+    {
+        printf("Shader cache   : %zu programs, %zu compiled, %zu loaded from binaries, %zu hits, program binaries %s\n",
+            programs.size(), compileCount, binaryLoadCount, hitCount,
+            !programBinaries ? "off" : binariesSupported ? "on" : "unsupported");
+
+        size_t uploadCount = 0;
+        size_t skipCount = 0;
+        for (std::unordered_map<GLuint, UniformTable>::const_iterator it = uniformTables.begin(); it != uniformTables.end(); ++it) {
+            uploadCount += it->second.getUploadCount();
+            skipCount += it->second.getSkipCount();
+        }
+        printf("Uniforms       : %zu uploaded, %zu unchanged and skipped\n", uploadCount, skipCount);
+    }
+
+    void ShaderCache::Clear()
+    {
+        uniformTables.clear();
+        programs.clear();
+    }
+
+    bool ShaderCache::BinariesSupported()
+    {
+        if (!binariesChecked) {
+            binariesChecked = true;
+            GLint formatCount = 0;
+            if (GLEW_ARB_get_program_binary) {
+                glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+            }
+            binariesSupported = formatCount > 0;
+            driver = GLString(GL_VENDOR) + "|" + GLString(GL_RENDERER) + "|" + GLString(GL_VERSION);
+        }
+        return binariesSupported;
+    }
+
+    GLuint ShaderCache::LoadBinary(const std::string& binaryFileName, uint64_t sourceHash)
+    {
+        std::ifstream in(binaryFileName.c_str(), std::ios::binary);
+        if (!in) {
+            return 0;
+        }
+
+        BinaryHeader header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(BinaryHeader))
+            || memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION || header.sourceHash != sourceHash) {
+            return 0;
+        }
+        std::vector<char> binary(header.binaryLength);
+        if (!in.read(binary.data(), binary.size())) {
+            return 0;
+        }
+
+        GLProgram program = GLProgram::Create();
+        glProgramParameteri(program.get(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glProgramBinary(program.get(), header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+
+        // drivers reject binaries of other versions here - the caller compiles instead
+        GLint success;
+        glGetProgramiv(program.get(), GL_LINK_STATUS, &success);
+        return success ? program.release() : 0;
+    }
+
+    // Writes next to the final name first, so a half-written file is never picked up
+    void ShaderCache::SaveBinary(const std::string& binaryFileName, uint64_t sourceHash, GLuint program)
+    {
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) {
+            return;
+        }
+        std::vector<char> binary(length);
+        GLenum binaryFormat;
+        glGetProgramBinary(program, length, NULL, &binaryFormat, binary.data());
+
+#ifdef _WIN32
+        _mkdir(CACHE_DIRECTORY);
+#else
+        mkdir(CACHE_DIRECTORY, 0755);
+#endif
+        BinaryHeader header;
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.sourceHash = sourceHash;
+        header.binaryFormat = binaryFormat;
+        header.binaryLength = static_cast<uint32_t>(length);
+
+        std::string tempFileName = binaryFileName + ".tmp";
+        std::ofstream out(tempFileName.c_str(), std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(BinaryHeader));
+        out.write(binary.data(), binary.size());
+        out.close();
+        if (!out) {
+            remove(tempFileName.c_str());
+            return;
+        }
+        remove(binaryFileName.c_str());
+        if (rename(tempFileName.c_str(), binaryFileName.c_str()) != 0) {
+            remove(tempFileName.c_str());
+        }
+    }
+
+    GLuint ShaderCache::Compile(const std::string& vertexShaderFileName, const std::string& vertexSource,
+        const std::string& fragmentShaderFileName, const std::string& fragmentSource, bool retrievable)
+    {
+        const GLchar* vertexShaderString = vertexSource.c_str();
+        GLShaderObject vertexShader(glCreateShader(GL_VERTEX_SHADER));
+        glShaderSource(vertexShader.get(), 1, &vertexShaderString, NULL);
+        glCompileShader(vertexShader.get());
+        CompileLog(vertexShader.get(), vertexShaderFileName);
+
+        const GLchar* fragmentShaderString = fragmentSource.c_str();
+        GLShaderObject fragmentShader(glCreateShader(GL_FRAGMENT_SHADER));
+        glShaderSource(fragmentShader.get(), 1, &fragmentShaderString, NULL);
+        glCompileShader(fragmentShader.get());
+        CompileLog(fragmentShader.get(), fragmentShaderFileName);
+
+        // the shader objects are deleted when they go out of scope, once linked
+        GLuint program = glCreateProgram();
+        if (retrievable) {
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        glAttachShader(program, vertexShader.get());
+        glAttachShader(program, fragmentShader.get());
+        glLinkProgram(program);
+        glDetachShader(program, vertexShader.get());
+        glDetachShader(program, fragmentShader.get());
+        return program;
+    }
+
+    // The defines go right behind the #version line, #line keeps the compile errors pointing at the file's lines
+    bool ShaderCache::ReadSource(const std::string& fileName, const std::vector<std::string>& defines, std::string& source)
+    {
+        std::ifstream file(fileName.c_str(), std::ios::binary);
+        if (!file) {
+            std::cerr << "ERROR: could not read shader " << fileName << std::endl;
+            return false;
+        }
+        file.seekg(0, std::ios::end);
+        source.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0, std::ios::beg);
+        file.read(&source[0], source.size());
+
+        if (defines.empty()) {
+            return true;
+        }
+
+        std::string defineLines;
+        for (size_t d = 0; d < defines.size(); d++) {
+            defineLines += "#define " + defines[d] + "\n";
+        }
+
+        size_t version = source.find("#version");
+        if (version == std::string::npos) {
+            source = defineLines + "#line 1\n" + source;
+            return true;
+        }
+        size_t lineEnd = source.find('\n', version);
+        size_t versionLine = 1;
+        for (size_t i = 0; i < version; i++) {
+            versionLine += source[i] == '\n';
+        }
+        std::string insert = (lineEnd == std::string::npos ? "\n" : "") + defineLines + "#line " + std::to_string(versionLine + 1) + "\n";
+        source.insert(lineEnd == std::string::npos ? source.size() : lineEnd + 1, insert);
+        return true;
+    }
+
+    bool ShaderCache::CompileLog(GLuint shaderId, const std::string& fileName)
+    {
+        GLint success;
+        GLchar infoLog[512];
+
+        //check compilation info
+        glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success);
+        if (!success) {
+            glGetShaderInfoLog(shaderId, 512, NULL, infoLog);
+            std::cout << "Shader compilation error (" << fileName << ")\n" << infoLog << std::endl;
+        }
+        return success != 0;
+    }
+
+    bool ShaderCache::LinkLog(GLuint programId, const std::string& name)
+    {
+        GLint success;
+        GLchar infoLog[512];
+
+        //check linking info
+        glGetProgramiv(programId, GL_LINK_STATUS, &success);
+        if (!success) {
+            glGetProgramInfoLog(programId, 512, NULL, infoLog);
+            std::cout << "Shader linking error (" << name << ")\n" << infoLog << std::endl;
+        }
+        return success != 0;
+    }
+}
@@ -0,0 +1,127 @@
+#ifndef ShaderCache_hpp
+#define ShaderCache_hpp
+
+#include <GL/glew.h>
+
+#include "GLHandle.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+// FNV-1a of a uniform name - constexpr, so the names written as literals are hashed by the compiler
+constexpr uint64_t UniformHash(const char* name, uint64_t hash = 14695981039346656037ull) {
+    return *name == '\0' ? hash : UniformHash(name + 1, (hash ^ static_cast<unsigned char>(*name)) * 1099511628211ull);
+}
+
+// A uniform name, looked up by its hash
+struct UniformName {
+    uint64_t hash;
+    constexpr UniformName(const char* name) : hash(UniformHash(name)) {}
+};
+
+// The active uniforms of a program, reflected once it links, with the last value uploaded to each.
+// A handle is the index of a uniform in the table, -1 for one the program does not have.
+class UniformTable
+{
+public:
+    // Large enough for a mat4
+    static const size_t MAX_VALUE_BYTES = 16 * sizeof(GLfloat);
+
+    UniformTable();
+
+    void Reflect(GLuint program);
+
+    int find(UniformName name) const;
+    // Records the value of a uniform - false if it already holds it, so the upload can be skipped
+    bool Update(int handle, const void* value, size_t bytes);
+    GLint getLocation(int handle) const;
+
+    size_t getUploadCount() const;
+    size_t getSkipCount() const;
+
+private:
+    struct Uniform {
+        std::string name;
+        GLint location;
+        GLenum type;
+        GLint size;
+        bool hasValue;
+        unsigned char value[MAX_VALUE_BYTES];
+    };
+
+    std::vector<Uniform> uniforms;
+    std::unordered_map<uint64_t, int> handles;
+    size_t uploadCount;
+    size_t skipCount;
+};
+
+// Linked programs shared by every Shader, one per (vertex file, fragment file, defines) combination.
+// Each combination is compiled once per run - and once per driver, when the driver can hand out program binaries:
+// those are kept in CACHE_DIRECTORY, keyed on the sources and the driver, and loaded instead of compiling.
+// Only used from the thread owning the GL context.
+class ShaderCache
+{
+public:
+    static const char* CACHE_DIRECTORY;
+
+    // Never destroyed, so shaders can still be loaded from static constructors
+    static ShaderCache& getInstance();
+
+    // Returns the program of a combination, building it on first use - owned by the cache, 0 if it failed to build
+    // defines are inserted as "#define <define>" lines behind the #version line of both stages
+    GLuint getProgram(const std::string& vertexShaderFileName, const std::string& fragmentShaderFileName,
+        const std::vector<std::string>& defines = std::vector<std::string>());
+
+    // Uniforms of a program returned by getProgram - NULL for any other name, valid until Clear
+    UniformTable* getUniforms(GLuint program);
+
+    // Reads and writes program binaries - on by default where the driver supports them
+    void setProgramBinaries(bool enabled);
+
+    // Starts counting the programs built during a frame
+    void BeginFrame();
+    // Programs compiled or loaded from binaries since BeginFrame - anything but 0 after startup is a stall
+    size_t getFrameBuildCount() const;
+
+    void PrintStats() const;
+
+    // Deletes every program - before the GL context goes away
+    void Clear();
+
+private:
+    std::unordered_map<std::string, GLProgram> programs;
+    std::unordered_map<GLuint, UniformTable> uniformTables;
+    bool programBinaries;
+    bool binariesChecked;
+    bool binariesSupported;
+    std::string driver;
+    size_t compileCount;
+    size_t binaryLoadCount;
+    size_t hitCount;
+    size_t frameBuildCount;
+
+    ShaderCache();
+    ShaderCache(const ShaderCache&);
+    ShaderCache& operator=(const ShaderCache&);
+
+    bool BinariesSupported();
+
+    // Returns 0 unless the binary exists, was made from these sources by this driver and links
+    GLuint LoadBinary(const std::string& binaryFileName, uint64_t sourceHash);
+    void SaveBinary(const std::string& binaryFileName, uint64_t sourceHash, GLuint program);
+
+    static GLuint Compile(const std::string& vertexShaderFileName, const std::string& vertexSource,
+        const std::string& fragmentShaderFileName, const std::string& fragmentSource, bool retrievable);
+    static bool ReadSource(const std::string& fileName, const std::vector<std::string>& defines, std::string& source);
+    static bool CompileLog(GLuint shaderId, const std::string& fileName);
+    static bool LinkLog(GLuint programId, const std::string& name);
+};
+
+}
+
+#endif /* ShaderCache_hpp */
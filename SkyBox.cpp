@@ -8,8 +8,12 @@
 
 #include "SkyBox.hpp"
 
+#include <algorithm>
+
 namespace gps {
     
+    const char* const SkyBox::FACE_FILES[6] = { "right.tga", "left.tga", "top.tga", "bottom.tga", "back.tga", "front.tga" };
+    
     SkyBox::SkyBox()
     {
         
@@ -21,49 +25,70 @@ namespace gps {
         InitSkyBox();
     }
     
-    void SkyBox::Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix)
+    bool SkyBox::Load(const std::string& bundleFileName)
+    {
+        AssetBundle bundle;
+        if (!bundle.Open(bundleFileName)) {
+            return false;
+        }
+        if (bundle.getCubeMaps().empty()) {
+            fprintf(stderr, "ERROR: bundle %s has no cube map\n", bundleFileName.c_str());
+            return false;
+        }
+        if (!GLEW_EXT_texture_compression_s3tc) {
+            fprintf(stderr, "ERROR: this GPU cannot load the compressed cube map of %s\n", bundleFileName.c_str());
+            return false;
+        }
+        
+        cubemapTexture = LoadSkyBoxTextures(bundle.getCubeMaps()[0]);
+        InitSkyBox();
+        return true;
+    }
+    
+    void SkyBox::Draw(gps::Shader& shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix)
     {
         shader.useShaderProgram();
         
         //set the view and projection matrices
         glm::mat4 transformedView = glm::mat4(glm::mat3(viewMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(transformedView));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+        shader.setUniform("view", transformedView);
+        shader.setUniform("projection", projectionMatrix);
         
         glDepthFunc(GL_LEQUAL);
         
-        glBindVertexArray(skyboxVAO);
+        glBindVertexArray(skyboxVAO.get());
         glActiveTexture(GL_TEXTURE0);
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+        shader.setUniform("skybox", 0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture.get());
         glDrawArrays(GL_TRIANGLES, 0, 36);
         glBindVertexArray(0);
         
         glDepthFunc(GL_LESS);
     }
     
-    GLuint SkyBox::LoadSkyBoxTextures(std::vector<const GLchar*> skyBoxFaces)
+    GLTexture SkyBox::LoadSkyBoxTextures(std::vector<const GLchar*> skyBoxFaces)
     {
-        GLuint textureID;
-        glGenTextures(1, &textureID);
+        GLTexture texture = GLTexture::Create();
         glActiveTexture(GL_TEXTURE0);
         
         int width,height, n;
         unsigned char* image;
         int force_channels = 3;
         
-        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texture.get());
         for(GLuint i = 0; i < skyBoxFaces.size(); i++)
         {
             image = stbi_load(skyBoxFaces[i], &width, &height, &n, force_channels);
             if (!image) {
                 fprintf(stderr, "ERROR: could not load %s\n", skyBoxFaces[i]);
-                return false;
+                glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+                return GLTexture();
             }
             glTexImage2D(
                          GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
                          GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
                          );
+            stbi_image_free(image);
         }
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -72,7 +97,38 @@ namespace gps {
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
         glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
         
-        return textureID;
+        return texture;
+    }
+    
+    // The faces come with baked mip chains
+    GLTexture SkyBox::LoadSkyBoxTextures(const AssetBundle::CubeMap& cubeMap)
+    {
+        GLTexture texture = GLTexture::Create();
+        glActiveTexture(GL_TEXTURE0);
+        
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texture.get());
+        GLint levelCount = static_cast<GLint>(cubeMap.faces[0].levels.size());
+        for(GLuint i = 0; i < 6; i++)
+        {
+            const AssetBundle::Image& face = cubeMap.faces[i];
+            levelCount = std::min(levelCount, static_cast<GLint>(face.levels.size()));
+            for (size_t level = 0; level < face.levels.size(); level++) {
+                glCompressedTexImage2D(
+                             GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, static_cast<GLint>(level), face.format,
+                             face.levels[level].width, face.levels[level].height, 0,
+                             static_cast<GLsizei>(face.levels[level].size), face.data + face.levels[level].offset
+                             );
+            }
+        }
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        
+        return texture;
     }
     
     void SkyBox::InitSkyBox()
@@ -121,11 +177,11 @@ namespace gps {
             1.0f, -1.0f,  1.0f
         };
         
-        glGenVertexArrays(1, &(this->skyboxVAO));
-        glGenBuffers(1, &skyboxVBO);
+        skyboxVAO = GLVertexArray::Create();
+        skyboxVBO = GLBuffer::Create();
         
-        glBindVertexArray(skyboxVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
+        glBindVertexArray(skyboxVAO.get());
+        glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO.get());
         glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
         
         glEnableVertexAttribArray(0);
@@ -136,6 +192,13 @@ namespace gps {
     
     GLuint SkyBox::GetTextureId()
     {
-        return cubemapTexture;
+        return cubemapTexture.get();
+    }
+
+    void SkyBox::Clear()
+    {
+        skyboxVAO.reset();
+        skyboxVBO.reset();
+        cubemapTexture.reset();
     }
 }
@@ -11,6 +11,9 @@
 
 #include <stdio.h>
 #include "Shader.hpp"
+#include "AssetBundle.hpp"
+#include "GLHandle.hpp"
+#include <string>
 #include <vector>
 #include "stb_image.h"
 #include "glm/glm.hpp"
@@ -21,14 +24,21 @@ namespace gps {
     {
     public:
         SkyBox();
+        // File names of the cube map faces, in the order Load expects them
+        static const char* const FACE_FILES[6];
         void Load(std::vector<const GLchar*> cubeMapFaces);
-        void Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix);
+        // Loads the first cube map of a bundle baked by asset_baker - false if there is none
+        bool Load(const std::string& bundleFileName);
+        void Draw(gps::Shader& shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix);
         GLuint GetTextureId();
+        // Frees the cube map and its geometry - while the GL context is still current
+        void Clear();
     private:
-        GLuint skyboxVAO;
-        GLuint skyboxVBO;
-        GLuint cubemapTexture;
-        GLuint LoadSkyBoxTextures(std::vector<const GLchar*> cubeMapFaces);
+        GLVertexArray skyboxVAO;
+        GLBuffer skyboxVBO;
+        GLTexture cubemapTexture;
+        GLTexture LoadSkyBoxTextures(std::vector<const GLchar*> cubeMapFaces);
+        GLTexture LoadSkyBoxTextures(const AssetBundle::CubeMap& cubeMap);
         void InitSkyBox();
     };
 }
@@ -0,0 +1,222 @@
+#include "TextureCache.hpp"
+#include "TextureLoader.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+
+namespace gps {
+
+    namespace {
+        // FNV-1a
+        uint64_t HashBytes(const unsigned char* data, size_t size) {
+            uint64_t hash = 14695981039346656037ull;
+            for (size_t i = 0; i < size; i++) {
+                hash ^= data[i];
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+    }
+
+    TextureCache& TextureCache::getInstance()
+    {
+        static TextureCache* instance = new TextureCache();
+        return *instance;
+    }
+
+    TextureCache::TextureCache()
+        : deduplicateContent(false), hits(0), contentHits(0), misses(0)
+    {
+    }
+
+    // Absolute path with forward slashes and no "." or ".." segments, lower case on Windows
+    std::string TextureCache::CanonicalPath(const std::string& fileName)
+    {
+        std::string path = fileName;
+#ifdef _WIN32
+        char resolved[_MAX_PATH];
+        if (_fullpath(resolved, fileName.c_str(), _MAX_PATH)) {
+            path = resolved;
+        }
+        std::replace(path.begin(), path.end(), '\\', '/');
+        std::transform(path.begin(), path.end(), path.begin(), ::tolower);
+#else
+        // also resolves symbolic links, but only works for files that exist
+        char resolved[PATH_MAX];
+        if (realpath(fileName.c_str(), resolved)) {
+            path = resolved;
+        }
+#endif
+
+        // collapse the segments lexically for paths that could not be resolved
+        std::vector<std::string> segments;
+        size_t start = 0;
+        while (start <= path.size()) {
+            size_t end = path.find('/', start);
+            if (end == std::string::npos) {
+                end = path.size();
+            }
+            std::string segment = path.substr(start, end - start);
+            if (segment == "..") {
+                if (!segments.empty() && segments.back() != "..") {
+                    segments.pop_back();
+                } else {
+                    segments.push_back(segment);
+                }
+            } else if (!segment.empty() && segment != ".") {
+                segments.push_back(segment);
+            }
+            start = end + 1;
+        }
+
+        std::string canonical = (!path.empty() && path[0] == '/') ? "/" : "";
+        for (size_t i = 0; i < segments.size(); i++) {
+            if (i > 0) {
+                canonical += '/';
+            }
+            canonical += segments[i];
+        }
+        return canonical;
+    }
+
+    bool TextureCache::HashFile(const std::string& fileName, uint64_t& hash)
+    {
+        MappedFile file;
+        if (!file.Open(fileName)) {
+            return false;
+        }
+        // mix in the size so files that are prefixes of each other stay apart
+        hash = HashBytes(file.getData(), file.getSize()) ^ static_cast<uint64_t>(file.getSize());
+        return true;
+    }
+
+    GLuint TextureCache::Acquire(const std::string& fileName)
+    {
+        std::string path = CanonicalPath(fileName);
+
+        std::unordered_map<std::string, GLuint>::const_iterator found = byPath.find(path);
+        if (found != byPath.end()) {
+            hits++;
+            entries[found->second].references++;
+            return found->second;
+        }
+
+        uint64_t contentHash = 0;
+        bool hashed = deduplicateContent && HashFile(fileName, contentHash);
+        if (hashed) {
+            std::unordered_map<uint64_t, GLuint>::const_iterator same = byContent.find(contentHash);
+            if (same != byContent.end()) {
+                hits++;
+                contentHits++;
+                Entry& entry = entries[same->second];
+                entry.references++;
+                entry.paths.push_back(path);
+                byPath[path] = same->second;
+                return same->second;
+            }
+        }
+
+        misses++;
+        return AddEntry(path, TextureLoader::getInstance().Request(fileName), hashed, contentHash);
+    }
+
+    // Bundle textures are keyed by the bundle's path and the texture name
+    GLuint TextureCache::Acquire(const AssetBundle& bundle, size_t textureIndex)
+    {
+        std::string path = CanonicalPath(bundle.getFileName()) + "#" + bundle.getTextureNames()[textureIndex];
+
+        std::unordered_map<std::string, GLuint>::const_iterator found = byPath.find(path);
+        if (found != byPath.end()) {
+            hits++;
+            entries[found->second].references++;
+            return found->second;
+        }
+
+        misses++;
+        CompressedImage* image = bundle.getTextures()[textureIndex].Copy();
+        return AddEntry(path, TextureLoader::getInstance().Request(image, path), false, 0);
+    }
+
+    GLuint TextureCache::AddEntry(const std::string& path, GLuint textureID, bool hashed, uint64_t contentHash)
+    {
+        Entry entry;
+        entry.references = 1;
+        entry.paths.push_back(path);
+        entry.hashed = hashed;
+        entry.contentHash = contentHash;
+        entries[textureID] = entry;
+        byPath[path] = textureID;
+        if (hashed) {
+            byContent[contentHash] = textureID;
+        }
+        return textureID;
+    }
+
+    void TextureCache::Release(GLuint textureID)
+    {
+        std::unordered_map<GLuint, Entry>::iterator found = entries.find(textureID);
+        if (found == entries.end()) {
+            fprintf(stderr, "ERROR: releasing texture %u which is not in the texture cache\n", textureID);
+            return;
+        }
+
+        Entry& entry = found->second;
+        if (--entry.references > 0) {
+            return;
+        }
+
+        for (size_t i = 0; i < entry.paths.size(); i++) {
+            byPath.erase(entry.paths[i]);
+        }
+        if (entry.hashed) {
+            byContent.erase(entry.contentHash);
+        }
+        entries.erase(found);
+        TextureLoader::getInstance().Delete(textureID);
+    }
+
+    void TextureCache::setContentDeduplication(bool enabled)
+    {
+        deduplicateContent = enabled;
+    }
+
+    size_t TextureCache::getTextureCount() const
+    {
+        return entries.size();
+    }
+
+    size_t TextureCache::getResidentBytes() const
+    {
+        size_t bytes = 0;
+        for (std::unordered_map<GLuint, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+            bytes += TextureLoader::getInstance().getTextureBytes(it->first);
+        }
+        return bytes;
+    }
+
+    size_t TextureCache::getSavedBytes() const
+    {
+        size_t bytes = 0;
+        for (std::unordered_map<GLuint, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+            bytes += TextureLoader::getInstance().getSavedBytes(it->first);
+        }
+        return bytes;
+    }
+
+    float TextureCache::getHitRate() const
+    {
+        size_t requests = hits + misses;
+        return requests > 0 ? static_cast<float>(hits) / requests : 0.0f;
+    }
+
+    void TextureCache::PrintStats() const
+    {
+        printf("Texture cache  : %zu textures, %.1f MB resident (%.1f MB saved by compression), %.1f%% hit rate (%zu hits, %zu by content, %zu misses)\n",
+            getTextureCount(), getResidentBytes() / (1024.0 * 1024.0), getSavedBytes() / (1024.0 * 1024.0),
+            getHitRate() * 100.0f, hits, contentHits, misses);
+    }
+
+}
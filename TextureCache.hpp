@@ -0,0 +1,75 @@
+#ifndef TextureCache_hpp
+#define TextureCache_hpp
+
+#include <GL/glew.h>
+
+#include "AssetBundle.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+// Reference-counted textures shared by every model, keyed by the canonical path of the image file.
+// Only used from the thread owning the GL context.
+class TextureCache
+{
+public:
+    // Never destroyed, so models can still release their textures from static destructors
+    static TextureCache& getInstance();
+
+    // Returns the texture of an image file, loading it on first use - pair every call with Release
+    GLuint Acquire(const std::string& fileName);
+
+    // Returns a texture baked into a bundle, uploading it on first use - pair every call with Release
+    GLuint Acquire(const AssetBundle& bundle, size_t textureIndex);
+
+    // Drops one reference, the texture is deleted once nothing uses it
+    void Release(GLuint textureID);
+
+    // Also shares textures between different files with identical contents - hashes every new file
+    void setContentDeduplication(bool enabled);
+
+    size_t getTextureCount() const;
+    // Video memory used by the cached textures
+    size_t getResidentBytes() const;
+    // Video memory saved by block compression
+    size_t getSavedBytes() const;
+    // Fraction of Acquire calls served without loading a file
+    float getHitRate() const;
+
+    void PrintStats() const;
+
+private:
+    struct Entry {
+        int references;
+        // canonical paths mapped to this texture
+        std::vector<std::string> paths;
+        bool hashed;
+        uint64_t contentHash;
+    };
+
+    std::unordered_map<std::string, GLuint> byPath;
+    std::unordered_map<uint64_t, GLuint> byContent;
+    std::unordered_map<GLuint, Entry> entries;
+    bool deduplicateContent;
+    size_t hits;
+    size_t contentHits;
+    size_t misses;
+
+    TextureCache();
+    TextureCache(const TextureCache&);
+    TextureCache& operator=(const TextureCache&);
+
+    GLuint AddEntry(const std::string& path, GLuint textureID, bool hashed, uint64_t contentHash);
+
+    static std::string CanonicalPath(const std::string& fileName);
+    static bool HashFile(const std::string& fileName, uint64_t& hash);
+};
+
+}
+
+#endif /* TextureCache_hpp */
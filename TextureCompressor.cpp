@@ -0,0 +1,353 @@
+#include "TextureCompressor.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    namespace {
+        float SRGBToLinear(float value) {
+            return value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+        }
+
+        float LinearToSRGB(float value) {
+            return value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+        }
+
+        struct SRGBTable {
+            float toLinear[256];
+
+            SRGBTable() {
+                for (int i = 0; i < 256; i++) {
+                    toLinear[i] = SRGBToLinear(i / 255.0f);
+                }
+            }
+        };
+
+        uint16_t Pack565(const float* color) {
+            int r = static_cast<int>(color[0] * 31.0f / 255.0f + 0.5f);
+            int g = static_cast<int>(color[1] * 63.0f / 255.0f + 0.5f);
+            int b = static_cast<int>(color[2] * 31.0f / 255.0f + 0.5f);
+            return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+        }
+
+        void Unpack565(uint16_t packed, float* color) {
+            int r = (packed >> 11) & 31;
+            int g = (packed >> 5) & 63;
+            int b = packed & 31;
+            color[0] = static_cast<float>((r << 3) | (r >> 2));
+            color[1] = static_cast<float>((g << 2) | (g >> 4));
+            color[2] = static_cast<float>((b << 3) | (b >> 2));
+        }
+
+        float Clamp255(float value) {
+            return std::min(255.0f, std::max(0.0f, value));
+        }
+
+        // Copies a 4x4 block, repeating the edge pixels past the image border
+        void FetchBlock(const unsigned char* pixels, int width, int height, int blockX, int blockY, unsigned char* block) {
+            for (int y = 0; y < 4; y++) {
+                int row = std::min(blockY * 4 + y, height - 1);
+                for (int x = 0; x < 4; x++) {
+                    int column = std::min(blockX * 4 + x, width - 1);
+                    const unsigned char* pixel = pixels + (static_cast<size_t>(row) * width + column) * 4;
+                    std::copy(pixel, pixel + 4, block + (y * 4 + x) * 4);
+                }
+            }
+        }
+    }
+
+    bool TextureCompressor::ParseFormat(const std::string& name, Format& format)
+    {
+        static const Format formats[] = { FORMAT_AUTO, FORMAT_RGBA8, FORMAT_BC1, FORMAT_BC3, FORMAT_BC7 };
+        for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+            if (name == getFormatName(formats[i])) {
+                format = formats[i];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const char* TextureCompressor::getFormatName(Format format)
+    {
+        switch (format) {
+        case FORMAT_AUTO: return "auto";
+        case FORMAT_RGBA8: return "rgba8";
+        case FORMAT_BC1: return "bc1";
+        case FORMAT_BC3: return "bc3";
+        case FORMAT_BC7: return "bc7";
+        default: return "unknown";
+        }
+    }
+
+    TextureCompressor::Format TextureCompressor::ChooseFormat(const unsigned char* pixels, int width, int height)
+    {
+        size_t pixelCount = static_cast<size_t>(width) * height;
+        for (size_t i = 0; i < pixelCount; i++) {
+            if (pixels[i * 4 + 3] != 255) {
+                return FORMAT_BC3;
+            }
+        }
+        return FORMAT_BC1;
+    }
+
+    void TextureCompressor::FlipRows(unsigned char* pixels, int width, int height)
+    {
+        size_t rowSize = static_cast<size_t>(width) * 4;
+        std::vector<unsigned char> temp(rowSize);
+        for (int row = 0; row < height / 2; row++) {
+            unsigned char* top = pixels + row * rowSize;
+            unsigned char* bottom = pixels + (height - row - 1) * rowSize;
+            memcpy(&temp[0], top, rowSize);
+            memcpy(top, bottom, rowSize);
+            memcpy(bottom, &temp[0], rowSize);
+        }
+    }
+
+    void TextureCompressor::Compress(const unsigned char* pixels, int width, int height, Format format, CompressedImage& image, bool sRGB)
+    {
+        if (format == FORMAT_AUTO) {
+            format = ChooseFormat(pixels, width, height);
+        }
+        bool withAlpha = format != FORMAT_BC1;
+
+        if (sRGB) {
+            image.format = withAlpha ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+        } else {
+            image.format = withAlpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        }
+        image.width = width;
+        image.height = height;
+        image.levels.clear();
+        image.data.clear();
+
+        std::vector<unsigned char> level(pixels, pixels + static_cast<size_t>(width) * height * 4);
+        std::vector<unsigned char> nextLevel;
+        int levelWidth = width;
+        int levelHeight = height;
+        for (;;) {
+            unsigned char* out = image.AddLevel(levelWidth, levelHeight);
+            int blocksWide = (levelWidth + 3) / 4;
+            int blocksHigh = (levelHeight + 3) / 4;
+            unsigned char block[64];
+            for (int blockY = 0; blockY < blocksHigh; blockY++) {
+                for (int blockX = 0; blockX < blocksWide; blockX++) {
+                    FetchBlock(&level[0], levelWidth, levelHeight, blockX, blockY, block);
+                    // BC3 stores the alpha block first
+                    if (withAlpha) {
+                        EncodeAlphaBlock(block, out);
+                        out += 8;
+                    }
+                    EncodeColorBlock(block, out);
+                    out += 8;
+                }
+            }
+
+            if (levelWidth == 1 && levelHeight == 1) {
+                break;
+            }
+            int nextWidth = std::max(1, levelWidth / 2);
+            int nextHeight = std::max(1, levelHeight / 2);
+            nextLevel.resize(static_cast<size_t>(nextWidth) * nextHeight * 4);
+            Downsample(&level[0], levelWidth, levelHeight, &nextLevel[0], sRGB);
+            level.swap(nextLevel);
+            levelWidth = nextWidth;
+            levelHeight = nextHeight;
+        }
+    }
+
+    // Averages 2x2 pixels in linear space - odd sizes repeat the last row or column
+    void TextureCompressor::Downsample(const unsigned char* source, int width, int height, unsigned char* target, bool sRGB)
+    {
+        // initialised once, even with several encoding threads
+        static const SRGBTable table;
+        float identity[256];
+        if (!sRGB) {
+            for (int i = 0; i < 256; i++) {
+                identity[i] = i / 255.0f;
+            }
+        }
+        const float* toLinear = sRGB ? table.toLinear : identity;
+        int targetWidth = std::max(1, width / 2);
+        int targetHeight = std::max(1, height / 2);
+
+        for (int y = 0; y < targetHeight; y++) {
+            int rows[2] = { std::min(y * 2, height - 1), std::min(y * 2 + 1, height - 1) };
+            for (int x = 0; x < targetWidth; x++) {
+                int columns[2] = { std::min(x * 2, width - 1), std::min(x * 2 + 1, width - 1) };
+                float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                for (int i = 0; i < 2; i++) {
+                    for (int j = 0; j < 2; j++) {
+                        const unsigned char* pixel = source + (static_cast<size_t>(rows[i]) * width + columns[j]) * 4;
+                        for (int c = 0; c < 3; c++) {
+                            sum[c] += toLinear[pixel[c]];
+                        }
+                        sum[3] += pixel[3];
+                    }
+                }
+
+                unsigned char* out = target + (static_cast<size_t>(y) * targetWidth + x) * 4;
+                for (int c = 0; c < 3; c++) {
+                    float value = sum[c] * 0.25f;
+                    out[c] = static_cast<unsigned char>((sRGB ? LinearToSRGB(value) : value) * 255.0f + 0.5f);
+                }
+                out[3] = static_cast<unsigned char>(sum[3] * 0.25f + 0.5f);
+            }
+        }
+    }
+
+    // Fits the endpoints along the principal axis of the block's colours
+    void TextureCompressor::EncodeColorBlock(const unsigned char* block, unsigned char* out)
+    {
+        float mean[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < 3; c++) {
+                mean[c] += block[i * 4 + c];
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            mean[c] /= 16.0f;
+        }
+
+        float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; i++) {
+            float r = block[i * 4] - mean[0];
+            float g = block[i * 4 + 1] - mean[1];
+            float b = block[i * 4 + 2] - mean[2];
+            covariance[0] += r * r;
+            covariance[1] += r * g;
+            covariance[2] += r * b;
+            covariance[3] += g * g;
+            covariance[4] += g * b;
+            covariance[5] += b * b;
+        }
+
+        // power iteration
+        float axis[3] = { 1.0f, 1.0f, 1.0f };
+        for (int iteration = 0; iteration < 4; iteration++) {
+            float next[3] = {
+                covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+                covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+                covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]
+            };
+            float length = std::max(fabsf(next[0]), std::max(fabsf(next[1]), fabsf(next[2])));
+            if (length < 1e-6f) {
+                break;
+            }
+            for (int c = 0; c < 3; c++) {
+                axis[c] = next[c] / length;
+            }
+        }
+        float axisLength = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        for (int c = 0; c < 3; c++) {
+            axis[c] /= axisLength;
+        }
+
+        float minProjection = 0.0f;
+        float maxProjection = 0.0f;
+        for (int i = 0; i < 16; i++) {
+            float projection = 0.0f;
+            for (int c = 0; c < 3; c++) {
+                projection += (block[i * 4 + c] - mean[c]) * axis[c];
+            }
+            minProjection = std::min(minProjection, projection);
+            maxProjection = std::max(maxProjection, projection);
+        }
+        // pull the endpoints in slightly, the extremes are rarely the best fit
+        float inset = (maxProjection - minProjection) / 16.0f;
+        minProjection += inset;
+        maxProjection -= inset;
+
+        float endpoints[2][3];
+        for (int c = 0; c < 3; c++) {
+            endpoints[0][c] = Clamp255(mean[c] + axis[c] * maxProjection);
+            endpoints[1][c] = Clamp255(mean[c] + axis[c] * minProjection);
+        }
+        uint16_t color0 = Pack565(endpoints[0]);
+        uint16_t color1 = Pack565(endpoints[1]);
+        // color0 > color1 selects the four colour mode
+        if (color0 < color1) {
+            std::swap(color0, color1);
+        }
+
+        float palette[4][3];
+        Unpack565(color0, palette[0]);
+        Unpack565(color1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+
+        uint32_t indices = 0;
+        if (color0 != color1) {
+            for (int i = 0; i < 16; i++) {
+                int best = 0;
+                float bestDistance = 1e30f;
+                for (int p = 0; p < 4; p++) {
+                    float distance = 0.0f;
+                    for (int c = 0; c < 3; c++) {
+                        float d = block[i * 4 + c] - palette[p][c];
+                        distance += d * d;
+                    }
+                    if (distance < bestDistance) {
+                        bestDistance = distance;
+                        best = p;
+                    }
+                }
+                indices |= static_cast<uint32_t>(best) << (i * 2);
+            }
+        }
+
+        out[0] = static_cast<unsigned char>(color0 & 0xFF);
+        out[1] = static_cast<unsigned char>(color0 >> 8);
+        out[2] = static_cast<unsigned char>(color1 & 0xFF);
+        out[3] = static_cast<unsigned char>(color1 >> 8);
+        for (int i = 0; i < 4; i++) {
+            out[4 + i] = static_cast<unsigned char>(indices >> (i * 8));
+        }
+    }
+
+    // Eight interpolated values between the largest and smallest alpha
+    void TextureCompressor::EncodeAlphaBlock(const unsigned char* block, unsigned char* out)
+    {
+        int alpha0 = 0;
+        int alpha1 = 255;
+        for (int i = 0; i < 16; i++) {
+            alpha0 = std::max(alpha0, static_cast<int>(block[i * 4 + 3]));
+            alpha1 = std::min(alpha1, static_cast<int>(block[i * 4 + 3]));
+        }
+
+        int palette[8];
+        palette[0] = alpha0;
+        palette[1] = alpha1;
+        for (int p = 2; p < 8; p++) {
+            palette[p] = ((8 - p) * alpha0 + (p - 1) * alpha1) / 7;
+        }
+
+        uint64_t indices = 0;
+        if (alpha0 != alpha1) {
+            for (int i = 0; i < 16; i++) {
+                int alpha = block[i * 4 + 3];
+                int best = 0;
+                for (int p = 1; p < 8; p++) {
+                    if (abs(alpha - palette[p]) < abs(alpha - palette[best])) {
+                        best = p;
+                    }
+                }
+                indices |= static_cast<uint64_t>(best) << (i * 3);
+            }
+        }
+
+        out[0] = static_cast<unsigned char>(alpha0);
+        out[1] = static_cast<unsigned char>(alpha1);
+        for (int i = 0; i < 6; i++) {
+            out[2 + i] = static_cast<unsigned char>(indices >> (i * 8));
+        }
+    }
+
+}
@@ -0,0 +1,46 @@
+#ifndef TextureCompressor_hpp
+#define TextureCompressor_hpp
+
+#include "CompressedImage.hpp"
+
+#include <string>
+
+namespace gps {
+
+// Encodes RGBA8 images into BC1 or BC3 with a mip chain, gamma-correct for sRGB images.
+class TextureCompressor
+{
+public:
+    enum Format {
+        // BC1 for opaque images, BC3 when any pixel is transparent
+        FORMAT_AUTO,
+        // keep the uncompressed upload
+        FORMAT_RGBA8,
+        FORMAT_BC1,
+        FORMAT_BC3,
+        // only loaded from pre-compressed files - encoding falls back to BC3
+        FORMAT_BC7
+    };
+
+    // Parses "auto", "rgba8", "bc1", "bc3" or "bc7"
+    static bool ParseFormat(const std::string& name, Format& format);
+    static const char* getFormatName(Format format);
+
+    // Picks the format FORMAT_AUTO stands for
+    static Format ChooseFormat(const unsigned char* pixels, int width, int height);
+
+    // Compresses every mip level of an image - pixels are 4 bytes each, rows tightly packed
+    static void Compress(const unsigned char* pixels, int width, int height, Format format, CompressedImage& image, bool sRGB = true);
+
+    // OpenGL expects the first row at the bottom
+    static void FlipRows(unsigned char* pixels, int width, int height);
+
+private:
+    static void EncodeColorBlock(const unsigned char* block, unsigned char* out);
+    static void EncodeAlphaBlock(const unsigned char* block, unsigned char* out);
+    static void Downsample(const unsigned char* source, int width, int height, unsigned char* target, bool sRGB);
+};
+
+}
+
+#endif /* TextureCompressor_hpp */
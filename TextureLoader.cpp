@@ -0,0 +1,518 @@
+#include "TextureLoader.hpp"
+
+#include "stb_image.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+namespace gps {
+
+    namespace {
+
+        // leave one core to the render thread
+        unsigned int DecodeThreadCount() {
+            unsigned int cores = std::thread::hardware_concurrency();
+            return cores > 1 ? cores - 1 : 1;
+        }
+
+        bool EndsWith(const std::string& text, const std::string& suffix) {
+            return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+        }
+
+        bool IsCompressedFile(const std::string& fileName) {
+            std::string lower = fileName;
+            for (size_t i = 0; i < lower.size(); i++) {
+                lower[i] = static_cast<char>(tolower(static_cast<unsigned char>(lower[i])));
+            }
+            return EndsWith(lower, ".dds") || EndsWith(lower, ".ktx");
+        }
+
+        bool ModificationTime(const std::string& fileName, int64_t& time) {
+#ifdef _WIN32
+            struct _stat64 fileStat;
+            if (_stat64(fileName.c_str(), &fileStat) != 0) {
+                return false;
+            }
+#else
+            struct stat fileStat;
+            if (stat(fileName.c_str(), &fileStat) != 0) {
+                return false;
+            }
+#endif
+            time = static_cast<int64_t>(fileStat.st_mtime);
+            return true;
+        }
+
+        // FNV-1a
+        uint64_t HashString(const std::string& text) {
+            uint64_t hash = 14695981039346656037ull;
+            for (size_t i = 0; i < text.size(); i++) {
+                hash ^= static_cast<unsigned char>(text[i]);
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        // RGBA8 with a full mip chain
+        size_t UncompressedBytes(int width, int height) {
+            size_t bytes = static_cast<size_t>(width) * height * 4;
+            return bytes + bytes / 3;
+        }
+    }
+
+    const char* TextureLoader::CACHE_DIRECTORY = "texture_cache";
+
+    TextureLoader& TextureLoader::getInstance()
+    {
+        static TextureLoader* instance = new TextureLoader();
+        return *instance;
+    }
+
+    TextureLoader::TextureLoader()
+        : nextSerial(0), pendingCount(0), cancelled(false), pixelBuffer(0), compressionEnabled(true),
+        s3tcSupported(false), bptcSupported(false), decodePool(new ThreadPool(DecodeThreadCount()))
+    {
+    }
+
+    TextureLoader::~TextureLoader()
+    {
+        Shutdown();
+    }
+
+    void TextureLoader::Shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cancelled = true;
+        }
+        // queued decodes return right away once cancelled
+        delete decodePool;
+        decodePool = NULL;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < decoded.size(); i++) {
+            FreeImage(decoded[i]);
+        }
+        decoded.clear();
+        pendingCount = 0;
+    }
+
+    void TextureLoader::setCompression(bool enabled)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        compressionEnabled = enabled;
+    }
+
+    bool TextureLoader::LoadFormatOverrides(const std::string& fileName)
+    {
+        std::ifstream in(fileName.c_str());
+        if (!in) {
+            return false;
+        }
+
+        std::vector<std::pair<std::string, TextureCompressor::Format> > overrides;
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(in, line)) {
+            lineNumber++;
+            std::istringstream words(line);
+            std::string suffix;
+            std::string formatName;
+            if (!(words >> suffix) || suffix[0] == '#') {
+                continue;
+            }
+            TextureCompressor::Format format;
+            if (!(words >> formatName) || !TextureCompressor::ParseFormat(formatName, format)) {
+                fprintf(stderr, "ERROR: %s:%d: expected a file name and one of auto, rgba8, bc1, bc3, bc7\n", fileName.c_str(), lineNumber);
+                continue;
+            }
+            overrides.push_back(std::make_pair(suffix, format));
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        formatOverrides.insert(formatOverrides.end(), overrides.begin(), overrides.end());
+        return true;
+    }
+
+    TextureCompressor::Format TextureLoader::getFormat(const std::string& fileName)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        TextureCompressor::Format format = TextureCompressor::FORMAT_AUTO;
+        for (size_t i = 0; i < formatOverrides.size(); i++) {
+            if (EndsWith(fileName, formatOverrides[i].first)) {
+                format = formatOverrides[i].second;
+            }
+        }
+        return format;
+    }
+
+    GLuint TextureLoader::CreatePlaceholder()
+    {
+        static const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return textureID;
+    }
+
+    unsigned long long TextureLoader::Register(GLuint textureID)
+    {
+        s3tcSupported = GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB;
+        bptcSupported = GLEW_ARB_texture_compression_bptc;
+        unsigned long long serial = nextSerial++;
+        liveTextures[textureID] = serial;
+        // the 1x1 placeholder
+        TextureSize size = { 4, 0 };
+        textureSizes[textureID] = size;
+        pendingCount++;
+        return serial;
+    }
+
+    GLuint TextureLoader::Request(const std::string& fileName)
+    {
+        GLuint textureID = CreatePlaceholder();
+
+        unsigned long long serial;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (cancelled) {
+                return textureID;
+            }
+            serial = Register(textureID);
+        }
+        decodePool->Submit([this, textureID, serial, fileName]() {
+            Decode(textureID, serial, fileName);
+        });
+
+        return textureID;
+    }
+
+    GLuint TextureLoader::Request(CompressedImage* image, const std::string& name)
+    {
+        GLuint textureID = CreatePlaceholder();
+
+        DecodedImage decodedImage;
+        decodedImage.textureID = textureID;
+        decodedImage.fileName = name;
+        decodedImage.width = image->width;
+        decodedImage.height = image->height;
+        decodedImage.pixels = NULL;
+        decodedImage.compressed = image;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        decodedImage.serial = Register(textureID);
+        bool bc7 = image->format == GL_COMPRESSED_RGBA_BPTC_UNORM || image->format == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+        if (cancelled || (bc7 ? !bptcSupported : !s3tcSupported)) {
+            if (!cancelled) {
+                fprintf(stderr, "ERROR: %s uses a compression format this GPU does not support\n", name.c_str());
+            }
+            // keeps the placeholder
+            decodedImage.compressed = NULL;
+            delete image;
+        }
+        decoded.push_back(decodedImage);
+        return textureID;
+    }
+
+    void TextureLoader::Delete(GLuint textureID)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            liveTextures.erase(textureID);
+            textureSizes.erase(textureID);
+        }
+        glDeleteTextures(1, &textureID);
+    }
+
+    size_t TextureLoader::getTextureBytes(GLuint textureID)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unordered_map<GLuint, TextureSize>::const_iterator found = textureSizes.find(textureID);
+        return found != textureSizes.end() ? found->second.bytes : 0;
+    }
+
+    size_t TextureLoader::getSavedBytes(GLuint textureID)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unordered_map<GLuint, TextureSize>::const_iterator found = textureSizes.find(textureID);
+        return found != textureSizes.end() ? found->second.savedBytes : 0;
+    }
+
+    // <name>.<hash of the path>.<format>.dds - a different format override gets a new file
+    std::string TextureLoader::getCachePath(const std::string& fileName, TextureCompressor::Format format)
+    {
+        size_t slash = fileName.find_last_of("/\\");
+        std::string name = slash == std::string::npos ? fileName : fileName.substr(slash + 1);
+        char hash[17];
+        snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(HashString(fileName)));
+        return std::string(CACHE_DIRECTORY) + "/" + name + "." + hash + "." + TextureCompressor::getFormatName(format) + ".dds";
+    }
+
+    CompressedImage* TextureLoader::ReadCache(const std::string& cacheFileName, const std::string& fileName)
+    {
+        int64_t sourceTime;
+        int64_t cacheTime;
+        if (!ModificationTime(cacheFileName, cacheTime) || !ModificationTime(fileName, sourceTime) || cacheTime < sourceTime) {
+            return NULL;
+        }
+
+        CompressedImage* image = new CompressedImage();
+        if (!image->Read(cacheFileName)) {
+            delete image;
+            return NULL;
+        }
+        return image;
+    }
+
+    // Writes next to the final name first, so a half-written file is never picked up
+    void TextureLoader::WriteCache(const std::string& cacheFileName, const CompressedImage& image)
+    {
+#ifdef _WIN32
+        _mkdir(CACHE_DIRECTORY);
+#else
+        mkdir(CACHE_DIRECTORY, 0755);
+#endif
+        std::string tempFileName = cacheFileName + ".tmp";
+        if (!image.WriteDDS(tempFileName)) {
+            remove(tempFileName.c_str());
+            return;
+        }
+        remove(cacheFileName.c_str());
+        if (rename(tempFileName.c_str(), cacheFileName.c_str()) != 0) {
+            fprintf(stderr, "ERROR: could not write %s\n", cacheFileName.c_str());
+            remove(tempFileName.c_str());
+        }
+    }
+
+    void TextureLoader::FreeImage(DecodedImage& image)
+    {
+        stbi_image_free(image.pixels);
+        delete image.compressed;
+        image.pixels = NULL;
+        image.compressed = NULL;
+    }
+
+    // Runs on a decode thread
+    void TextureLoader::Decode(GLuint textureID, unsigned long long serial, const std::string& fileName)
+    {
+        bool compress;
+        bool s3tc;
+        bool bptc;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (cancelled) {
+                return;
+            }
+            compress = compressionEnabled;
+            s3tc = s3tcSupported;
+            bptc = bptcSupported;
+        }
+        TextureCompressor::Format format = getFormat(fileName);
+
+        DecodedImage image;
+        image.textureID = textureID;
+        image.serial = serial;
+        image.fileName = fileName;
+        image.width = 0;
+        image.height = 0;
+        image.pixels = NULL;
+        image.compressed = NULL;
+
+        if (IsCompressedFile(fileName)) {
+            CompressedImage* compressed = new CompressedImage();
+            bool loaded = compressed->Read(fileName);
+            bool bc7 = compressed->format == GL_COMPRESSED_RGBA_BPTC_UNORM || compressed->format == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+            if (!loaded) {
+                delete compressed;
+            } else if (bc7 ? !bptc : !s3tc) {
+                fprintf(stderr, "ERROR: %s uses a compression format this GPU does not support\n", fileName.c_str());
+                delete compressed;
+            } else {
+                image.compressed = compressed;
+            }
+        } else {
+            // there is no BC7 encoder, BC3 is the closest format with alpha
+            if (format == TextureCompressor::FORMAT_BC7) {
+                format = TextureCompressor::FORMAT_BC3;
+            }
+            bool transcode = compress && s3tc && format != TextureCompressor::FORMAT_RGBA8;
+            std::string cacheFileName;
+            if (transcode) {
+                cacheFileName = getCachePath(fileName, format);
+                image.compressed = ReadCache(cacheFileName, fileName);
+            }
+
+            if (!image.compressed) {
+                int n;
+                int force_channels = 4;
+                image.pixels = stbi_load(fileName.c_str(), &image.width, &image.height, &n, force_channels);
+
+                if (image.pixels) {
+                    // NPOT check
+                    if ((image.width & (image.width - 1)) != 0 || (image.height & (image.height - 1)) != 0) {
+                        fprintf(stderr, "WARNING: texture %s is not power-of-2 dimensions\n", fileName.c_str());
+                    }
+                    TextureCompressor::FlipRows(image.pixels, image.width, image.height);
+
+                    if (transcode) {
+                        CompressedImage* compressed = new CompressedImage();
+                        TextureCompressor::Compress(image.pixels, image.width, image.height, format, *compressed);
+                        WriteCache(cacheFileName, *compressed);
+                        stbi_image_free(image.pixels);
+                        image.pixels = NULL;
+                        image.compressed = compressed;
+                    }
+                } else {
+                    fprintf(stderr, "ERROR: could not load %s\n", fileName.c_str());
+                }
+            }
+        }
+
+        if (image.compressed) {
+            image.width = image.compressed->width;
+            image.height = image.compressed->height;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        decoded.push_back(image);
+    }
+
+    void TextureLoader::ProcessUploads(size_t byteBudget)
+    {
+        size_t uploadedBytes = 0;
+
+        for (;;) {
+            DecodedImage image;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (decoded.empty()) {
+                    return;
+                }
+                image = decoded.front();
+                size_t imageBytes = 0;
+                if (image.compressed) {
+                    imageBytes = image.compressed->data.size();
+                } else if (image.pixels) {
+                    imageBytes = static_cast<size_t>(image.width) * image.height * 4;
+                }
+                // always make progress, even with an image larger than the budget
+                if (uploadedBytes > 0 && uploadedBytes + imageBytes > byteBudget) {
+                    return;
+                }
+                decoded.pop_front();
+                pendingCount--;
+
+                // the texture was deleted while its image was decoding
+                std::unordered_map<GLuint, unsigned long long>::const_iterator live = liveTextures.find(image.textureID);
+                if (live == liveTextures.end() || live->second != image.serial) {
+                    FreeImage(image);
+                    continue;
+                }
+                if (image.compressed) {
+                    size_t uncompressed = UncompressedBytes(image.width, image.height);
+                    TextureSize size = { imageBytes, uncompressed > imageBytes ? uncompressed - imageBytes : 0 };
+                    textureSizes[image.textureID] = size;
+                } else if (image.pixels) {
+                    TextureSize size = { UncompressedBytes(image.width, image.height), 0 };
+                    textureSizes[image.textureID] = size;
+                }
+                uploadedBytes += imageBytes;
+            }
+
+            // a failed decode keeps its placeholder
+            if (image.compressed) {
+                UploadCompressed(image);
+            } else if (image.pixels) {
+                Upload(image);
+            }
+            FreeImage(image);
+        }
+    }
+
+    bool TextureLoader::FillPixelBuffer(const void* data, size_t size)
+    {
+        if (pixelBuffer == 0) {
+            glGenBuffers(1, &pixelBuffer);
+        }
+
+        // orphan the previous storage so the copy never waits for an upload still in flight
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(size), NULL, GL_STREAM_DRAW);
+        void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(size),
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (!mapped) {
+            // mapping failed - the caller falls back to a direct upload
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return false;
+        }
+        memcpy(mapped, data, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        return true;
+    }
+
+    void TextureLoader::Upload(const DecodedImage& image)
+    {
+        size_t imageBytes = static_cast<size_t>(image.width) * image.height * 4;
+        bool buffered = FillPixelBuffer(image.pixels, imageBytes);
+
+        glBindTexture(GL_TEXTURE_2D, image.textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+            buffered ? (GLvoid*)0 : image.pixels);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // Uploads every stored level - compressed textures cannot generate their own mipmaps
+    void TextureLoader::UploadCompressed(const DecodedImage& image)
+    {
+        const CompressedImage& compressed = *image.compressed;
+        bool buffered = FillPixelBuffer(&compressed.data[0], compressed.data.size());
+
+        glBindTexture(GL_TEXTURE_2D, image.textureID);
+        for (size_t i = 0; i < compressed.levels.size(); i++) {
+            const CompressedImage::Level& level = compressed.levels[i];
+            const GLvoid* source = buffered ? (const GLvoid*)level.offset : (const GLvoid*)&compressed.data[level.offset];
+            glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), compressed.format, level.width, level.height, 0,
+                static_cast<GLsizei>(level.size), source);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(compressed.levels.size()) - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, compressed.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void TextureLoader::FinishUploads()
+    {
+        while (getPendingCount() > 0) {
+            ProcessUploads(static_cast<size_t>(-1));
+            std::this_thread::yield();
+        }
+    }
+
+    size_t TextureLoader::getPendingCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pendingCount;
+    }
+}
@@ -0,0 +1,128 @@
+#ifndef TextureLoader_hpp
+#define TextureLoader_hpp
+
+#include <GL/glew.h>
+
+#include "ThreadPool.hpp"
+#include "CompressedImage.hpp"
+#include "TextureCompressor.hpp"
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace gps {
+
+// Decodes image files on worker threads and uploads them on the render thread.
+// A requested texture shows a 1x1 placeholder until its image has been uploaded into it,
+// so meshes can keep the texture id from the start.
+// .dds and .ktx files are uploaded block-compressed as they are. Other images are transcoded to BC1/BC3
+// on first use and kept in CACHE_DIRECTORY, unless compression is turned off.
+class TextureLoader
+{
+public:
+    // Never destroyed, so textures can still be deleted from static destructors
+    static TextureLoader& getInstance();
+
+    // Creates the texture with a placeholder image and queues the file for decoding
+    GLuint Request(const std::string& fileName);
+
+    // Creates the texture with a placeholder image and queues an image already in memory for upload
+    // Takes ownership of the image - the name is only used in messages
+    GLuint Request(CompressedImage* image, const std::string& name);
+
+    // Deletes a requested texture - a decode still in flight for it is dropped
+    void Delete(GLuint textureID);
+
+    // Video memory used by a texture, including its mipmaps
+    size_t getTextureBytes(GLuint textureID);
+
+    // Video memory a compressed texture saves compared to uncompressed RGBA8
+    size_t getSavedBytes(GLuint textureID);
+
+    // Turns the transcoding of uncompressed images on or off - affects later requests
+    void setCompression(bool enabled);
+
+    // Reads lines of "<file name suffix> <auto|rgba8|bc1|bc3|bc7>" picking the format of matching images
+    bool LoadFormatOverrides(const std::string& fileName);
+
+    // Format picked for an image file - the last matching override wins
+    TextureCompressor::Format getFormat(const std::string& fileName);
+
+    // Uploads decoded images through a pixel buffer object, stopping once byteBudget bytes were uploaded
+    // Must be called from the thread owning the GL context, once per frame
+    void ProcessUploads(size_t byteBudget);
+
+    // Blocks until every requested texture has been uploaded
+    void FinishUploads();
+
+    // Number of textures still showing their placeholder
+    size_t getPendingCount();
+
+    // Stops the decode threads - call before the program exits
+    void Shutdown();
+
+private:
+    struct DecodedImage {
+        GLuint textureID;
+        // identifies the request, texture names are reused after being deleted
+        unsigned long long serial;
+        std::string fileName;
+        int width;
+        int height;
+        // one of the two is set once decoded - both stay NULL if the file could not be loaded
+        unsigned char* pixels;
+        CompressedImage* compressed;
+    };
+
+    struct TextureSize {
+        size_t bytes;
+        size_t savedBytes;
+    };
+
+    static const char* CACHE_DIRECTORY;
+
+    std::mutex mutex;
+    std::deque<DecodedImage> decoded;
+    // serial of the request each live texture is waiting for
+    std::unordered_map<GLuint, unsigned long long> liveTextures;
+    std::unordered_map<GLuint, TextureSize> textureSizes;
+    unsigned long long nextSerial;
+    size_t pendingCount;
+    bool cancelled;
+    GLuint pixelBuffer;
+    std::vector<std::pair<std::string, TextureCompressor::Format> > formatOverrides;
+    bool compressionEnabled;
+    // extension support, queried on the render thread for the decode threads
+    bool s3tcSupported;
+    bool bptcSupported;
+    ThreadPool* decodePool;
+
+    TextureLoader();
+    ~TextureLoader();
+    TextureLoader(const TextureLoader&);
+    TextureLoader& operator=(const TextureLoader&);
+
+    void Decode(GLuint textureID, unsigned long long serial, const std::string& fileName);
+    GLuint CreatePlaceholder();
+    // Starts tracking a new texture, returns the serial of its request - the caller holds the mutex
+    unsigned long long Register(GLuint textureID);
+    static std::string getCachePath(const std::string& fileName, TextureCompressor::Format format);
+    // Loads the transcoded image if it is newer than the source image
+    static CompressedImage* ReadCache(const std::string& cacheFileName, const std::string& fileName);
+    static void WriteCache(const std::string& cacheFileName, const CompressedImage& image);
+    static void FreeImage(DecodedImage& image);
+
+    // Copies the data into the orphaned pixel buffer - returns false with the buffer unbound if that failed
+    bool FillPixelBuffer(const void* data, size_t size);
+    void Upload(const DecodedImage& image);
+    void UploadCompressed(const DecodedImage& image);
+};
+
+}
+
+#endif /* TextureLoader_hpp */
@@ -0,0 +1,123 @@
+#include "ThreadPool.hpp"
+
+#include <atomic>
+#include <memory>
+
+namespace gps {
+
+    ThreadPool::ThreadPool(unsigned int threadCount)
+        : stopping(false)
+    {
+        if (threadCount == 0) {
+            threadCount = std::thread::hardware_concurrency();
+        }
+        if (threadCount == 0) {
+            threadCount = 1;
+        }
+
+        for (unsigned int i = 0; i < threadCount; i++) {
+            workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        taskAvailable.notify_all();
+
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    void ThreadPool::Submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(task);
+        }
+        taskAvailable.notify_one();
+    }
+
+    void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& task)
+    {
+        if (count == 0) {
+            return;
+        }
+
+        // Shared with the helper tasks, which may still be queued after this call returns
+        struct Batch {
+            std::function<void(size_t)> task;
+            size_t count;
+            std::atomic<size_t> next;
+            std::atomic<size_t> done;
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+        batch->task = task;
+        batch->count = count;
+        batch->next = 0;
+        batch->done = 0;
+
+        std::function<void()> runBatch = [batch]() {
+            for (;;) {
+                size_t i = batch->next++;
+                if (i >= batch->count) {
+                    return;
+                }
+                batch->task(i);
+                if (++batch->done == batch->count) {
+                    std::lock_guard<std::mutex> lock(batch->mutex);
+                    batch->finished.notify_all();
+                }
+            }
+        };
+
+        size_t helpers = count - 1 < workers.size() ? count - 1 : workers.size();
+        for (size_t i = 0; i < helpers; i++) {
+            Submit(runBatch);
+        }
+
+        // the calling thread works too, so this is safe to call from a worker
+        runBatch();
+
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        while (batch->done < batch->count) {
+            batch->finished.wait(lock);
+        }
+    }
+
+    unsigned int ThreadPool::getThreadCount() const
+    {
+        return static_cast<unsigned int>(workers.size());
+    }
+
+    ThreadPool& ThreadPool::getShared()
+    {
+        static ThreadPool sharedPool;
+        return sharedPool;
+    }
+
+    void ThreadPool::WorkerLoop()
+    {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!stopping && tasks.empty()) {
+                    taskAvailable.wait(lock);
+                }
+                if (stopping && tasks.empty()) {
+                    return;
+                }
+                task = tasks.front();
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+// Fixed set of worker threads executing queued tasks
+class ThreadPool
+{
+public:
+    // threadCount = 0 uses one thread per hardware core
+    explicit ThreadPool(unsigned int threadCount = 0);
+    ~ThreadPool();
+
+    void Submit(std::function<void()> task);
+
+    // Runs task(i) for every i in [0, count) on the pool and the calling thread, and waits for all of them
+    void ParallelFor(size_t count, const std::function<void(size_t)>& task);
+
+    unsigned int getThreadCount() const;
+
+    // Pool shared by the loaders
+    static ThreadPool& getShared();
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()> > tasks;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    bool stopping;
+
+    void WorkerLoop();
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+};
+
+}
+
+#endif /* ThreadPool_hpp */
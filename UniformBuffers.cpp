@@ -0,0 +1,265 @@
+#include "UniformBuffers.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+namespace gps {
+
+    namespace {
+
+        const char* BLOCK_NAMES[] = { "FrameData", "LightData", "ObjectData" };
+
+        // glClientWaitSync timeout, in nanoseconds - waited in a loop, so only bounds a single call
+        const GLuint64 FENCE_TIMEOUT = 100000000;
+
+        size_t AlignUp(size_t value, size_t alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+    }
+
+    // the std140 layouts the shaders expect
+    static_assert(sizeof(FrameData) == 208, "FrameData does not match its std140 block");
+    static_assert(sizeof(LightData) == 48, "LightData does not match its std140 block");
+    static_assert(sizeof(ObjectData) == 144, "ObjectData does not match its std140 block");
+
+    size_t UniformBuffers::segmentBytes = 1024 * 1024;
+
+    UniformBuffers& UniformBuffers::getInstance()
+    {
+        static UniformBuffers* instance = new UniformBuffers();
+        return *instance;
+    }
+
+    UniformBuffers::UniformBuffers()
+        : mapped(NULL), alignment(256), segment(0), writeOffset(0),
+        ringFull(false), frameSet(false), lightSet(false),
+        frameCount(0), objectCount(0), bytesWritten(0), fenceWaitCount(0), overflowCount(0), growCount(0)
+    {
+        for (size_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+            fences[i] = NULL;
+            written[i] = false;
+        }
+    }
+
+    void UniformBuffers::BindBlocks(GLuint program)
+    {
+        const GLuint bindings[] = { FRAME_BINDING, LIGHT_BINDING, OBJECT_BINDING };
+        for (size_t b = 0; b < sizeof(bindings) / sizeof(bindings[0]); b++) {
+            GLuint blockIndex = glGetUniformBlockIndex(program, BLOCK_NAMES[b]);
+            if (blockIndex != GL_INVALID_INDEX) {
+                glUniformBlockBinding(program, blockIndex, bindings[b]);
+            }
+        }
+    }
+
+    void UniformBuffers::Create()
+    {
+        GLint offsetAlignment = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+        if (offsetAlignment > 0) {
+            alignment = static_cast<size_t>(offsetAlignment);
+        }
+        segmentBytes = AlignUp(segmentBytes, alignment);
+        GLsizeiptr size = static_cast<GLsizeiptr>(segmentBytes * FRAMES_IN_FLIGHT);
+
+        buffer = GLBuffer::Create();
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer.get());
+        if (GLEW_ARB_buffer_storage) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_UNIFORM_BUFFER, size, NULL, flags);
+            mapped = static_cast<unsigned char*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags));
+        }
+        if (!mapped) {
+            // immutable storage cannot be resized by glBufferData - start over with a mutable buffer
+            buffer = GLBuffer::Create();
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer.get());
+            glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void UniformBuffers::WaitForFence(size_t segmentIndex)
+    {
+        GLsync& fence = fences[segmentIndex];
+        if (fence == NULL) {
+            return;
+        }
+        GLenum result = glClientWaitSync(fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED) {
+            fenceWaitCount++;
+            do {
+                result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+            } while (result == GL_TIMEOUT_EXPIRED);
+        }
+        glDeleteSync(fence);
+        fence = NULL;
+    }
+
+    void UniformBuffers::BeginFrame()
+    {
+        if (ringFull && buffer) {
+            // the old buffer goes once the GPU is done with all of it
+            for (size_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+                WaitForFence(i);
+            }
+            ringFull = false;
+            segmentBytes *= 2;
+            growCount++;
+            if (mapped) {
+                glBindBuffer(GL_UNIFORM_BUFFER, buffer.get());
+                glUnmapBuffer(GL_UNIFORM_BUFFER);
+                glBindBuffer(GL_UNIFORM_BUFFER, 0);
+                mapped = NULL;
+            }
+            buffer.reset();
+            segment = 0;
+            printf("Uniform buffers: a frame filled the whole ring - segments grown to %zu KB\n", segmentBytes / 1024);
+        }
+        if (!buffer) {
+            Create();
+        }
+        WaitForFence(segment);
+        writeOffset = 0;
+        frameCount++;
+    }
+
+    void UniformBuffers::EndFrame()
+    {
+        if (!buffer) {
+            return;
+        }
+        // draws are queued, so an overflowed segment is only fenced here - after the last draw reading it
+        written[segment] = true;
+        for (size_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+            if (written[i]) {
+                fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                written[i] = false;
+            }
+        }
+        segment = (segment + 1) % FRAMES_IN_FLIGHT;
+    }
+
+    size_t UniformBuffers::Write(const void* data, size_t size)
+    {
+        if (!buffer) {
+            return 0;
+        }
+        if (writeOffset + size > segmentBytes) {
+            // the blocks written so far may still be read - carry on in the next segment
+            overflowCount++;
+            written[segment] = true;
+            size_t next = (segment + 1) % FRAMES_IN_FLIGHT;
+            bool reused = written[next];
+            if (reused) {
+                ReuseRing();
+            }
+            segment = next;
+            WaitForFence(segment);
+            writeOffset = 0;
+
+            // the bound frame and light blocks may be written over - they move to the fresh segment
+            if (reused && frameSet) {
+                setFrame(frameData);
+            }
+            if (reused && lightSet) {
+                setLight(lightData);
+            }
+        }
+
+        size_t offset = segment * segmentBytes + writeOffset;
+        if (mapped) {
+            memcpy(mapped + offset, data, size);
+        }
+        else {
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer.get());
+            glBufferSubData(GL_UNIFORM_BUFFER, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(size), data);
+        }
+
+        writeOffset += AlignUp(size, alignment);
+        bytesWritten += size;
+        return offset;
+    }
+
+    void UniformBuffers::ReuseRing()
+    {
+        ringFull = true;
+        for (size_t i = 0; i < reuseCallbacks.size(); i++) {
+            reuseCallbacks[i]();
+        }
+
+        // the segments are waited for one by one as the frame gets to them again
+        for (size_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+            if (written[i]) {
+                if (fences[i] != NULL) {
+                    glDeleteSync(fences[i]);
+                }
+                fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                written[i] = false;
+            }
+        }
+    }
+
+    void UniformBuffers::AddReuseCallback(const std::function<void()>& callback)
+    {
+        reuseCallbacks.push_back(callback);
+    }
+
+    void UniformBuffers::setFrame(const FrameData& frame)
+    {
+        frameData = frame;
+        frameSet = true;
+        size_t offset = Write(&frame, sizeof(FrameData));
+        if (buffer) {
+            glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BINDING, buffer.get(), static_cast<GLintptr>(offset), sizeof(FrameData));
+        }
+    }
+
+    void UniformBuffers::setLight(const LightData& light)
+    {
+        lightData = light;
+        lightSet = true;
+        size_t offset = Write(&light, sizeof(LightData));
+        if (buffer) {
+            glBindBufferRange(GL_UNIFORM_BUFFER, LIGHT_BINDING, buffer.get(), static_cast<GLintptr>(offset), sizeof(LightData));
+        }
+    }
+
+    size_t UniformBuffers::WriteObject(const ObjectData& object)
+    {
+        objectCount++;
+        return Write(&object, sizeof(ObjectData));
+    }
+
+    void UniformBuffers::BindObject(size_t offset)
+    {
+        if (buffer) {
+            glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_BINDING, buffer.get(), static_cast<GLintptr>(offset), sizeof(ObjectData));
+        }
+    }
+
+    void UniformBuffers::PrintStats() const
+    {
+        printf("Uniform buffers: %zu objects in %zu frames (%.1f per frame), %zu KB written, %zu fence waits, %zu segment overflows, %zu ring growths to %zu KB segments, %s\n",
+            objectCount, frameCount, frameCount ? static_cast<double>(objectCount) / frameCount : 0.0,
+            bytesWritten / 1024, fenceWaitCount, overflowCount, growCount, segmentBytes / 1024,
+            mapped ? "persistently mapped" : "glBufferSubData");
+    }
+
+    void UniformBuffers::Destroy()
+    {
+        for (size_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+            if (fences[i] != NULL) {
+                glDeleteSync(fences[i]);
+                fences[i] = NULL;
+            }
+            written[i] = false;
+        }
+        if (mapped) {
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer.get());
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            mapped = NULL;
+        }
+        buffer.reset();
+    }
+}
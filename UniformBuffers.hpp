@@ -0,0 +1,139 @@
+#ifndef UniformBuffers_hpp
+#define UniformBuffers_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "GLHandle.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace gps {
+
+// std140 layouts of the uniform blocks shared by the shaders - keep them in sync with the blocks in shaders/
+// vec3s take a vec4 slot unless a float follows them, a mat3 takes three vec4 columns
+
+struct FrameData {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 lightSpaceTrMatrix;
+    glm::vec3 cameraPosition;
+    // seconds since startup
+    float time;
+};
+
+struct LightData {
+    // direction towards the directional light, normalized in eye space
+    glm::vec3 lightDirEye;
+    float padding0;
+    glm::vec3 lightColor;
+    float padding1;
+    glm::vec3 pointLight;
+    float padding2;
+};
+
+struct ObjectData {
+    glm::mat4 model;
+    glm::vec4 normalMatrix[3];
+    // dequantization of packed positions - identity for float meshes
+    glm::vec3 positionOffset;
+    // level of detail cross-fade, see Mesh::DrawRanges
+    float lodFade;
+    glm::vec3 positionScale;
+    GLint packedNormals;
+};
+
+// Writes the FrameData, LightData and ObjectData blocks into one ring-buffered uniform buffer and binds each block
+// to its binding point, so drawing an object only moves the ObjectData range.
+// The ring holds FRAMES_IN_FLIGHT segments, fenced at the end of every frame that wrote into them. The buffer is persistently
+// mapped where the driver has ARB_buffer_storage and written with glBufferSubData otherwise.
+// A frame writing more than the whole ring issues the draws queued so far and waits for them before it writes over the
+// ring again, and the segments double in size at the next BeginFrame.
+// Only used from the thread owning the GL context.
+class UniformBuffers
+{
+public:
+    enum Binding {
+        FRAME_BINDING = 0,
+        LIGHT_BINDING = 1,
+        OBJECT_BINDING = 2
+    };
+
+    static const size_t FRAMES_IN_FLIGHT = 3;
+    // Room for one frame of blocks - a frame writing more moves on to the next segment early, doubled when a frame
+    // fills the whole ring
+    static size_t segmentBytes;
+
+    // Never destroyed - Destroy frees the GL objects
+    static UniformBuffers& getInstance();
+
+    // Points the blocks of a freshly linked program at their binding points - programs without them are left alone
+    static void BindBlocks(GLuint program);
+
+    // Waits until the GPU is done with the next segment and starts writing into it - creates the buffer on first use
+    void BeginFrame();
+    // Fences the segments written during the frame and moves on to the next one
+    void EndFrame();
+
+    void setFrame(const FrameData& frame);
+    void setLight(const LightData& light);
+
+    // Writes the ObjectData of one draw without binding it - returns where it went, for BindObject
+    // Valid until the end of the frame, so the draw may be issued any time before EndFrame
+    size_t WriteObject(const ObjectData& object);
+    void BindObject(size_t offset);
+
+    // Run when a frame has filled the whole ring, before its blocks are written over - each callback has to issue the
+    // draws reading the blocks written so far and forget their offsets
+    void AddReuseCallback(const std::function<void()>& callback);
+
+    void PrintStats() const;
+
+    // Before the GL context goes away
+    void Destroy();
+
+private:
+    GLBuffer buffer;
+    // NULL unless persistently mapped
+    unsigned char* mapped;
+    size_t alignment;
+    size_t segment;
+    // offset of the next block in the current segment
+    size_t writeOffset;
+    GLsync fences[FRAMES_IN_FLIGHT];
+    // segments written since the last EndFrame
+    bool written[FRAMES_IN_FLIGHT];
+    // a frame filled the whole ring - the next BeginFrame grows it
+    bool ringFull;
+    std::vector<std::function<void()> > reuseCallbacks;
+
+    // last blocks set, written again when the ring is reused within a frame
+    FrameData frameData;
+    LightData lightData;
+    bool frameSet;
+    bool lightSet;
+
+    size_t frameCount;
+    size_t objectCount;
+    size_t bytesWritten;
+    size_t fenceWaitCount;
+    size_t overflowCount;
+    size_t growCount;
+
+    UniformBuffers();
+    UniformBuffers(const UniformBuffers&);
+    UniformBuffers& operator=(const UniformBuffers&);
+
+    void Create();
+    void WaitForFence(size_t segmentIndex);
+    // Issues and waits for everything reading the ring before it is written over within the same frame
+    void ReuseRing();
+    // Copies a block into the current segment - returns its offset in the buffer
+    size_t Write(const void* data, size_t size);
+};
+
+}
+
+#endif /* UniformBuffers_hpp */
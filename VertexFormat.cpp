@@ -0,0 +1,143 @@
+#include "VertexFormat.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace gps {
+
+    const VertexAttribute VertexLayout<Vertex>::attributes[VertexLayout<Vertex>::ATTRIBUTE_COUNT] = {
+        { 0, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Position) },
+        { 1, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Normal) },
+        { 2, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, TexCoords) }
+    };
+
+    // The shaders read the two octahedral components of the normal as vNormal.xy
+    const VertexAttribute VertexLayout<PackedVertex>::attributes[VertexLayout<PackedVertex>::ATTRIBUTE_COUNT] = {
+        { 0, 3, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(PackedVertex, Position) },
+        { 1, 2, GL_SHORT, GL_TRUE, offsetof(PackedVertex, Normal) },
+        { 2, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertex, TexCoords) }
+    };
+
+    const float VertexPacker::MAX_TEXCOORD = 2.0f;
+
+    // the 16 bits span the bounds of each mesh - meshes over 655 units on a side stay float
+    const float VertexPacker::MAX_POSITION_STEP = 0.01f;
+
+    bool VertexPacker::CanPack(const Vertex* vertices, size_t vertexCount) {
+
+        glm::vec3 boundsMin = vertexCount > 0 ? vertices[0].Position : glm::vec3(0.0f);
+        glm::vec3 boundsMax = boundsMin;
+        for (size_t v = 0; v < vertexCount; v++) {
+            if (std::fabs(vertices[v].TexCoords.x) > MAX_TEXCOORD || std::fabs(vertices[v].TexCoords.y) > MAX_TEXCOORD) {
+                return false;
+            }
+            boundsMin = glm::min(boundsMin, vertices[v].Position);
+            boundsMax = glm::max(boundsMax, vertices[v].Position);
+        }
+
+        glm::vec3 extent = boundsMax - boundsMin;
+        float largestExtent = glm::max(extent.x, glm::max(extent.y, extent.z));
+        return largestExtent / 65535.0f <= MAX_POSITION_STEP;
+    }
+
+    void VertexPacker::Pack(const Vertex* vertices, size_t vertexCount, std::vector<PackedVertex>& packed,
+        glm::vec3& positionOffset, glm::vec3& positionScale) {
+
+        glm::vec3 boundsMin = vertexCount > 0 ? vertices[0].Position : glm::vec3(0.0f);
+        glm::vec3 boundsMax = boundsMin;
+        for (size_t v = 1; v < vertexCount; v++) {
+            boundsMin = glm::min(boundsMin, vertices[v].Position);
+            boundsMax = glm::max(boundsMax, vertices[v].Position);
+        }
+
+        positionOffset = boundsMin;
+        positionScale = boundsMax - boundsMin;
+
+        glm::vec3 quantizeScale(0.0f);
+        for (int c = 0; c < 3; c++) {
+            if (positionScale[c] > 0.0f) {
+                quantizeScale[c] = 65535.0f / positionScale[c];
+            }
+        }
+
+        packed.resize(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++) {
+            const Vertex& vertex = vertices[v];
+            PackedVertex& out = packed[v];
+
+            glm::vec3 position = (vertex.Position - positionOffset) * quantizeScale;
+            for (int c = 0; c < 3; c++) {
+                out.Position[c] = static_cast<GLushort>(glm::clamp(std::floor(position[c] + 0.5f), 0.0f, 65535.0f));
+            }
+            out.Position[3] = 0;
+
+            glm::vec2 normal = EncodeOctahedral(vertex.Normal);
+            out.Normal[0] = static_cast<GLshort>(std::floor(glm::clamp(normal.x, -1.0f, 1.0f) * 32767.0f + 0.5f));
+            out.Normal[1] = static_cast<GLshort>(std::floor(glm::clamp(normal.y, -1.0f, 1.0f) * 32767.0f + 0.5f));
+
+            out.TexCoords[0] = FloatToHalf(vertex.TexCoords.x);
+            out.TexCoords[1] = FloatToHalf(vertex.TexCoords.y);
+        }
+    }
+
+    GLushort VertexPacker::FloatToHalf(float value) {
+
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+
+        uint32_t sign = (bits >> 16) & 0x8000u;
+        uint32_t floatExponent = (bits >> 23) & 0xffu;
+        uint32_t mantissa = bits & 0x7fffffu;
+        int exponent = static_cast<int>(floatExponent) - 127 + 15;
+
+        // infinity and NaN
+        if (floatExponent == 0xffu) {
+            return static_cast<GLushort>(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+        }
+        // too large - infinity
+        if (exponent >= 31) {
+            return static_cast<GLushort>(sign | 0x7c00u);
+        }
+        // too small for a normal half - subnormal or zero
+        if (exponent <= 0) {
+            if (exponent < -10) {
+                return static_cast<GLushort>(sign);
+            }
+            mantissa |= 0x800000u;
+            uint32_t shift = static_cast<uint32_t>(14 - exponent);
+            uint32_t half = mantissa >> shift;
+            uint32_t rest = mantissa & ((1u << shift) - 1u);
+            uint32_t halfway = 1u << (shift - 1u);
+            if (rest > halfway || (rest == halfway && (half & 1u))) {
+                half++;
+            }
+            return static_cast<GLushort>(sign | half);
+        }
+
+        // a carry out of the mantissa correctly rounds up into the exponent
+        uint32_t half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+        uint32_t rest = mantissa & 0x1fffu;
+        if (rest > 0x1000u || (rest == 0x1000u && (half & 1u))) {
+            half++;
+        }
+        return static_cast<GLushort>(sign | half);
+    }
+
+    glm::vec2 VertexPacker::EncodeOctahedral(glm::vec3 normal) {
+
+        float length = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+        if (length == 0.0f) {
+            return glm::vec2(0.0f);
+        }
+
+        glm::vec2 encoded(normal.x / length, normal.y / length);
+        // fold the lower hemisphere over the diagonals
+        if (normal.z < 0.0f) {
+            glm::vec2 folded(1.0f - std::fabs(encoded.y), 1.0f - std::fabs(encoded.x));
+            encoded.x = encoded.x >= 0.0f ? folded.x : -folded.x;
+            encoded.y = encoded.y >= 0.0f ? folded.y : -folded.y;
+        }
+        return encoded;
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef VertexFormat_hpp
+#define VertexFormat_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+// 32 bytes - the layout meshes are parsed, optimized and cached in
+struct Vertex
+{
+    glm::vec3 Position;
+    glm::vec3 Normal;
+    glm::vec2 TexCoords;
+};
+
+// 16 bytes - quantized copy of a Vertex, only used for the GPU-side buffers
+struct PackedVertex
+{
+    // 16-bit normalized within the bounds of the mesh, the fourth component is padding
+    GLushort Position[4];
+    // octahedral encoding, 16-bit signed normalized
+    GLshort Normal[2];
+    // half floats
+    GLushort TexCoords[2];
+};
+
+enum VertexFormat {
+    VERTEX_FORMAT_FLOAT,
+    VERTEX_FORMAT_PACKED
+};
+
+// One glVertexAttribPointer call
+struct VertexAttribute {
+    GLuint location;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    size_t offset;
+};
+
+// Compile-time description of the attributes of a vertex struct - specialized for each layout
+template <typename VertexType>
+struct VertexLayout;
+
+template <>
+struct VertexLayout<Vertex> {
+    static const size_t ATTRIBUTE_COUNT = 3;
+    static const VertexAttribute attributes[ATTRIBUTE_COUNT];
+};
+
+template <>
+struct VertexLayout<PackedVertex> {
+    static const size_t ATTRIBUTE_COUNT = 3;
+    static const VertexAttribute attributes[ATTRIBUTE_COUNT];
+};
+
+// Quantizes vertices into PackedVertex
+class VertexPacker
+{
+public:
+    // Half floats keep texture coordinates up to this magnitude within half a texel of a 1024 wide texture
+    static const float MAX_TEXCOORD;
+
+    // Largest quantization step of the positions - a seam between two packed meshes opens by up to one step
+    static const float MAX_POSITION_STEP;
+
+    // False if the positions or texture coordinates would lose too much precision
+    static bool CanPack(const Vertex* vertices, size_t vertexCount);
+
+    // The shader dequantizes the positions as positionOffset + positionScale * position
+    static void Pack(const Vertex* vertices, size_t vertexCount, std::vector<PackedVertex>& packed,
+        glm::vec3& positionOffset, glm::vec3& positionScale);
+
+    // Round-to-nearest-even conversion to an IEEE half float
+    static GLushort FloatToHalf(float value);
+
+    // Maps a unit vector onto the [-1, 1] square of the octahedral encoding
+    static glm::vec2 EncodeOctahedral(glm::vec3 normal);
+};
+
+}
+
+#endif /* VertexFormat_hpp */
@@ -0,0 +1,410 @@
+#include "WorldStreamer.hpp"
+
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace gps {
+
+    namespace {
+
+        // Seconds over which the camera velocity used for prefetching is averaged
+        const float VELOCITY_SMOOTHING = 0.5f;
+
+        // Reads one byte per page so the GL thread does not stall on disk when it uploads the tile
+        void PageIn(const AssetBundle& bundle) {
+            const size_t PAGE_SIZE = 4096;
+            volatile unsigned char sink = 0;
+            const std::vector<AssetBundle::Model>& models = bundle.getModels();
+            for (size_t m = 0; m < models.size(); m++) {
+                for (size_t s = 0; s < models[m].shapes.size(); s++) {
+                    const AssetBundle::Shape& shape = models[m].shapes[s];
+                    const unsigned char* vertices = reinterpret_cast<const unsigned char*>(shape.vertices);
+                    for (size_t offset = 0; offset < shape.vertexCount * sizeof(Vertex); offset += PAGE_SIZE) {
+                        sink = sink + vertices[offset];
+                    }
+                    const unsigned char* indices = reinterpret_cast<const unsigned char*>(shape.indices);
+                    for (size_t offset = 0; offset < shape.indexCount * sizeof(GLuint); offset += PAGE_SIZE) {
+                        sink = sink + indices[offset];
+                    }
+                    for (size_t l = 0; l < shape.lods.size(); l++) {
+                        const unsigned char* lodIndices = reinterpret_cast<const unsigned char*>(shape.lods[l].indices);
+                        for (size_t offset = 0; offset < shape.lods[l].indexCount * sizeof(GLuint); offset += PAGE_SIZE) {
+                            sink = sink + lodIndices[offset];
+                        }
+                    }
+                }
+            }
+        }
+
+        struct LoadCandidate {
+            size_t tile;
+            float priority;
+        };
+
+        bool CloserCandidate(const LoadCandidate& a, const LoadCandidate& b) {
+            return a.priority < b.priority;
+        }
+    }
+
+    float WorldStreamer::loadRadius = 300.0f;
+    float WorldStreamer::prefetchSeconds = 2.0f;
+    size_t WorldStreamer::memoryBudget = 256 * 1024 * 1024;
+
+    std::string WorldStreamer::getManifestPath(const std::string& directory)
+    {
+        std::string bundlePath = AssetBundle::getBundlePath(directory);
+        return bundlePath.substr(0, bundlePath.size() - std::string(".bundle").size()) + ".tiles";
+    }
+
+    std::string WorldStreamer::getTilePath(const std::string& directory, int x, int z)
+    {
+        std::string bundlePath = AssetBundle::getBundlePath(directory);
+        std::ostringstream path;
+        path << bundlePath.substr(0, bundlePath.size() - std::string(".bundle").size()) << ".tile_" << x << "_" << z << ".bundle";
+        return path.str();
+    }
+
+    // One line with the tile size, then one line per tile: x z and the bounds
+    bool WorldStreamer::WriteManifest(const std::string& directory, float tileSize, const std::vector<TileInfo>& tiles)
+    {
+        std::string fileName = getManifestPath(directory);
+        std::ofstream out(fileName.c_str(), std::ios::trunc);
+        if (!out) {
+            std::cerr << "ERROR: could not write tile manifest " << fileName << std::endl;
+            return false;
+        }
+
+        out << "tileSize " << tileSize << "\n";
+        for (size_t t = 0; t < tiles.size(); t++) {
+            const TileInfo& tile = tiles[t];
+            out << "tile " << tile.x << " " << tile.z
+                << " " << tile.bounds.min.x << " " << tile.bounds.min.y << " " << tile.bounds.min.z
+                << " " << tile.bounds.max.x << " " << tile.bounds.max.y << " " << tile.bounds.max.z << "\n";
+        }
+
+        out.close();
+        if (!out) {
+            std::cerr << "ERROR: could not write tile manifest " << fileName << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    WorldStreamer::WorldStreamer()
+        : tileSize(0.0f), opened(false), velocity(0.0f), hasLastCameraPosition(false), frame(0), residentBytes(0),
+        loadsInFlight(0), loadCount(0), evictionCount(0), peakResidentBytes(0) {
+    }
+
+    WorldStreamer::~WorldStreamer() {
+        Close();
+    }
+
+    bool WorldStreamer::Open(const std::string& directory)
+    {
+        Close();
+
+        std::string manifestFileName = getManifestPath(directory);
+        std::ifstream in(manifestFileName.c_str());
+        if (!in) {
+            return false;
+        }
+
+        std::string keyword;
+        if (!(in >> keyword >> tileSize) || keyword != "tileSize" || tileSize <= 0.0f) {
+            std::cerr << "ERROR: tile manifest " << manifestFileName << " is corrupt, re-run asset_baker" << std::endl;
+            return false;
+        }
+
+        Tile tile;
+        tile.state = TILE_UNLOADED;
+        tile.bundle = NULL;
+        tile.model = NULL;
+        tile.bytes = 0;
+        tile.lastUsed = 0;
+        while (in >> keyword) {
+            TileInfo& info = tile.info;
+            if (keyword != "tile" || !(in >> info.x >> info.z
+                >> info.bounds.min.x >> info.bounds.min.y >> info.bounds.min.z
+                >> info.bounds.max.x >> info.bounds.max.y >> info.bounds.max.z)) {
+                std::cerr << "ERROR: tile manifest " << manifestFileName << " is corrupt, re-run asset_baker" << std::endl;
+                tiles.clear();
+                return false;
+            }
+            tile.fileName = getTilePath(directory, info.x, info.z);
+            tiles.push_back(tile);
+        }
+
+        // the tiles only index the textures of the directory bundle
+        if (!textureBundle.Open(AssetBundle::getBundlePath(directory))) {
+            std::cerr << "ERROR: the textures of " << manifestFileName << " are missing, re-run asset_baker" << std::endl;
+            tiles.clear();
+            return false;
+        }
+
+        this->directory = directory;
+        opened = true;
+        std::cout << "Streaming : " << manifestFileName << " (" << tiles.size() << " tiles of " << tileSize << " units)" << std::endl;
+        return true;
+    }
+
+    bool WorldStreamer::isOpen() const
+    {
+        return opened;
+    }
+
+    void WorldStreamer::Close()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (loadsInFlight > 0) {
+                loadFinished.wait(lock);
+            }
+        }
+        CollectLoads();
+
+        for (size_t t = 0; t < tiles.size(); t++) {
+            delete tiles[t].bundle;
+            delete tiles[t].model;
+        }
+        tiles.clear();
+        textureBundle.Close();
+        directory.clear();
+        opened = false;
+        hasLastCameraPosition = false;
+        velocity = glm::vec3(0.0f);
+        residentBytes = 0;
+        loadCount = 0;
+        evictionCount = 0;
+        peakResidentBytes = 0;
+    }
+
+    void WorldStreamer::Update(const glm::vec3& cameraPosition, float deltaTime)
+    {
+        if (!opened) {
+            return;
+        }
+        frame++;
+        CollectLoads();
+
+        if (hasLastCameraPosition && deltaTime > 0.0f) {
+            glm::vec3 currentVelocity = (cameraPosition - lastCameraPosition) / deltaTime;
+            velocity += (currentVelocity - velocity) * std::min(1.0f, deltaTime / VELOCITY_SMOOTHING);
+        }
+        lastCameraPosition = cameraPosition;
+        hasLastCameraPosition = true;
+
+        glm::vec3 prefetchPosition = cameraPosition + velocity * prefetchSeconds;
+
+        // tiles around the camera load before the ones ahead of it
+        std::vector<LoadCandidate> candidates;
+        for (size_t t = 0; t < tiles.size(); t++) {
+            Tile& tile = tiles[t];
+            float distance = Distance(tile.info, cameraPosition);
+            float prefetchDistance = Distance(tile.info, prefetchPosition);
+            bool wanted = distance <= loadRadius || prefetchDistance <= loadRadius;
+
+            if (wanted) {
+                tile.lastUsed = frame;
+                if (tile.state == TILE_UNLOADED) {
+                    LoadCandidate candidate = { t, distance <= loadRadius ? distance : loadRadius + prefetchDistance };
+                    candidates.push_back(candidate);
+                }
+            }
+            else if (tile.state == TILE_LOADED) {
+                // left the area before it was uploaded
+                delete tile.bundle;
+                tile.bundle = NULL;
+                tile.state = TILE_UNLOADED;
+            }
+        }
+
+        std::sort(candidates.begin(), candidates.end(), CloserCandidate);
+        for (size_t c = 0; c < candidates.size(); c++) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (loadsInFlight >= MAX_LOADS_IN_FLIGHT) {
+                    break;
+                }
+            }
+            StartLoad(candidates[c].tile);
+        }
+
+        // least recently used first, never a tile wanted this frame
+        while (residentBytes > memoryBudget) {
+            size_t oldest = tiles.size();
+            for (size_t t = 0; t < tiles.size(); t++) {
+                if (tiles[t].state == TILE_RESIDENT && tiles[t].lastUsed < frame
+                    && (oldest == tiles.size() || tiles[t].lastUsed < tiles[oldest].lastUsed)) {
+                    oldest = t;
+                }
+            }
+            if (oldest == tiles.size()) {
+                break;
+            }
+            Evict(oldest);
+        }
+    }
+
+    void WorldStreamer::ProcessLoads(size_t maxTiles)
+    {
+        if (!opened) {
+            return;
+        }
+        CollectLoads();
+
+        std::vector<LoadCandidate> loaded;
+        for (size_t t = 0; t < tiles.size(); t++) {
+            if (tiles[t].state == TILE_LOADED) {
+                LoadCandidate candidate = { t, Distance(tiles[t].info, lastCameraPosition) };
+                loaded.push_back(candidate);
+            }
+        }
+        std::sort(loaded.begin(), loaded.end(), CloserCandidate);
+
+        for (size_t l = 0; l < loaded.size() && l < maxTiles; l++) {
+            Tile& tile = tiles[loaded[l].tile];
+
+            Model3D* model = new Model3D();
+            model->setStatic(true);
+            bool uploaded = model->LoadTile(*tile.bundle, textureBundle);
+            delete tile.bundle;
+            tile.bundle = NULL;
+
+            if (!uploaded) {
+                delete model;
+                tile.state = TILE_FAILED;
+                continue;
+            }
+
+            tile.model = model;
+            tile.bytes = model->getMeshBytes();
+            tile.state = TILE_RESIDENT;
+            residentBytes += tile.bytes;
+            peakResidentBytes = std::max(peakResidentBytes, residentBytes);
+            loadCount++;
+        }
+    }
+
+    void WorldStreamer::Draw(gps::Shader& shaderProgram, const gps::Frustum* frustum, OcclusionCulling occlusion)
+    {
+        for (size_t t = 0; t < tiles.size(); t++) {
+            if (tiles[t].state == TILE_RESIDENT && (!frustum || frustum->Intersects(tiles[t].info.bounds))) {
+                tiles[t].model->Draw(shaderProgram, frustum, occlusion);
+            }
+        }
+    }
+
+    void WorldStreamer::DrawLod(gps::Shader& shaderProgram, const Model3D::LodParameters& parameters, const gps::Frustum* frustum,
+        OcclusionCulling occlusion)
+    {
+        for (size_t t = 0; t < tiles.size(); t++) {
+            if (tiles[t].state == TILE_RESIDENT && (!frustum || frustum->Intersects(tiles[t].info.bounds))) {
+                tiles[t].model->DrawLod(shaderProgram, parameters, frustum, occlusion);
+            }
+        }
+    }
+
+    void WorldStreamer::RasterizeOccluders(const glm::mat4& model, const gps::Frustum* frustum)
+    {
+        for (size_t t = 0; t < tiles.size(); t++) {
+            if (tiles[t].state == TILE_RESIDENT && (!frustum || frustum->Intersects(tiles[t].info.bounds))) {
+                tiles[t].model->RasterizeOccluders(model);
+            }
+        }
+    }
+
+    void WorldStreamer::PrintStats() const
+    {
+        size_t resident = 0;
+        size_t pending = 0;
+        for (size_t t = 0; t < tiles.size(); t++) {
+            if (tiles[t].state == TILE_RESIDENT) {
+                resident++;
+            }
+            else if (tiles[t].state == TILE_LOADING || tiles[t].state == TILE_LOADED) {
+                pending++;
+            }
+        }
+
+        printf("World tiles    : %zu of %zu resident, %zu loading, %.1f MB of %.1f MB budget (peak %.1f MB), %zu loads, %zu evictions\n",
+            resident, tiles.size(), pending, residentBytes / (1024.0 * 1024.0), memoryBudget / (1024.0 * 1024.0),
+            peakResidentBytes / (1024.0 * 1024.0), loadCount, evictionCount);
+    }
+
+    float WorldStreamer::Distance(const TileInfo& info, const glm::vec3& position)
+    {
+        float dx = std::max(std::max(info.bounds.min.x - position.x, position.x - info.bounds.max.x), 0.0f);
+        float dz = std::max(std::max(info.bounds.min.z - position.z, position.z - info.bounds.max.z), 0.0f);
+        return std::sqrt(dx * dx + dz * dz);
+    }
+
+    void WorldStreamer::StartLoad(size_t tileIndex)
+    {
+        Tile& tile = tiles[tileIndex];
+        tile.state = TILE_LOADING;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            loadsInFlight++;
+        }
+
+        std::string fileName = tile.fileName;
+        ThreadPool::getShared().Submit([this, tileIndex, fileName]() {
+            AssetBundle* bundle = new AssetBundle();
+            if (bundle->Open(fileName) && bundle->hasSharedTextures()) {
+                PageIn(*bundle);
+            }
+            else {
+                delete bundle;
+                bundle = NULL;
+            }
+
+            // notified under the lock so Close cannot return before this task is done with the streamer
+            std::lock_guard<std::mutex> lock(mutex);
+            FinishedLoad finished = { tileIndex, bundle };
+            finishedLoads.push_back(finished);
+            loadsInFlight--;
+            loadFinished.notify_all();
+        });
+    }
+
+    void WorldStreamer::Evict(size_t tileIndex)
+    {
+        Tile& tile = tiles[tileIndex];
+        delete tile.model;
+        tile.model = NULL;
+        residentBytes -= tile.bytes;
+        tile.bytes = 0;
+        tile.state = TILE_UNLOADED;
+        evictionCount++;
+    }
+
+    void WorldStreamer::CollectLoads()
+    {
+        std::deque<FinishedLoad> finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.swap(finishedLoads);
+        }
+
+        for (size_t f = 0; f < finished.size(); f++) {
+            if (finished[f].tile >= tiles.size()) {
+                delete finished[f].bundle;
+                continue;
+            }
+            Tile& tile = tiles[finished[f].tile];
+            if (!finished[f].bundle) {
+                std::cerr << "ERROR: could not load tile " << tile.fileName << std::endl;
+                tile.state = TILE_FAILED;
+                continue;
+            }
+            tile.bundle = finished[f].bundle;
+            tile.state = TILE_LOADED;
+        }
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef WorldStreamer_hpp
+#define WorldStreamer_hpp
+
+#include "Model3D.hpp"
+#include "AssetBundle.hpp"
+#include "Shader.hpp"
+
+#include "glm/glm.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+// Keeps the tiles of a map baked with asset_baker --tiles resident around the camera.
+// Tile bundles are opened and paged in on the shared thread pool, uploaded a few per frame on the GL thread,
+// prefetched ahead of the camera's motion and evicted least recently used first once over the memory budget.
+class WorldStreamer
+{
+public:
+    // Grid cell of a tile and the bounds of its geometry, in model space
+    struct TileInfo {
+        int x;
+        int z;
+        BoundingBox bounds;
+    };
+
+    // Tiles whose bounds come closer to the camera than this, on the xz plane, are loaded
+    static float loadRadius;
+    // Tiles around where the camera will be this many seconds from now are loaded as well
+    static float prefetchSeconds;
+    // Mesh memory the resident tiles may take before the least recently used ones are evicted
+    static size_t memoryBudget;
+    // Bundles opened in the background at a time
+    static const size_t MAX_LOADS_IN_FLIGHT = 4;
+
+    // <directory>.tiles lists the tiles, <directory>.tile_<x>_<z>.bundle holds each one
+    static std::string getManifestPath(const std::string& directory);
+    static std::string getTilePath(const std::string& directory, int x, int z);
+    static bool WriteManifest(const std::string& directory, float tileSize, const std::vector<TileInfo>& tiles);
+
+    WorldStreamer();
+    ~WorldStreamer();
+
+    // Reads the manifest and opens the texture bundle of the directory - false if it was not baked into tiles
+    bool Open(const std::string& directory);
+    bool isOpen() const;
+    // Waits for the loads in flight and frees every tile
+    void Close();
+
+    // Picks the tiles to keep around the camera, given in the model space of the map, queues their loads and evicts the rest
+    void Update(const glm::vec3& cameraPosition, float deltaTime);
+    // Uploads up to maxTiles of the tiles loaded in the background - on the GL thread
+    void ProcessLoads(size_t maxTiles);
+
+    // frustum, in the model space of the map, skips the tiles outside it and culls the shapes of the others
+    void Draw(gps::Shader& shaderProgram, const gps::Frustum* frustum = NULL, OcclusionCulling occlusion = OCCLUSION_OFF);
+    void DrawLod(gps::Shader& shaderProgram, const Model3D::LodParameters& parameters, const gps::Frustum* frustum = NULL,
+        OcclusionCulling occlusion = OCCLUSION_OFF);
+
+    // Adds the occluders of the resident tiles in the frustum to the frame of the DepthRasterizer
+    void RasterizeOccluders(const glm::mat4& model, const gps::Frustum* frustum = NULL);
+
+    void PrintStats() const;
+
+private:
+    enum TileState {
+        TILE_UNLOADED,
+        // opening on the thread pool
+        TILE_LOADING,
+        // opened, waiting for ProcessLoads
+        TILE_LOADED,
+        TILE_RESIDENT,
+        // corrupt or missing - not retried until the next Open
+        TILE_FAILED
+    };
+
+    struct Tile {
+        TileInfo info;
+        std::string fileName;
+        TileState state;
+        // set while TILE_LOADED
+        AssetBundle* bundle;
+        // set while TILE_RESIDENT
+        Model3D* model;
+        size_t bytes;
+        unsigned long long lastUsed;
+    };
+
+    // A bundle opened in the background - NULL if it could not be opened
+    struct FinishedLoad {
+        size_t tile;
+        AssetBundle* bundle;
+    };
+
+    std::string directory;
+    float tileSize;
+    std::vector<Tile> tiles;
+    AssetBundle textureBundle;
+    bool opened;
+
+    glm::vec3 lastCameraPosition;
+    glm::vec3 velocity;
+    bool hasLastCameraPosition;
+    unsigned long long frame;
+    size_t residentBytes;
+
+    std::mutex mutex;
+    std::condition_variable loadFinished;
+    std::deque<FinishedLoad> finishedLoads;
+    size_t loadsInFlight;
+
+    // statistics since Open
+    size_t loadCount;
+    size_t evictionCount;
+    size_t peakResidentBytes;
+
+    // Distance from a point to the bounds of a tile on the xz plane
+    static float Distance(const TileInfo& info, const glm::vec3& position);
+
+    void StartLoad(size_t tileIndex);
+    void Evict(size_t tileIndex);
+    // Moves the finished background loads into their tiles
+    void CollectLoads();
+
+    WorldStreamer(const WorldStreamer&);
+    WorldStreamer& operator=(const WorldStreamer&);
+};
+
+}
+
+#endif /* WorldStreamer_hpp */
@@ -12,7 +12,16 @@
 #include "Camera.hpp"
 #include "Model3D.hpp"
 #include "SkyBox.hpp"
-
+#include "TextureLoader.hpp"
+#include "TextureCache.hpp"
+#include "ShaderCache.hpp"
+#include "RenderQueue.hpp"
+#include "OcclusionQueries.hpp"
+#include "DepthRasterizer.hpp"
+#include "UniformBuffers.hpp"
+#include "WorldStreamer.hpp"
+
+#include <algorithm>
 #include <iostream>
 
 // window
@@ -29,7 +38,9 @@ glm::mat3 normalMatrix;
 glm::vec3 lightDir;
 glm::vec3 colorDir;
 
-glm::vec3 fog;
+// toggled with 6/7 and 9/0, each picks a permutation of simple.frag
+bool fogEnabled = false;
+bool pointLightEnabled = false;
 
 glm::vec3 diffuseDir;
 glm::vec3 specularDir;
@@ -47,35 +58,6 @@ glm::vec3 ambientSpot;
 glm::vec3 diffuseSpot;
 glm::vec3 specularSpot;
 
-// shader uniform locations
-GLint modelLoc;
-GLint carLoc;
-GLint viewLoc;
-GLint projectionLoc;
-GLint normalMatrixLoc;
-
-GLint lightDirLoc;
-GLint colorDirLoc;
-
-GLint fogLoc;
-GLint pointLoc;
-
-GLint diffuseDirLoc;
-GLint specularDirLoc;
-
-GLint positionSpotLoc;
-GLint directionSpotLoc;
-GLint cutOffSpotLoc;
-GLint outerCutOffSpotLoc;
-
-GLint constantSpotLoc;
-GLint linearSpotLoc;
-GLint quadraticSpotLoc;
-
-GLint ambientSpotLoc;
-GLint diffuseSpotLoc;
-GLint specularSpotLoc;
-
 // camera
 gps::Camera myCamera(
     glm::vec3(0.0f, 100.0f, 3.0f),
@@ -101,13 +83,50 @@ bool animation = false;
 int animationPoint = 0;
 int count = 0;
 
+// bytes of decoded texture data uploaded per frame
+const size_t TEXTURE_UPLOAD_BUDGET = 8 * 1024 * 1024;
+
+// projected simplification error allowed by the level of detail selection, in pixels
+const float LOD_PIXEL_ERROR = 1.0f;
+// the shadow map hides more error - and goes one level coarser on top of that
+const float SHADOW_LOD_PIXEL_ERROR = 4.0f;
+const int SHADOW_LOD_BIAS = 1;
+// seconds between the last two frames, advances the level of detail cross-fades
+float frameDeltaTime = 0.0f;
+bool lodEnabled = true;
+
+// map tiles uploaded per frame when the map is streamed
+const size_t TILE_UPLOADS_PER_FRAME = 1;
+
+// passes of the render queue, in drawing order
+enum RenderPass {
+    SHADOW_PASS = 0,
+    MAIN_PASS = 1
+};
+
 const unsigned int SHADOW_WIDTH = 2048;
 const unsigned int SHADOW_HEIGHT = 2048;
+// half the side of the square around the camera the shadow map covers, and the distance of the light volume's
+// near plane above the camera - in world units
+const float SHADOW_HALF_EXTENT = 800.0f;
+const float SHADOW_LIGHT_DISTANCE = 1000.0f;
+// toggled with 8
 bool shadow = false;
+// toggled with C
+bool frustumCulling = true;
+// cycled with O - skips the map shapes hidden behind others, among those in the frustum
+gps::OcclusionCulling occlusionCulling = gps::OCCLUSION_OFF;
+// width of the CPU depth buffer, its height follows the window
+const int DEPTH_RASTER_WIDTH = 256;
+// overrides the features of simple.frag while benchmarking them, -1 otherwise
+int benchmarkFeatures = -1;
+bool runPermutationBenchmark = false;
 
 // models
 gps::Model3D car;
 gps::Model3D map;
+// streams the map instead when it was baked into tiles
+gps::WorldStreamer mapStreamer;
 gps::Model3D screenQuad;
 GLfloat angle;
 
@@ -117,8 +136,8 @@ gps::Shader carShader;
 gps::Shader depthMapShader;
 gps::Shader screenQuadShader;
 
-GLuint shadowMapFBO;
-GLuint depthMapTexture;
+gps::GLFramebuffer shadowMapFBO;
+gps::GLTexture depthMapTexture;
 
 GLenum glCheckError_(const char *file, int line)
 {
@@ -163,6 +182,38 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
         glfwSetWindowShouldClose(window, GL_TRUE);
     }
 
+    // print the texture cache and mesh memory statistics
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        gps::TextureCache::getInstance().PrintStats();
+        gps::ShaderCache::getInstance().PrintStats();
+        gps::UniformBuffers::getInstance().PrintStats();
+        gps::RenderQueue::getInstance().PrintStats();
+        gps::OcclusionQueries::getInstance().PrintStats();
+        gps::DepthRasterizer::getInstance().PrintStats();
+        map.PrintStats("map");
+        car.PrintStats("car");
+        if (mapStreamer.isOpen())
+            mapStreamer.PrintStats();
+    }
+
+    // frustum culling on and off, to measure what it saves
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        frustumCulling = !frustumCulling;
+        printf("Frustum culling %s\n", frustumCulling ? "on" : "off");
+    }
+
+    // off, GPU queries, CPU depth rasterizer - to measure what each saves
+    if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+        const char* names[] = { "off", "GPU queries", "CPU depth rasterizer" };
+        occlusionCulling = static_cast<gps::OcclusionCulling>((occlusionCulling + 1) % 3);
+        printf("Occlusion culling %s\n", names[occlusionCulling]);
+    }
+
+    // the shadow map is only rendered and sampled while shadows are on
+    if (key == GLFW_KEY_8 && action == GLFW_PRESS && !animation) {
+        shadow = !shadow;
+    }
+
 	if (key >= 0 && key < 1024) {
         if (action == GLFW_PRESS) {
             pressedKeys[key] = true;
@@ -197,8 +248,6 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
         myCamera.rotate(yoffset, xoffset);
         //update view matrix
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         // compute normal matrix for teapot
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
@@ -210,56 +259,36 @@ void processMovement() {
             myCamera.move(gps::MOVE_FORWARD, cameraSpeed);
             //update view matrix
             view = myCamera.getViewMatrix();
-            myBasicShader.useShaderProgram();
-            glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
             // compute normal matrix for teapot
             normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-            glUniformMatrix4fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
             directionSpot = myCamera.getPosition();
-            directionSpotLoc = glGetUniformLocation(myBasicShader.shaderProgram, "pointLight");
-            glUniform3fv(directionSpotLoc, 1, glm::value_ptr(directionSpot));
         }
 
         if (pressedKeys[GLFW_KEY_S]) {
             myCamera.move(gps::MOVE_BACKWARD, cameraSpeed);
             //update view matrix
             view = myCamera.getViewMatrix();
-            myBasicShader.useShaderProgram();
-            glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
             // compute normal matrix for teapot
             normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-            glUniformMatrix4fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
             directionSpot = myCamera.getPosition();
-            directionSpotLoc = glGetUniformLocation(myBasicShader.shaderProgram, "pointLight");
-            glUniform3fv(directionSpotLoc, 1, glm::value_ptr(directionSpot));
         }
 
         if (pressedKeys[GLFW_KEY_A]) {
             myCamera.move(gps::MOVE_LEFT, cameraSpeed);
             //update view matrix
             view = myCamera.getViewMatrix();
-            myBasicShader.useShaderProgram();
-            glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
             // compute normal matrix for teapot
             normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-            glUniformMatrix4fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
             directionSpot = myCamera.getPosition();
-            directionSpotLoc = glGetUniformLocation(myBasicShader.shaderProgram, "pointLight");
-            glUniform3fv(directionSpotLoc, 1, glm::value_ptr(directionSpot));
         }
 
         if (pressedKeys[GLFW_KEY_D]) {
             myCamera.move(gps::MOVE_RIGHT, cameraSpeed);
             //update view matrix
             view = myCamera.getViewMatrix();
-            myBasicShader.useShaderProgram();
-            glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
             // compute normal matrix for teapot
             normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-            glUniformMatrix4fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
             directionSpot = myCamera.getPosition();
-            directionSpotLoc = glGetUniformLocation(myBasicShader.shaderProgram, "pointLight");
-            glUniform3fv(directionSpotLoc, 1, glm::value_ptr(directionSpot));
         }
 
         if (pressedKeys[GLFW_KEY_Q]) {
@@ -268,9 +297,6 @@ void processMovement() {
             model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0, 1, 0));
             // update normal matrix for teapot
             normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-            myBasicShader.useShaderProgram();
-            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-            glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
         }
 
         if (pressedKeys[GLFW_KEY_E]) {
@@ -279,33 +305,24 @@ void processMovement() {
             model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0, 1, 0));
             // update normal matrix for teapot
             normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-            myBasicShader.useShaderProgram();
-            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-            glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
         }
 
         if (pressedKeys[GLFW_KEY_UP]) {
             myCamera.zoom(gps::MOVE_FORWARD, cameraSpeed);
             //update view matrix
             view = myCamera.getViewMatrix();
-            myBasicShader.useShaderProgram();
             projection = glm::perspective(glm::radians(myCamera.getFov()),
                 (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
                 0.1f, 200.0f);
-            // send projection matrix to shader
-            glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
         }
 
         if (pressedKeys[GLFW_KEY_DOWN]) {
             myCamera.zoom(gps::MOVE_BACKWARD, cameraSpeed);
             //update view matrix
             view = myCamera.getViewMatrix();
-            myBasicShader.useShaderProgram();
             projection = glm::perspective(glm::radians(myCamera.getFov()),
                 (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
                 0.1f, 200.0f);
-            // send projection matrix to shader
-            glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
         }
 
         if (pressedKeys[GLFW_KEY_1]) {
@@ -317,10 +334,7 @@ void processMovement() {
         }
 
         if (pressedKeys[GLFW_KEY_3]) {
-            myBasicShader.useShaderProgram();
             colorDir = glm::vec3(0.05f, 0.05f, 0.05f); //white light
-            // send light color to shader
-            glUniform3fv(colorDirLoc, 1, glm::value_ptr(colorDir));
             
             std::vector<const GLchar*> faces;
             faces.push_back("skybox/nightsky_rt.tga");
@@ -334,10 +348,7 @@ void processMovement() {
         }
 
         if (pressedKeys[GLFW_KEY_4]) {
-            myBasicShader.useShaderProgram();
             colorDir = glm::vec3(0.5f, 0.5f, 0.5f); //white light
-            // send light color to shader
-            glUniform3fv(colorDirLoc, 1, glm::value_ptr(colorDir));
 
             std::vector<const GLchar*> faces;
             faces.push_back("skybox/right.tga");
@@ -351,29 +362,19 @@ void processMovement() {
         }
 
         if (pressedKeys[GLFW_KEY_6]) {
-            fog = glm::vec3(1.0f, 0.0f, 0.0f);
-            myBasicShader.useShaderProgram();
-            glUniform3fv(fogLoc, 1, glm::value_ptr(fog));
+            fogEnabled = true;
         }
 
         if (pressedKeys[GLFW_KEY_7]) {
-            fog = glm::vec3(1.0f, 1.0f, 0.0f);
-            myBasicShader.useShaderProgram();
-            glUniform3fv(fogLoc, 1, glm::value_ptr(fog));
-        }
-
-        if (pressedKeys[GLFW_KEY_8]) {
-            shadow = false;
+            fogEnabled = false;
         }
 
         if (pressedKeys[GLFW_KEY_9]) {
-            myBasicShader.useShaderProgram();
-            glUniform3fv(pointLoc, 1, glm::value_ptr(glm::vec3(1.0f, 0.0f, 0.0f)));
+            pointLightEnabled = true;
         }
 
         if (pressedKeys[GLFW_KEY_0]) {
-            myBasicShader.useShaderProgram();
-            glUniform3fv(pointLoc, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.0f)));
+            pointLightEnabled = false;
             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
         }
     }
@@ -407,10 +408,10 @@ void initOpenGLState() {
 
 void initFBO() {
     //TODO - Create the FBO, the depth texture and attach the depth texture to the FBO
-    glGenFramebuffers(1, &shadowMapFBO);
+    shadowMapFBO = gps::GLFramebuffer::Create();
     //create depth texture for FBO
-    glGenTextures(1, &depthMapTexture);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
+    depthMapTexture = gps::GLTexture::Create();
+    glBindTexture(GL_TEXTURE_2D, depthMapTexture.get());
     glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
         SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -421,8 +422,8 @@ void initFBO() {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 
     //attach texture to FBO
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapTexture,
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO.get());
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapTexture.get(),
         0);
 
     glDrawBuffer(GL_NONE);
@@ -431,16 +432,34 @@ void initFBO() {
 }
 
 void initModels() {
-    map.LoadModel("models/Map/NewMap.obj");
+    // baked with asset_baker --tiles - streamed around the camera instead of loaded whole
+    if (!gps::Model3D::rebuildMeshCache
+        && gps::AssetBundle::IsUpToDate(gps::WorldStreamer::getManifestPath("models/Map"), "models/Map/NewMap.obj")
+        && mapStreamer.Open("models/Map")) {
+        std::cout << "Map tiles are loaded as the camera approaches them" << std::endl;
+    }
+    else {
+        // the map never moves - merge its shapes by material
+        map.setStatic(true);
+        map.LoadModel("models/Map/NewMap.obj");
+    }
     car.LoadModel("models/Car/Challenger.obj");
 }
 
 void initShaders() {
-	myBasicShader.loadShader("shaders/simple.vert", "shaders/simple.frag");
+	// every permutation is built here, so toggling a feature never compiles during a frame
+	myBasicShader.loadShader("shaders/simple.vert", "shaders/simple.frag", std::vector<std::string>(), gps::SHADER_ALL_FEATURES);
     depthMapShader.loadShader("shaders/depthMap.vert", "shaders/depthMap.frag");
+    skyboxShader.loadShader("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
+    gps::OcclusionQueries::getInstance().Init();
 }
 
 void initSkyBox() {
+    // baked by asset_baker
+    if (mySkyBox.Load(gps::AssetBundle::getBundlePath("skybox"))) {
+        return;
+    }
+
     std::vector<const GLchar*> faces;
     faces.push_back("skybox/right.tga");
     faces.push_back("skybox/left.tga");
@@ -453,59 +472,50 @@ void initSkyBox() {
 }
 
 void initUniforms() {
-
-    myBasicShader.useShaderProgram();
-
     // create model matrix for teapot
     model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-	modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
 
 	// get view matrix for current camera
 	view = myCamera.getViewMatrix();
-	viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
-	// send view matrix to shader
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
     // compute normal matrix for teapot
     normalMatrix = glm::mat3(glm::inverseTranspose(view*model));
-	normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
 
 	// create projection matrix
 	projection = glm::perspective(glm::radians(myCamera.getFov()),
                                (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
                                0.1f, 5000.0f);
-	projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-	// send projection matrix to shader
-	glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));	
 
 
 	//set the light direction (direction towards the light)
 	lightDir = glm::vec3(-0.2f, 4.0f, -0.3f);
-	lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
-	// send light dir to shader
-	glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
 
 	//set light color
     colorDir = glm::vec3(0.5f, 0.5f, 0.5f); //white light
-    colorDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
-	// send light color to shader
-	glUniform3fv(colorDirLoc, 1, glm::value_ptr(colorDir));
 
     directionSpot = myCamera.getPosition();
-    directionSpotLoc = glGetUniformLocation(myBasicShader.shaderProgram, "pointLight");
-    glUniform3fv(directionSpotLoc, 1, glm::value_ptr(directionSpot));
 
-    fog = glm::vec3(1.0f, 1.0f, 0.0f);
-    fogLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fog");
-    // send light color to shader
-    glUniform3fv(fogLoc, 1, glm::value_ptr(fog));
+    // the render queue binds the maps of every mesh to the same units
+    myBasicShader.setSampler("diffuseTexture", gps::RenderQueue::DIFFUSE_TEXTURE_UNIT);
+    myBasicShader.setSampler("specularTexture", gps::RenderQueue::SPECULAR_TEXTURE_UNIT);
+    myBasicShader.setSampler("shadowMap", 3);
+}
 
-    pointLoc = glGetUniformLocation(myBasicShader.shaderProgram, "point");
-    // send light color to shader
-    glUniform3fv(pointLoc, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.0f)));
+// level of detail selection for the main or the shadow pass - both measured from the camera
+gps::Model3D::LodParameters lodParameters(const glm::mat4& modelMatrix, bool depth) {
+    gps::Model3D::LodParameters parameters;
+    parameters.model = modelMatrix;
+    parameters.cameraPosition = myCamera.getPosition();
+    parameters.projectionScale = myWindow.getWindowDimensions().height / (2.0f * tanf(glm::radians(myCamera.getFov()) * 0.5f));
+    parameters.pixelError = depth ? SHADOW_LOD_PIXEL_ERROR : LOD_PIXEL_ERROR;
+    parameters.lodBias = depth ? SHADOW_LOD_BIAS : 0;
+    // only the main pass advances the cross-fades
+    parameters.deltaTime = depth ? 0.0f : frameDeltaTime;
+    return parameters;
 }
 
-void renderMap(gps::Shader shader, bool depth) {
+// viewFrustum is in world space - it culls the shapes the pass cannot see
+void renderMap(gps::Shader& shader, bool depth, const gps::Frustum& viewFrustum) {
     // select active shader program
     shader.useShaderProgram();
 
@@ -513,20 +523,48 @@ void renderMap(gps::Shader shader, bool depth) {
 
     //send teapot normal matrix data to shader
     
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-
-    // do not send the normal matrix if we are rendering in the depth map
+    // do not compute the normal matrix if we are rendering in the depth map
     if (!depth) {
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        normalMatrixLoc = glGetUniformLocation(shader.shaderProgram, "normalMatrix");
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    }
+    // the meshes send both with their ObjectData
+    gps::RenderQueue::getInstance().setObjectTransform(model, normalMatrix);
+
+    // only the main pass is tested for occlusion - the queries run against its depth buffer
+    gps::OcclusionCulling occlusion = depth ? gps::OCCLUSION_OFF : occlusionCulling;
+    gps::Frustum modelFrustum = viewFrustum.InModelSpace(model);
+    const gps::Frustum* frustum = frustumCulling || occlusion != gps::OCCLUSION_OFF ? &modelFrustum : NULL;
+
+    if (occlusion == gps::OCCLUSION_QUERIES) {
+        gps::OcclusionQueries::getInstance().setObjectTransform(model, myCamera.getPosition());
+    }
+    else if (occlusion == gps::OCCLUSION_DEPTH_RASTER) {
+        // the occluders of this frame, before the shapes behind them are tested
+        gps::DepthRasterizer& rasterizer = gps::DepthRasterizer::getInstance();
+        rasterizer.BeginFrame(projection * view, DEPTH_RASTER_WIDTH,
+            DEPTH_RASTER_WIDTH * myWindow.getWindowDimensions().height / std::max(myWindow.getWindowDimensions().width, 1));
+        if (mapStreamer.isOpen())
+            mapStreamer.RasterizeOccluders(model, &modelFrustum);
+        else
+            map.RasterizeOccluders(model);
+        rasterizer.Rasterize();
+        rasterizer.setObjectTransform(model);
     }
 
     // draw teapot
-    map.Draw(shader);
+    if (mapStreamer.isOpen()) {
+        if (lodEnabled)
+            mapStreamer.DrawLod(shader, lodParameters(model, depth), frustum, occlusion);
+        else
+            mapStreamer.Draw(shader, frustum, occlusion);
+    }
+    else if (lodEnabled)
+        map.DrawLod(shader, lodParameters(model, depth), frustum, occlusion);
+    else
+        map.Draw(shader, frustum, occlusion);
 }
 
-void renderCar(gps::Shader shader, bool depth) {
+void renderCar(gps::Shader& shader, bool depth, const gps::Frustum& viewFrustum) {
     // select active shader program
     shader.useShaderProgram();
 
@@ -548,25 +586,30 @@ void renderCar(gps::Shader shader, bool depth) {
     carModel = glm::rotate(carModel, glm::radians(rotation), glm::vec3(0.0f, 1.0f, 0.0f));
     if (rotation == 180)
         carModel = glm::translate(carModel, glm::vec3(0.0f, 0.0f, 150.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(carModel));
-
 
     //send teapot normal matrix data to shader
     if (!depth) {
         normalMatrix = glm::mat3(glm::inverseTranspose(view * carModel));
-        normalMatrixLoc = glGetUniformLocation(shader.shaderProgram, "normalMatrix");
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
     }
+    gps::RenderQueue::getInstance().setObjectTransform(carModel, normalMatrix);
+
+    gps::Frustum modelFrustum = viewFrustum.InModelSpace(carModel);
+    const gps::Frustum* frustum = frustumCulling ? &modelFrustum : NULL;
 
     // draw teapot
-    car.Draw(shader);
+    if (lodEnabled)
+        car.DrawLod(shader, lodParameters(carModel, depth), frustum);
+    else
+        car.Draw(shader, frustum);
 }
 
 glm::mat4 computeLightSpaceTrMatrix() {
-    //TODO - Return the light-space transformation matrix
-    glm::mat4 lightView = glm::lookAt(lightDir, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    const GLfloat near_plane = 0.1f, far_plane = 5.0f;
-    glm::mat4 lightProjection = glm::ortho(-1.0f, 1.0f, -1.0f, 1.0f, near_plane, far_plane);
+    // an orthographic volume around the camera, looking along the light - sized for the map, not for the unit cube
+    glm::vec3 center = myCamera.getPosition();
+    glm::mat4 lightView = glm::lookAt(center + glm::normalize(lightDir) * SHADOW_LIGHT_DISTANCE, center,
+        glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::mat4 lightProjection = glm::ortho(-SHADOW_HALF_EXTENT, SHADOW_HALF_EXTENT, -SHADOW_HALF_EXTENT, SHADOW_HALF_EXTENT,
+        0.0f, 2.0f * SHADOW_LIGHT_DISTANCE);
 
     glm::mat4 lightSpaceTrMatrix = lightProjection * lightView;
     return lightSpaceTrMatrix;
@@ -776,78 +819,234 @@ void cameraAnimation() {
         if (count == 300)
             myCamera.setCamera(glm::vec3(-873.189514, 361.486603, 242.407684), glm::vec3(-872.200745, 361.538806, 242.386978));
     }
-    myBasicShader.useShaderProgram();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
     
     normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix4fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+}
+
+// Writes the blocks every program of the frame reads - once, before the first pass
+void sendFrameUniforms() {
+    gps::FrameData frameData;
+    frameData.view = view;
+    frameData.projection = projection;
+    frameData.lightSpaceTrMatrix = computeLightSpaceTrMatrix();
+    frameData.cameraPosition = myCamera.getPosition();
+    frameData.time = static_cast<float>(glfwGetTime());
+    gps::UniformBuffers::getInstance().setFrame(frameData);
+
+    directionSpot = myCamera.getFront();
+    gps::LightData lightData;
+    // transformed once here instead of in every fragment
+    lightData.lightDirEye = glm::normalize(glm::mat3(view) * lightDir);
+    lightData.lightColor = colorDir;
+    lightData.pointLight = directionSpot;
+    lightData.padding0 = lightData.padding1 = lightData.padding2 = 0.0f;
+    gps::UniformBuffers::getInstance().setLight(lightData);
+}
+
+// Permutation of simple.frag for the current toggles - meshes without a specular map drop TEXTURED_SPECULAR themselves,
+// ranges that are not cross-fading drop LOD_FADE
+unsigned sceneFeatures() {
+    if (benchmarkFeatures >= 0)
+        return static_cast<unsigned>(benchmarkFeatures) | gps::SHADER_LOD_FADE;
+    unsigned features = gps::SHADER_TEXTURED_SPECULAR | gps::SHADER_LOD_FADE;
+    if (fogEnabled)
+        features |= gps::SHADER_FOG;
+    if (pointLightEnabled)
+        features |= gps::SHADER_POINT_LIGHT;
+    if (shadow)
+        features |= gps::SHADER_SHADOWS;
+    return features;
 }
 
 void renderScene() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    sendFrameUniforms();
+    // only depth is written into the shadow map
+    myBasicShader.setFeatures(0);
+    // the passes render into different framebuffers - each one is flushed before the next binds its own
+    gps::RenderQueue& renderQueue = gps::RenderQueue::getInstance();
+    renderQueue.setCameraPosition(myCamera.getPosition());
+    // depthMap.vert projects through the light, simple.vert through the camera
+    gps::Frustum cameraFrustum = myCamera.getFrustum(projection);
+
     if (shadow) {
         depthMapShader.useShaderProgram();
-        glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix"),
-            1,
-            GL_FALSE,
-            glm::value_ptr(computeLightSpaceTrMatrix()));
         glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO.get());
         glClear(GL_DEPTH_BUFFER_BIT);
-        renderMap(depthMapShader, true);
-        renderCar(myBasicShader, true);
+        renderQueue.setPass(SHADOW_PASS);
+        gps::Frustum lightFrustum(computeLightSpaceTrMatrix());
+        renderMap(depthMapShader, true, lightFrustum);
+        renderCar(depthMapShader, true, lightFrustum);
+        renderQueue.Flush();
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
     }
-    myBasicShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrix"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(computeLightSpaceTrMatrix()));
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    renderMap(myBasicShader, true);
-    renderCar(myBasicShader, true);
-    glClear(GL_DEPTH_BUFFER_BIT);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     if (animation == true)
         cameraAnimation();
 
-    myBasicShader.useShaderProgram();
     positionSpot = myCamera.getPosition();
-    glUniform3fv(positionSpotLoc, 1, glm::value_ptr(positionSpot));
-
-    directionSpot = myCamera.getFront();
-    glUniform3fv(directionSpotLoc, 1, glm::value_ptr(directionSpot));
 
     //render the scene
     glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "shadowMap"), 3);
+    glBindTexture(GL_TEXTURE_2D, depthMapTexture.get());
+    myBasicShader.setFeatures(sceneFeatures());
 
     // render the teapot
-    renderMap(myBasicShader, false);
-    renderCar(myBasicShader, false);
-    skyboxShader.loadShader("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
+    renderQueue.setPass(MAIN_PASS);
+    renderMap(myBasicShader, false, cameraFrustum);
+    renderCar(myBasicShader, false, cameraFrustum);
+    renderQueue.Flush();
+    // the boxes of the shapes due for a test, against the depth of the main pass - read back in the next frames
+    gps::OcclusionQueries::getInstance().Issue();
     skyboxShader.useShaderProgram();
     view = myCamera.getViewMatrix();
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "view"), 1, GL_FALSE,
-        glm::value_ptr(view));
+    // SkyBox::Draw sends both matrices - its projection is its own, the scene keeps the camera's
+    glm::mat4 skyboxProjection = glm::perspective(glm::radians(45.0f), (float)myWindow.getWindowDimensions().width / myWindow.getWindowDimensions().height, 0.1f, 1000.0f);
+    mySkyBox.Draw(skyboxShader, view, skyboxProjection);
+}
+
+// Renders the current view with every permutation of simple.frag and prints the GPU time of a frame with each.
+// The rest of the frame is the same for all of them, so the differences are the fragment cost of the features.
+void benchmarkPermutations() {
+    const int WARMUP_FRAMES = 10;
+    const int MEASURED_FRAMES = 100;
+
+    // finish the texture uploads and the tiles around the camera first, they would show up in the first permutations
+    const double TILE_SETTLE_SECONDS = 2.0;
+    double settleEnd = glfwGetTime() + TILE_SETTLE_SECONDS;
+    while (mapStreamer.isOpen() && glfwGetTime() < settleEnd) {
+        mapStreamer.Update(glm::vec3(glm::inverse(model) * glm::vec4(myCamera.getPosition(), 1.0f)), 0.0f);
+        mapStreamer.ProcessLoads(static_cast<size_t>(-1));
+    }
+    gps::TextureLoader::getInstance().FinishUploads();
+    gps::GLQuery timer = gps::GLQuery::Create();
+
+    printf("%-40s %12s %12s\n", "simple.frag features", "GPU ms", "vs none");
+    double baseline = 0.0;
+    for (unsigned features = 0; features <= gps::SHADER_ALL_FEATURES; features++) {
+        // picked per range by its fade, not by a toggle
+        if (features & gps::SHADER_LOD_FADE)
+            continue;
+        benchmarkFeatures = static_cast<int>(features);
+        GLuint64 elapsed = 0;
+        for (int frame = 0; frame < WARMUP_FRAMES + MEASURED_FRAMES; frame++) {
+            gps::UniformBuffers::getInstance().BeginFrame();
+            gps::RenderQueue::getInstance().BeginFrame();
+            gps::OcclusionQueries::getInstance().BeginFrame();
+            glBeginQuery(GL_TIME_ELAPSED, timer.get());
+            renderScene();
+            glEndQuery(GL_TIME_ELAPSED);
+            gps::UniformBuffers::getInstance().EndFrame();
+            glfwSwapBuffers(myWindow.getWindow());
+
+            // waits for the frame - fine while benchmarking
+            GLuint64 frameTime = 0;
+            glGetQueryObjectui64v(timer.get(), GL_QUERY_RESULT, &frameTime);
+            if (frame >= WARMUP_FRAMES)
+                elapsed += frameTime;
+        }
 
-    projection = glm::perspective(glm::radians(45.0f), (float)myWindow.getWindowDimensions().width / myWindow.getWindowDimensions().height, 0.1f, 1000.0f);
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "projection"), 1, GL_FALSE,
-        glm::value_ptr(projection));
-    mySkyBox.Draw(skyboxShader, view, projection);
+        double milliseconds = elapsed / 1e6 / MEASURED_FRAMES;
+        if (features == 0)
+            baseline = milliseconds;
+        printf("%-40s %12.3f %+11.1f%%\n", gps::getShaderFeatureNames(features).c_str(), milliseconds,
+            baseline > 0.0 ? (milliseconds / baseline - 1.0) * 100.0 : 0.0);
+    }
+    benchmarkFeatures = -1;
 }
 
 void cleanup() {
+    gps::TextureCache::getInstance().PrintStats();
+    gps::ShaderCache::getInstance().PrintStats();
+    gps::UniformBuffers::getInstance().PrintStats();
+    gps::RenderQueue::getInstance().PrintStats();
+    gps::OcclusionQueries::getInstance().PrintStats();
+    gps::DepthRasterizer::getInstance().PrintStats();
+    map.PrintStats("map");
+    car.PrintStats("car");
+    if (mapStreamer.isOpen())
+        mapStreamer.PrintStats();
+    // waits for the tile loads in flight
+    mapStreamer.Close();
+    // GL objects have to go before the context does - the globals holding them are only destroyed after it
+    car.Clear();
+    map.Clear();
+    screenQuad.Clear();
+    mySkyBox.Clear();
+    shadowMapFBO.reset();
+    depthMapTexture.reset();
+    gps::ShaderCache::getInstance().Clear();
+    // their uniform tables went with the cache
+    myBasicShader = gps::Shader();
+    carShader = gps::Shader();
+    depthMapShader = gps::Shader();
+    screenQuadShader = gps::Shader();
+    skyboxShader = gps::Shader();
+    gps::UniformBuffers::getInstance().Destroy();
+    gps::OcclusionQueries::getInstance().Destroy();
+    gps::TextureLoader::getInstance().Shutdown();
     myWindow.Delete();
     //cleanup code for your own data
 }
 
 int main(int argc, const char * argv[]) {
 
+    for (int i = 1; i < argc; i++) {
+        // re-parse the .obj files even if their mesh caches are up to date
+        if (std::string(argv[i]) == "--rebuild-cache")
+            gps::Model3D::rebuildMeshCache = true;
+        // skip the vertex cache and fetch reordering of freshly parsed meshes
+        if (std::string(argv[i]) == "--no-mesh-optimization")
+            gps::Model3D::optimizeMeshes = false;
+        // also reorder freshly parsed meshes to reduce overdraw
+        if (std::string(argv[i]) == "--optimize-overdraw")
+            gps::Model3D::optimizeOverdraw = true;
+        // also regroup freshly parsed meshes into tighter clusters for culling
+        if (std::string(argv[i]) == "--optimize-clusters")
+            gps::Model3D::optimizeClusters = true;
+        // upload the vertices as 32 byte floats instead of quantizing them to 16 bytes
+        if (std::string(argv[i]) == "--float-vertices")
+            gps::Model3D::vertexFormat = gps::VERTEX_FORMAT_FLOAT;
+        // draw every shape of the map on its own instead of merging them by material
+        if (std::string(argv[i]) == "--no-static-batching")
+            gps::Model3D::staticBatching = false;
+        // draw everything at full detail
+        if (std::string(argv[i]) == "--no-lod") {
+            gps::Model3D::generateLods = false;
+            lodEnabled = false;
+        }
+        // switch levels of detail without cross-fading
+        if (std::string(argv[i]) == "--no-lod-fade")
+            gps::Model3D::lodFadeTime = 0.0f;
+        // share one texture between image files with identical contents
+        if (std::string(argv[i]) == "--dedup-textures")
+            gps::TextureCache::getInstance().setContentDeduplication(true);
+        // memory the streamed map tiles may take, in MB
+        if (std::string(argv[i]) == "--tile-budget" && i + 1 < argc)
+            gps::WorldStreamer::memoryBudget = static_cast<size_t>(atof(argv[++i]) * 1024.0 * 1024.0);
+        // always compile the shaders instead of loading the program binaries of earlier runs
+        if (std::string(argv[i]) == "--no-program-binaries")
+            gps::ShaderCache::getInstance().setProgramBinaries(false);
+        // start with the shapes hidden behind the largest buildings culled on the CPU - no GPU queries
+        if (std::string(argv[i]) == "--depth-raster-occlusion")
+            occlusionCulling = gps::OCCLUSION_DEPTH_RASTER;
+        // upload the images uncompressed instead of transcoding them to BC1/BC3
+        if (std::string(argv[i]) == "--no-texture-compression")
+            gps::TextureLoader::getInstance().setCompression(false);
+        // time a frame with every permutation of simple.frag and exit
+        if (std::string(argv[i]) == "--benchmark-permutations")
+            runPermutationBenchmark = true;
+        // compare the parallel .obj parser against tinyobj and exit
+        if (std::string(argv[i]) == "--benchmark-obj" && i + 1 < argc)
+            return gps::ObjParser::Benchmark(argv[i + 1]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // optional per-texture compression formats
+    gps::TextureLoader::getInstance().LoadFormatOverrides("texture_formats.txt");
+
     try {
         initOpenGLWindow();
     } catch (const std::exception& e) {
@@ -863,11 +1062,36 @@ int main(int argc, const char * argv[]) {
     initSkyBox();
     initFBO();
 
+    if (runPermutationBenchmark) {
+        benchmarkPermutations();
+        cleanup();
+        return EXIT_SUCCESS;
+    }
+
 	//glCheckError();
 	// application loop
+    double lastFrameTime = glfwGetTime();
 	while (!glfwWindowShouldClose(myWindow.getWindow())) {
+        double frameTime = glfwGetTime();
+        frameDeltaTime = static_cast<float>(frameTime - lastFrameTime);
+        lastFrameTime = frameTime;
+
+        gps::ShaderCache::getInstance().BeginFrame();
+        gps::UniformBuffers::getInstance().BeginFrame();
+        gps::RenderQueue::getInstance().BeginFrame();
+        gps::OcclusionQueries::getInstance().BeginFrame();
         processMovement();
+        // the tiles are cut in the model space of the map
+        mapStreamer.Update(glm::vec3(glm::inverse(model) * glm::vec4(myCamera.getPosition(), 1.0f)), frameDeltaTime);
+        mapStreamer.ProcessLoads(TILE_UPLOADS_PER_FRAME);
+        gps::TextureLoader::getInstance().ProcessUploads(TEXTURE_UPLOAD_BUDGET);
 	    renderScene();
+        gps::UniformBuffers::getInstance().EndFrame();
+
+        // every program is built by initShaders - building one here stalls the frame
+        size_t shaderBuilds = gps::ShaderCache::getInstance().getFrameBuildCount();
+        if (shaderBuilds > 0)
+            fprintf(stderr, "WARNING: %zu shader programs built during a frame\n", shaderBuilds);
 
 		glfwPollEvents();
 		glfwSwapBuffers(myWindow.getWindow());
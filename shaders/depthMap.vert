@@ -1,8 +1,25 @@
 #version 410 core
 layout(location=0) in vec3 vPosition;
-uniform mat4 lightSpaceTrMatrix;
-uniform mat4 model;
+// shared by every program - matches FrameData in UniformBuffers.hpp
+layout(std140) uniform FrameData {
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix;
+	vec3 cameraPosition;
+	float time;
+};
+// one per draw - matches ObjectData in UniformBuffers.hpp
+layout(std140) uniform ObjectData {
+	mat4 model;
+	mat3 normalMatrix;
+	// dequantization of the vertices - identity for float meshes
+	vec3 positionOffset;
+	// level of detail cross-fade - 1 draws everything, (0, 1) keeps that share of a dither pattern, (-1, 0) the rest
+	float lodFade;
+	vec3 positionScale;
+	bool packedNormals;
+};
 void main()
 {
- gl_Position = lightSpaceTrMatrix * model * vec4(vPosition,1.0f);
+ gl_Position = lightSpaceTrMatrix * model * vec4(positionOffset + positionScale * vPosition,1.0f);
 }
\ No newline at end of file
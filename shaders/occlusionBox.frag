@@ -0,0 +1,7 @@
+#version 410 core
+// only depth is tested - the color writes are masked off
+out vec4 fColor;
+void main()
+{
+fColor = vec4(1.0f);
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#version 410 core
+// corner of the unit cube, stretched over the box
+layout(location=0) in vec3 vCorner;
+// shared by every program - matches FrameData in UniformBuffers.hpp
+layout(std140) uniform FrameData {
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix;
+	vec3 cameraPosition;
+	float time;
+};
+// one per draw - matches ObjectData in UniformBuffers.hpp
+layout(std140) uniform ObjectData {
+	mat4 model;
+	mat3 normalMatrix;
+	vec3 positionOffset;
+	float lodFade;
+	vec3 positionScale;
+	bool packedNormals;
+};
+// model space bounds of the tested shapes
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+void main()
+{
+ gl_Position = projection * view * model * vec4(mix(boxMin, boxMax, vCorner), 1.0f);
+}
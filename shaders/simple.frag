@@ -1,45 +1,70 @@
 #version 410 core
 
+// Compiled once per combination of these features, see ShaderFeature in Shader.hpp:
+// FOG, POINT_LIGHT, SHADOWS, TEXTURED_SPECULAR (the drawn mesh has a specular map)
+// and LOD_FADE (the drawn range is cross-fading - without it nothing discards and early depth testing stays on)
+
+// model space - the point light is evaluated there
 in vec3 fPosition;
 in vec3 fNormal;
 in vec2 fTexCoords;
 in vec4 fPosLightSpace;
-in vec4 fPosEye;
+// eye space, the normal is not normalized
+in vec3 fPosEye;
+in vec3 fNormalEye;
 
 out vec4 fColor;
 
-//matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat3 normalMatrix;
-//lighting
-uniform vec3 lightDir;
-uniform vec3 lightColor;
-
-uniform vec3 pointLight;
+// shared by every program - matches FrameData in UniformBuffers.hpp
+layout(std140) uniform FrameData {
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix;
+	vec3 cameraPosition;
+	float time;
+};
+
+// matches LightData in UniformBuffers.hpp
+layout(std140) uniform LightData {
+	// direction towards the directional light, normalized in eye space
+	vec3 lightDirEye;
+	vec3 lightColor;
+	vec3 pointLight;
+};
+
+// one per draw - matches ObjectData in UniformBuffers.hpp
+layout(std140) uniform ObjectData {
+	mat4 model;
+	mat3 normalMatrix;
+	// dequantization of the vertices - identity for float meshes
+	vec3 positionOffset;
+	// level of detail cross-fade - 1 draws everything, (0, 1) keeps that share of a dither pattern, (-1, 0) the rest
+	float lodFade;
+	vec3 positionScale;
+	bool packedNormals;
+};
 
 // textures
 uniform sampler2D diffuseTexture;
 uniform sampler2D specularTexture;
 uniform sampler2D shadowMap;
 
+const float ambientStrength = 0.2f;
+const float specularStrength = 0.5f;
+const float shininess = 32.0f;
 
-uniform vec3 point;
-uniform vec3 fog;
+const float pointShininess = 50.0f;
+const float pointAttenuation = 0.25f;
 
-//components
-vec3 ambient;
-float ambientStrength = 0.2f;
-vec3 diffuse;
-vec3 specular;
-float specularStrength = 0.5f;
-float shadow;
+const float fogDensity = 0.0015f;
+const vec4 fogColor = vec4(0.1f, 0.1f, 0.1f, 1.0f);
 
-float shininess = 32.0f;
-
-float constant = 1.0f;
-float linear = 0.045f;
-float quadratic = 0.0073f;
+// light reaching a fragment, by the texture it is multiplied with
+struct Lighting {
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+};
 
 float computeShadow()
 {
@@ -56,111 +81,97 @@ float computeShadow()
     // Get depth of current fragment from light's perspective
     float currentDepth = normalizedCoords.z;
     //Check wheter current frag pos is in shadow
-    float bias= 0.05f;
+    // the light volume is 2 * SHADOW_LIGHT_DISTANCE = 2000 units deep (main.cpp) - this is 4 units
+    float bias= 0.002f;
     float shadow= currentDepth - bias > closestDepth ? 1.0 : 0.0;
     return shadow;
 
 }
 
-vec3 CalcPointLight(vec3 light)
-{
-	vec3 cameraPosEye = light;//in eye coordinates, the viewer is situated at the origin
-	shininess = 50.0f;
-	vec3 yellow = vec3(1,1,1);
-	//transform normal
-	vec3 normalEye = normalize(fNormal);
-	
-	//compute light direction
-	vec3 lightDirN = normalize(pointLight.xyz - fPosition);
-	
-	//compute view direction 
-	vec3 viewDirN = normalize(cameraPosEye - fPosition);
-	
-	
-	//compute half vector
-	vec3 halfVector = normalize(lightDirN + viewDirN);
-	
-	//compute distance to light
-	float dist = length(pointLight.xyz - fPosition);
-	//compute attenuation
-	//float att = (1.0 / (constant + linear * dist + quadratic * (dist * dist)));
-	float att = 0.25f;
-	
-	
-	//compute ambient light
-	ambient = att * ambientStrength * yellow;
-	ambient *= texture(diffuseTexture, fTexCoords).rgb;
-
-	//compute diffuse light
-	diffuse = att * max(dot(normalEye, lightDirN), 0.0f) * yellow;
-	diffuse *= texture(diffuseTexture, fTexCoords).rgb;
-
-	//compute specular light
-	float specCoeff = pow(max(dot(normalEye, halfVector), 0.0f), shininess);
-	specular = att * specularStrength * specCoeff * yellow;
-	specular *= texture(specularTexture, fTexCoords).rgb;
-
-	return ambient + diffuse + specular;
-} 
-
-vec3 computeDirLight()
+// Directional light, in eye coordinates - the viewer is situated at the origin
+Lighting computeDirLight(vec3 normalEye, vec3 viewDirEye)
 {
-    //compute eye space coordinates
-    vec4 fPosEye = view * model * vec4(fPosition, 1.0f);
-    vec3 normalEye = normalize(normalMatrix * fNormal);
-
-    //normalize light direction
-    vec3 lightDirN = vec3(normalize(view * vec4(lightDir, 0.0f)));
-
-    //compute view direction (in eye coordinates, the viewer is situated at the origin
-    vec3 viewDir = normalize(- fPosEye.xyz);
-
-    //compute ambient light
-    ambient = ambientStrength * lightColor;
-
-    //compute diffuse light
-    diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor;
+	Lighting light;
+	light.ambient = ambientStrength * lightColor;
+	light.diffuse = max(dot(normalEye, lightDirEye), 0.0f) * lightColor;
+
+	vec3 reflectDir = reflect(-lightDirEye, normalEye);
+	float specCoeff = pow(max(dot(viewDirEye, reflectDir), 0.0f), shininess);
+	light.specular = specularStrength * specCoeff * lightColor;
+	return light;
+}
 
-    //compute specular light
-    vec3 reflectDir = reflect(-lightDirN, normalEye);
-    float specCoeff = pow(max(dot(viewDir, reflectDir), 0.0f), 32);
-    specular = specularStrength * specCoeff * lightColor;
-	
-	return ambient + diffuse + specular;
+// White point light in model coordinates, where pointLight is the position of both the light and the viewer
+vec3 computePointLight(vec3 diffuseColor, vec3 specularColor)
+{
+	vec3 normal = normalize(fNormal);
+	vec3 lightDirN = normalize(pointLight - fPosition);
+	float diffCoeff = max(dot(normal, lightDirN), 0.0f);
+	vec3 color = pointAttenuation * (ambientStrength + diffCoeff) * diffuseColor;
+
+#ifdef TEXTURED_SPECULAR
+	// the viewer sits on the light, so the half vector is the light direction
+	float specCoeff = pow(diffCoeff, pointShininess);
+	color += pointAttenuation * specularStrength * specCoeff * specularColor;
+#endif
+	return color;
 }
 
 float computeFog()
 {
-	vec4 fPosEye = view * model * vec4(fPosition, 1.0f);
-
-	float fogDensity = 0.0015f;
 	float fragmentDistance = length(fPosEye);
 	float fogFactor = exp(-pow(fragmentDistance * fogDensity, 2));
 
 	return clamp(fogFactor, 0.0f, 1.0f);
 }
-vec4 colorE;
+
+#ifdef LOD_FADE
+// 4x4 ordered dither threshold in [0, 1)
+float ditherThreshold()
+{
+	const float bayer[16] = float[16](0.0f, 8.0f, 2.0f, 10.0f, 12.0f, 4.0f, 14.0f, 6.0f, 3.0f, 11.0f, 1.0f, 9.0f, 15.0f, 7.0f, 13.0f, 5.0f);
+	ivec2 pixel = ivec2(gl_FragCoord.xy) & 3;
+	return (bayer[pixel.y * 4 + pixel.x] + 0.5f) / 16.0f;
+}
+#endif
+
 void main() 
 {
-	vec3 natural = computeDirLight();
-    //compute final vertex color
-	shadow = computeShadow();
-    vec3 color = min((ambient + (1.0f - shadow) * diffuse) * texture(diffuseTexture, fTexCoords).rgb + (1.0f - shadow) * specular * texture(specularTexture, fTexCoords).rgb, 1.0f);
-	
-	vec3 res = CalcPointLight(pointLight);
-	
-	if (point != vec3(1.0f, 1.0f, 0.0f))
-		colorE = vec4(res + color, 1.0f);
-	else
-		 colorE = vec4(color, 1.0f);
-	
-	fColor = colorE;
-	
-	float fogFactor = computeFog();
-	vec4 fogColor = vec4(0.1f, 0.1f, 0.1f, 1.0f);
-	
-	//fColor = fogColor * (1 – fogFactor) + colorE * fogFactor;
-	
-	if (fog == vec3(1.0f, 0.0f, 0.0f))
-		fColor = mix(fogColor, colorE, fogFactor);
+#ifdef LOD_FADE
+	float threshold = ditherThreshold();
+	if (lodFade > 0.0f ? threshold >= lodFade : threshold < -lodFade)
+		discard;
+#endif
+
+	// every texture is sampled once, the lights share the samples
+	vec3 diffuseColor = texture(diffuseTexture, fTexCoords).rgb;
+#ifdef TEXTURED_SPECULAR
+	vec3 specularColor = texture(specularTexture, fTexCoords).rgb;
+#else
+	// without a specular map the specular terms are black
+	vec3 specularColor = vec3(0.0f);
+#endif
+
+#ifdef SHADOWS
+	float shadow = computeShadow();
+#else
+	float shadow = 0.0f;
+#endif
+
+	Lighting natural = computeDirLight(normalize(fNormalEye), normalize(-fPosEye));
+	vec3 color = (natural.ambient + (1.0f - shadow) * natural.diffuse) * diffuseColor;
+#ifdef TEXTURED_SPECULAR
+	color += (1.0f - shadow) * natural.specular * specularColor;
+#endif
+	color = min(color, 1.0f);
+
+#ifdef POINT_LIGHT
+	color += computePointLight(diffuseColor, specularColor);
+#endif
+
+	fColor = vec4(color, 1.0f);
+
+#ifdef FOG
+	fColor = mix(fogColor, fColor, computeFog());
+#endif
 }
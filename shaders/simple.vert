@@ -1,26 +1,59 @@
 #version 410 core
 
 layout(location=0) in vec3 vPosition;
+// packed meshes only provide the octahedral encoding in vNormal.xy
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
 
+// model space - for the point light
 out vec3 fPosition;
 out vec3 fNormal;
 out vec2 fTexCoords;
 out vec4 fPosLightSpace;
-out vec4 fPosEye;
+// eye space - the normal is normalized per fragment
+out vec3 fPosEye;
+out vec3 fNormalEye;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceTrMatrix;
+// shared by every program - matches FrameData in UniformBuffers.hpp
+layout(std140) uniform FrameData {
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix;
+	vec3 cameraPosition;
+	float time;
+};
+
+// one per draw - matches ObjectData in UniformBuffers.hpp
+layout(std140) uniform ObjectData {
+	mat4 model;
+	mat3 normalMatrix;
+	// dequantization of the vertices - identity for float meshes
+	vec3 positionOffset;
+	// level of detail cross-fade - 1 draws everything, (0, 1) keeps that share of a dither pattern, (-1, 0) the rest
+	float lodFade;
+	vec3 positionScale;
+	bool packedNormals;
+};
+
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+	if (n.z < 0.0f) {
+		n.xy = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return normalize(n);
+}
 
 void main() 
 {
-	fPosition = vPosition;
-	fNormal = vNormal;
+	vec3 position = positionOffset + positionScale * vPosition;
+	vec4 worldPosition = model * vec4(position, 1.0f);
+	vec4 eyePosition = view * worldPosition;
+	fPosition = position;
+	fNormal = packedNormals ? decodeOctahedral(vNormal.xy) : vNormal;
 	fTexCoords = vTexCoords;
-	fPosLightSpace = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
-	fPosEye = view * model * vec4(vPosition, 1.0f);
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
+	fPosLightSpace = lightSpaceTrMatrix * worldPosition;
+	fPosEye = eyePosition.xyz;
+	fNormalEye = normalMatrix * fNormal;
+	gl_Position = projection * eyePosition;
 }